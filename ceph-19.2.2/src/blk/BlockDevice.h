@@ -102,6 +102,10 @@ public:
   std::atomic_int num_running = {0};
   bool allow_eio;
   uint32_t flags = 0;               // FLAG_*
+  /// I/Os with the same hint go to the same aio queue; the OSD uses the
+  /// pg's placement seed so each op shard keeps to one queue.  -1 uses
+  /// the submitting thread's queue.
+  int64_t queue_hint = -1;
 
   explicit IOContext(CephContext* cct, void *p, bool allow_eio = false)
     : cct(cct), priv(p), allow_eio(allow_eio)
@@ -103,6 +103,14 @@ struct io_queue_t {
   virtual int submit_batch(aio_iter begin, aio_iter end,
 			   void *priv, int *retries) = 0;
   virtual int get_next_completed(int timeout_ms, aio_t **paio, int max) = 0;
+
+  /// buffer the queue can do I/O into cheaper than into arbitrary memory
+  /// (e.g. memory pre-registered with the kernel), or nullptr if none is
+  /// available right now
+  virtual ceph::unique_leakable_ptr<ceph::buffer::raw>
+  create_io_buffer(size_t len) {
+    return nullptr;
+  }
 };
 
 struct aio_queue_t final : public io_queue_t {
@@ -65,29 +65,11 @@ KernelDevice::KernelDevice(CephContext* cct, aio_callback_t cb, void *cbpriv, ai
     discard_callback(d_cb),
     discard_callback_priv(d_cbpriv),
     aio_stop(false),
-    aio_thread(this),
     injecting_crash(0)
 {
   cct->_conf.add_observer(this);
   fd_directs.resize(WRITE_LIFE_MAX, -1);
   fd_buffereds.resize(WRITE_LIFE_MAX, -1);
-
-  bool use_ioring = cct->_conf.get_val<bool>("bdev_ioring");
-  unsigned int iodepth = cct->_conf->bdev_aio_max_queue_depth;
-
-  if (use_ioring && ioring_queue_t::supported()) {
-    bool use_ioring_hipri = cct->_conf.get_val<bool>("bdev_ioring_hipri");
-    bool use_ioring_sqthread_poll = cct->_conf.get_val<bool>("bdev_ioring_sqthread_poll");
-    io_queue = std::make_unique<ioring_queue_t>(iodepth, use_ioring_hipri, use_ioring_sqthread_poll);
-  } else {
-    static bool once;
-    if (use_ioring && !once) {
-      derr << "WARNING: io_uring API is not supported! Fallback to libaio!"
-           << dendl;
-      once = true;
-    }
-    io_queue = std::make_unique<aio_queue_t>(iodepth);
-  }
 }
 
 KernelDevice::~KernelDevice()
@@ -502,21 +484,88 @@ int KernelDevice::flush()
   return r;
 }
 
+unsigned KernelDevice::_get_num_io_queues() const
+{
+  uint64_t n = cct->_conf.get_val<uint64_t>("bdev_aio_queues");
+  if (n == 0) {
+    // follow the OSD op shards, the way OSD::get_num_op_shards() does
+    int64_t shards = cct->_conf.get_val<int64_t>("osd_op_num_shards");
+    if (shards <= 0) {
+      shards = cct->_conf.get_val<int64_t>(
+	rotational ? "osd_op_num_shards_hdd" : "osd_op_num_shards_ssd");
+    }
+    n = std::max<int64_t>(shards, 1);
+  }
+  return n;
+}
+
+std::unique_ptr<io_queue_t> KernelDevice::_create_io_queue(
+  unsigned num_queues) const
+{
+  bool use_ioring = cct->_conf.get_val<bool>("bdev_ioring");
+  unsigned int iodepth = cct->_conf->bdev_aio_max_queue_depth;
+
+  if (use_ioring && ioring_queue_t::supported()) {
+    bool use_ioring_hipri = cct->_conf.get_val<bool>("bdev_ioring_hipri");
+    bool use_ioring_sqthread_poll = cct->_conf.get_val<bool>("bdev_ioring_sqthread_poll");
+    // registered buffers are split between the rings
+    uint64_t fixed_buffers =
+      cct->_conf.get_val<uint64_t>("bdev_ioring_fixed_buffers") / num_queues;
+    return std::make_unique<ioring_queue_t>(
+      iodepth, use_ioring_hipri, use_ioring_sqthread_poll,
+      cct->_conf.get_val<uint64_t>("bdev_ioring_sqthread_idle_ms"),
+      cct->_conf.get_val<Option::size_t>("bdev_ioring_fixed_buffer_size"),
+      fixed_buffers);
+  }
+  static bool once;
+  if (use_ioring && !once) {
+    derr << "WARNING: io_uring API is not supported! Fallback to libaio!"
+	 << dendl;
+    once = true;
+  }
+  return std::make_unique<aio_queue_t>(iodepth);
+}
+
+// The OSD hints with the pg's placement seed, which maps to op shards
+// as ps % osd_op_num_shards; with one queue per shard (bdev_aio_queues
+// = 0) every shard thus has its own queue and reaper.  Unhinted I/O
+// (kv sync, deferred, BlueFS) keeps to a queue per submitting thread.
+io_queue_t *KernelDevice::_get_io_queue(const IOContext *ioc)
+{
+  static std::atomic<unsigned> next_slot = {0};
+  static thread_local unsigned slot = next_slot++;
+  ceph_assert(!io_queues.empty());
+  uint64_t i = ioc->queue_hint >= 0 ? ioc->queue_hint : slot;
+  return io_queues[i % io_queues.size()].get();
+}
+
 int KernelDevice::_aio_start()
 {
   if (aio) {
-    dout(10) << __func__ << dendl;
-    int r = io_queue->init(fd_directs);
-    if (r < 0) {
-      if (r == -EAGAIN) {
-	derr << __func__ << " io_setup(2) failed with EAGAIN; "
-	     << "try increasing /proc/sys/fs/aio-max-nr" << dendl;
-      } else {
-	derr << __func__ << " io_setup(2) failed: " << cpp_strerror(r) << dendl;
+    unsigned n = _get_num_io_queues();
+    dout(10) << __func__ << " " << n << " queues" << dendl;
+    ceph_assert(io_queues.empty());
+    for (unsigned i = 0; i < n; ++i) {
+      auto q = _create_io_queue(n);
+      int r = q->init(fd_directs);
+      if (r < 0) {
+	if (r == -EAGAIN) {
+	  derr << __func__ << " io_setup(2) failed with EAGAIN; "
+	       << "try increasing /proc/sys/fs/aio-max-nr" << dendl;
+	} else {
+	  derr << __func__ << " io_setup(2) failed: " << cpp_strerror(r) << dendl;
+	}
+	_aio_stop();
+	return r;
       }
-      return r;
+      io_queues.push_back(std::move(q));
+    }
+    // only start reaping once io_queues is complete and won't move
+    for (unsigned i = 0; i < n; ++i) {
+      aio_threads.emplace_back(
+	new AioCompletionThread(this, i, io_queues[i].get()));
+      aio_threads.back()->create("bstore_aio");
     }
-    aio_thread.create("bstore_aio");
   }
   return 0;
 }
@@ -526,9 +575,15 @@ void KernelDevice::_aio_stop()
   if (aio) {
     dout(10) << __func__ << dendl;
     aio_stop = true;
-    aio_thread.join();
+    for (auto& t : aio_threads) {
+      t->join();
+    }
+    aio_threads.clear();
     aio_stop = false;
-    io_queue->shutdown();
+    for (auto& q : io_queues) {
+      q->shutdown();
+    }
+    io_queues.clear();
   }
 }
 
@@ -607,9 +662,9 @@ static bool is_expected_ioerr(const int r)
 	  );
 }
 
-void KernelDevice::_aio_thread()
+void KernelDevice::_aio_thread(unsigned idx, io_queue_t *io_queue)
 {
-  dout(10) << __func__ << " start" << dendl;
+  dout(10) << __func__ << " " << idx << " start" << dendl;
   int inject_crash_count = 0;
   while (!aio_stop) {
     dout(40) << __func__ << " polling" << dendl;
@@ -929,12 +984,15 @@ void KernelDevice::aio_submit(IOContext *ioc)
 
   void *priv = static_cast<void*>(ioc);
   int r, retries = 0;
-  r = io_queue->submit_batch(ioc->running_aios.begin(), e,
+  r = _get_io_queue(ioc)->submit_batch(ioc->running_aios.begin(), e,
 			     priv, &retries);
 
   if (retries)
     derr << __func__ << " retries " << retries << dendl;
   if (r < 0) {
+    // io_uring hands aios it could not submit back to _aio_thread with the
+    // error, so this is libaio running out of retries with an unknown
+    // subset of the batch in flight
     derr << " aio submit got " << cpp_strerror(r) << dendl;
     ceph_assert(r == 0);
   }
@@ -1368,8 +1426,15 @@ int KernelDevice::aio_read(
     ioc->pending_aios.push_back(aio_t(ioc, fd_directs[WRITE_LIFE_NOT_SET]));
     ++ioc->num_pending;
     aio_t& aio = ioc->pending_aios.back();
-    aio.bl.push_back(
-      ceph::buffer::ptr_node::create(create_custom_aligned(len, ioc)));
+    auto raw = _get_io_queue(ioc)->create_io_buffer(len);
+    if (raw) {
+      // registered buffers are a small, fixed pool; keep them out of
+      // the long-lived caches so they keep cycling
+      ioc->flags |= IOContext::FLAG_DONT_CACHE;
+    } else {
+      raw = create_custom_aligned(len, ioc);
+    }
+    aio.bl.push_back(ceph::buffer::ptr_node::create(std::move(raw)));
     aio.bl.prepare_iov(&aio.iov);
     aio.preadv(off, len);
     dout(30) << aio << dendl;
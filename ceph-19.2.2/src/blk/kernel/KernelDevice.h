@@ -48,7 +48,9 @@ private:
   std::atomic<bool> io_since_flush = {false};
   ceph::mutex flush_mutex = ceph::make_mutex("KernelDevice::flush_mutex");
 
-  std::unique_ptr<io_queue_t> io_queue;
+  /// one submission/completion queue per reaper thread; an IOContext
+  /// picks one by its queue_hint (see _get_io_queue())
+  std::vector<std::unique_ptr<io_queue_t>> io_queues;
   aio_callback_t discard_callback;
   void *discard_callback_priv;
   bool aio_stop;
@@ -60,12 +62,16 @@ private:
 
   struct AioCompletionThread : public Thread {
     KernelDevice *bdev;
-    explicit AioCompletionThread(KernelDevice *b) : bdev(b) {}
+    const unsigned idx;
+    io_queue_t *io_queue;
+    AioCompletionThread(KernelDevice *b, unsigned idx, io_queue_t *q)
+      : bdev(b), idx(idx), io_queue(q) {}
     void *entry() override {
-      bdev->_aio_thread();
+      bdev->_aio_thread(idx, io_queue);
       return NULL;
     }
-  } aio_thread;
+  };
+  std::vector<std::unique_ptr<AioCompletionThread>> aio_threads;
 
   struct DiscardThread : public Thread {
     KernelDevice *bdev;
@@ -84,11 +90,14 @@ private:
   virtual int _post_open() { return 0; }  // hook for child implementations
   virtual void  _pre_close() { }  // hook for child implementations
 
-  void _aio_thread();
+  void _aio_thread(unsigned idx, io_queue_t *io_queue);
   void _discard_thread(uint64_t tid);
   void _queue_discard(interval_set<uint64_t> &to_release);
   bool try_discard(interval_set<uint64_t> &to_release, bool async = true) override;
 
+  unsigned _get_num_io_queues() const;
+  std::unique_ptr<io_queue_t> _create_io_queue(unsigned num_queues) const;
+  io_queue_t *_get_io_queue(const IOContext *ioc);
   int _aio_start();
   void _aio_stop();
 
@@ -7,16 +7,100 @@
 
 #include "liburing.h"
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "common/ceph_mutex.h"
+#include "common/deleter.h"
+#include "include/page.h"
 
 using std::list;
 using std::make_unique;
 
+// the kernel refuses to register more buffers than this
+static constexpr size_t IORING_MAX_FIXED_BUFFERS = 1u << 14;
+
+// Memory registered with the ring (IORING_REGISTER_BUFFERS), split into
+// equally sized slots, one registered buffer each.  Slots are lent out as
+// bufferptrs and come back when the last reference is dropped, which may
+// happen after the ring is gone, hence the shared ownership.
+struct ioring_fixed_arena {
+  char *base = nullptr;
+  size_t slot_size;
+  size_t slots;
+  ceph::mutex lock = ceph::make_mutex("ioring_fixed_arena::lock");
+  std::vector<uint32_t> free_slots;
+
+  ioring_fixed_arena(size_t slot_size_, size_t slots_)
+    : slot_size(p2roundup<size_t>(slot_size_, CEPH_PAGE_SIZE)),
+      slots(std::min(slots_, IORING_MAX_FIXED_BUFFERS)) {
+    void *p = nullptr;
+    if (::posix_memalign(&p, CEPH_PAGE_SIZE, slot_size * slots) == 0) {
+      base = static_cast<char*>(p);
+      free_slots.reserve(slots);
+      for (size_t i = slots; i > 0; --i) {
+	free_slots.push_back(i - 1);
+      }
+    }
+  }
+  ~ioring_fixed_arena() {
+    ::free(base);
+  }
+
+  void get_iovecs(std::vector<struct iovec> *iovs) const {
+    iovs->resize(slots);
+    for (size_t i = 0; i < slots; ++i) {
+      (*iovs)[i].iov_base = base + i * slot_size;
+      (*iovs)[i].iov_len = slot_size;
+    }
+  }
+
+  /// registered buffer index for [p, p+len), or -1 if it is not ours
+  int find_slot(const void *p, size_t len) const {
+    const char *c = static_cast<const char*>(p);
+    if (c < base || c >= base + slot_size * slots) {
+      return -1;
+    }
+    size_t slot = (c - base) / slot_size;
+    if (c + len > base + (slot + 1) * slot_size) {
+      return -1;
+    }
+    return slot;
+  }
+
+  char *get() {
+    std::lock_guard l(lock);
+    if (free_slots.empty()) {
+      return nullptr;
+    }
+    uint32_t slot = free_slots.back();
+    free_slots.pop_back();
+    return base + slot * slot_size;
+  }
+  void put(char *p) {
+    std::lock_guard l(lock);
+    free_slots.push_back((p - base) / slot_size);
+  }
+};
+
 struct ioring_data {
   struct io_uring io_uring;
   pthread_mutex_t cq_mutex;
   pthread_mutex_t sq_mutex;
   int epoll_fd = -1;
+  int wake_fd = -1;  ///< kicks get_next_completed() when 'failed' fills up
   std::map<int, int> fixed_fds_map;
+  std::shared_ptr<ioring_fixed_arena> arena;  ///< registered buffers, if any
+
+  // aios handed to submit_batch() while another thread was busy
+  // submitting; that thread flushes them with its next io_uring_submit()
+  // so that concurrent aio_submit() callers share one syscall.  Only the
+  // thread that set 'submitting' touches the submission ring.
+  std::vector<aio_t*> staged;  ///< protected by sq_mutex
+  bool submitting = false;     ///< protected by sq_mutex
+  /// aios the ring never saw because submission failed; handed back with
+  /// the error by get_next_completed(), which wake_fd gets out of epoll
+  std::vector<aio_t*> failed;  ///< protected by cq_mutex
 };
 
 static int ioring_get_cqe(struct ioring_data *d, unsigned int max,
@@ -26,6 +110,13 @@ static int ioring_get_cqe(struct ioring_data *d, unsigned int max,
   struct io_uring_cqe *cqe;
 
   unsigned nr = 0;
+  while (!d->failed.empty() && nr < max) {
+    paio[nr++] = d->failed.back();
+    d->failed.pop_back();
+  }
+  if (nr == max)
+    return nr;
+
   unsigned head;
   io_uring_for_each_cqe(ring, head, cqe) {
     struct aio_t *io = (struct aio_t *)(uintptr_t) io_uring_cqe_get_data(cqe);
@@ -50,6 +141,14 @@ static int find_fixed_fd(struct ioring_data *d, int real_fd)
   return it->second;
 }
 
+static int find_fixed_buffer(struct ioring_data *d, struct aio_t *io)
+{
+  if (!d->arena || io->iov.size() != 1)
+    return -1;
+
+  return d->arena->find_slot(io->iov[0].iov_base, io->iov[0].iov_len);
+}
+
 static void init_sqe(struct ioring_data *d, struct io_uring_sqe *sqe,
 		     struct aio_t *io)
 {
@@ -57,44 +156,69 @@ static void init_sqe(struct ioring_data *d, struct io_uring_sqe *sqe,
 
   ceph_assert(fixed_fd != -1);
 
-  if (io->iocb.aio_lio_opcode == IO_CMD_PWRITEV)
-    io_uring_prep_writev(sqe, fixed_fd, &io->iov[0],
-			 io->iov.size(), io->offset);
-  else if (io->iocb.aio_lio_opcode == IO_CMD_PREADV)
-    io_uring_prep_readv(sqe, fixed_fd, &io->iov[0],
-			io->iov.size(), io->offset);
-  else
+  // registered buffers are already pinned, which saves the kernel from
+  // mapping the pages for every request
+  int buf_index = find_fixed_buffer(d, io);
+
+  if (io->iocb.aio_lio_opcode == IO_CMD_PWRITEV) {
+    if (buf_index >= 0)
+      io_uring_prep_write_fixed(sqe, fixed_fd, io->iov[0].iov_base,
+				io->iov[0].iov_len, io->offset, buf_index);
+    else
+      io_uring_prep_writev(sqe, fixed_fd, &io->iov[0],
+			   io->iov.size(), io->offset);
+  } else if (io->iocb.aio_lio_opcode == IO_CMD_PREADV) {
+    if (buf_index >= 0)
+      io_uring_prep_read_fixed(sqe, fixed_fd, io->iov[0].iov_base,
+			       io->iov[0].iov_len, io->offset, buf_index);
+    else
+      io_uring_prep_readv(sqe, fixed_fd, &io->iov[0],
+			  io->iov.size(), io->offset);
+  } else {
     ceph_assert(0);
+  }
 
   io_uring_sqe_set_data(sqe, io);
   io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
 }
 
-static int ioring_queue(struct ioring_data *d, void *priv,
-			list<aio_t>::iterator beg, list<aio_t>::iterator end)
+/// @param prepped set to the number of ios put on the submission ring
+static int ioring_queue(struct ioring_data *d,
+			const std::vector<aio_t*> &ios,
+			size_t *prepped)
 {
   struct io_uring *ring = &d->io_uring;
-  struct aio_t *io = nullptr;
-
-  ceph_assert(beg != end);
-
-  do {
-    struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
-    if (!sqe)
-      break;
-
-    io = &*beg;
-    io->priv = priv;
-
-    init_sqe(d, sqe, io);
-
-  } while (++beg != end);
-
-  if (!io)
-    /* Queue is full, go and reap something first */
-    return 0;
+  int submitted = 0;
+
+  ceph_assert(!ios.empty());
+
+  auto p = ios.begin();
+  while (p != ios.end()) {
+    unsigned queued = 0;
+    for (; p != ios.end(); ++p) {
+      struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+      if (!sqe)
+	break;
+
+      init_sqe(d, sqe, *p);
+      ++queued;
+    }
+
+    *prepped = p - ios.begin();
+    int r = io_uring_submit(ring);
+    if (r < 0)
+      return r;
+    submitted += r;
+
+    if (!queued && (ring->flags & IORING_SETUP_SQPOLL)) {
+      /* The kernel thread has not caught up yet, wait for room */
+      r = io_uring_sqring_wait(ring);
+      if (r < 0)
+	return r;
+    }
+  }
 
-  return io_uring_submit(ring);
+  return submitted;
 }
 
 static void build_fixed_fds_map(struct ioring_data *d,
@@ -106,11 +230,17 @@ static void build_fixed_fds_map(struct ioring_data *d,
   }
 }
 
-ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_, bool sq_thread_) :
+ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_, bool sq_thread_,
+			       unsigned sq_thread_idle_ms_,
+			       size_t fixed_buffer_size_,
+			       size_t fixed_buffer_count_) :
   d(make_unique<ioring_data>()),
   iodepth(iodepth_),
   hipri(hipri_),
-  sq_thread(sq_thread_)
+  sq_thread(sq_thread_),
+  sq_thread_idle_ms(sq_thread_idle_ms_),
+  fixed_buffer_size(fixed_buffer_size_),
+  fixed_buffer_count(fixed_buffer_count_)
 {
 }
 
@@ -120,17 +250,20 @@ ioring_queue_t::~ioring_queue_t()
 
 int ioring_queue_t::init(std::vector<int> &fds)
 {
-  unsigned flags = 0;
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
 
   pthread_mutex_init(&d->cq_mutex, NULL);
   pthread_mutex_init(&d->sq_mutex, NULL);
 
   if (hipri)
-    flags |= IORING_SETUP_IOPOLL;
-  if (sq_thread)
-    flags |= IORING_SETUP_SQPOLL;
+    params.flags |= IORING_SETUP_IOPOLL;
+  if (sq_thread) {
+    params.flags |= IORING_SETUP_SQPOLL;
+    params.sq_thread_idle = sq_thread_idle_ms;
+  }
 
-  int ret = io_uring_queue_init(iodepth, &d->io_uring, flags);
+  int ret = io_uring_queue_init_params(iodepth, &d->io_uring, &params);
   if (ret < 0)
     return ret;
 
@@ -143,6 +276,21 @@ int ioring_queue_t::init(std::vector<int> &fds)
 
   build_fixed_fds_map(d.get(), fds);
 
+  if (fixed_buffer_size && fixed_buffer_count) {
+    auto arena = std::make_shared<ioring_fixed_arena>(fixed_buffer_size,
+						      fixed_buffer_count);
+    std::vector<struct iovec> iovs;
+    arena->get_iovecs(&iovs);
+    // registration pins the memory and counts against RLIMIT_MEMLOCK;
+    // if we can't have it, just go on with plain iovecs
+    if (arena->base &&
+	io_uring_register_buffers(&d->io_uring, &iovs[0], iovs.size()) == 0) {
+      d->arena = std::move(arena);
+    } else {
+      fixed_buffer_count = 0;
+    }
+  }
+
   d->epoll_fd = epoll_create1(0);
   if (d->epoll_fd < 0) {
     ret = -errno;
@@ -151,14 +299,31 @@ int ioring_queue_t::init(std::vector<int> &fds)
 
   struct epoll_event ev;
   ev.events = EPOLLIN;
+  ev.data.fd = d->io_uring.ring_fd;
   ret = epoll_ctl(d->epoll_fd, EPOLL_CTL_ADD, d->io_uring.ring_fd, &ev);
   if (ret < 0) {
     ret = -errno;
     goto close_epoll_fd;
   }
 
+  d->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (d->wake_fd < 0) {
+    ret = -errno;
+    goto close_epoll_fd;
+  }
+  ev.events = EPOLLIN;
+  ev.data.fd = d->wake_fd;
+  ret = epoll_ctl(d->epoll_fd, EPOLL_CTL_ADD, d->wake_fd, &ev);
+  if (ret < 0) {
+    ret = -errno;
+    goto close_wake_fd;
+  }
+
   return 0;
 
+close_wake_fd:
+  close(d->wake_fd);
+  d->wake_fd = -1;
 close_epoll_fd:
   close(d->epoll_fd);
 close_ring_fd:
@@ -170,6 +335,10 @@ close_ring_fd:
 void ioring_queue_t::shutdown()
 {
   d->fixed_fds_map.clear();
+  // buffers still lent out keep the arena memory alive
+  d->arena.reset();
+  close(d->wake_fd);
+  d->wake_fd = -1;
   close(d->epoll_fd);
   d->epoll_fd = -1;
   io_uring_queue_exit(&d->io_uring);
@@ -179,10 +348,65 @@ int ioring_queue_t::submit_batch(aio_iter beg, aio_iter end,
                                  void *priv,
                                  int *retries)
 {
-  (void)retries;
+  // same backoff as aio_queue_t: 2^16 * 125us = ~8 seconds
+  int attempts = 16;
+  int delay = 125;
 
   pthread_mutex_lock(&d->sq_mutex);
-  int rc = ioring_queue(d.get(), priv, beg, end);
+  for (aio_iter p = beg; p != end; ++p) {
+    p->priv = priv;
+    d->staged.push_back(&*p);
+  }
+  if (d->submitting) {
+    /* Whoever is in io_uring_submit() will pick these up */
+    pthread_mutex_unlock(&d->sq_mutex);
+    return 0;
+  }
+
+  d->submitting = true;
+  int rc = 0;
+  std::vector<aio_t*> ios;
+  while (!d->staged.empty()) {
+    ios.swap(d->staged);
+    pthread_mutex_unlock(&d->sq_mutex);
+    size_t prepped = 0;
+    int r = ioring_queue(d.get(), ios, &prepped);
+    pthread_mutex_lock(&d->sq_mutex);
+    if ((r == -EAGAIN || r == -EBUSY) && attempts-- > 0) {
+      /* Out of kernel resources or the cq is full, retry whatever is
+       * left once the reaper had a chance to catch up */
+      d->staged.insert(d->staged.begin(), ios.begin() + prepped, ios.end());
+      ios.clear();
+      pthread_mutex_unlock(&d->sq_mutex);
+      usleep(delay);
+      delay *= 2;
+      (*retries)++;
+      pthread_mutex_lock(&d->sq_mutex);
+      continue;
+    }
+    if (r < 0) {
+      /* Whatever never made it onto the ring, ours or staged by other
+       * threads that already got 0 back, completes with the error through
+       * the reaper, the same way an aio failed by the device would.
+       * Prepped sqes stay queued and go in with the next submit. */
+      std::vector<aio_t*> orphans(ios.begin() + prepped, ios.end());
+      orphans.insert(orphans.end(), d->staged.begin(), d->staged.end());
+      d->staged.clear();
+      pthread_mutex_lock(&d->cq_mutex);
+      for (auto io : orphans) {
+	io->rval = r;
+	d->failed.push_back(io);
+      }
+      pthread_mutex_unlock(&d->cq_mutex);
+      uint64_t one = 1;
+      ssize_t w = ::write(d->wake_fd, &one, sizeof(one));
+      (void)w;  // EAGAIN only if the counter is saturated, still readable
+      break;
+    }
+    ios.clear();
+    rc += r;
+  }
+  d->submitting = false;
   pthread_mutex_unlock(&d->sq_mutex);
 
   return rc;
@@ -200,14 +424,34 @@ get_cqe:
     int ret = TEMP_FAILURE_RETRY(epoll_wait(d->epoll_fd, &ev, 1, timeout_ms));
     if (ret < 0)
       events = -errno;
-    else if (ret > 0)
+    else if (ret > 0) {
+      if (ev.data.fd == d->wake_fd) {
+	uint64_t n;
+	ssize_t r = ::read(d->wake_fd, &n, sizeof(n));
+	(void)r;
+      }
       /* Time to reap */
       goto get_cqe;
+    }
   }
 
   return events;
 }
 
+ceph::unique_leakable_ptr<ceph::buffer::raw>
+ioring_queue_t::create_io_buffer(size_t len)
+{
+  if (!d->arena || len > d->arena->slot_size)
+    return nullptr;
+
+  char *p = d->arena->get();
+  if (!p)
+    return nullptr;
+
+  return ceph::buffer::claim_buffer(
+    len, p, make_deleter([arena = d->arena, p] { arena->put(p); }));
+}
+
 bool ioring_queue_t::supported()
 {
   struct io_uring ring;
@@ -223,7 +467,10 @@ bool ioring_queue_t::supported()
 
 struct ioring_data {};
 
-ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_, bool sq_thread_)
+ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_, bool sq_thread_,
+			       unsigned sq_thread_idle_ms_,
+			       size_t fixed_buffer_size_,
+			       size_t fixed_buffer_count_)
 {
   ceph_assert(0);
 }
@@ -255,6 +502,12 @@ int ioring_queue_t::get_next_completed(int timeout_ms, aio_t **paio, int max)
   ceph_assert(0);
 }
 
+ceph::unique_leakable_ptr<ceph::buffer::raw>
+ioring_queue_t::create_io_buffer(size_t len)
+{
+  ceph_assert(0);
+}
+
 bool ioring_queue_t::supported()
 {
   return false;
@@ -15,13 +15,19 @@ struct ioring_queue_t final : public io_queue_t {
   unsigned iodepth = 0;
   bool hipri = false;
   bool sq_thread = false;
+  unsigned sq_thread_idle_ms = 0;
+  size_t fixed_buffer_size = 0;   ///< size of one registered buffer slot
+  size_t fixed_buffer_count = 0;  ///< number of registered buffer slots
 
   typedef std::list<aio_t>::iterator aio_iter;
 
   // Returns true if arch is x86-64 and kernel supports io_uring
   static bool supported();
 
-  ioring_queue_t(unsigned iodepth_, bool hipri_, bool sq_thread_);
+  ioring_queue_t(unsigned iodepth_, bool hipri_, bool sq_thread_,
+                 unsigned sq_thread_idle_ms_ = 0,
+                 size_t fixed_buffer_size_ = 0,
+                 size_t fixed_buffer_count_ = 0);
   ~ioring_queue_t() final;
 
   int init(std::vector<int> &fds) final;
@@ -30,4 +36,7 @@ struct ioring_queue_t final : public io_queue_t {
   int submit_batch(aio_iter begin, aio_iter end,
                    void *priv, int *retries) final;
   int get_next_completed(int timeout_ms, aio_t **paio, int max) final;
+
+  ceph::unique_leakable_ptr<ceph::buffer::raw>
+  create_io_buffer(size_t len) final;
 };
@@ -4,9 +4,14 @@
 #ifndef CEPH_OS_BLUESTORE_CHECKSUMMER
 #define CEPH_OS_BLUESTORE_CHECKSUMMER
 
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
 #include "include/buffer.h"
 #include "include/byteorder.h"
 #include "include/ceph_assert.h"
+#include "include/crc32c.h"
 
 #include "xxHash/xxhash.h"
 
@@ -90,6 +95,14 @@ public:
       ) {
       return p.crc32c(len, init_value);
     }
+    static init_value_t calc(
+      state_t state,
+      init_value_t init_value,
+      size_t len,
+      const char *data
+      ) {
+      return ceph_crc32c(init_value, (const unsigned char*)data, len);
+    }
   };
 
   struct crc32c_16 {
@@ -111,6 +124,14 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xffff;
     }
+    static init_value_t calc(
+      state_t state,
+      init_value_t init_value,
+      size_t len,
+      const char *data
+      ) {
+      return ceph_crc32c(init_value, (const unsigned char*)data, len) & 0xffff;
+    }
   };
 
   struct crc32c_8 {
@@ -132,6 +153,14 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xff;
     }
+    static init_value_t calc(
+      state_t state,
+      init_value_t init_value,
+      size_t len,
+      const char *data
+      ) {
+      return ceph_crc32c(init_value, (const unsigned char*)data, len) & 0xff;
+    }
   };
 
   struct xxhash32 {
@@ -161,6 +190,14 @@ public:
       }
       return XXH32_digest(state);
     }
+    static init_value_t calc(
+      state_t state,
+      init_value_t init_value,
+      size_t len,
+      const char *data
+      ) {
+      return XXH32(data, len, init_value);
+    }
   };
 
   struct xxhash64 {
@@ -190,6 +227,14 @@ public:
       }
       return XXH64_digest(state);
     }
+    static init_value_t calc(
+      state_t state,
+      init_value_t init_value,
+      size_t len,
+      const char *data
+      ) {
+      return XXH64(data, len, init_value);
+    }
   };
 
   template<class Alg>
@@ -269,6 +314,158 @@ public:
     Alg::fini(&state);
     return -1;  // no errors
   }
+
+  /// a range to check with verify_batch()
+  struct verify_item_t {
+    int csum_type = CSUM_NONE;
+    size_t csum_block_size = 0;
+    size_t offset = 0;                       ///< offset of bl in csum space
+    const ceph::buffer::list *bl = nullptr;  ///< csum_block_size aligned
+    const ceph::buffer::ptr *csum_data = nullptr;
+
+    int bad = -1;                            ///< out: first bad offset
+    uint64_t bad_csum = 0;                   ///< out: value found at bad
+  };
+
+  /*
+   * Verify many ranges, possibly of different blobs and checksum types,
+   * in one pass.  Unlike verify() blocks are hashed straight from the
+   * underlying buffers; crc32c blocks of equal size are queued and
+   * handed to ceph_crc32c_multi() together.  Returns -EOPNOTSUPP for an
+   * unknown checksum type, otherwise the number of items with a bad block.
+   */
+  static int verify_batch(verify_item_t *items, size_t n) {
+    crc_queue_t q;
+    for (size_t i = 0; i < n; ++i) {
+      auto& item = items[i];
+      item.bad = -1;
+      switch (item.csum_type) {
+      case CSUM_NONE:
+	break;
+      case CSUM_XXHASH32:
+	_verify_item<xxhash32>(item, nullptr);
+	break;
+      case CSUM_XXHASH64:
+	_verify_item<xxhash64>(item, nullptr);
+	break;
+      case CSUM_CRC32C:
+      case CSUM_CRC32C_16:
+      case CSUM_CRC32C_8:
+	_verify_item<crc32c>(item, &q);
+	break;
+      default:
+	return -EOPNOTSUPP;
+      }
+    }
+    q.flush();
+    int errors = 0;
+    for (size_t i = 0; i < n; ++i) {
+      if (items[i].bad >= 0) {
+	++errors;
+      }
+    }
+    return errors;
+  }
+
+private:
+  template<class Alg>
+  static void _check(verify_item_t& item, size_t pos,
+		     typename Alg::init_value_t v) {
+    const typename Alg::value_t *pv =
+      reinterpret_cast<const typename Alg::value_t*>(item.csum_data->c_str());
+    if (pv[pos / item.csum_block_size] != v &&
+	(item.bad < 0 || pos < (size_t)item.bad)) {
+      item.bad = pos;
+      item.bad_csum = v;
+    }
+  }
+
+  static void _check_crc(verify_item_t& item, size_t pos, uint32_t v) {
+    switch (item.csum_type) {
+    case CSUM_CRC32C:
+      _check<crc32c>(item, pos, v);
+      break;
+    case CSUM_CRC32C_16:
+      _check<crc32c_16>(item, pos, v & 0xffff);
+      break;
+    case CSUM_CRC32C_8:
+      _check<crc32c_8>(item, pos, v & 0xff);
+      break;
+    }
+  }
+
+  // crc32c blocks waiting for a multi-buffer pass, all of the same size
+  struct crc_queue_t {
+    static constexpr unsigned MAX = 16;
+    unsigned n = 0;
+    size_t len = 0;
+    const unsigned char *data[MAX];
+    verify_item_t *item[MAX];
+    size_t pos[MAX];
+
+    void push(verify_item_t *i, size_t p, const char *d, size_t l) {
+      if (n == MAX || (n > 0 && l != len)) {
+	flush();
+      }
+      len = l;
+      data[n] = reinterpret_cast<const unsigned char*>(d);
+      item[n] = i;
+      pos[n] = p;
+      ++n;
+    }
+    void flush() {
+      if (n == 0) {
+	return;
+      }
+      uint32_t crc[MAX];
+      std::fill_n(crc, n, (uint32_t)-1);
+      ceph_crc32c_multi(crc, data, n, len);
+      for (unsigned i = 0; i < n; ++i) {
+	_check_crc(*item[i], pos[i], crc[i]);
+      }
+      n = 0;
+    }
+  };
+
+  // crc32c flavours go through q, anything else is checked in place
+  template<class Alg>
+  static void _verify_item(verify_item_t& item, crc_queue_t *q) {
+    const size_t bs = item.csum_block_size;
+    size_t length = item.bl->length();
+    ceph_assert(length % bs == 0);
+    ceph_assert(item.csum_data->length() >= (item.offset + length) / bs *
+		get_csum_value_size(item.csum_type));
+    ceph::buffer::list::const_iterator p = item.bl->begin();
+    typename Alg::state_t state = {};
+    std::unique_ptr<char[]> bounce;
+    for (size_t pos = item.offset; length > 0;
+	 pos += bs, length -= bs) {
+      const char *data;
+      size_t l = p.get_ptr_and_advance(bs, &data);
+      if (l < bs) {
+	// block straddles two buffers, hash a flat copy of it
+	if (!bounce) {
+	  bounce.reset(new char[bs]);
+	}
+	memcpy(bounce.get(), data, l);
+	while (l < bs) {
+	  const char *more;
+	  size_t m = p.get_ptr_and_advance(bs - l, &more);
+	  memcpy(bounce.get() + l, more, m);
+	  l += m;
+	}
+	data = bounce.get();
+	if (q) {
+	  _check_crc(item, pos, ceph_crc32c(-1, (const unsigned char*)data, bs));
+	  continue;
+	}
+      } else if (q) {
+	q->push(&item, pos, data, bs);
+	continue;
+      }
+      _check<Alg>(item, pos, Alg::calc(state, -1, bs, data));
+    }
+  }
 };
 
 #endif
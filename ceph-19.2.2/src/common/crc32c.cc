@@ -11,6 +11,11 @@
 #include "common/crc32c_aarch64.h"
 #include "common/crc32c_ppc.h"
 
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
 /*
  * choose best implementation based on the CPU architecture.
  */
@@ -238,3 +243,67 @@ uint32_t ceph_crc32c_zeros(uint32_t crc, unsigned len)
     crc = ceph_crc32c(crc, nullptr, remainder);
   return crc;
 }
+
+#if defined(__x86_64__)
+/*
+ * a single crc32 instruction has a latency of 3 cycles but a throughput
+ * of one per cycle, so feeding it from 4 independent buffers in lockstep
+ * keeps the unit busy without the recombination step a single-buffer
+ * interleaved implementation needs.
+ */
+__attribute__((target("sse4.2")))
+static void ceph_crc32c_multi_sse42(uint32_t *crcs,
+				    unsigned char const * const *data,
+				    unsigned n, unsigned length)
+{
+  unsigned i = 0;
+  for (; i + 4 <= n; i += 4) {
+    uint64_t c0 = crcs[i], c1 = crcs[i + 1], c2 = crcs[i + 2], c3 = crcs[i + 3];
+    unsigned char const *p0 = data[i], *p1 = data[i + 1];
+    unsigned char const *p2 = data[i + 2], *p3 = data[i + 3];
+    unsigned left = length;
+    for (; left >= 8; left -= 8) {
+      uint64_t w0, w1, w2, w3;
+      memcpy(&w0, p0, 8);
+      memcpy(&w1, p1, 8);
+      memcpy(&w2, p2, 8);
+      memcpy(&w3, p3, 8);
+      c0 = _mm_crc32_u64(c0, w0);
+      c1 = _mm_crc32_u64(c1, w1);
+      c2 = _mm_crc32_u64(c2, w2);
+      c3 = _mm_crc32_u64(c3, w3);
+      p0 += 8;
+      p1 += 8;
+      p2 += 8;
+      p3 += 8;
+    }
+    for (; left > 0; --left) {
+      c0 = _mm_crc32_u8(c0, *p0++);
+      c1 = _mm_crc32_u8(c1, *p1++);
+      c2 = _mm_crc32_u8(c2, *p2++);
+      c3 = _mm_crc32_u8(c3, *p3++);
+    }
+    crcs[i] = c0;
+    crcs[i + 1] = c1;
+    crcs[i + 2] = c2;
+    crcs[i + 3] = c3;
+  }
+  for (; i < n; ++i) {
+    crcs[i] = ceph_crc32c(crcs[i], data[i], length);
+  }
+}
+#endif
+
+void ceph_crc32c_multi(uint32_t *crcs, unsigned char const * const *data,
+		       unsigned n, unsigned length)
+{
+#if defined(__x86_64__)
+  if (ceph_arch_intel_sse42) {
+    ceph_crc32c_multi_sse42(crcs, data, n, length);
+    return;
+  }
+#endif
+  for (unsigned i = 0; i < n; ++i) {
+    crcs[i] = ceph_crc32c(crcs[i], data[i], length);
+  }
+}
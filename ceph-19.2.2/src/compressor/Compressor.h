@@ -19,6 +19,7 @@
 #include <optional>
 #include <string>
 #include <string_view>
+#include <vector>
 #include "include/ceph_assert.h"    // boost clobbers this
 #include "include/common_fwd.h"
 #include "include/buffer.h"
@@ -67,6 +68,16 @@ public:
     COMP_FORCE                  ///< compress always
   };
 
+  /// a trained dictionary, only usable with the compressor type that
+  /// loaded it
+  class Dictionary {
+  public:
+    virtual ~Dictionary() {}
+    /// id stored along with the data compressed with this dictionary
+    virtual int32_t get_id() const = 0;
+  };
+  typedef std::shared_ptr<Dictionary> DictionaryRef;
+
   static const char* get_comp_alg_name(int a);
   static std::optional<CompressionAlgorithm> get_comp_alg_type(std::string_view s);
 
@@ -88,6 +99,23 @@ public:
   // alignment with decode methods
   virtual int decompress(ceph::bufferlist::const_iterator &p, size_t compressed_len, ceph::bufferlist &out, std::optional<int32_t> compressor_message) = 0;
 
+  // dictionary support; compressors without it ignore the dictionary
+  virtual int train_dictionary(const std::vector<ceph::bufferlist> &samples,
+			       size_t max_size, ceph::bufferlist &out) {
+    return -EOPNOTSUPP;
+  }
+  virtual DictionaryRef load_dictionary(const ceph::bufferlist &raw) {
+    return DictionaryRef();
+  }
+  /// on success compressor_message is set to the dictionary id if the
+  /// dictionary was used
+  virtual int compress_with_dict(const ceph::bufferlist &in, ceph::bufferlist &out, std::optional<int32_t> &compressor_message, const DictionaryRef &dict) {
+    return compress(in, out, compressor_message);
+  }
+  virtual int decompress_with_dict(ceph::bufferlist::const_iterator &p, size_t compressed_len, ceph::bufferlist &out, std::optional<int32_t> compressor_message, const DictionaryRef &dict) {
+    return decompress(p, compressed_len, out, compressor_message);
+  }
+
   static CompressorRef create(CephContext *cct, const std::string &type);
   static CompressorRef create(CephContext *cct, int alg);
 
@@ -17,6 +17,7 @@
 
 #define ZSTD_STATIC_LINKING_ONLY
 #include "zstd/lib/zstd.h"
+#include "zstd/lib/zdict.h"
 
 #include "include/buffer.h"
 #include "include/encoding.h"
@@ -27,8 +28,101 @@ class ZstdCompressor : public Compressor {
   ZstdCompressor(CephContext *cct) : Compressor(COMP_ALG_ZSTD, "zstd"), cct(cct) {}
 
   int compress(const ceph::buffer::list &src, ceph::buffer::list &dst, std::optional<int32_t> &compressor_message) override {
+    return _compress(src, dst, nullptr);
+  }
+
+  int decompress(const ceph::buffer::list &src, ceph::buffer::list &dst, std::optional<int32_t> compressor_message) override {
+    auto i = std::cbegin(src);
+    return decompress(i, src.length(), dst, compressor_message);
+  }
+
+  int decompress(ceph::buffer::list::const_iterator &p,
+		 size_t compressed_len,
+		 ceph::buffer::list &dst,
+		 std::optional<int32_t> compressor_message) override {
+    return _decompress(p, compressed_len, dst, nullptr);
+  }
+
+  int train_dictionary(const std::vector<ceph::buffer::list> &samples,
+		       size_t max_size, ceph::buffer::list &out) override {
+    ceph::buffer::list flat;
+    std::vector<size_t> sizes;
+    sizes.reserve(samples.size());
+    for (auto& s : samples) {
+      flat.append(s);
+      sizes.push_back(s.length());
+    }
+    ceph::buffer::ptr dict(max_size);
+    size_t r = ZDICT_trainFromBuffer(dict.c_str(), dict.length(),
+				     flat.c_str(), sizes.data(), sizes.size());
+    if (ZDICT_isError(r)) {
+      return -EINVAL;
+    }
+    out.append(dict, 0, r);
+    return 0;
+  }
+
+  DictionaryRef load_dictionary(const ceph::buffer::list &raw) override {
+    ceph::buffer::list flat = raw;
+    unsigned id = ZDICT_getDictID(flat.c_str(), flat.length());
+    if (id == 0) {
+      // raw content without a header can't be told apart on decompress
+      return DictionaryRef();
+    }
+    auto d = std::make_shared<ZstdDictionary>(id);
+    d->cdict = ZSTD_createCDict(flat.c_str(), flat.length(),
+				cct->_conf->compressor_zstd_level);
+    d->ddict = ZSTD_createDDict(flat.c_str(), flat.length());
+    if (!d->cdict || !d->ddict) {
+      return DictionaryRef();
+    }
+    return d;
+  }
+
+  int compress_with_dict(const ceph::buffer::list &src, ceph::buffer::list &dst, std::optional<int32_t> &compressor_message, const DictionaryRef &dict) override {
+    auto d = static_cast<const ZstdDictionary*>(dict.get());
+    int r = _compress(src, dst, d ? d->cdict : nullptr);
+    if (r == 0 && d) {
+      compressor_message = d->get_id();
+    }
+    return r;
+  }
+
+  int decompress_with_dict(ceph::buffer::list::const_iterator &p,
+			   size_t compressed_len,
+			   ceph::buffer::list &dst,
+			   std::optional<int32_t> compressor_message,
+			   const DictionaryRef &dict) override {
+    auto d = static_cast<const ZstdDictionary*>(dict.get());
+    return _decompress(p, compressed_len, dst, d ? d->ddict : nullptr);
+  }
+
+ private:
+  struct ZstdDictionary : public Dictionary {
+    unsigned id;
+    ZSTD_CDict *cdict = nullptr;
+    ZSTD_DDict *ddict = nullptr;
+
+    explicit ZstdDictionary(unsigned id) : id(id) {}
+    ~ZstdDictionary() override {
+      ZSTD_freeCDict(cdict);
+      ZSTD_freeDDict(ddict);
+    }
+    int32_t get_id() const override {
+      return id;
+    }
+  };
+
+  int _compress(const ceph::buffer::list &src, ceph::buffer::list &dst,
+		const ZSTD_CDict *cdict) {
     ZSTD_CStream *s = ZSTD_createCStream();
-    ZSTD_initCStream_srcSize(s, cct->_conf->compressor_zstd_level, src.length());
+    if (cdict) {
+      // level and window come with the dictionary
+      ZSTD_CCtx_refCDict(s, cdict);
+      ZSTD_CCtx_setPledgedSrcSize(s, src.length());
+    } else {
+      ZSTD_initCStream_srcSize(s, cct->_conf->compressor_zstd_level, src.length());
+    }
     auto p = src.begin();
     size_t left = src.length();
 
@@ -48,6 +142,7 @@ class ZstdCompressor : public Compressor {
       ZSTD_EndDirective const zed = (left==0) ? ZSTD_e_end : ZSTD_e_continue;
       size_t r = ZSTD_compressStream2(s, &outbuf, &inbuf, zed);
       if (ZSTD_isError(r)) {
+	ZSTD_freeCStream(s);
 	return -EINVAL;
       }
     }
@@ -61,15 +156,10 @@ class ZstdCompressor : public Compressor {
     return 0;
   }
 
-  int decompress(const ceph::buffer::list &src, ceph::buffer::list &dst, std::optional<int32_t> compressor_message) override {
-    auto i = std::cbegin(src);
-    return decompress(i, src.length(), dst, compressor_message);
-  }
-
-  int decompress(ceph::buffer::list::const_iterator &p,
-		 size_t compressed_len,
-		 ceph::buffer::list &dst,
-		 std::optional<int32_t> compressor_message) override {
+  int _decompress(ceph::buffer::list::const_iterator &p,
+		  size_t compressed_len,
+		  ceph::buffer::list &dst,
+		  const ZSTD_DDict *ddict) {
     if (compressed_len < 4) {
       return -1;
     }
@@ -84,15 +174,24 @@ class ZstdCompressor : public Compressor {
     outbuf.pos = 0;
     ZSTD_DStream *s = ZSTD_createDStream();
     ZSTD_initDStream(s);
+    if (ddict) {
+      ZSTD_DCtx_refDDict(s, ddict);
+    }
     while (compressed_len > 0) {
       if (p.end()) {
+	ZSTD_freeDStream(s);
 	return -1;
       }
       ZSTD_inBuffer_s inbuf;
       inbuf.pos = 0;
       inbuf.size = p.get_ptr_and_advance(compressed_len,
 					 (const char**)&inbuf.src);
-      ZSTD_decompressStream(s, &outbuf, &inbuf);
+      size_t r = ZSTD_decompressStream(s, &outbuf, &inbuf);
+      if (ZSTD_isError(r)) {
+	// e.g. a frame made with a dictionary we were not given
+	ZSTD_freeDStream(s);
+	return -1;
+      }
       compressed_len -= inbuf.size;
     }
     ZSTD_freeDStream(s);
@@ -100,7 +199,7 @@ class ZstdCompressor : public Compressor {
     dst.append(dstptr, 0, outbuf.pos);
     return 0;
   }
- private:
+
   CephContext *const cct;
 };
 
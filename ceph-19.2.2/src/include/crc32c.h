@@ -50,6 +50,20 @@ static inline uint32_t ceph_crc32c(uint32_t crc, unsigned char const *data, unsi
   return ceph_crc32c_func(crc, data, length);
 }
 
+/**
+ * calculate crc32c of several buffers of the same length at once
+ *
+ * Interleaves the buffers where the CPU allows that, otherwise this is
+ * equivalent to calling ceph_crc32c() on each of them.
+ *
+ * @param crcs initial values on input, results on output
+ * @param data pointers to n data buffers, none of them may be NULL
+ * @param n number of buffers
+ * @param length length of each buffer
+ */
+void ceph_crc32c_multi(uint32_t *crcs, unsigned char const * const *data,
+		       unsigned n, unsigned length);
+
 #ifdef __cplusplus
 }
 #endif
@@ -171,6 +171,7 @@ namespace mempool {
   f(bluefs_file_writer)              \
   f(buffer_anon)		      \
   f(buffer_meta)		      \
+  f(msgr_rx_cache)		      \
   f(osd)			      \
   f(osd_mapbl)			      \
   f(osd_pglog)			      \
@@ -124,6 +124,15 @@ public:
       const std::string &end        ///< [in] The start bound of remove keys
       ) = 0;
 
+    /// Remove keys in [start, end) with a single range tombstone, whatever
+    /// their number. For callers that know the range holds nothing else
+    /// but keys they mean to remove.
+    virtual void rm_range_keys_direct(
+      const std::string &prefix,    ///< [in] Prefix by which to remove keys
+      const std::string &start,     ///< [in] The start bound of remove keys
+      const std::string &end        ///< [in] The end bound of remove keys
+      ) { rm_range_keys(prefix, start, end); }
+
     /// Merge value into key
     virtual void merge(
       const std::string &prefix,   ///< [in] Prefix/CF ==> MUST match some established merge operator
@@ -397,6 +406,18 @@ public:
   virtual void compact_range_async(const std::string& prefix,
 				   const std::string& start, const std::string& end) {}
 
+  /// counts the deleted entries iterators step over on the calling thread
+  /// between begin_ and end_thread_tombstone_count()
+  struct tombstone_count_t {
+    uint64_t start = 0;
+    int saved_level = 0;  ///< backend state to restore at the end
+  };
+  virtual void begin_thread_tombstone_count(tombstone_count_t *c) {}
+  /// ends the count, returns 0 if the backend does not track it
+  virtual uint64_t end_thread_tombstone_count(const tombstone_count_t& c) {
+    return 0;
+  }
+
   // See RocksDB merge operator definition, we support the basic
   // associative merge only right now.
   class MergeOperator {
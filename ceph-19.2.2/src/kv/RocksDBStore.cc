@@ -1815,6 +1815,28 @@ void RocksDBStore::RocksDBTransactionImpl::rm_range_keys(const string &prefix,
   ldout(db->cct, 10) << __func__ << " end" << dendl;
 }
 
+void RocksDBStore::RocksDBTransactionImpl::rm_range_keys_direct(
+  const string &prefix,
+  const string &start,
+  const string &end)
+{
+  ldout(db->cct, 10) << __func__
+                     << " prefix=" << prefix
+                     << " start=" << pretty_binary_string(start)
+		     << " end=" << pretty_binary_string(end) << dendl;
+  auto p_iter = db->cf_handles.find(prefix);
+  if (p_iter == db->cf_handles.end()) {
+    bat.DeleteRange(db->default_cf,
+		    rocksdb::Slice(combine_strings(prefix, start)),
+		    rocksdb::Slice(combine_strings(prefix, end)));
+  } else {
+    ceph_assert(p_iter->second.handles.size() >= 1);
+    for (auto cf : p_iter->second.handles) {
+      bat.DeleteRange(cf, rocksdb::Slice(start), rocksdb::Slice(end));
+    }
+  }
+}
+
 void RocksDBStore::RocksDBTransactionImpl::merge(
   const string &prefix,
   const string &k,
@@ -2077,6 +2099,25 @@ void RocksDBStore::compact_range_async(const string& start, const string& end)
     compact_thread.create("rstore_compact");
   }
 }
+void RocksDBStore::begin_thread_tombstone_count(tombstone_count_t *c)
+{
+  // counting is cheap, but the perf context only counts when asked to;
+  // raise the thread's level just for the count
+  c->saved_level = (int)rocksdb::GetPerfLevel();
+  if (rocksdb::GetPerfLevel() < rocksdb::PerfLevel::kEnableCount) {
+    rocksdb::SetPerfLevel(rocksdb::PerfLevel::kEnableCount);
+  }
+  c->start = rocksdb::get_perf_context()->internal_delete_skipped_count;
+}
+
+uint64_t RocksDBStore::end_thread_tombstone_count(const tombstone_count_t& c)
+{
+  uint64_t now = rocksdb::get_perf_context()->internal_delete_skipped_count;
+  rocksdb::SetPerfLevel((rocksdb::PerfLevel)c.saved_level);
+  // the thread's counters may have been reset in between
+  return now >= c.start ? now - c.start : now;
+}
+
 bool RocksDBStore::check_omap_dir(string &omap_dir)
 {
   rocksdb::Options options;
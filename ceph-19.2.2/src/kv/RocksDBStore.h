@@ -236,6 +236,8 @@ public:
 			   const std::string& end) override {
     compact_range_async(combine_strings(prefix, start), combine_strings(prefix, end));
   }
+  void begin_thread_tombstone_count(tombstone_count_t *c) override;
+  uint64_t end_thread_tombstone_count(const tombstone_count_t& c) override;
 
   RocksDBStore(CephContext *c, const std::string &path, std::map<std::string,std::string> opt, void *p) :
     cct(c),
@@ -325,6 +327,10 @@ public:
       const std::string &prefix,
       const std::string &start,
       const std::string &end) override;
+    void rm_range_keys_direct(
+      const std::string &prefix,
+      const std::string &start,
+      const std::string &end) override;
     void merge(
       const std::string& prefix,
       const std::string& k,
@@ -123,9 +123,35 @@ BinnedLRUCacheShard::BinnedLRUCacheShard(CephContext *c, size_t capacity, bool s
 BinnedLRUCacheShard::~BinnedLRUCacheShard() {}
 
 bool BinnedLRUCacheShard::Unref(BinnedLRUHandle* e) {
-  ceph_assert(e->refs > 0);
-  e->refs--;
-  return e->refs == 0;
+  uint32_t refs = e->refs--;
+  ceph_assert(refs > 0);
+  return refs == 1;
+}
+
+bool BinnedLRUCacheShard::RefIfReferenced(BinnedLRUHandle* e) {
+  // in_cache only changes under the exclusive lock. an entry in the cache
+  // with a single ref is on the LRU, taking it off needs the exclusive lock
+  uint32_t min_refs = e->InCache() ? 1 : 0;
+  uint32_t refs = e->refs.load();
+  while (refs > min_refs) {
+    if (e->refs.compare_exchange_weak(refs, refs + 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool BinnedLRUCacheShard::UnrefIfReferenced(BinnedLRUHandle* e) {
+  // dropping to a single ref puts an entry in the cache on the LRU, dropping
+  // the last ref frees one that is not; both need the exclusive lock
+  uint32_t min_refs = e->InCache() ? 2 : 1;
+  uint32_t refs = e->refs.load();
+  while (refs > min_refs) {
+    if (e->refs.compare_exchange_weak(refs, refs - 1)) {
+      return true;
+    }
+  }
+  return false;
 }
 
 // Call deleter and free
@@ -133,7 +159,7 @@ bool BinnedLRUCacheShard::Unref(BinnedLRUHandle* e) {
 void BinnedLRUCacheShard::EraseUnRefEntries() {
   ceph::autovector<BinnedLRUHandle*> last_reference_list;
   {
-    std::lock_guard<std::mutex> l(mutex_);
+    std::lock_guard<std::shared_mutex> l(mutex_);
     while (lru_.next != &lru_) {
       BinnedLRUHandle* old = lru_.next;
       ceph_assert(old->InCache());
@@ -161,14 +187,14 @@ void BinnedLRUCacheShard::ApplyToAllCacheEntries(
   bool thread_safe)
 {
   if (thread_safe) {
-    mutex_.lock();
+    mutex_.lock_shared();
   }
   table_.ApplyToAllCacheEntries(
     [callback](BinnedLRUHandle* h) {
       callback(h->key(), h->value, h->charge, h->deleter);
     });
   if (thread_safe) {
-    mutex_.unlock();
+    mutex_.unlock_shared();
   }
 }
 
@@ -188,12 +214,12 @@ size_t BinnedLRUCacheShard::TEST_GetLRUSize() {
 }
 
 double BinnedLRUCacheShard::GetHighPriPoolRatio() const {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::shared_lock<std::shared_mutex> l(mutex_);
   return high_pri_pool_ratio_;
 }
 
 size_t BinnedLRUCacheShard::GetHighPriPoolUsage() const {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::shared_lock<std::shared_mutex> l(mutex_);
   return high_pri_pool_usage_;
 }
 
@@ -245,7 +271,7 @@ void BinnedLRUCacheShard::LRU_Insert(BinnedLRUHandle* e) {
 }
 
 uint64_t BinnedLRUCacheShard::sum_bins(uint32_t start, uint32_t end) const {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::shared_lock<std::shared_mutex> l(mutex_);
   auto size = age_bins.size();
   if (size < start) {
     return 0;
@@ -287,7 +313,7 @@ void BinnedLRUCacheShard::EvictFromLRU(size_t charge,
 void BinnedLRUCacheShard::SetCapacity(size_t capacity) {
   ceph::autovector<BinnedLRUHandle*> last_reference_list;
   {
-    std::lock_guard<std::mutex> l(mutex_);
+    std::lock_guard<std::shared_mutex> l(mutex_);
     capacity_ = capacity;
     high_pri_pool_capacity_ = capacity_ * high_pri_pool_ratio_;
     EvictFromLRU(0, &last_reference_list);
@@ -300,12 +326,25 @@ void BinnedLRUCacheShard::SetCapacity(size_t capacity) {
 }
 
 void BinnedLRUCacheShard::SetStrictCapacityLimit(bool strict_capacity_limit) {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::lock_guard<std::shared_mutex> l(mutex_);
   strict_capacity_limit_ = strict_capacity_limit;
 }
 
 rocksdb::Cache::Handle* BinnedLRUCacheShard::Lookup(const rocksdb::Slice& key, uint32_t hash) {
-  std::lock_guard<std::mutex> l(mutex_);
+  {
+    // an entry somebody holds already is off the LRU, only its ref count
+    // changes
+    std::shared_lock<std::shared_mutex> l(mutex_);
+    BinnedLRUHandle* e = table_.Lookup(key, hash);
+    if (e == nullptr) {
+      return nullptr;
+    }
+    if (RefIfReferenced(e)) {
+      e->SetHit();
+      return reinterpret_cast<rocksdb::Cache::Handle*>(e);
+    }
+  }
+  std::lock_guard<std::shared_mutex> l(mutex_);
   BinnedLRUHandle* e = table_.Lookup(key, hash);
   if (e != nullptr) {
     ceph_assert(e->InCache());
@@ -320,7 +359,14 @@ rocksdb::Cache::Handle* BinnedLRUCacheShard::Lookup(const rocksdb::Slice& key, u
 
 bool BinnedLRUCacheShard::Ref(rocksdb::Cache::Handle* h) {
   BinnedLRUHandle* handle = reinterpret_cast<BinnedLRUHandle*>(h);
-  std::lock_guard<std::mutex> l(mutex_);
+  {
+    // the caller holds a reference, so normally the entry is off the LRU
+    std::shared_lock<std::shared_mutex> l(mutex_);
+    if (RefIfReferenced(handle)) {
+      return true;
+    }
+  }
+  std::lock_guard<std::shared_mutex> l(mutex_);
   if (handle->InCache() && handle->refs == 1) {
     LRU_Remove(handle);
   }
@@ -329,7 +375,7 @@ bool BinnedLRUCacheShard::Ref(rocksdb::Cache::Handle* h) {
 }
 
 void BinnedLRUCacheShard::SetHighPriPoolRatio(double high_pri_pool_ratio) {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::lock_guard<std::shared_mutex> l(mutex_);
   high_pri_pool_ratio_ = high_pri_pool_ratio;
   high_pri_pool_capacity_ = capacity_ * high_pri_pool_ratio_;
   MaintainPoolSize();
@@ -341,8 +387,15 @@ bool BinnedLRUCacheShard::Release(rocksdb::Cache::Handle* handle, bool force_era
   }
   BinnedLRUHandle* e = reinterpret_cast<BinnedLRUHandle*>(handle);
   bool last_reference = false;
+  if (!force_erase) {
+    // other references remain, the entry stays off the LRU
+    std::shared_lock<std::shared_mutex> l(mutex_);
+    if (UnrefIfReferenced(e)) {
+      return false;
+    }
+  }
   {
-    std::lock_guard<std::mutex> l(mutex_);
+    std::lock_guard<std::shared_mutex> l(mutex_);
     last_reference = Unref(e);
     if (last_reference) {
       usage_ -= e->charge;
@@ -397,7 +450,7 @@ rocksdb::Status BinnedLRUCacheShard::Insert(const rocksdb::Slice& key, uint32_t
   std::copy_n(key.data(), e->key_length, e->key_data);
 
   {
-    std::lock_guard<std::mutex> l(mutex_);
+    std::lock_guard<std::shared_mutex> l(mutex_);
     // Free the space following strict LRU policy until enough space
     // is freed or the lru list is empty
     EvictFromLRU(charge, &last_reference_list);
@@ -451,7 +504,7 @@ void BinnedLRUCacheShard::Erase(const rocksdb::Slice& key, uint32_t hash) {
   BinnedLRUHandle* e;
   bool last_reference = false;
   {
-    std::lock_guard<std::mutex> l(mutex_);
+    std::lock_guard<std::shared_mutex> l(mutex_);
     e = table_.Remove(key, hash);
     if (e != nullptr) {
       last_reference = Unref(e);
@@ -473,28 +526,28 @@ void BinnedLRUCacheShard::Erase(const rocksdb::Slice& key, uint32_t hash) {
 }
 
 size_t BinnedLRUCacheShard::GetUsage() const {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::shared_lock<std::shared_mutex> l(mutex_);
   return usage_;
 }
 
 size_t BinnedLRUCacheShard::GetPinnedUsage() const {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::shared_lock<std::shared_mutex> l(mutex_);
   ceph_assert(usage_ >= lru_usage_);
   return usage_ - lru_usage_;
 }
 
 void BinnedLRUCacheShard::shift_bins() {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::lock_guard<std::shared_mutex> l(mutex_);
   age_bins.push_front(std::make_shared<uint64_t>(0));
 }
 
 uint32_t BinnedLRUCacheShard::get_bin_count() const {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::shared_lock<std::shared_mutex> l(mutex_);
   return age_bins.capacity();
 }
 
 void BinnedLRUCacheShard::set_bin_count(uint32_t count) {
-  std::lock_guard<std::mutex> l(mutex_);
+  std::lock_guard<std::shared_mutex> l(mutex_);
   age_bins.set_capacity(count);
 }
 
@@ -502,7 +555,7 @@ std::string BinnedLRUCacheShard::GetPrintableOptions() const {
   const int kBufferSize = 200;
   char buffer[kBufferSize];
   {
-    std::lock_guard<std::mutex> l(mutex_);
+    std::shared_lock<std::shared_mutex> l(mutex_);
     snprintf(buffer, kBufferSize, "    high_pri_pool_ratio: %.3lf\n",
              high_pri_pool_ratio_);
   }
@@ -10,8 +10,10 @@
 #ifndef ROCKSDB_BINNED_LRU_CACHE
 #define ROCKSDB_BINNED_LRU_CACHE
 
+#include <atomic>
 #include <string>
 #include <mutex>
+#include <shared_mutex>
 #include <boost/circular_buffer.hpp>
 
 #include "ShardedCache.h"
@@ -47,6 +49,11 @@ namespace rocksdb_cache {
 // that any successful BinnedLRUCacheShard::Lookup/BinnedLRUCacheShard::Insert have a
 // matching
 // RUCache::Release (to move into state 2) or BinnedLRUCacheShard::Erase (for state 3)
+//
+// Only moving between states 1 and 2 touches the LRU list. Taking or
+// dropping a reference on an entry that stays in state 1 just changes its
+// atomic ref count, so that is done holding the shard lock shared and hits
+// on entries that are in use already don't serialize.
 
 std::shared_ptr<rocksdb::Cache> NewBinnedLRUCache(
     CephContext *c,
@@ -64,14 +71,14 @@ struct BinnedLRUHandle {
   BinnedLRUHandle* prev;
   size_t charge;  // TODO(opt): Only allow uint32_t?
   size_t key_length;
-  uint32_t refs;     // a number of refs to this entry
-                     // cache itself is counted as 1
+  std::atomic<uint32_t> refs;  // a number of refs to this entry
+                               // cache itself is counted as 1
 
   // Include the following flags:
   //   in_cache:    whether this entry is referenced by the hash table.
   //   is_high_pri: whether this entry is high priority entry.
   //   in_high_pri_pool: whether this entry is in high-pri pool.
-  char flags;
+  std::atomic<char> flags;
 
   uint32_t hash;     // Hash of key(); used for fast sharding and comparisons
 
@@ -202,7 +209,7 @@ class alignas(CACHE_LINE_SIZE) BinnedLRUCacheShard : public CacheShard {
 
   // Although in some platforms the update of size_t is atomic, to make sure
   // GetUsage() and GetPinnedUsage() work correctly under any platform, we'll
-  // protect them with mutex_.
+  // protect them with mutex_, held shared.
 
   virtual size_t GetUsage() const override;
   virtual size_t GetPinnedUsage() const override;
@@ -257,10 +264,20 @@ class alignas(CACHE_LINE_SIZE) BinnedLRUCacheShard : public CacheShard {
   // Return true if last reference
   bool Unref(BinnedLRUHandle* e);
 
+  // Take a reference on an entry in state 1 or 3, leaving it there.
+  // Return false, changing nothing, if the entry is in state 2.
+  // Needs the mutex_, shared at least.
+  bool RefIfReferenced(BinnedLRUHandle* e);
+
+  // Drop a reference on an entry that stays in state 1 or 3 afterwards.
+  // Return false, changing nothing, if this is the last external one.
+  // Needs the mutex_, shared at least.
+  bool UnrefIfReferenced(BinnedLRUHandle* e);
+
   // Free some space following strict LRU policy until enough space
   // to hold (usage_ + charge) is freed or the lru list is empty
   // This function is not thread safe - it needs to be executed while
-  // holding the mutex_
+  // holding the mutex_ exclusively
   void EvictFromLRU(size_t charge, ceph::autovector<BinnedLRUHandle*>* deleted);
 
   // Initialized before use.
@@ -306,10 +323,12 @@ class alignas(CACHE_LINE_SIZE) BinnedLRUCacheShard : public CacheShard {
   // Memory size for entries residing only in the LRU list
   size_t lru_usage_;
 
-  // mutex_ protects the following state.
+  // mutex_ protects the following state. Taking or dropping references on
+  // entries that stay off the LRU holds it shared, anything else holds it
+  // exclusively.
   // We don't count mutex_ as the cache's internal state so semantically we
   // don't mind mutex_ invoking the non-const actions.
-  mutable std::mutex mutex_;
+  mutable std::shared_mutex mutex_;
 
   // Circular buffer of byte counters for age binning
   boost::circular_buffer<std::shared_ptr<uint64_t>> age_bins;
@@ -5412,7 +5412,8 @@ namespace {
     CSUM_TYPE, CSUM_MAX_BLOCK, CSUM_MIN_BLOCK, FINGERPRINT_ALGORITHM,
     PG_AUTOSCALE_MODE, PG_NUM_MIN, TARGET_SIZE_BYTES, TARGET_SIZE_RATIO,
     PG_AUTOSCALE_BIAS, DEDUP_TIER, DEDUP_CHUNK_ALGORITHM, 
-    DEDUP_CDC_CHUNK_SIZE, POOL_EIO, BULK, PG_NUM_MAX, READ_RATIO };
+    DEDUP_CDC_CHUNK_SIZE, POOL_EIO, BULK, PG_NUM_MAX, READ_RATIO,
+    COMPRESSION_ASYNC_MIN_SIZE };
 
   std::set<osd_pool_get_choices>
     subtract_second_from_first(const std::set<osd_pool_get_choices>& first,
@@ -6205,6 +6206,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
       {"compression_required_ratio", COMPRESSION_REQUIRED_RATIO},
       {"compression_max_blob_size", COMPRESSION_MAX_BLOB_SIZE},
       {"compression_min_blob_size", COMPRESSION_MIN_BLOB_SIZE},
+      {"compression_async_min_size", COMPRESSION_ASYNC_MIN_SIZE},
       {"csum_type", CSUM_TYPE},
       {"csum_max_block", CSUM_MAX_BLOCK},
       {"csum_min_block", CSUM_MIN_BLOCK},
@@ -6453,6 +6455,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 	  case COMPRESSION_REQUIRED_RATIO:
 	  case COMPRESSION_MAX_BLOB_SIZE:
 	  case COMPRESSION_MIN_BLOB_SIZE:
+	  case COMPRESSION_ASYNC_MIN_SIZE:
 	  case CSUM_TYPE:
 	  case CSUM_MAX_BLOCK:
 	  case CSUM_MIN_BLOCK:
@@ -6617,6 +6620,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 	  case COMPRESSION_REQUIRED_RATIO:
 	  case COMPRESSION_MAX_BLOB_SIZE:
 	  case COMPRESSION_MIN_BLOB_SIZE:
+	  case COMPRESSION_ASYNC_MIN_SIZE:
 	  case CSUM_TYPE:
 	  case CSUM_MAX_BLOCK:
 	  case CSUM_MIN_BLOCK:
@@ -8943,6 +8947,7 @@ int OSDMonitor::prepare_command_pool_set(const cmdmap_t& cmdmap,
       interr.clear(); 
     } else if (var == "compression_max_blob_size" ||
                var == "compression_min_blob_size" ||
+               var == "compression_async_min_size" ||
                var == "csum_max_block" ||
                var == "csum_min_block") {
       if (interr.length()) {
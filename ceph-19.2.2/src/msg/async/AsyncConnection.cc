@@ -18,6 +18,7 @@
 
 #include "include/Context.h"
 #include "include/random.h"
+#include "include/scope_guard.h"
 #include "common/errno.h"
 #include "AsyncMessenger.h"
 #include "AsyncConnection.h"
@@ -124,6 +125,9 @@ AsyncConnection::AsyncConnection(CephContext *cct, AsyncMessenger *m, DispatchQu
     last_active(ceph::coarse_mono_clock::now()),
     connect_timeout_us(cct->_conf->ms_connection_ready_timeout*1000*1000),
     inactive_timeout_us(cct->_conf->ms_connection_idle_timeout*1000*1000),
+    rebalance_interval(m->get_stack()->support_connection_migration() ?
+      cct->_conf.get_val<std::chrono::seconds>("ms_async_rebalance_interval") :
+      ceph::timespan::zero()),
     msgr2(m2), state_offset(0),
     worker(w), center(&w->center),read_buffer(nullptr)
 {
@@ -376,11 +380,23 @@ bool AsyncConnection::inject_network_congestion() const {
 
 void AsyncConnection::process() {
   std::lock_guard<std::mutex> l(lock);
+  if (forward_stale_event(read_handler)) {
+    return;
+  }
   last_active = ceph::coarse_mono_clock::now();
   recv_start_time = ceph::mono_clock::now();
+  auto account = make_scope_guard([this, start=recv_start_time] {
+    account_busy(start);
+  });
 
   ldout(async_msgr->cct, 20) << __func__ << dendl;
 
+  if (cs) {
+    // zero-copy completions raise EPOLLERR, which keeps waking us until
+    // they are reaped, whether or not the protocol reads right now
+    cs.reap_completions();
+  }
+
   switch (state) {
     case STATE_NONE: {
       ldout(async_msgr->cct, 20) << __func__ << " enter none state" << dendl;
@@ -728,11 +744,19 @@ void AsyncConnection::mark_down()
 void AsyncConnection::handle_write()
 {
   ldout(async_msgr->cct, 10) << __func__ << dendl;
+  if (forward_stale_event(write_handler)) {
+    return;
+  }
+  auto start = ceph::mono_clock::now();
   protocol->write_event();
+  account_busy(start);
 }
 
 void AsyncConnection::handle_write_callback() {
   std::lock_guard<std::mutex> l(lock);
+  if (forward_stale_event(write_callback_handler)) {
+    return;
+  }
   last_active = ceph::coarse_mono_clock::now();
   recv_start_time = ceph::mono_clock::now();
   write_lock.lock();
@@ -767,6 +791,120 @@ void AsyncConnection::cleanup() {
   }
 }
 
+// A connection moved to another worker may still have events queued on
+// the center of the one it left, hand them over to its current center.
+bool AsyncConnection::forward_stale_event(EventCallbackRef e)
+{
+  if (rebalance_interval == ceph::timespan::zero()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> l(write_lock);
+  if (center->in_thread()) {
+    return false;
+  }
+  ldout(async_msgr->cct, 20) << __func__ << " to " << center->get_id()
+                             << dendl;
+  center->dispatch_event_external(e);
+  return true;
+}
+
+void AsyncConnection::account_busy(ceph::mono_time start)
+{
+  if (rebalance_interval == ceph::timespan::zero()) {
+    return;
+  }
+  auto now = ceph::mono_clock::now();
+  uint64_t epoch = now.time_since_epoch() / rebalance_interval;
+  if (epoch != busy_epoch) {
+    busy_prev = epoch == busy_epoch + 1 ? busy_cur : ceph::timespan::zero();
+    busy_cur = ceph::timespan::zero();
+    busy_epoch = epoch;
+  }
+  busy_cur += now - start;
+}
+
+std::optional<ceph::timespan> AsyncConnection::get_rebalance_load(
+  Worker *w, ceph::timespan cooldown)
+{
+  std::lock_guard<std::mutex> l(lock);
+  // a closed connection may have outlived its messenger
+  if (state == STATE_CLOSED || worker != w ||
+      rebalance_interval == ceph::timespan::zero()) {
+    return std::nullopt;
+  }
+  ceph_assert(center->in_thread());
+  auto now = ceph::mono_clock::now();
+  if (last_migrated != ceph::mono_time() && now - last_migrated < cooldown) {
+    return std::nullopt;
+  }
+  uint64_t epoch = now.time_since_epoch() / rebalance_interval;
+  if (busy_epoch == epoch) {
+    return busy_prev;
+  } else if (busy_epoch + 1 == epoch) {
+    return busy_cur;
+  }
+  return ceph::timespan::zero();
+}
+
+bool AsyncConnection::migrate(Worker *w)
+{
+  std::lock_guard<std::mutex> l(lock);
+  ceph_assert(center->in_thread());
+  std::lock_guard<std::mutex> wl(write_lock);
+  if (state == STATE_CLOSED) {
+    // the messenger may be gone already, don't touch async_msgr
+    return false;
+  }
+  // anything waiting on this center's file or time events stays put
+  if (state != STATE_CONNECTION_ESTABLISHED || !protocol->is_connected() ||
+      !cs || is_queued() || writeCallback || !register_time_events.empty() ||
+      (delay_state && !delay_state->ready())) {
+    ldout(async_msgr->cct, 10) << __func__ << " busy, not moving" << dendl;
+    return false;
+  }
+  ldout(async_msgr->cct, 1) << __func__ << " from worker " << worker->id
+                            << " to worker " << w->id << dendl;
+
+  center->delete_file_event(cs.fd(), EVENT_READABLE | EVENT_WRITABLE);
+  open_write = false;
+  bool had_tick = last_tick_id;
+  if (last_tick_id) {
+    center->delete_time_event(last_tick_id);
+    last_tick_id = 0;
+  }
+  logger->dec(l_msgr_active_connections);
+  w->get_perf_counter()->inc(l_msgr_active_connections);
+  w->get_perf_counter()->inc(l_msgr_migrated_connections);
+  worker->references--;
+  w->references++;
+  logger = w->get_perf_counter();
+  labeled_logger = w->get_labeled_perf_counter();
+  worker = w;
+  center = &w->center;
+  if (delay_state) {
+    delay_state->set_center(center);
+  }
+  last_migrated = ceph::mono_clock::now();
+
+  // senders wake up the new center from now on, catch up with whatever
+  // came in or was queued in the meantime once the socket is polled there
+  center->submit_to(center->get_id(), [this, had_tick,
+                                       conn=AsyncConnectionRef(this)] {
+    std::lock_guard<std::mutex> l(lock);
+    if (state != STATE_CONNECTION_ESTABLISHED || !cs) {
+      return;
+    }
+    center->create_file_event(cs.fd(), EVENT_READABLE, read_handler);
+    if (had_tick && !last_tick_id) {
+      last_tick_id = center->create_time_event(inactive_timeout_us,
+                                               tick_handler);
+    }
+    center->dispatch_event_external(read_handler);
+    center->dispatch_event_external(write_handler);
+  }, true);
+  return true;
+}
+
 void AsyncConnection::wakeup_from(uint64_t id)
 {
   lock.lock();
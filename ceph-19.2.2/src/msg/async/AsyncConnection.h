@@ -207,6 +207,17 @@ private:
   const uint64_t connect_timeout_us;
   const uint64_t inactive_timeout_us;
 
+  // Busy time is accounted per rebalance interval, see get_rebalance_load().
+  // Only touched on the connection's own thread.
+  const ceph::timespan rebalance_interval;  ///< zero if not rebalanced
+  uint64_t busy_epoch = 0;        ///< interval busy_cur is accounted in
+  ceph::timespan busy_cur = ceph::timespan::zero();
+  ceph::timespan busy_prev = ceph::timespan::zero();  ///< the one before
+  ceph::mono_time last_migrated;
+
+  void account_busy(ceph::mono_time start);
+  bool forward_stale_event(EventCallbackRef e);
+
   // Tis section are temp variables used by state transition
 
   // Accepting state
@@ -241,6 +252,20 @@ private:
     return logger;
   }
 
+  /**
+   * Busy time of the last complete rebalance interval, for connections
+   * running on w which may be moved. To be called on w's thread.
+   *
+   * @param cooldown time after a move during which it may not move again
+   */
+  std::optional<ceph::timespan> get_rebalance_load(Worker *w,
+                                                   ceph::timespan cooldown);
+  /**
+   * Hand this connection over to worker w. To be called on the
+   * connection's own thread, gives up unless it is between messages.
+   */
+  bool migrate(Worker *w);
+
   bool is_msgr2() const override;
 
   friend class Protocol;
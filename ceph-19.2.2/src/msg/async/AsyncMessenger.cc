@@ -273,6 +273,16 @@ class C_handle_reap : public EventCallback {
   }
 };
 
+class C_handle_rebalance : public EventCallback {
+  AsyncMessenger *msgr;
+
+  public:
+  explicit C_handle_rebalance(AsyncMessenger *m): msgr(m) {}
+  void do_request(uint64_t id) override {
+    msgr->rebalance();
+  }
+};
+
 /*******************
  * AsyncMessenger
  */
@@ -288,6 +298,8 @@ AsyncMessenger::AsyncMessenger(CephContext *cct, entity_name_t name,
     transport_type = "rdma";
   else if (type.find("dpdk") != std::string::npos)
     transport_type = "dpdk";
+  else if (type.find("io_uring") != std::string::npos)
+    transport_type = "io_uring";
 
   auto single = &cct->lookup_or_create_singleton_object<StackSingleton>(
     "AsyncMessenger::NetworkStack::" + transport_type, true, cct);
@@ -299,6 +311,7 @@ AsyncMessenger::AsyncMessenger(CephContext *cct, entity_name_t name,
 					 local_worker, true, true);
   init_local_connection();
   reap_handler = new C_handle_reap(this);
+  rebalance_handler = new C_handle_rebalance(this);
   unsigned processor_num = 1;
   if (stack->support_local_listen_table())
     processor_num = stack->get_num_worker();
@@ -313,6 +326,7 @@ AsyncMessenger::AsyncMessenger(CephContext *cct, entity_name_t name,
 AsyncMessenger::~AsyncMessenger()
 {
   delete reap_handler;
+  delete rebalance_handler;
   ceph_assert(!did_bind); // either we didn't bind or we shut down the Processor
   for (auto &&p : processors)
     delete p;
@@ -335,6 +349,18 @@ void AsyncMessenger::ready()
   for (auto &&p : processors)
     p->start();
   dispatch_queue.start();
+
+  auto interval = cct->_conf.get_val<std::chrono::seconds>(
+    "ms_async_rebalance_interval");
+  if (interval.count() > 0 && stack->support_connection_migration() &&
+      stack->get_num_worker() > 1) {
+    local_worker->center.submit_to(local_worker->center.get_id(),
+                                   [this, interval] {
+      rebalance_timer_id = local_worker->center.create_time_event(
+        std::chrono::duration_cast<std::chrono::microseconds>(interval).count(),
+        rebalance_handler);
+    }, true);
+  }
 }
 
 int AsyncMessenger::shutdown()
@@ -344,6 +370,12 @@ int AsyncMessenger::shutdown()
   // done!  clean up.
   for (auto &&p : processors)
     p->stop();
+  local_worker->center.submit_to(local_worker->center.get_id(), [this] {
+    if (rebalance_timer_id) {
+      local_worker->center.delete_time_event(rebalance_timer_id);
+      rebalance_timer_id = 0;
+    }
+  }, false);
   mark_down_all();
   // break ref cycles on the loopback connection
   local_connection->clear_priv();
@@ -960,3 +992,61 @@ void AsyncMessenger::reap_dead()
     deleted_conns.clear();
   }
 }
+
+void AsyncMessenger::rebalance()
+{
+  auto interval = cct->_conf.get_val<std::chrono::seconds>(
+    "ms_async_rebalance_interval");
+  rebalance_timer_id = local_worker->center.create_time_event(
+    std::chrono::duration_cast<std::chrono::microseconds>(interval).count(),
+    rebalance_handler);
+
+  auto r = stack->claim_rebalance();
+  if (!r) {
+    return;
+  }
+  std::vector<AsyncConnectionRef> candidates;
+  {
+    std::lock_guard l{lock};
+    candidates.reserve(conns.size() + anon_conns.size());
+    for (auto& [addrs, conn] : conns) {
+      candidates.push_back(conn);
+    }
+    candidates.insert(candidates.end(), anon_conns.begin(), anon_conns.end());
+  }
+  ldout(cct, 10) << __func__ << " worker " << r->from->id << " -> "
+                 << r->to->id << " gap " << r->gap << dendl;
+
+  // connection loads can only be looked at on their worker, which also
+  // skips the ones running elsewhere. We may be shut down by the time it
+  // gets to it, so hold on to the stack rather than to us.
+  r->from->center.submit_to(r->from->center.get_id(),
+                            [cct=cct, stack=stack->shared_from_this(), r=*r,
+                             candidates=std::move(candidates)] {
+    // moving half the gap evens both workers out, skip connections that
+    // would just swap which one is hot
+    AsyncConnectionRef best;
+    ceph::timespan best_diff = ceph::timespan::max();
+    for (auto& conn : candidates) {
+      auto load = conn->get_rebalance_load(r.from, r.cooldown);
+      if (!load || *load == ceph::timespan::zero() || *load >= r.gap) {
+        continue;
+      }
+      auto diff = r.gap - 2 * *load;
+      if (diff < ceph::timespan::zero()) {
+        diff = -diff;
+      }
+      if (diff < best_diff) {
+        best = conn;
+        best_diff = diff;
+      }
+    }
+    if (best && best->migrate(r.to)) {
+      lgeneric_subdout(cct, ms, 5) << "rebalance moved " << best
+                                   << " from worker " << r.from->id
+                                   << " to worker " << r.to->id << dendl;
+      return;
+    }
+    stack->return_rebalance(r);
+  }, true);
+}
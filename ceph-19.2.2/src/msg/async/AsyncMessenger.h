@@ -299,6 +299,10 @@ private:
 
   EventCallbackRef reap_handler;
 
+  /// periodically moves a connection between workers, see rebalance()
+  EventCallbackRef rebalance_handler;
+  uint64_t rebalance_timer_id = 0;  ///< only touched on local_worker
+
   /// internal cluster protocol version, if any, for talking to entities of the same type.
   int cluster_protocol = 0;
 
@@ -425,6 +429,13 @@ public:
    */
   void reap_dead();
 
+  /**
+   * Carry out the move between workers the stack asks for, if one of
+   * our connections on the overloaded worker qualifies. Runs on
+   * local_worker off a timer.
+   */
+  void rebalance();
+
   /**
    * @} // AsyncMessenger Internals
    */
@@ -9,6 +9,7 @@
 #include "common/EventTrace.h"
 #include "common/ceph_crypto.h"
 #include "common/errno.h"
+#include "include/page.h"
 #include "include/random.h"
 #include "auth/AuthClient.h"
 #include "auth/AuthServer.h"
@@ -1176,6 +1177,38 @@ CtPtr ProtocolV2::handle_read_frame_dispatch() {
   return nullptr;
 }
 
+// The in-page offset the data segment of the message being read should
+// start at, so that it lines up with the object offset it is destined
+// for as ProtocolV1 arranges. Only known if the header segment can be
+// read before the frame is complete, which is not the case for msgr2.0
+// secure mode and compressed frames.
+uint32_t ProtocolV2::get_rx_data_page_off() {
+  if (rx_frame_asm.is_compressed() ||
+      rx_frame_asm.get_segment_logical_len(SegmentIndex::Msg::HEADER) !=
+        sizeof(ceph_msg_header2)) {
+    return 0;
+  }
+  const bufferlist* header_bl;
+  unsigned header_off = 0;
+  if (!session_stream_handlers.rx) {
+    header_bl = &rx_segments_data[SegmentIndex::Msg::HEADER];
+  } else if (rx_frame_asm.get_is_rev1()) {
+    // inlined into the preamble, already decrypted
+    static_assert(sizeof(ceph_msg_header2) <= FRAME_PREAMBLE_INLINE_SIZE);
+    header_bl = &rx_preamble;
+    header_off = sizeof(preamble_block_t);
+  } else {
+    return 0;
+  }
+  if (header_bl->length() < header_off + sizeof(ceph_msg_header2)) {
+    return 0;
+  }
+  ceph_msg_header2 header;
+  header_bl->begin(header_off).copy(sizeof(header),
+                                    reinterpret_cast<char*>(&header));
+  return header.data_off & ~CEPH_PAGE_MASK;
+}
+
 CtPtr ProtocolV2::read_frame_segment() {
   size_t seg_idx = rx_segments_data.size();
   ldout(cct, 20) << __func__ << " seg_idx=" << seg_idx << dendl;
@@ -1186,11 +1219,25 @@ CtPtr ProtocolV2::read_frame_segment() {
     return _handle_read_frame_segment();
   }
 
-  rx_buffer_t rx_buffer;
   uint16_t align = rx_frame_asm.get_segment_align(seg_idx);
+  uint32_t page_off = 0;
+  if (next_tag == Tag::MESSAGE && seg_idx == SegmentIndex::Msg::DATA &&
+      align == segment_t::PAGE_SIZE_ALIGNMENT) {
+    page_off = get_rx_data_page_off();
+  }
+
+  rx_buffer_t rx_buffer;
   try {
-    rx_buffer = ceph::buffer::ptr_node::create(ceph::buffer::create_aligned(
-        onwire_len, align));
+    bool hit = false;
+    auto raw = connection->worker->rx_buffer_pool->get(onwire_len + page_off,
+                                                       align, &hit);
+    if (raw) {
+      connection->logger->inc(hit ? l_msgr_recv_buffer_pool_hits :
+                                    l_msgr_recv_buffer_pool_misses);
+    } else {
+      raw = ceph::buffer::create_aligned(onwire_len + page_off, align);
+    }
+    rx_buffer = ceph::buffer::ptr_node::create(std::move(raw));
   } catch (const ceph::buffer::bad_alloc&) {
     // Catching because of potential issues with satisfying alignment.
     ldout(cct, 1) << __func__ << " can't allocate aligned rx_buffer"
@@ -1199,6 +1246,9 @@ CtPtr ProtocolV2::read_frame_segment() {
                   << dendl;
     return _fault();
   }
+  // pooled buffers span their whole size class
+  rx_buffer->set_offset(page_off);
+  rx_buffer->set_length(onwire_len);
 
   return READ_RXBUF(std::move(rx_buffer), handle_read_frame_segment);
 }
@@ -1394,6 +1444,12 @@ CtPtr ProtocolV2::handle_message() {
   ceph_msg_footer footer{ceph_le32(0), ceph_le32(0),
 	                 ceph_le32(0), ceph_le64(0), current_header.flags};
 
+  if (msg_frame.data_len() > 0 &&
+      (reinterpret_cast<uintptr_t>(msg_frame.data().front().c_str()) &
+       ~CEPH_PAGE_MASK) != (current_header.data_off & ~CEPH_PAGE_MASK)) {
+    connection->logger->inc(l_msgr_recv_realign_bytes, msg_frame.data_len());
+  }
+
   Message *message = decode_message(cct, 0, header, footer,
       msg_frame.front(),
       msg_frame.middle(),
@@ -0,0 +1,127 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <algorithm>
+#include <mutex>
+
+#include "RxBufferPool.h"
+
+#include "common/ceph_context.h"
+#include "include/buffer_raw.h"
+#include "include/compat.h"
+#include "include/intarith.h"
+#include "include/page.h"
+
+class RxBufferPool::raw_pooled : public ceph::buffer::raw {
+  std::shared_ptr<RxBufferPool> pool;
+  const unsigned cls;
+
+ public:
+  raw_pooled(std::shared_ptr<RxBufferPool> pool, unsigned cls,
+	     char *data, unsigned len)
+    : raw(data, len), pool(std::move(pool)), cls(cls) {}
+  ~raw_pooled() override {
+    pool->put(cls, data);
+  }
+};
+
+static unsigned class_shift(unsigned cls)
+{
+  return RxBufferPool::MIN_BUFFER_SHIFT + cls;
+}
+
+static void adjust_cached(ssize_t items, ssize_t bytes)
+{
+  mempool::get_pool(mempool::mempool_msgr_rx_cache).adjust_count(items, bytes);
+}
+
+RxBufferPool::RxBufferPool(uint64_t max_cached, uint32_t max_buffer_size)
+  : max_cached(max_cached),
+    num_classes(cbits(std::max(max_buffer_size, MIN_BUFFER_SIZE) - 1) -
+		MIN_BUFFER_SHIFT + 1),
+    free_lists(new free_list_t[num_classes])
+{
+}
+
+RxBufferPool::~RxBufferPool()
+{
+  for (unsigned cls = 0; cls < num_classes; ++cls) {
+    auto& bufs = free_lists[cls].bufs;
+    for (auto data : bufs) {
+      aligned_free(data);
+    }
+    adjust_cached(-(ssize_t)bufs.size(),
+		  -(ssize_t)(bufs.size() << class_shift(cls)));
+  }
+}
+
+std::shared_ptr<RxBufferPool> RxBufferPool::create(CephContext *cct)
+{
+  return std::make_shared<RxBufferPool>(
+    cct->_conf.get_val<Option::size_t>("ms_async_rx_buffer_pool_size"),
+    cct->_conf.get_val<Option::size_t>(
+      "ms_async_rx_buffer_pool_max_buffer_size"));
+}
+
+ceph::unique_leakable_ptr<ceph::buffer::raw> RxBufferPool::get(
+  uint32_t len, uint32_t align, bool *hit)
+{
+  ceph_assert(align <= CEPH_PAGE_SIZE);
+  if (!enabled() || len == 0 || len > get_max_buffer_size()) {
+    return nullptr;
+  }
+  // buffers are aligned to their size, up to a page
+  const uint32_t size = std::max(len, align);
+  const unsigned cls = size > MIN_BUFFER_SIZE ?
+    cbits(size - 1) - MIN_BUFFER_SHIFT : 0;
+  ceph_assert(cls < num_classes);
+
+  char *data = nullptr;
+  {
+    auto& fl = free_lists[cls];
+    std::lock_guard l(fl.lock);
+    if (!fl.bufs.empty()) {
+      data = fl.bufs.back();
+      fl.bufs.pop_back();
+    }
+  }
+  const uint64_t class_size = 1ull << class_shift(cls);
+  if (data) {
+    cached -= class_size;
+    adjust_cached(-1, -(ssize_t)class_size);
+    *hit = true;
+  } else {
+    int r = ::posix_memalign((void**)(void*)&data,
+			     std::min<uint64_t>(class_size, CEPH_PAGE_SIZE),
+			     class_size);
+    if (r || !data) {
+      throw ceph::buffer::bad_alloc();
+    }
+    *hit = false;
+  }
+  return ceph::unique_leakable_ptr<ceph::buffer::raw>(
+    new raw_pooled(shared_from_this(), cls, data, class_size));
+}
+
+void RxBufferPool::put(unsigned cls, char *data)
+{
+  const uint64_t class_size = 1ull << class_shift(cls);
+  if (cached.fetch_add(class_size) + class_size > max_cached) {
+    cached -= class_size;
+    aligned_free(data);
+    return;
+  }
+  adjust_cached(1, class_size);
+  auto& fl = free_lists[cls];
+  std::lock_guard l(fl.lock);
+  fl.bufs.push_back(data);
+}
@@ -0,0 +1,85 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MSG_ASYNC_RXBUFFERPOOL_H
+#define CEPH_MSG_ASYNC_RXBUFFERPOOL_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "include/buffer.h"
+#include "include/common_fwd.h"
+#include "include/spinlock.h"
+
+/*
+ * Recycles the buffers a messenger worker receives frame segments into.
+ *
+ * Buffers come in power of two size classes from MIN_BUFFER_SIZE up to
+ * the configured maximum and are aligned to their size, up to a page.
+ * A buffer handed out goes back to the free list of its class once the
+ * last bufferptr referencing it is gone, on whatever thread that
+ * happens, unless the pool already holds max_cached idle bytes. Buffers
+ * in use are accounted to the buffer_anon mempool by their class size,
+ * idle ones to msgr_rx_cache.
+ *
+ * Only the worker thread takes buffers from the pool. Buffers outliving
+ * the worker keep the pool alive.
+ */
+class RxBufferPool : public std::enable_shared_from_this<RxBufferPool> {
+  class raw_pooled;
+
+  struct free_list_t {
+    ceph::spinlock lock;
+    std::vector<char*> bufs;
+  };
+
+  const uint64_t max_cached;
+  const unsigned num_classes;
+  std::atomic<uint64_t> cached = {0};
+  std::unique_ptr<free_list_t[]> free_lists;
+
+  void put(unsigned cls, char *data);
+
+ public:
+  static constexpr unsigned MIN_BUFFER_SHIFT = 9;
+  static constexpr uint32_t MIN_BUFFER_SIZE = 1u << MIN_BUFFER_SHIFT;
+
+  RxBufferPool(uint64_t max_cached, uint32_t max_buffer_size);
+  ~RxBufferPool();
+
+  /// a pool configured by the ms_async_rx_buffer_pool_* options
+  static std::shared_ptr<RxBufferPool> create(CephContext *cct);
+
+  bool enabled() const {
+    return max_cached > 0;
+  }
+  uint32_t get_max_buffer_size() const {
+    return MIN_BUFFER_SIZE << (num_classes - 1);
+  }
+  uint64_t get_cached() const {
+    return cached;
+  }
+
+  /**
+   * Get a buffer for len bytes aligned to align, which is at most a page.
+   * The buffer spans its whole size class; trim the bufferptr to len.
+   *
+   * @param hit set to whether the buffer was recycled
+   * @return the buffer, nullptr if len is not poolable
+   */
+  ceph::unique_leakable_ptr<ceph::buffer::raw> get(uint32_t len,
+						   uint32_t align,
+						   bool *hit);
+};
+
+#endif
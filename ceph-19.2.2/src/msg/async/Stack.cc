@@ -26,6 +26,9 @@
 #ifdef HAVE_DPDK
 #include "dpdk/DPDKStack.h"
 #endif
+#ifdef HAVE_LIBURING
+#include "io_uring/IoUringStack.h"
+#endif
 
 #include "common/dout.h"
 #include "include/ceph_assert.h"
@@ -75,6 +78,10 @@ std::shared_ptr<NetworkStack> NetworkStack::create(CephContext *c,
   else if (t == "dpdk")
     stack.reset(new DPDKStack(c));
 #endif
+#ifdef HAVE_IO_URING_STACK
+  else if (t == "io_uring")
+    stack.reset(new IoUringStack(c));
+#endif
 
   if (stack == nullptr) {
     lderr(c) << __func__ << " ms_async_transport_type " << t <<
@@ -155,6 +162,91 @@ Worker* NetworkStack::get_worker()
   return current_best;
 }
 
+void NetworkStack::_update_rebalance(ceph::mono_time now)
+{
+  ceph::timespan elapsed = now - rebalance_stamp;
+  rebalance_stamp = now;
+  pending_rebalance.reset();
+
+  unsigned hot = 0, cold = 0;
+  std::vector<ceph::timespan> busy(workers.size());
+  for (unsigned i = 0; i < workers.size(); ++i) {
+    ceph::timespan total(
+      workers[i]->perf_logger->tget(l_msgr_running_total_time).to_nsec());
+    busy[i] = std::min(total - rebalance_busy[i], elapsed);
+    rebalance_busy[i] = total;
+    workers[i]->perf_logger->set(l_msgr_worker_load,
+				 100 * busy[i].count() / elapsed.count());
+    if (busy[i] > busy[hot]) {
+      hot = i;
+    }
+    if (busy[i] < busy[cold]) {
+      cold = i;
+    }
+  }
+
+  const auto& conf = cct->_conf;
+  double hot_load = (double)busy[hot].count() / elapsed.count();
+  double cold_load = (double)busy[cold].count() / elapsed.count();
+  if (hot == cold ||
+      hot_load < conf.get_val<double>("ms_async_rebalance_min_load") ||
+      hot_load - cold_load < conf.get_val<double>("ms_async_rebalance_threshold")) {
+    rebalance_rounds = 0;
+    return;
+  }
+  auto hysteresis = conf.get_val<uint64_t>("ms_async_rebalance_hysteresis");
+  ldout(cct, 10) << __func__ << " worker " << hot << " load " << hot_load
+		 << " worker " << cold << " load " << cold_load
+		 << " round " << rebalance_rounds + 1 << "/" << hysteresis << dendl;
+  if (++rebalance_rounds < hysteresis) {
+    return;
+  }
+  rebalance_rounds = 0;
+  // connection loads are measured over the configured interval
+  ceph::timespan interval =
+    conf.get_val<std::chrono::seconds>("ms_async_rebalance_interval");
+  pending_rebalance = rebalance_t{
+    workers[hot], workers[cold],
+    std::chrono::duration_cast<ceph::timespan>(
+      (busy[hot] - busy[cold]) * ((double)interval.count() / elapsed.count())),
+    interval * hysteresis, now};
+}
+
+std::optional<NetworkStack::rebalance_t> NetworkStack::claim_rebalance()
+{
+  auto interval = cct->_conf.get_val<std::chrono::seconds>(
+    "ms_async_rebalance_interval");
+  if (interval == interval.zero() || workers.size() < 2) {
+    return std::nullopt;
+  }
+
+  std::lock_guard l(rebalance_lock);
+  auto now = ceph::mono_clock::now();
+  if (rebalance_busy.empty()) {
+    rebalance_busy.resize(workers.size());
+    for (unsigned i = 0; i < workers.size(); ++i) {
+      rebalance_busy[i] = ceph::timespan(
+	workers[i]->perf_logger->tget(l_msgr_running_total_time).to_nsec());
+    }
+    rebalance_stamp = now;
+    return std::nullopt;
+  }
+  if (now - rebalance_stamp >= interval) {
+    _update_rebalance(now);
+  }
+  auto r = std::move(pending_rebalance);
+  pending_rebalance.reset();
+  return r;
+}
+
+void NetworkStack::return_rebalance(const rebalance_t &r)
+{
+  std::lock_guard l(rebalance_lock);
+  if (!pending_rebalance && r.stamp == rebalance_stamp) {
+    pending_rebalance = r;
+  }
+}
+
 void NetworkStack::stop()
 {
   std::lock_guard lk(pool_spin);
@@ -17,11 +17,16 @@
 #ifndef CEPH_MSG_ASYNC_STACK_H
 #define CEPH_MSG_ASYNC_STACK_H
 
+#include "common/ceph_mutex.h"
+#include "common/ceph_time.h"
 #include "common/perf_counters.h"
 #include "common/perf_counters_key.h"
 #include "include/spinlock.h"
 #include "msg/async/Event.h"
+#include "msg/async/RxBufferPool.h"
 #include "msg/msg_types.h"
+#include <memory>
+#include <optional>
 #include <string>
 
 class Worker;
@@ -35,6 +40,7 @@ class ConnectedSocketImpl {
   virtual void close() = 0;
   virtual int fd() const = 0;
   virtual void set_priority(int sd, int prio, int domain) = 0;
+  virtual void reap_completions() {}
 };
 
 class ConnectedSocket;
@@ -130,6 +136,14 @@ class ConnectedSocket {
     _csi->set_priority(sd, prio, domain);
   }
 
+  /// Releases what completed sends still hold.
+  ///
+  /// Some stacks report send completions out of band, waking the read
+  /// handler until they are reaped.
+  void reap_completions() {
+    _csi->reap_completions();
+  }
+
   explicit operator bool() const {
     return _csi.get();
   }
@@ -213,6 +227,16 @@ enum {
   l_msgr_recv_encrypted_bytes,
   l_msgr_send_encrypted_bytes,
 
+  l_msgr_send_zerocopy_bytes,
+  l_msgr_send_zerocopy_copied,
+
+  l_msgr_recv_buffer_pool_hits,
+  l_msgr_recv_buffer_pool_misses,
+  l_msgr_recv_realign_bytes,
+
+  l_msgr_worker_load,
+  l_msgr_migrated_connections,
+
   l_msgr_last,
 };
 
@@ -240,12 +264,14 @@ class Worker {
 
   std::atomic_uint references;
   EventCenter center;
+  std::shared_ptr<RxBufferPool> rx_buffer_pool;
 
   Worker(const Worker&) = delete;
   Worker& operator=(const Worker&) = delete;
 
   Worker(CephContext *c, unsigned worker_id)
-    : cct(c), id(worker_id), references(0), center(c) {
+    : cct(c), id(worker_id), references(0), center(c),
+      rx_buffer_pool(RxBufferPool::create(c)) {
     char name[128];
     char name_prefix[] = "AsyncMessenger::Worker";
     sprintf(name, "%s-%u", name_prefix, id);
@@ -271,6 +297,16 @@ class Worker {
     plb.add_u64_counter(l_msgr_recv_encrypted_bytes, "msgr_recv_encrypted_bytes", "Network received encrypted bytes", NULL, 0, unit_t(UNIT_BYTES));
     plb.add_u64_counter(l_msgr_send_encrypted_bytes, "msgr_send_encrypted_bytes", "Network sent encrypted bytes", NULL, 0, unit_t(UNIT_BYTES));
 
+    plb.add_u64_counter(l_msgr_send_zerocopy_bytes, "msgr_send_zerocopy_bytes", "Network bytes sent with MSG_ZEROCOPY", NULL, 0, unit_t(UNIT_BYTES));
+    plb.add_u64_counter(l_msgr_send_zerocopy_copied, "msgr_send_zerocopy_copied", "MSG_ZEROCOPY completions the kernel had to copy for");
+
+    plb.add_u64_counter(l_msgr_recv_buffer_pool_hits, "msgr_recv_buffer_pool_hits", "Frame segments received into recycled buffers");
+    plb.add_u64_counter(l_msgr_recv_buffer_pool_misses, "msgr_recv_buffer_pool_misses", "Frame segments the receive buffer pool had to allocate for");
+    plb.add_u64_counter(l_msgr_recv_realign_bytes, "msgr_recv_realign_bytes", "Received message data bytes not lined up with their data offset", NULL, 0, unit_t(UNIT_BYTES));
+
+    plb.add_u64(l_msgr_worker_load, "msgr_worker_load", "Percentage of the last rebalance interval the worker was busy");
+    plb.add_u64_counter(l_msgr_migrated_connections, "msgr_migrated_connections", "Connections moved to this worker to even out load");
+
     perf_logger = plb.create_perf_counters();
     cct->get_perfcounters_collection()->add(perf_logger);
 
@@ -341,10 +377,30 @@ class Worker {
   }
 };
 
-class NetworkStack {
+class NetworkStack : public std::enable_shared_from_this<NetworkStack> {
+ public:
+  /// a connection busy for less than gap should move from one worker to another
+  struct rebalance_t {
+    Worker *from = nullptr;
+    Worker *to = nullptr;
+    ceph::timespan gap;		///< busy time difference per interval
+    ceph::timespan cooldown;	///< time a moved connection has to stay put
+    ceph::mono_time stamp;	///< when loads were compared
+  };
+
+ private:
   ceph::spinlock pool_spin;
   bool started = false;
 
+  ceph::mutex rebalance_lock = ceph::make_mutex("NetworkStack::rebalance_lock");
+  ceph::mono_time rebalance_stamp;
+  /// l_msgr_running_total_time of each worker at rebalance_stamp
+  std::vector<ceph::timespan> rebalance_busy;
+  unsigned rebalance_rounds = 0;
+  std::optional<rebalance_t> pending_rebalance;
+
+  void _update_rebalance(ceph::mono_time now);
+
   std::function<void ()> add_thread(Worker* w);
 
   virtual Worker* create_worker(CephContext *c, unsigned i) = 0;
@@ -379,6 +435,9 @@ class NetworkStack {
   // need to let each thread do binding port.
   virtual bool support_local_listen_table() const { return false; }
   virtual bool nonblock_connect_need_writable_event() const { return true; }
+  // backend need to override this method if its connected sockets may be
+  // handed over to another worker, see claim_rebalance().
+  virtual bool support_connection_migration() const { return false; }
 
   void start();
   void stop();
@@ -391,6 +450,19 @@ class NetworkStack {
     return workers.size();
   }
 
+  /**
+   * Take the pending move of a connection between workers, if any.
+   *
+   * Worker loads are compared at most once per ms_async_rebalance_interval,
+   * by whichever messenger asks first. A move is proposed once the busiest
+   * and the least busy worker stayed apart for ms_async_rebalance_hysteresis
+   * intervals in a row, and stays on offer until the end of the interval
+   * for the messengers sharing this stack to pick a connection for it.
+   */
+  std::optional<rebalance_t> claim_rebalance();
+  /// put back a move no connection could be found for
+  void return_rebalance(const rebalance_t &r);
+
   // direct is used in tests only
   virtual void spawn_worker(std::function<void ()> &&) = 0;
   virtual void join_worker(unsigned i) = 0;
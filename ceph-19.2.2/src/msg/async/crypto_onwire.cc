@@ -1,7 +1,10 @@
 // -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
 // vim: ts=8 sw=2 smarttab
 
+#include <algorithm>
 #include <array>
+#include <cstring>
+#include <numeric>
 #include <openssl/evp.h>
 
 #include "crypto_onwire.h"
@@ -36,14 +39,37 @@ using key_t = std::array<std::uint8_t, AESGCM_KEY_LEN>;
 // https://wiki.openssl.org/index.php/EVP_Authenticated_Encryption_and_Decryption
 // https://nvlpubs.nist.gov/nistpubs/Legacy/SP/nistspecialpublication800-38d.pdf
 class AES128GCM_OnWireTxHandler : public ceph::crypto::onwire::TxHandler {
+  // Plaintext pieces shorter than this are gathered and encrypted with
+  // a single EVP call. Encoded messages are often made of many tiny
+  // buffers and OpenSSL's wide (AES-NI/VAES) GCM loops only kick in for
+  // inputs spanning several blocks.
+  static constexpr const std::uint32_t GATHER_MIN_LEN{512};
+  // Ciphertext of consecutive frames is carved out of buffers of at
+  // least this size instead of allocating one buffer per frame.
+  static constexpr const std::uint32_t OUT_BATCH_LEN{64 << 10};
+
   CephContext* const cct;
   std::unique_ptr<EVP_CIPHER_CTX, decltype(&::EVP_CIPHER_CTX_free)> ectx;
-  ceph::bufferlist buffer;
+  ceph::bufferptr out;
+  std::uint32_t frame_off = 0;
+  std::uint32_t frame_end = 0;
+  std::array<unsigned char, 4096> gather;
+  std::uint32_t gather_len = 0;
   nonce_t nonce, initial_nonce;
   bool used_initial_nonce;
   bool new_nonce_format;  // 64-bit counter?
   static_assert(sizeof(nonce) == AESGCM_IV_LEN);
 
+  void encrypt(const unsigned char* plaintext, std::uint32_t len);
+  void flush_gather() {
+    if (gather_len > 0) {
+      encrypt(gather.data(), gather_len);
+      // don't keep plaintext around longer than needed
+      ::TOPNSPC::crypto::zeroize_for_security(gather.data(), gather_len);
+      gather_len = 0;
+    }
+  }
+
 public:
   AES128GCM_OnWireTxHandler(CephContext* const cct,
 			    const key_t& key,
@@ -70,11 +96,14 @@ public:
   ~AES128GCM_OnWireTxHandler() override {
     ::TOPNSPC::crypto::zeroize_for_security(&nonce, sizeof(nonce));
     ::TOPNSPC::crypto::zeroize_for_security(&initial_nonce, sizeof(initial_nonce));
+    ::TOPNSPC::crypto::zeroize_for_security(gather.data(), gather.size());
   }
 
   void reset_tx_handler(const uint32_t* first, const uint32_t* last) override;
 
   void authenticated_encrypt_update(const ceph::bufferlist& plaintext) override;
+  void authenticated_encrypt_update(const char* plaintext,
+                                    std::uint32_t len) override;
   ceph::bufferlist authenticated_encrypt_final() override;
 };
 
@@ -93,8 +122,17 @@ void AES128GCM_OnWireTxHandler::reset_tx_handler(const uint32_t* first,
     throw std::runtime_error("EVP_EncryptInit_ex failed");
   }
 
-  ceph_assert(buffer.get_append_buffer_unused_tail_length() == 0);
-  buffer.reserve(std::accumulate(first, last, AESGCM_TAG_LEN));
+  ceph_assert(out.length() == frame_end && gather_len == 0);
+  const std::uint32_t frame_len = std::accumulate(first, last,
+                                                  AESGCM_TAG_LEN);
+  if (out.unused_tail_length() < frame_len) {
+    // the frames already handed out keep the previous buffer alive
+    out = ceph::bufferptr(ceph::buffer::create_small_page_aligned(
+      std::max(frame_len, OUT_BATCH_LEN)));
+    out.set_length(0);
+  }
+  frame_off = out.length();
+  frame_end = frame_off + frame_len;
 
   if (!new_nonce_format) {
     // msgr2.0: 32-bit counter followed by 64-bit fixed field,
@@ -105,42 +143,61 @@ void AES128GCM_OnWireTxHandler::reset_tx_handler(const uint32_t* first,
   }
 }
 
+void AES128GCM_OnWireTxHandler::encrypt(const unsigned char* plaintext,
+                                        std::uint32_t len)
+{
+  ceph_assert(out.length() + len + AESGCM_TAG_LEN <= frame_end);
+  int update_len = 0;
+
+  if(1 != EVP_EncryptUpdate(ectx.get(),
+      reinterpret_cast<unsigned char*>(out.end_c_str()),
+      &update_len,
+      plaintext,
+      len)) {
+    throw std::runtime_error("EVP_EncryptUpdate failed");
+  }
+  ceph_assert_always(update_len >= 0);
+  ceph_assert(static_cast<unsigned>(update_len) == len);
+  out.set_length(out.length() + update_len);
+}
+
 void AES128GCM_OnWireTxHandler::authenticated_encrypt_update(
-  const ceph::bufferlist& plaintext)
+  const char* plaintext, std::uint32_t len)
 {
-  ceph_assert(buffer.get_append_buffer_unused_tail_length() >=
-              plaintext.length());
-  auto filler = buffer.append_hole(plaintext.length());
+  auto p = reinterpret_cast<const unsigned char*>(plaintext);
+  if (len >= GATHER_MIN_LEN) {
+    flush_gather();
+    encrypt(p, len);
+    return;
+  }
+  if (gather_len + len > gather.size()) {
+    flush_gather();
+  }
+  ::memcpy(gather.data() + gather_len, p, len);
+  gather_len += len;
+}
 
+void AES128GCM_OnWireTxHandler::authenticated_encrypt_update(
+  const ceph::bufferlist& plaintext)
+{
   for (const auto& plainbuf : plaintext.buffers()) {
-    int update_len = 0;
-
-    if(1 != EVP_EncryptUpdate(ectx.get(),
-	reinterpret_cast<unsigned char*>(filler.c_str()),
-	&update_len,
-	reinterpret_cast<const unsigned char*>(plainbuf.c_str()),
-	plainbuf.length())) {
-      throw std::runtime_error("EVP_EncryptUpdate failed");
-    }
-    ceph_assert_always(update_len >= 0);
-    ceph_assert(static_cast<unsigned>(update_len) == plainbuf.length());
-    filler.advance(update_len);
+    authenticated_encrypt_update(plainbuf.c_str(), plainbuf.length());
   }
 
   ldout(cct, 15) << __func__
 		 << " plaintext.length()=" << plaintext.length()
-		 << " buffer.length()=" << buffer.length()
+		 << " frame_len=" << out.length() + gather_len - frame_off
 		 << dendl;
 }
 
 ceph::bufferlist AES128GCM_OnWireTxHandler::authenticated_encrypt_final()
 {
+  flush_gather();
+
   int final_len = 0;
-  ceph_assert(buffer.get_append_buffer_unused_tail_length() ==
-              AESGCM_BLOCK_LEN);
-  auto filler = buffer.append_hole(AESGCM_BLOCK_LEN);
+  ceph_assert(out.length() + AESGCM_BLOCK_LEN == frame_end);
   if(1 != EVP_EncryptFinal_ex(ectx.get(),
-	reinterpret_cast<unsigned char*>(filler.c_str()),
+	reinterpret_cast<unsigned char*>(out.end_c_str()),
 	&final_len)) {
     throw std::runtime_error("EVP_EncryptFinal_ex failed");
   }
@@ -149,15 +206,18 @@ ceph::bufferlist AES128GCM_OnWireTxHandler::authenticated_encrypt_final()
   static_assert(AESGCM_BLOCK_LEN == AESGCM_TAG_LEN);
   if(1 != EVP_CIPHER_CTX_ctrl(ectx.get(),
 	EVP_CTRL_GCM_GET_TAG, AESGCM_TAG_LEN,
-	filler.c_str())) {
+	out.end_c_str())) {
     throw std::runtime_error("EVP_CIPHER_CTX_ctrl failed");
   }
+  out.set_length(frame_end);
 
   ldout(cct, 15) << __func__
-		 << " buffer.length()=" << buffer.length()
+		 << " frame_len=" << frame_end - frame_off
 		 << " final_len=" << final_len
 		 << dendl;
-  return std::move(buffer);
+  ceph::bufferlist frame_bl;
+  frame_bl.push_back(ceph::bufferptr(out, frame_off, frame_end - frame_off));
+  return frame_bl;
 }
 
 // RX PART
@@ -83,6 +83,12 @@ struct TxHandler {
   virtual void authenticated_encrypt_update(
     const ceph::bufferlist& plaintext) = 0;
 
+  // Same as above for plaintext sitting in contiguous memory which stays
+  // owned by the caller. Spares building a bufferlist around e.g. a frame
+  // preamble living on the stack.
+  virtual void authenticated_encrypt_update(const char* plaintext,
+                                            std::uint32_t len) = 0;
+
   // Generates authentication signature and returns bufferlist crafted
   // basing on plaintext from preceding call to _update().
   virtual ceph::bufferlist authenticated_encrypt_final() = 0;
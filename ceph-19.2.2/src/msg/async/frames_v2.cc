@@ -14,6 +14,7 @@
 
 #include "frames_v2.h"
 
+#include <algorithm>
 #include <ostream>
 
 #include <fmt/format.h>
@@ -28,6 +29,26 @@ static void unpad_zero(bufferlist& bl, uint32_t unpadded_len) {
   }
 }
 
+// Encrypts len bytes of plaintext starting at p followed by zeros up
+// to padded_len. Padding is fed to the cipher from here rather than
+// appended to the segment, so segments go through unmodified.
+static void encrypt_padded(ceph::crypto::onwire::TxHandler& tx,
+                           bufferlist::const_iterator& p, uint32_t len,
+                           uint32_t padded_len) {
+  static const char zero_pad[CRYPTO_BLOCK_SIZE] = {};
+  ceph_assert(padded_len >= len && padded_len - len < CRYPTO_BLOCK_SIZE);
+  const uint32_t pad_len = padded_len - len;
+  while (len > 0) {
+    const char* data;
+    size_t data_len = p.get_ptr_and_advance(len, &data);
+    tx.authenticated_encrypt_update(data, data_len);
+    len -= data_len;
+  }
+  if (pad_len > 0) {
+    tx.authenticated_encrypt_update(zero_pad, pad_len);
+  }
+}
+
 // Discards trailing empty segments, unless there is just one segment.
 // A frame always has at least one (possibly empty) segment.
 static size_t calc_num_segments(const bufferlist segment_bls[],
@@ -119,33 +140,28 @@ bufferlist FrameAssembler::asm_crc_rev0(const preamble_block_t& preamble,
 
 bufferlist FrameAssembler::asm_secure_rev0(const preamble_block_t& preamble,
                                            bufferlist segment_bls[]) const {
-  bufferlist preamble_bl(sizeof(preamble));
-  preamble_bl.append(reinterpret_cast<const char*>(&preamble),
-                     sizeof(preamble));
-
   epilogue_secure_rev0_block_t epilogue;
   // FIPS zeroization audit 20191115: this memset is not security related.
   ::memset(&epilogue, 0, sizeof(epilogue));
-  bufferlist epilogue_bl(sizeof(epilogue));
-  epilogue_bl.append(reinterpret_cast<const char*>(&epilogue),
-                     sizeof(epilogue));
 
   // preamble + MAX_NUM_SEGMENTS + epilogue
   uint32_t onwire_lens[MAX_NUM_SEGMENTS + 2];
-  onwire_lens[0] = preamble_bl.length();
+  onwire_lens[0] = sizeof(preamble);
   for (size_t i = 0; i < m_descs.size(); i++) {
-    onwire_lens[i + 1] = segment_bls[i].length();  // already padded
+    onwire_lens[i + 1] = get_segment_padded_len(i);
   }
-  onwire_lens[m_descs.size() + 1] = epilogue_bl.length();
+  onwire_lens[m_descs.size() + 1] = sizeof(epilogue);
   m_crypto->tx->reset_tx_handler(onwire_lens,
                                  onwire_lens + m_descs.size() + 2);
-  m_crypto->tx->authenticated_encrypt_update(preamble_bl);
+  m_crypto->tx->authenticated_encrypt_update(
+      reinterpret_cast<const char*>(&preamble), sizeof(preamble));
   for (size_t i = 0; i < m_descs.size(); i++) {
-    if (segment_bls[i].length() > 0) {
-      m_crypto->tx->authenticated_encrypt_update(segment_bls[i]);
-    }
+    auto p = segment_bls[i].cbegin();
+    encrypt_padded(*m_crypto->tx, p, segment_bls[i].length(),
+                   get_segment_padded_len(i));
   }
-  m_crypto->tx->authenticated_encrypt_update(epilogue_bl);
+  m_crypto->tx->authenticated_encrypt_update(
+      reinterpret_cast<const char*>(&epilogue), sizeof(epilogue));
   return m_crypto->tx->authenticated_encrypt_final();
 }
 
@@ -183,32 +199,24 @@ bufferlist FrameAssembler::asm_crc_rev1(const preamble_block_t& preamble,
 
 bufferlist FrameAssembler::asm_secure_rev1(const preamble_block_t& preamble,
                                            bufferlist segment_bls[]) const {
-  bufferlist preamble_bl;
-  if (segment_bls[0].length() > FRAME_PREAMBLE_INLINE_SIZE) {
-    // first segment is partially inlined, inline buffer is full
-    preamble_bl.reserve(sizeof(preamble));
-    preamble_bl.append(reinterpret_cast<const char*>(&preamble),
-                       sizeof(preamble));
-    segment_bls[0].splice(0, FRAME_PREAMBLE_INLINE_SIZE, &preamble_bl);
-  } else {
-    // first segment is fully inlined, inline buffer may need padding
-    uint32_t pad_len = FRAME_PREAMBLE_INLINE_SIZE - segment_bls[0].length();
-    preamble_bl.reserve(sizeof(preamble) + pad_len);
-    preamble_bl.append(reinterpret_cast<const char*>(&preamble),
-                       sizeof(preamble));
-    preamble_bl.claim_append(segment_bls[0]);
-    if (pad_len > 0) {
-      preamble_bl.append_zero(pad_len);
-    }
-  }
-
-  m_crypto->tx->reset_tx_handler({preamble_bl.length()});
-  m_crypto->tx->authenticated_encrypt_update(preamble_bl);
+  // the first segment is partially or fully inlined into the preamble
+  // block, the inline buffer is padded if not full
+  const uint32_t inline_len = std::min<uint32_t>(segment_bls[0].length(),
+                                                 FRAME_PREAMBLE_INLINE_SIZE);
+  auto p = segment_bls[0].cbegin();
+  m_crypto->tx->reset_tx_handler({sizeof(preamble) +
+                                  FRAME_PREAMBLE_INLINE_SIZE});
+  m_crypto->tx->authenticated_encrypt_update(
+      reinterpret_cast<const char*>(&preamble), sizeof(preamble));
+  encrypt_padded(*m_crypto->tx, p, inline_len, FRAME_PREAMBLE_INLINE_SIZE);
   auto frame_bl = m_crypto->tx->authenticated_encrypt_final();
 
-  if (segment_bls[0].length() > 0) {
-    m_crypto->tx->reset_tx_handler({segment_bls[0].length()});
-    m_crypto->tx->authenticated_encrypt_update(segment_bls[0]);
+  if (segment_bls[0].length() > inline_len) {
+    // FRAME_PREAMBLE_INLINE_SIZE is a multiple of CRYPTO_BLOCK_SIZE
+    const uint32_t padded_len = get_segment_padded_len(0) - inline_len;
+    m_crypto->tx->reset_tx_handler({padded_len});
+    encrypt_padded(*m_crypto->tx, p, segment_bls[0].length() - inline_len,
+                   padded_len);
     frame_bl.claim_append(m_crypto->tx->authenticated_encrypt_final());
   }
   if (m_descs.size() == 1) {
@@ -219,23 +227,21 @@ bufferlist FrameAssembler::asm_secure_rev1(const preamble_block_t& preamble,
   // FIPS zeroization audit 20191115: this memset is not security related.
   ::memset(&epilogue, 0, sizeof(epilogue));
   epilogue.late_status |= FRAME_LATE_STATUS_COMPLETE;
-  bufferlist epilogue_bl(sizeof(epilogue));
-  epilogue_bl.append(reinterpret_cast<const char*>(&epilogue),
-                     sizeof(epilogue));
 
   // MAX_NUM_SEGMENTS - 1 + epilogue
   uint32_t onwire_lens[MAX_NUM_SEGMENTS];
   for (size_t i = 1; i < m_descs.size(); i++) {
-    onwire_lens[i - 1] = segment_bls[i].length();  // already padded
+    onwire_lens[i - 1] = get_segment_padded_len(i);
   }
-  onwire_lens[m_descs.size() - 1] = epilogue_bl.length();
+  onwire_lens[m_descs.size() - 1] = sizeof(epilogue);
   m_crypto->tx->reset_tx_handler(onwire_lens, onwire_lens + m_descs.size());
   for (size_t i = 1; i < m_descs.size(); i++) {
-    if (segment_bls[i].length() > 0) {
-      m_crypto->tx->authenticated_encrypt_update(segment_bls[i]);
-    }
+    auto p = segment_bls[i].cbegin();
+    encrypt_padded(*m_crypto->tx, p, segment_bls[i].length(),
+                   get_segment_padded_len(i));
   }
-  m_crypto->tx->authenticated_encrypt_update(epilogue_bl);
+  m_crypto->tx->authenticated_encrypt_update(
+      reinterpret_cast<const char*>(&epilogue), sizeof(epilogue));
   frame_bl.claim_append(m_crypto->tx->authenticated_encrypt_final());
   return frame_bl;
 }
@@ -260,16 +266,11 @@ bufferlist FrameAssembler::assemble_frame(Tag tag, bufferlist segment_bls[],
   if (m_crypto->rx) {
     for (size_t i = 0; i < m_descs.size(); i++) {
       ceph_assert(segment_bls[i].length() == m_descs[i].logical_len);
-      // We're padding segments to biggest cipher's block size. Although
-      // AES-GCM can live without that as it's a stream cipher, we don't
-      // want to be fixed to stream ciphers only.
-      uint32_t padded_len = get_segment_padded_len(i);
-      if (padded_len > segment_bls[i].length()) {
-        uint32_t pad_len = padded_len - segment_bls[i].length();
-        segment_bls[i].reserve(pad_len);
-        segment_bls[i].append_zero(pad_len);
-      }
     }
+    // We're padding segments to biggest cipher's block size. Although
+    // AES-GCM can live without that as it's a stream cipher, we don't
+    // want to be fixed to stream ciphers only. The padding is encrypted
+    // along with each segment, see get_segment_padded_len().
     if (m_is_rev1) {
       return asm_secure_rev1(preamble, segment_bls);
     }
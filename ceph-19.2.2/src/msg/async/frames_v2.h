@@ -202,6 +202,10 @@ public:
     return m_is_rev1;
   }
 
+  bool is_compressed() const {
+    return m_flags & FRAME_EARLY_DATA_COMPRESSED;
+  }
+
   size_t get_num_segments() const {
     ceph_assert(!m_descs.empty());
     return m_descs.size();
@@ -332,10 +336,6 @@ private:
     return m_crypto->rx->get_extra_size_at_final();
   }
 
-  bool is_compressed() const { 
-    return m_flags & FRAME_EARLY_DATA_COMPRESSED; 
-  }
-
   void asm_compress(bufferlist segment_bls[]);
 
   bufferlist asm_crc_rev0(const preamble_block_t& preamble,
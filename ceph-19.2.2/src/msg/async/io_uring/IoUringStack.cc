@@ -0,0 +1,739 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <algorithm>
+#include <bit>
+#include <deque>
+
+#include "IoUringStack.h"
+
+#ifdef HAVE_IO_URING_STACK
+
+#include "include/buffer.h"
+#include "include/page.h"
+#include "common/errno.h"
+#include "common/dout.h"
+#include "include/compat.h"
+#include "include/sock_compat.h"
+
+#define dout_subsys ceph_subsys_ms
+#undef dout_prefix
+#define dout_prefix *_dout << "IoUringStack "
+
+IoUringFile::IoUringFile(IoUringWorker *w, int fd)
+  : worker(w), fd(fd), notify_fd(eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK))
+{
+  ceph_assert(notify_fd >= 0);
+}
+
+void IoUringFile::attach()
+{
+  if (!id) {
+    worker->attach(shared_from_this());
+  }
+}
+
+void IoUringFile::notify()
+{
+  if (!closed) {
+    eventfd_write(notify_fd, 1);
+  }
+}
+
+void IoUringFile::drain()
+{
+  eventfd_t v;
+  eventfd_read(notify_fd, &v);
+}
+
+void IoUringFile::close()
+{
+  if (closed) {
+    return;
+  }
+  if (!id) {
+    // never made it to the ring
+    closed = true;
+    on_close();
+    ::close(fd);
+    ::close(notify_fd);
+    return;
+  }
+  auto self = shared_from_this();
+  worker->run([this, self] {
+    closed = true;
+    if (worker->is_ready()) {
+      if (inflight) {
+	auto sqe = worker->get_sqe(this, OP_CANCEL);
+	io_uring_prep_cancel_fd(sqe, fd, IORING_ASYNC_CANCEL_ALL);
+	// the ring holds its own reference to the file, closing fd right
+	// after submitting the cancel is fine
+	worker->submit();
+      }
+      on_close();
+    }
+    ::close(fd);
+    ::close(notify_fd);
+    worker->maybe_release(this);
+  });
+}
+
+/*
+ * A connected socket.  One multishot recv stays armed, filling provided
+ * buffers that read() copies out of and hands back.  send() queues the
+ * bufferlist and keeps one sendmsg in flight for it.
+ */
+class IoUringConnection final : public IoUringFile {
+  static constexpr unsigned MAX_SEND_IOV = 64;
+
+  struct rx_buf_t {
+    uint16_t bid;
+    uint32_t off;
+    uint32_t len;
+  };
+  std::deque<rx_buf_t> rx;
+  bool recv_armed = false;
+  bool recv_cancelling = false;
+  bool eof = false;
+  int error = 0;
+
+  // bytes send() took but the kernel has not yet; the front of it is in
+  // flight
+  ceph::buffer::list tx;
+  bool send_inflight = false;
+  bool send_more = false;
+  struct msghdr tx_msg;
+  struct iovec tx_iov[MAX_SEND_IOV];
+
+  bool poll_armed = false;
+
+  void arm_recv() {
+    if (!id || recv_armed || eof || error || closed ||
+	rx.size() >= worker->get_recv_backlog()) {
+      return;
+    }
+    auto sqe = worker->get_sqe(this, OP_RECV);
+    io_uring_prep_recv_multishot(sqe, fd, nullptr, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = IoUringWorker::BUF_GROUP;
+    recv_armed = true;
+  }
+
+  void submit_send() {
+    unsigned n = 0;
+    for (auto& p : tx.buffers()) {
+      if (n == MAX_SEND_IOV) {
+	break;
+      }
+      tx_iov[n].iov_base = (void*)p.c_str();
+      tx_iov[n].iov_len = p.length();
+      ++n;
+    }
+    // FIPS zeroization audit 20191115: this memset is not security related.
+    memset(&tx_msg, 0, sizeof(tx_msg));
+    tx_msg.msg_iov = tx_iov;
+    tx_msg.msg_iovlen = n;
+    bool more = send_more || n < tx.get_num_buffers();
+    auto sqe = worker->get_sqe(this, OP_SEND);
+    io_uring_prep_sendmsg(sqe, fd, &tx_msg,
+			  MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+    send_inflight = true;
+  }
+
+  void handle_recv(int res, uint32_t flags) {
+    if (!(flags & IORING_CQE_F_MORE)) {
+      recv_armed = false;
+      recv_cancelling = false;
+    }
+    if (res > 0) {
+      ceph_assert(flags & IORING_CQE_F_BUFFER);
+      uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+      if (closed) {
+	worker->put_buffer(bid);
+	return;
+      }
+      bool was_empty = rx.empty();
+      rx.push_back(rx_buf_t{bid, 0, (uint32_t)res});
+      if (recv_armed && !recv_cancelling &&
+	  rx.size() >= worker->get_recv_backlog()) {
+	// the reader is behind, leave the buffers to other sockets until
+	// it caught up
+	auto sqe = worker->get_sqe(this, OP_CANCEL);
+	io_uring_prep_cancel64(sqe, user_data(OP_RECV), 0);
+	recv_cancelling = true;
+      }
+      if (was_empty) {
+	notify();
+      }
+      // rearm if the kernel ended the multishot on its own
+      arm_recv();
+    } else if (res == 0) {
+      eof = true;
+      notify();
+    } else if (res == -ENOBUFS) {
+      worker->wait_for_buffers(this);
+    } else if (res != -ECANCELED) {
+      error = -res;
+      notify();
+    }
+  }
+
+  void handle_send(int res) {
+    send_inflight = false;
+    if (res == -EINTR || res == -EAGAIN) {
+      res = 0;
+    } else if (res < 0) {
+      if (res != -ECANCELED && !error) {
+	error = -res;
+      }
+      tx.clear();
+      notify();
+      return;
+    }
+    tx.splice(0, res);
+    if (closed) {
+      return;
+    }
+    if (tx.length()) {
+      submit_send();
+    }
+  }
+
+ public:
+  bool shut = false;
+
+  IoUringConnection(IoUringWorker *w, int fd) : IoUringFile(w, fd) {}
+
+  /// attach to the ring and start receiving
+  void start() {
+    attach();
+    arm_recv();
+  }
+
+  /// wake up the poller once a connect in progress finished
+  void wait_connected() {
+    attach();
+    if (!poll_armed) {
+      auto sqe = worker->get_sqe(this, OP_POLL);
+      io_uring_prep_poll_add(sqe, fd, POLLOUT);
+      poll_armed = true;
+      worker->submit();
+    }
+  }
+
+  ssize_t read(char *buf, size_t len) {
+    size_t copied = 0;
+    while (copied < len && !rx.empty()) {
+      auto& b = rx.front();
+      size_t n = std::min<size_t>(len - copied, b.len - b.off);
+      memcpy(buf + copied, worker->get_buffer(b.bid) + b.off, n);
+      copied += n;
+      b.off += n;
+      if (b.off == b.len) {
+	worker->put_buffer(b.bid);
+	rx.pop_front();
+      }
+    }
+    arm_recv();
+    worker->submit();
+    if (copied) {
+      return copied;
+    }
+    drain();
+    if (error) {
+      return -error;
+    }
+    return eof ? 0 : -EAGAIN;
+  }
+
+  ssize_t send(ceph::buffer::list &bl, bool more) {
+    if (error) {
+      return -error;
+    }
+    if (shut) {
+      return -EPIPE;
+    }
+    // take everything, like the RDMA stack: the eventfd standing in for
+    // the socket is always writable, a short send would have the
+    // connection spin on EVENT_WRITABLE. tx only shares the buffers the
+    // connection held anyway, the messenger's throttles bound them
+    size_t n = bl.length();
+    tx.claim_append(bl);
+    send_more = more;
+    if (!send_inflight && tx.length()) {
+      submit_send();
+    }
+    worker->submit();
+    return n;
+  }
+
+  void complete(op_t op, int res, uint32_t flags) override {
+    switch (op) {
+    case OP_RECV:
+      handle_recv(res, flags);
+      break;
+    case OP_SEND:
+      handle_send(res);
+      break;
+    case OP_POLL:
+      poll_armed = false;
+      notify();
+      break;
+    default:
+      break;
+    }
+  }
+
+  void buffers_available() override {
+    arm_recv();
+  }
+
+  void on_close() override {
+    for (auto& b : rx) {
+      worker->put_buffer(b.bid);
+    }
+    rx.clear();
+  }
+};
+
+class IoUringConnectedSocketImpl final : public ConnectedSocketImpl {
+  ceph::NetHandler &handler;
+  std::shared_ptr<IoUringConnection> conn;
+  entity_addr_t sa;
+  bool connected;
+
+ public:
+  IoUringConnectedSocketImpl(ceph::NetHandler &h, IoUringWorker *w,
+			     const entity_addr_t &sa, int f, bool connected)
+    : handler(h), conn(std::make_shared<IoUringConnection>(w, f)),
+      sa(sa), connected(connected) {}
+
+  int is_connected() override {
+    if (connected) {
+      return 1;
+    }
+    int r = handler.reconnect(sa, conn->fd);
+    if (r == 0) {
+      connected = true;
+      conn->start();
+      conn->worker->submit();
+      return 1;
+    } else if (r < 0) {
+      return r;
+    }
+    conn->wait_connected();
+    return 0;
+  }
+
+  ssize_t read(char *buf, size_t len) override {
+    if (connected) {
+      conn->start();
+    }
+    return conn->read(buf, len);
+  }
+
+  ssize_t send(ceph::buffer::list &bl, bool more) override {
+    conn->start();
+    return conn->send(bl, more);
+  }
+
+  void shutdown() override {
+    conn->shut = true;
+    ::shutdown(conn->fd, SHUT_RDWR);
+  }
+  void close() override {
+    conn->close();
+  }
+  void set_priority(int sd, int prio, int domain) override {
+    handler.set_priority(sd, prio, domain);
+  }
+  int fd() const override {
+    return conn->notify_fd;
+  }
+};
+
+/*
+ * A listening socket with a multishot accept armed on it; accept() hands
+ * out the sockets it queued.
+ */
+class IoUringListener final : public IoUringFile {
+  // accepted sockets, or negative errors
+  std::deque<int> accepted;
+  bool armed = false;
+
+ public:
+  IoUringListener(IoUringWorker *w, int fd) : IoUringFile(w, fd) {}
+
+  void start() {
+    attach();
+    if (!armed && !closed) {
+      auto sqe = worker->get_sqe(this, OP_ACCEPT);
+      io_uring_prep_multishot_accept(sqe, fd, nullptr, nullptr,
+				     SOCK_CLOEXEC | SOCK_NONBLOCK);
+      armed = true;
+    }
+    worker->submit();
+  }
+
+  /// the next accepted socket, or a negative error
+  int pop() {
+    ceph_assert(worker->center.in_thread());
+    if (accepted.empty()) {
+      drain();
+      // an error ended the multishot accept
+      start();
+      return -EAGAIN;
+    }
+    int sd = accepted.front();
+    accepted.pop_front();
+    return sd;
+  }
+
+  void complete(op_t op, int res, uint32_t flags) override {
+    if (op != OP_ACCEPT) {
+      return;
+    }
+    if (!(flags & IORING_CQE_F_MORE)) {
+      armed = false;
+    }
+    if (res >= 0 && closed) {
+      ::close(res);
+    } else if (res != -ECANCELED) {
+      if (accepted.empty()) {
+	notify();
+      }
+      accepted.push_back(res);
+    }
+  }
+
+  void on_close() override {
+    for (int sd : accepted) {
+      if (sd >= 0) {
+	::close(sd);
+      }
+    }
+    accepted.clear();
+  }
+};
+
+class IoUringServerSocketImpl : public ServerSocketImpl {
+  ceph::NetHandler &handler;
+  std::shared_ptr<IoUringListener> listener;
+
+ public:
+  IoUringServerSocketImpl(ceph::NetHandler &h, IoUringWorker *w, int f,
+			  const entity_addr_t& listen_addr, unsigned slot)
+    : ServerSocketImpl(listen_addr.get_type(), slot),
+      handler(h), listener(std::make_shared<IoUringListener>(w, f)) {
+    auto l = listener;
+    w->run([l] { l->start(); });
+  }
+  int accept(ConnectedSocket *sock, const SocketOptions &opts,
+	     entity_addr_t *out, Worker *w) override;
+  void abort_accept() override {
+    listener->close();
+  }
+  int fd() const override {
+    return listener->notify_fd;
+  }
+};
+
+int IoUringServerSocketImpl::accept(ConnectedSocket *sock,
+				    const SocketOptions &opt,
+				    entity_addr_t *out, Worker *w)
+{
+  ceph_assert(sock);
+  int sd = listener->pop();
+  if (sd < 0) {
+    return sd;
+  }
+
+  int r = handler.set_socket_options(sd, opt.nodelay, opt.rcbuf_size);
+  if (r < 0) {
+    ::close(sd);
+    return -ceph_sock_errno();
+  }
+
+  sockaddr_storage ss;
+  socklen_t slen = sizeof(ss);
+  if (::getpeername(sd, (sockaddr*)&ss, &slen) < 0) {
+    r = -ceph_sock_errno();
+    ::close(sd);
+    return r;
+  }
+
+  ceph_assert(NULL != out); //out should not be NULL in accept connection
+
+  out->set_type(addr_type);
+  out->set_sockaddr((sockaddr*)&ss);
+  handler.set_priority(sd, opt.priority, out->get_family());
+
+  // the socket is driven by w's ring, it attaches on first use from there
+  *sock = ConnectedSocket(std::make_unique<IoUringConnectedSocketImpl>(
+    handler, static_cast<IoUringWorker*>(w), *out, sd, true));
+  return 0;
+}
+
+class C_handle_io_uring_cq : public EventCallback {
+  IoUringWorker *worker;
+
+ public:
+  explicit C_handle_io_uring_cq(IoUringWorker *w) : worker(w) {}
+  void do_request(uint64_t fd) override {
+    worker->handle_completions();
+  }
+};
+
+void IoUringWorker::initialize()
+{
+  unsigned depth = cct->_conf.get_val<uint64_t>("ms_async_io_uring_queue_depth");
+  int r = io_uring_queue_init(depth, &ring, 0);
+  if (r < 0) {
+    lderr(cct) << __func__ << " io_uring_queue_init failed: "
+	       << cpp_strerror(r) << dendl;
+    ceph_abort();
+  }
+
+  // buffer ids are 16 bits, the ring size a power of two
+  buf_count = std::bit_ceil(std::min<uint64_t>(
+    cct->_conf.get_val<uint64_t>("ms_async_io_uring_recv_buffers"), 32768));
+  buf_size = cct->_conf.get_val<Option::size_t>(
+    "ms_async_io_uring_recv_buffer_size");
+  r = ::posix_memalign((void**)&buf_base, CEPH_PAGE_SIZE,
+		       (size_t)buf_count * buf_size);
+  ceph_assert(r == 0);
+  buf_ring = io_uring_setup_buf_ring(&ring, buf_count, BUF_GROUP, 0, &r);
+  if (!buf_ring) {
+    lderr(cct) << __func__ << " unable to set up provided buffers, "
+	       << "the io_uring messenger needs Linux 6.0 or later: "
+	       << cpp_strerror(r) << dendl;
+    ceph_abort();
+  }
+  for (unsigned i = 0; i < buf_count; i++) {
+    io_uring_buf_ring_add(buf_ring, get_buffer(i), buf_size, i,
+			  io_uring_buf_ring_mask(buf_count), i);
+  }
+  io_uring_buf_ring_advance(buf_ring, buf_count);
+  buf_free = buf_count;
+
+  cq_handler = new C_handle_io_uring_cq(this);
+  center.create_file_event(ring.ring_fd, EVENT_READABLE, cq_handler);
+  ring_ready = true;
+  ldout(cct, 10) << __func__ << " queue depth " << depth << ", "
+		 << buf_count << " receive buffers of " << buf_size
+		 << " bytes" << dendl;
+}
+
+void IoUringWorker::destroy()
+{
+  if (!ring_ready) {
+    return;
+  }
+  ring_ready = false;
+  center.delete_file_event(ring.ring_fd, EVENT_READABLE);
+  delete cq_handler;
+  cq_handler = nullptr;
+  // exiting the ring cancels whatever is still in flight
+  files.clear();
+  starved.clear();
+  io_uring_free_buf_ring(&ring, buf_ring, buf_count, BUF_GROUP);
+  buf_ring = nullptr;
+  io_uring_queue_exit(&ring);
+  ::free(buf_base);
+  buf_base = nullptr;
+}
+
+void IoUringWorker::attach(std::shared_ptr<IoUringFile> f)
+{
+  ceph_assert(center.in_thread());
+  ceph_assert(!f->id);
+  f->id = next_id++;
+  files.emplace(f->id, std::move(f));
+}
+
+void IoUringWorker::maybe_release(IoUringFile *f)
+{
+  if (f->id && f->closed && !f->inflight) {
+    files.erase(f->id);
+  }
+}
+
+io_uring_sqe *IoUringWorker::get_sqe(IoUringFile *f, IoUringFile::op_t op)
+{
+  ceph_assert(f->id);
+  io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+  if (!sqe) {
+    // the submission queue is full, flush it
+    submit();
+    sqe = io_uring_get_sqe(&ring);
+    ceph_assert(sqe);
+  }
+  io_uring_sqe_set_data64(sqe, f->user_data(op));
+  ++f->inflight;
+  return sqe;
+}
+
+void IoUringWorker::submit()
+{
+  if (!io_uring_sq_ready(&ring)) {
+    return;
+  }
+  int r = io_uring_submit(&ring);
+  if (r < 0) {
+    // -EBUSY with completions backed up; they are reaped and the rest
+    // goes with the next submit
+    ldout(cct, 5) << __func__ << " io_uring_submit: " << cpp_strerror(r)
+		  << dendl;
+  }
+}
+
+void IoUringWorker::handle_completions()
+{
+  static constexpr unsigned BATCH = 64;
+  struct completion_t {
+    uint64_t user_data;
+    int res;
+    uint32_t flags;
+  } done[BATCH];
+  io_uring_cqe *cqes[BATCH];
+  unsigned n;
+  while ((n = io_uring_peek_batch_cqe(&ring, cqes, BATCH)) > 0) {
+    for (unsigned i = 0; i < n; i++) {
+      done[i] = {cqes[i]->user_data, cqes[i]->res, cqes[i]->flags};
+    }
+    io_uring_cq_advance(&ring, n);
+    for (unsigned i = 0; i < n; i++) {
+      auto& c = done[i];
+      if (c.flags & IORING_CQE_F_BUFFER) {
+	--buf_free;
+      }
+      auto p = files.find(c.user_data >> IoUringFile::OP_BITS);
+      if (p == files.end()) {
+	if (c.flags & IORING_CQE_F_BUFFER) {
+	  put_buffer(c.flags >> IORING_CQE_BUFFER_SHIFT);
+	}
+	continue;
+      }
+      auto f = p->second;
+      if (!(c.flags & IORING_CQE_F_MORE)) {
+	ceph_assert(f->inflight > 0);
+	--f->inflight;
+      }
+      auto op = static_cast<IoUringFile::op_t>(
+	c.user_data & ((1 << IoUringFile::OP_BITS) - 1));
+      f->complete(op, c.res, c.flags);
+      maybe_release(f.get());
+    }
+  }
+  submit();
+}
+
+void IoUringWorker::put_buffer(uint16_t bid)
+{
+  io_uring_buf_ring_add(buf_ring, get_buffer(bid), buf_size, bid,
+			io_uring_buf_ring_mask(buf_count), 0);
+  io_uring_buf_ring_advance(buf_ring, 1);
+  ++buf_free;
+  if (!starved.empty() && buf_free >= buf_count / 4) {
+    auto ids = std::move(starved);
+    starved.clear();
+    for (auto id : ids) {
+      if (auto p = files.find(id); p != files.end()) {
+	p->second->buffers_available();
+      }
+    }
+    // buffers also come back from paths that submitted already, e.g.
+    // close(), don't leave the re-armed receives sitting in the sq
+    submit();
+  }
+}
+
+void IoUringWorker::wait_for_buffers(IoUringFile *f)
+{
+  ldout(cct, 20) << __func__ << " fd " << f->fd << " out of receive buffers"
+		 << dendl;
+  starved.push_back(f->id);
+}
+
+int IoUringWorker::listen(entity_addr_t &sa,
+			  unsigned addr_slot,
+			  const SocketOptions &opt,
+			  ServerSocket *sock)
+{
+  int listen_sd = net.create_socket(sa.get_family(), true);
+  if (listen_sd < 0) {
+    return -ceph_sock_errno();
+  }
+
+  int r = net.set_nonblock(listen_sd);
+  if (r < 0) {
+    ::close(listen_sd);
+    return -ceph_sock_errno();
+  }
+
+  r = net.set_socket_options(listen_sd, opt.nodelay, opt.rcbuf_size);
+  if (r < 0) {
+    ::close(listen_sd);
+    return -ceph_sock_errno();
+  }
+
+  r = ::bind(listen_sd, sa.get_sockaddr(), sa.get_sockaddr_len());
+  if (r < 0) {
+    r = -ceph_sock_errno();
+    ldout(cct, 10) << __func__ << " unable to bind to " << sa.get_sockaddr()
+                   << ": " << cpp_strerror(r) << dendl;
+    ::close(listen_sd);
+    return r;
+  }
+
+  r = ::listen(listen_sd, cct->_conf->ms_tcp_listen_backlog);
+  if (r < 0) {
+    r = -ceph_sock_errno();
+    lderr(cct) << __func__ << " unable to listen on " << sa << ": " << cpp_strerror(r) << dendl;
+    ::close(listen_sd);
+    return r;
+  }
+
+  *sock = ServerSocket(std::make_unique<IoUringServerSocketImpl>(
+    net, this, listen_sd, sa, addr_slot));
+  return 0;
+}
+
+int IoUringWorker::connect(const entity_addr_t &addr,
+			   const SocketOptions &opts,
+			   ConnectedSocket *socket)
+{
+  int sd;
+
+  if (opts.nonblock) {
+    sd = net.nonblock_connect(addr, opts.connect_bind_addr);
+  } else {
+    sd = net.connect(addr, opts.connect_bind_addr);
+  }
+
+  if (sd < 0) {
+    return -ceph_sock_errno();
+  }
+
+  net.set_priority(sd, opts.priority, addr.get_family());
+  *socket = ConnectedSocket(std::make_unique<IoUringConnectedSocketImpl>(
+    net, this, addr, sd, !opts.nonblock));
+  return 0;
+}
+
+#endif // HAVE_IO_URING_STACK
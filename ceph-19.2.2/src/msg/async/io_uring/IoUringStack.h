@@ -0,0 +1,176 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MSG_ASYNC_IOURINGSTACK_H
+#define CEPH_MSG_ASYNC_IOURINGSTACK_H
+
+#include <liburing.h>
+
+// provided buffer rings and multishot accept/recv need liburing 2.4
+#if defined(IO_URING_CHECK_VERSION)
+#if !IO_URING_CHECK_VERSION(2, 4)
+#define HAVE_IO_URING_STACK
+#endif
+#endif
+
+#ifdef HAVE_IO_URING_STACK
+
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "msg/async/net_handler.h"
+#include "msg/async/Stack.h"
+
+class IoUringWorker;
+
+/*
+ * A socket as seen by the ring: the operations in flight on it, and the
+ * eventfd the EventCenter polls in its place.  Completions are turned into
+ * readiness on that eventfd, so AsyncConnection keeps driving the socket
+ * through read() and send() as it does for the posix stack.
+ *
+ * The worker owns it until the last operation on it completed, which may
+ * be after the socket using it was closed.  Everything but close() runs
+ * on the worker thread.
+ */
+class IoUringFile : public std::enable_shared_from_this<IoUringFile> {
+ public:
+  enum op_t : uint64_t {
+    OP_ACCEPT,
+    OP_RECV,
+    OP_SEND,
+    OP_POLL,
+    OP_CANCEL,
+  };
+  static constexpr unsigned OP_BITS = 3;
+
+  IoUringWorker *worker;
+  const int fd;
+  const int notify_fd;
+  uint64_t id = 0;	///< 0 until attached to the worker
+  unsigned inflight = 0;
+  bool closed = false;
+
+  IoUringFile(IoUringWorker *w, int fd);
+  virtual ~IoUringFile() {}
+
+  uint64_t user_data(op_t op) const {
+    return (id << OP_BITS) | op;
+  }
+  void attach();
+  /// wake up whoever polls notify_fd
+  void notify();
+  /// swallow the wake ups the poller has seen
+  void drain();
+  /// cancel everything in flight on fd and close it
+  void close();
+
+  virtual void complete(op_t op, int res, uint32_t flags) = 0;
+  /// provided buffers are available again after running out
+  virtual void buffers_available() {}
+  /// called on the worker thread when closing
+  virtual void on_close() {}
+};
+
+class IoUringWorker : public Worker {
+  ceph::NetHandler net;
+  struct io_uring ring;
+  bool ring_ready = false;
+
+  // the provided buffer ring multishot receives pick their buffers from
+  io_uring_buf_ring *buf_ring = nullptr;
+  char *buf_base = nullptr;
+  unsigned buf_count = 0;
+  unsigned buf_size = 0;
+  unsigned buf_free = 0;
+
+  uint64_t next_id = 1;
+  std::unordered_map<uint64_t, std::shared_ptr<IoUringFile>> files;
+  /// files whose receive stopped for lack of provided buffers
+  std::vector<uint64_t> starved;
+  EventCallbackRef cq_handler = nullptr;
+
+  void initialize() override;
+  void destroy() override;
+
+ public:
+  static constexpr int BUF_GROUP = 0;
+
+  IoUringWorker(CephContext *c, unsigned i)
+    : Worker(c, i), net(c) {}
+
+  int listen(entity_addr_t &sa,
+	     unsigned addr_slot,
+	     const SocketOptions &opt,
+	     ServerSocket *socks) override;
+  int connect(const entity_addr_t &addr, const SocketOptions &opts,
+	      ConnectedSocket *socket) override;
+
+  bool is_ready() const {
+    return ring_ready;
+  }
+  /// run f on the worker thread, waiting for it unless already there
+  template <typename Func>
+  void run(Func &&f) {
+    center.submit_to(center.get_id(), std::forward<Func>(f), false);
+  }
+
+  void attach(std::shared_ptr<IoUringFile> f);
+  /// forget f once it is closed and has nothing in flight
+  void maybe_release(IoUringFile *f);
+
+  /// an sqe for op on f, which is in flight until its final cqe; the
+  /// liburing prep helpers leave the user_data set here alone
+  io_uring_sqe *get_sqe(IoUringFile *f, IoUringFile::op_t op);
+  void submit();
+  void handle_completions();
+
+  char *get_buffer(uint16_t bid) {
+    return buf_base + (size_t)bid * buf_size;
+  }
+  void put_buffer(uint16_t bid);
+  void wait_for_buffers(IoUringFile *f);
+  /// provided buffers a single socket may hold on to; a buffer is used
+  /// up by one receive however little it got
+  unsigned get_recv_backlog() const {
+    return buf_count / 4;
+  }
+};
+
+class IoUringStack : public NetworkStack {
+  std::vector<std::thread> threads;
+
+  Worker* create_worker(CephContext *c, unsigned worker_id) override {
+    return new IoUringWorker(c, worker_id);
+  }
+
+ public:
+  explicit IoUringStack(CephContext *c) : NetworkStack(c) {}
+
+  // connect progress is reported through the socket's eventfd
+  bool nonblock_connect_need_writable_event() const override {
+    return false;
+  }
+  void spawn_worker(std::function<void ()> &&func) override {
+    threads.emplace_back(std::move(func));
+  }
+  void join_worker(unsigned i) override {
+    ceph_assert(threads.size() > i && threads[i].joinable());
+    threads[i].join();
+  }
+};
+
+#endif // HAVE_IO_URING_STACK
+
+#endif //CEPH_MSG_ASYNC_IOURINGSTACK_H
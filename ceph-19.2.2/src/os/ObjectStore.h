@@ -456,13 +456,15 @@ public:
    * @param oid oid of object
    * @param st output information for the object
    * @param allow_eio if false, assert on -EIO operation failure
+   * @param op_flags is CEPH_OSD_OP_FLAG_*
    * @returns 0 on success, negative error code on failure.
    */
   virtual int stat(
     CollectionHandle &c,
     const ghobject_t& oid,
     struct stat *st,
-    bool allow_eio = false) = 0;
+    bool allow_eio = false,
+    uint32_t op_flags = 0) = 0;
   /**
    * read -- read a byte range of data from an object
    *
@@ -612,10 +614,12 @@ public:
    * @param cid collection for object
    * @param oid oid of object
    * @param aset upon success, will contain exactly the object attrs
+   * @param op_flags is CEPH_OSD_OP_FLAG_*
    * @returns 0 on success, negative error code on failure.
    */
   virtual int getattrs(CollectionHandle &c, const ghobject_t& oid,
-		       std::map<std::string,ceph::buffer::ptr, std::less<>>& aset) = 0;
+		       std::map<std::string,ceph::buffer::ptr, std::less<>>& aset,
+		       uint32_t op_flags = 0) = 0;
 
   /**
    * getattrs -- get all of the xattrs of an object
@@ -623,12 +627,14 @@ public:
    * @param cid collection for object
    * @param oid oid of object
    * @param aset upon success, will contain exactly the object attrs
+   * @param op_flags is CEPH_OSD_OP_FLAG_*
    * @returns 0 on success, negative error code on failure.
    */
   int getattrs(CollectionHandle &c, const ghobject_t& oid,
-	       std::map<std::string,ceph::buffer::list,std::less<>>& aset) {
+	       std::map<std::string,ceph::buffer::list,std::less<>>& aset,
+	       uint32_t op_flags = 0) {
     std::map<std::string,ceph::buffer::ptr,std::less<>> bmap;
-    int r = getattrs(c, oid, bmap);
+    int r = getattrs(c, oid, bmap, op_flags);
     aset.clear();
     for (auto i = bmap.begin(); i != bmap.end(); ++i) {
       aset[i->first].append(i->second);
@@ -713,7 +719,8 @@ public:
     CollectionHandle &c,     ///< [in] Collection containing oid
     const ghobject_t &oid,   ///< [in] Object containing omap
     ceph::buffer::list *header,      ///< [out] omap header
-    bool allow_eio = false ///< [in] don't assert on eio
+    bool allow_eio = false, ///< [in] don't assert on eio
+    uint32_t op_flags = 0   ///< [in] CEPH_OSD_OP_FLAG_*
     ) = 0;
 
   /// Get keys defined on oid
@@ -759,7 +766,8 @@ public:
    */
   virtual ObjectMap::ObjectMapIterator get_omap_iterator(
     CollectionHandle &c,   ///< [in] collection
-    const ghobject_t &oid  ///< [in] object
+    const ghobject_t &oid, ///< [in] object
+    uint32_t op_flags = 0  ///< [in] CEPH_OSD_OP_FLAG_*
     ) = 0;
 
   virtual int flush_journal() { return -EOPNOTSUPP; }
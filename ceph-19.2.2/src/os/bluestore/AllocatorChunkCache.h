@@ -0,0 +1,141 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <functional>
+#include <memory>
+
+#include "include/intarith.h"
+
+/*
+ * Lock-free cache of recently released chunks, sitting in front of an
+ * allocator's free-extent tree.
+ *
+ * Only chunks of block_size << n bytes (n < orders) that are naturally
+ * aligned to their own length are cached, so a cached chunk satisfies any
+ * power-of-2 allocation unit not larger than itself.  Slots are split into
+ * shards; every thread sticks to one shard, hence concurrent
+ * allocate/release calls from different threads mostly touch different
+ * cache lines and never the allocator lock.  A thread that finds nothing
+ * in its own shard takes from the others before giving up.
+ *
+ * Cached chunks are not visible to the owner's tree, so the owner must
+ * flush() the cache (under its own lock) before anything that walks the
+ * tree or needs the cached space back.
+ */
+class AllocatorChunkCache {
+public:
+  static constexpr size_t SLOTS = 8;
+  static constexpr size_t MAX_ORDERS = 16;
+
+  AllocatorChunkCache(uint64_t _block_size, size_t _shards, size_t _orders)
+    : block_size(_block_size),
+      shards(std::max<size_t>(_shards, 1)),
+      orders(std::clamp<size_t>(_orders, 1, MAX_ORDERS)),
+      buckets(new bucket_t[shards * orders]()) {
+  }
+
+  uint64_t get_max_chunk() const {
+    return block_size << (orders - 1);
+  }
+
+  // returns false if the chunk isn't cacheable or the shard is full
+  bool try_put(uint64_t offset, uint64_t length) {
+    int order = _get_order(offset, length);
+    if (order < 0) {
+      return false;
+    }
+    auto& b = _get_bucket(order);
+    for (auto& s : b.slot) {
+      uint64_t v = 0;
+      if (s.load(std::memory_order_relaxed) == 0 &&
+	  s.compare_exchange_strong(v, offset + 1,
+				    std::memory_order_release,
+				    std::memory_order_relaxed)) {
+	return true;
+      }
+    }
+    return false;
+  }
+
+  // returns offset of a cached chunk of exactly 'length' bytes, or -1
+  uint64_t try_get(uint64_t length) {
+    int order = _get_order(0, length);
+    if (order < 0) {
+      return -1ULL;
+    }
+    // own shard first, then whatever other threads released
+    for (size_t i = 0; i < shards; ++i) {
+      auto& b = _get_bucket(order, i);
+      for (auto& s : b.slot) {
+	uint64_t v = s.load(std::memory_order_relaxed);
+	if (v != 0 &&
+	    s.compare_exchange_strong(v, 0,
+				      std::memory_order_acquire,
+				      std::memory_order_relaxed)) {
+	  return v - 1;
+	}
+      }
+    }
+    return -1ULL;
+  }
+
+  // drain every shard, calling notify for each chunk taken out
+  void flush(std::function<void(uint64_t offset, uint64_t length)> notify) {
+    for (size_t i = 0; i < shards * orders; ++i) {
+      uint64_t length = block_size << (i % orders);
+      for (auto& s : buckets[i].slot) {
+	uint64_t v = s.exchange(0, std::memory_order_acquire);
+	if (v != 0) {
+	  notify(v - 1, length);
+	}
+      }
+    }
+  }
+
+  // approximate amount of bytes currently held, racy by design
+  uint64_t get_bytes() const {
+    uint64_t res = 0;
+    for (size_t i = 0; i < shards * orders; ++i) {
+      uint64_t length = block_size << (i % orders);
+      for (auto& s : buckets[i].slot) {
+	if (s.load(std::memory_order_relaxed) != 0) {
+	  res += length;
+	}
+      }
+    }
+    return res;
+  }
+
+private:
+  // one cache line per shard and chunk order
+  struct alignas(64) bucket_t {
+    std::atomic<uint64_t> slot[SLOTS];
+  };
+
+  const uint64_t block_size;
+  const size_t shards;
+  const size_t orders;
+  std::unique_ptr<bucket_t[]> buckets;
+
+  int _get_order(uint64_t offset, uint64_t length) const {
+    if (length < block_size || length > get_max_chunk() ||
+	!std::has_single_bit(length / block_size) ||
+	length % block_size != 0 ||
+	p2phase(offset, length) != 0) {
+      return -1;
+    }
+    return std::countr_zero(length / block_size);
+  }
+
+  // 'skip' walks the shards of other threads, starting after our own
+  bucket_t& _get_bucket(int order, size_t skip = 0) {
+    static std::atomic<unsigned> next_shard = {0};
+    thread_local unsigned shard = next_shard++;
+    return buckets[((shard + skip) % shards) * orders + order];
+  }
+};
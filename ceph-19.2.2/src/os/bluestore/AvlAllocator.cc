@@ -350,6 +350,9 @@ void AvlAllocator::_release(const PExtentVector& release_set) {
 
 void AvlAllocator::_shutdown()
 {
+  if (chunk_cache) {
+    chunk_cache->flush([](uint64_t, uint64_t) {});
+  }
   range_size_tree.clear();
   range_tree.clear_and_dispose(dispose_rs{});
 }
@@ -371,6 +374,17 @@ AvlAllocator::AvlAllocator(CephContext* cct,
   range_count_cap(max_mem / sizeof(range_seg_t)),
   cct(cct)
 {
+  if (auto shards = cct->_conf.get_val<uint64_t>("bluestore_alloc_cache_shards");
+      shards > 0 && std::has_single_bit(uint64_t(block_size))) {
+    auto max_chunk =
+      cct->_conf.get_val<Option::size_t>("bluestore_alloc_cache_max_chunk");
+    size_t orders = max_chunk >= uint64_t(block_size) ?
+      std::bit_width(max_chunk / block_size) : 0;
+    if (orders > 0) {
+      chunk_cache = std::make_unique<AllocatorChunkCache>(
+        block_size, shards, orders);
+    }
+  }
   ldout(cct, 10) << __func__ << " 0x" << std::hex << get_capacity() << "/"
                  << get_block_size() << std::dec << dendl;
 }
@@ -413,30 +427,128 @@ int64_t AvlAllocator::allocate(
       max_alloc_size >= cap) {
     max_alloc_size = p2align(uint64_t(cap), (uint64_t)block_size);
   }
+  if (chunk_cache && _try_allocate_cached(want, max_alloc_size, extents)) {
+    return want;
+  }
   std::lock_guard l(lock);
-  return _allocate(want, unit, max_alloc_size, hint, extents);
+  auto n = extents->size();
+  auto res = _allocate(want, unit, max_alloc_size, hint, extents);
+  if (_retry_with_chunk_cache(want, max_alloc_size, res, extents, n)) {
+    res = _allocate(want, unit, max_alloc_size, hint, extents);
+  }
+  return res;
 }
 
 void AvlAllocator::release(const interval_set<uint64_t>& release_set) {
+  if (chunk_cache) {
+    std::vector<std::pair<uint64_t, uint64_t>> rest;
+    if (_try_release_cached(release_set, rest)) {
+      return;
+    }
+    std::lock_guard l(lock);
+    for (auto& [offset, length] : rest) {
+      _add_to_tree(offset, length);
+    }
+    return;
+  }
   std::lock_guard l(lock);
   _release(release_set);
 }
 
+bool AvlAllocator::_try_allocate_cached(
+  uint64_t want,
+  uint64_t max_alloc_size,
+  PExtentVector* extents)
+{
+  if (want > max_alloc_size || want > chunk_cache->get_max_chunk()) {
+    return false;
+  }
+  // cached chunks are aligned to their own length, which is a multiple
+  // of any power-of-2 unit 'want' is a multiple of
+  uint64_t offset = chunk_cache->try_get(want);
+  if (offset == -1ULL) {
+    return false;
+  }
+  ldout(cct, 20) << __func__ << " cached 0x" << std::hex
+                 << offset << "~" << want
+                 << std::dec << dendl;
+  extents->emplace_back(offset, want);
+  return true;
+}
+
+bool AvlAllocator::_try_release_cached(
+  const interval_set<uint64_t>& release_set,
+  std::vector<std::pair<uint64_t, uint64_t>>& rest)
+{
+  for (auto p = release_set.begin(); p != release_set.end(); ++p) {
+    const auto offset = p.get_start();
+    const auto length = p.get_len();
+    ceph_assert(offset + length <= uint64_t(device_size));
+    if (!chunk_cache->try_put(offset, length)) {
+      rest.emplace_back(offset, length);
+    }
+  }
+  return rest.empty();
+}
+
+bool AvlAllocator::_flush_chunk_cache()
+{
+  bool flushed = false;
+  if (chunk_cache) {
+    chunk_cache->flush([&](uint64_t offset, uint64_t length) {
+      ldout(cct, 20) << "_flush_chunk_cache 0x" << std::hex
+                     << offset << "~" << length
+                     << std::dec << dendl;
+      _add_to_tree(offset, length);
+      flushed = true;
+    });
+  }
+  return flushed;
+}
+
+bool AvlAllocator::_retry_with_chunk_cache(
+  uint64_t want,
+  uint64_t max_alloc_size,
+  int64_t res,
+  PExtentVector* extents,
+  size_t n)
+{
+  if (!chunk_cache) {
+    return false;
+  }
+  if (res == int64_t(want) &&
+      extents->size() - n <= div_round_up(want, max_alloc_size)) {
+    return false;
+  }
+  // flushed chunks merge with their neighbours in the tree
+  if (!_flush_chunk_cache()) {
+    return false;
+  }
+  for (auto i = extents->begin() + n; i != extents->end(); ++i) {
+    _add_to_tree(i->offset, i->length);
+  }
+  extents->resize(n);
+  return true;
+}
+
 uint64_t AvlAllocator::get_free()
 {
   std::lock_guard l(lock);
-  return num_free;
+  return num_free + _get_cached();
 }
 
 double AvlAllocator::get_fragmentation()
 {
   std::lock_guard l(lock);
+  // cached chunks are left alone: this is polled by kv_finalize and
+  // draining the cache here would defeat it
   return _get_fragmentation();
 }
 
 void AvlAllocator::dump()
 {
   std::lock_guard l(lock);
+  _flush_chunk_cache();
   _dump();
 }
 
@@ -462,6 +574,7 @@ void AvlAllocator::foreach(
   std::function<void(uint64_t offset, uint64_t length)> notify)
 {
   std::lock_guard l(lock);
+  _flush_chunk_cache();
   _foreach(notify);
 }
 
@@ -496,6 +609,7 @@ void AvlAllocator::init_rm_free(uint64_t offset, uint64_t length)
     return;
   std::lock_guard l(lock);
   ceph_assert(offset + length <= uint64_t(device_size));
+  _flush_chunk_cache();
   _remove_from_tree(offset, length);
 }
 
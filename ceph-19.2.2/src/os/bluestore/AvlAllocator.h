@@ -7,6 +7,7 @@
 #include <boost/intrusive/avl_set.hpp>
 
 #include "Allocator.h"
+#include "AllocatorChunkCache.h"
 #include "os/bluestore/bluestore_types.h"
 #include "include/mempool.h"
 
@@ -233,6 +234,37 @@ protected:
 protected:
   CephContext* cct;
   std::mutex lock;
+  /*
+   * Optional lock-free cache of small released chunks, consulted before
+   * taking the lock. nullptr when bluestore_alloc_cache_shards is 0.
+   */
+  std::unique_ptr<AllocatorChunkCache> chunk_cache;
+
+  // lock-free fast paths, return false when the caller has to fall back
+  // to the tree
+  bool _try_allocate_cached(
+    uint64_t want,
+    uint64_t max_alloc_size,
+    PExtentVector *extents);
+  // returns true if the whole set went to the cache, otherwise
+  // the leftovers are appended to 'rest'
+  bool _try_release_cached(
+    const interval_set<uint64_t>& release_set,
+    std::vector<std::pair<uint64_t, uint64_t>>& rest);
+  // return cached chunks to the tree, lock must be held
+  bool _flush_chunk_cache();
+  // a short or needlessly fragmented allocation may have missed chunks
+  // parked by other threads; if any were flushed, hand back the extents
+  // added past 'n' and return true so the caller retries, lock must be held
+  bool _retry_with_chunk_cache(
+    uint64_t want,
+    uint64_t max_alloc_size,
+    int64_t res,
+    PExtentVector *extents,
+    size_t n);
+  uint64_t _get_cached() const {
+    return chunk_cache ? chunk_cache->get_bytes() : 0;
+  }
 
   double _get_fragmentation() const {
     auto free_blocks = p2align(num_free, (uint64_t)block_size) / block_size;
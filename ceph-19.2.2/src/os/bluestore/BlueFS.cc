@@ -10,6 +10,7 @@
 #include "common/perf_counters.h"
 #include "Allocator.h"
 #include "include/ceph_assert.h"
+#include "include/random.h"
 #include "common/admin_socket.h"
 
 #define dout_context cct
@@ -1768,6 +1769,7 @@ int BlueFS::_replay(bool noop, bool to_stdout)
 	return -EIO;
       }
     }
+    _recover_envelopes();
   }
   // reflect file count in logger
   logger->set(l_bluefs_num_files, nodes.file_map.size());
@@ -2369,6 +2371,115 @@ int64_t BlueFS::_read(
   return ret;
 }
 
+int64_t BlueFS::_read_envelope(
+  FileReader *h,
+  uint64_t off,
+  size_t len,
+  bufferlist *outbl,
+  char *out,
+  bool random)
+{
+  dout(10) << __func__ << " h " << h
+           << " 0x" << std::hex << off << "~" << len << std::dec
+	   << (random ? " (random)" : "") << dendl;
+  if (outbl) {
+    outbl->clear();
+  }
+  int64_t ret = 0;
+  while (len > 0) {
+    File::envelope_t e;
+    {
+      std::lock_guard fl(h->file->lock);
+      auto& v = h->file->envelopes;
+      auto p = std::upper_bound(
+	v.begin(), v.end(), off,
+	[](uint64_t o, const File::envelope_t& e) { return o < e.logical; });
+      if (p == v.begin()) {
+	break;
+      }
+      --p;
+      if (off >= p->logical + p->length) {
+	break;  // eof
+      }
+      e = *p;
+    }
+    uint64_t x_off = off - e.logical;
+    uint64_t l = std::min<uint64_t>(len, e.length - x_off);
+    int64_t r;
+    if (random) {
+      r = _read_random(h, e.physical + x_off, l, out);
+    } else {
+      bufferlist t;
+      r = _read(h, e.physical + x_off, l, outbl ? &t : nullptr, out);
+      if (outbl) {
+	outbl->claim_append(t);
+      }
+    }
+    if (r < 0) {
+      return r;
+    }
+    off += r;
+    len -= r;
+    ret += r;
+    if (out) {
+      out += r;
+    }
+    if ((uint64_t)r < l) {
+      break;
+    }
+  }
+  return ret;
+}
+
+void BlueFS::_recover_envelopes()
+{
+  constexpr unsigned hsize = bluefs_wal_envelope_t::HEADER_SIZE;
+  for (auto& [ino, f] : nodes.file_map) {
+    if (!f->fnode.envelope_seed) {
+      continue;
+    }
+    // walk the chain from the start to rebuild the logical layout;
+    // anything after the first bad envelope was never fsynced
+    FileReader *h = new FileReader(f, cct->_conf->bluefs_max_prefetch,
+				   false, true);
+    f->envelopes.clear();
+    f->envelope_size = 0;
+    uint64_t pos = 0;
+    while (pos + hsize <= f->fnode.get_allocated()) {
+      bufferlist bl;
+      int64_t r = _read(h, pos, hsize, &bl, nullptr);
+      if (r < hsize) {
+	break;
+      }
+      bluefs_wal_envelope_t e;
+      auto p = bl.cbegin();
+      decode(e, p);
+      if (e.ino != ino || e.length == 0 ||
+	  pos + hsize + e.length > f->fnode.get_allocated()) {
+	break;
+      }
+      r = _read(h, pos + hsize, e.length, &bl, nullptr);
+      if (r < e.length ||
+	  bl.crc32c(f->fnode.envelope_seed) != e.crc) {
+	break;
+      }
+      f->envelopes.push_back({f->envelope_size, pos + hsize, e.length});
+      f->envelope_size += e.length;
+      pos += hsize + e.length;
+    }
+    delete h;
+    dout(10) << __func__ << " " << f->fnode << " has "
+	     << f->envelopes.size() << " envelopes, 0x"
+	     << std::hex << f->envelope_size << " bytes, ending at 0x"
+	     << pos << std::dec << dendl;
+    if (pos != f->fnode.size) {
+      vselector->sub_usage(f->vselector_hint, f->fnode.size);
+      f->fnode.size = pos;
+      vselector->add_usage(f->vselector_hint, f->fnode.size);
+    }
+  }
+}
+
 void BlueFS::invalidate_cache(FileRef f, uint64_t offset, uint64_t length)
 {
   std::lock_guard l(f->lock);
@@ -3391,6 +3502,20 @@ ceph::bufferlist BlueFS::FileWriter::flush_buffer(
   return bl;
 }
 
+void BlueFS::FileWriter::seal_envelope()
+{
+  ceph_assert(ceph_mutex_is_locked(this->lock));
+  bluefs_wal_envelope_t e;
+  e.ino = file->fnode.ino;
+  e.length = buffer.length();
+  e.crc = buffer.crc32c(file->fnode.envelope_seed);
+  ceph::bufferlist bl;
+  encode(e, bl);
+  ceph_assert(bl.length() == bluefs_wal_envelope_t::HEADER_SIZE);
+  bl.claim_append(buffer);
+  buffer.swap(bl);
+}
+
 int BlueFS::_signal_dirty_to_log_D(FileWriter *h)
 {
   ceph_assert(ceph_mutex_is_locked(h->lock));
@@ -3429,6 +3554,11 @@ void BlueFS::flush_range(FileWriter *h, uint64_t offset, uint64_t length)/*_WF*/
 {
   _maybe_check_vselector_LNF();
   std::unique_lock hl(h->lock);
+  if (h->file->fnode.envelope_seed) {
+    // the range is in logical offsets, flush whatever is pending
+    _flush_F(h, true);
+    return;
+  }
   _flush_range_F(h, offset, length);
 }
 
@@ -3488,7 +3618,11 @@ int BlueFS::_flush_range_F(FileWriter *h, uint64_t offset, uint64_t length)
   if (h->file->fnode.size < offset + length) {
     vselector->add_usage(h->file->vselector_hint, offset + length - h->file->fnode.size);
     h->file->fnode.size = offset + length;
-    h->file->is_dirty = true;
+    // envelope files rediscover their size on replay; unless the
+    // allocation above changed, fsync doesn't need to touch the log
+    if (!h->file->fnode.envelope_seed) {
+      h->file->is_dirty = true;
+    }
   }
   dout(20) << __func__ << " file now, unflushed " << h->file->fnode << dendl;
   int res = _flush_data(h, offset, length, buffered);
@@ -3684,7 +3818,19 @@ int BlueFS::_flush_F(FileWriter *h, bool force, bool *flushed)
            << std::hex << offset << "~" << length << std::dec
 	   << " to " << h->file->fnode << dendl;
   ceph_assert(h->pos <= h->file->fnode.size);
+  uint32_t payload = length;
+  bool envelope = h->file->fnode.envelope_seed && !h->file->deleted;
+  if (envelope) {
+    h->seal_envelope();
+    length = h->get_buffer_length();
+  }
   int r = _flush_range_F(h, offset, length);
+  if (r == 0 && envelope) {
+    std::lock_guard fl(h->file->lock);
+    h->file->envelopes.push_back(
+      {h->file->envelope_size, offset + length - payload, payload});
+    h->file->envelope_size += payload;
+  }
   if (flushed) {
     *flushed = true;
   }
@@ -3726,6 +3872,15 @@ int BlueFS::truncate(FileWriter *h, uint64_t offset)/*_WF_L*/
   // we never truncate internal log files
   ceph_assert(h->file->fnode.ino > 1);
 
+  // envelope offsets are physical, only the space past the last
+  // envelope can be dropped
+  if (h->file->fnode.envelope_seed &&
+      offset != h->get_effective_write_pos()) {
+    derr << __func__ << " can't truncate envelope file " << h->file->fnode
+	 << " to 0x" << std::hex << offset << std::dec << dendl;
+    return -EOPNOTSUPP;
+  }
+
   // truncate off unflushed data?
   if (h->pos < offset &&
       h->pos + h->get_buffer_length() > offset) {
@@ -4028,6 +4183,10 @@ int BlueFS::preallocate(FileRef f, uint64_t off, uint64_t len)/*_LF*/
       return r;
 
     log.t.op_file_update_inc(f->fnode);
+    if (f->fnode.envelope_seed) {
+      // the extents must be durable before fsync may skip the log
+      f->is_dirty = true;
+    }
   }
   return 0;
 }
@@ -4135,6 +4294,19 @@ int BlueFS::open_for_write(
   ceph_assert(file->fnode.ino > 1);
 
   file->fnode.mtime = ceph_clock_now();
+  // any previous envelope chain is abandoned: a fresh seed makes its
+  // leftovers fail the crc check on replay
+  file->envelopes.clear();
+  file->envelope_size = 0;
+  if (cct->_conf.get_val<bool>("bluefs_wal_envelope_mode") &&
+      boost::algorithm::ends_with(filename, ".log")) {
+    file->fnode.envelope_seed =
+      ceph::util::generate_random_number<uint32_t>(1, UINT32_MAX);
+    // first fsync has to persist the seed (and the file itself)
+    file->is_dirty = true;
+  } else {
+    file->fnode.envelope_seed = 0;
+  }
   dout(20) << __func__ << " mapping " << dirname << "/" << filename
 	   << " vsel_hint " << file->vselector_hint
 	   << dendl;
@@ -4378,7 +4550,7 @@ int BlueFS::stat(std::string_view dirname, std::string_view filename,
   dout(10) << __func__ << " " << dirname << "/" << filename
 	   << " " << file->fnode << dendl;
   if (size)
-    *size = file->fnode.size;
+    *size = file->get_size();
   if (mtime)
     *mtime = file->fnode.mtime;
   return 0;
@@ -248,6 +248,20 @@ public:
     std::atomic_int num_reading;
 
     void* vselector_hint = nullptr;
+
+    // payload layout of envelope files (fnode.envelope_seed != 0)
+    struct envelope_t {
+      uint64_t logical;   ///< payload offset as seen by readers
+      uint64_t physical;  ///< payload offset within fnode extents
+      uint32_t length;
+    };
+    mempool::bluefs::vector<envelope_t> envelopes;
+    uint64_t envelope_size = 0;  ///< sum of envelope payload lengths
+
+    uint64_t get_size() const {
+      return fnode.envelope_seed ? envelope_size : fnode.size;
+    }
+
     /* lock protects fnode and other the parts that can be modified during read & write operations.
        Does not protect values that are fixed
        Does not need to be taken when doing one-time operations:
@@ -312,6 +326,8 @@ public:
       const bool partial,
       const unsigned length,
       const bluefs_super_t& super);
+    /// prefix pending data with a bluefs_wal_envelope_t header
+    void seal_envelope();
     ceph::buffer::list::page_aligned_appender buffer_appender;  //< for const char* only
   public:
     int writer_type = 0;    ///< WRITER_*
@@ -367,6 +383,11 @@ public:
     uint64_t get_effective_write_pos() {
       return pos + buffer.length();
     }
+
+    /// size of the file as seen by readers, including unflushed data
+    uint64_t get_logical_size() const {
+      return file->get_size() + buffer.length();
+    }
   };
 
   struct FileReaderBuffer {
@@ -616,6 +637,15 @@ private:
     uint64_t offset, ///< [in] offset
     uint64_t len,    ///< [in] this many bytes
     char *out);      ///< [out] optional: or copy it here
+  /// read payload of an envelope file, offset is logical
+  int64_t _read_envelope(
+    FileReader *h,
+    uint64_t offset,
+    size_t len,
+    ceph::buffer::list *outbl,
+    char *out,
+    bool random);
+  void _recover_envelopes();
 
   int _open_super();
   int _write_super(int dev);
@@ -758,6 +788,9 @@ public:
     // no need to hold the global lock here; we only touch h and
     // h->file, and read vs write or delete is already protected (via
     // atomics and asserts).
+    if (h->file->fnode.envelope_seed) {
+      return _read_envelope(h, offset, len, outbl, out, false);
+    }
     return _read(h, offset, len, outbl, out);
   }
   int64_t read_random(FileReader *h, uint64_t offset, size_t len,
@@ -765,6 +798,9 @@ public:
     // no need to hold the global lock here; we only touch h and
     // h->file, and read vs write or delete is already protected (via
     // atomics and asserts).
+    if (h->file->fnode.envelope_seed) {
+      return _read_envelope(h, offset, len, nullptr, out, true);
+    }
     return _read_random(h, offset, len, out);
   }
   void invalidate_cache(FileRef f, uint64_t offset, uint64_t len);
@@ -37,11 +37,13 @@
 #include "include/stringify.h"
 #include "include/str_map.h"
 #include "include/util.h"
+#include "common/admin_socket.h"
 #include "common/errno.h"
 #include "common/safe_io.h"
 #include "common/PriorityCache.h"
 #include "common/url_escape.h"
 #include "Allocator.h"
+#include "TieredAllocator.h"
 #include "FreelistManager.h"
 #include "BlueFS.h"
 #include "BlueRocksEnv.h"
@@ -68,6 +70,7 @@
 #define dout_subsys ceph_subsys_bluestore
 
 using bid_t = decltype(BlueStore::Blob::id);
+using TOPNSPC::common::cmd_getval;
 
 // bluestore_cache_onode
 MEMPOOL_DEFINE_OBJECT_FACTORY(BlueStore::Onode, bluestore_onode,
@@ -129,6 +132,7 @@ const string PREFIX_DEFERRED = "L";    // id -> deferred_transaction_t
 const string PREFIX_ALLOC = "B";       // u64 offset -> u64 length (freelist)
 const string PREFIX_ALLOC_BITMAP = "b";// (see BitmapFreelistManager)
 const string PREFIX_SHARED_BLOB = "X"; // u64 SB id -> shared_blob_t
+const string PREFIX_ALLOC_JOURNAL = "J"; // u64 seq -> allocated + released extents
 
 const string BLUESTORE_GLOBAL_STATFS_KEY = "bluestore_statfs";
 
@@ -649,8 +653,11 @@ ostream& operator<<(ostream& out, const BlueStore::Buffer& b)
   out << "buffer(" << &b << " space " << b.space << " 0x" << std::hex
       << b.offset << "~" << b.length << std::dec
       << " " << BlueStore::Buffer::get_state_name(b.state);
-  if (b.flags)
-    out << " " << BlueStore::Buffer::get_flag_name(b.flags);
+  for (uint32_t f = 1; f && f <= b.flags; f <<= 1) {
+    if (b.flags & f) {
+      out << " " << BlueStore::Buffer::get_flag_name(f);
+    }
+  }
   return out << ")";
 }
 
@@ -1108,11 +1115,16 @@ struct LruOnodeCacheShard : public BlueStore::OnodeCacheShard {
     if (o->is_cached() && o->pin_nref == 1) {
       if(!o->lru_item.is_linked()) {
         if (o->exists) {
-	  lru.push_front(*o);
+	  if (o->use_once) {
+	    // nobody but a use-once reader wanted this; let it go first
+	    lru.push_back(*o);
+	  } else {
+	    lru.push_front(*o);
+	  }
 	  o->cache_age_bin = age_bins.front();
 	  *(o->cache_age_bin) += 1;
 	  dout(20) << __func__ << " " << this << " " << o->oid << " unpinned"
-                   << dendl;
+                   << (o->use_once ? " (use once)" : "") << dendl;
         } else {
 	  ceph_assert(num);
 	  --num;
@@ -1122,7 +1134,7 @@ struct LruOnodeCacheShard : public BlueStore::OnodeCacheShard {
           // remove will also decrement nref
           o->c->onode_space._remove(o->oid);
         }
-      } else if (o->exists) {
+      } else if (o->exists && !o->use_once) {
         // move onode within LRU
         lru.erase(lru.iterator_to(*o));
         lru.push_front(*o);
@@ -1641,6 +1653,295 @@ public:
 #endif
 };
 
+// ArcBufferCacheShard
+//
+// Adaptive Replacement Cache (Megiddo & Modha).  Resident buffers live
+// either on the recency list (T1, seen once) or the frequency list (T2,
+// seen at least twice).  Evicted buffers are kept as empty "ghost"
+// buffers in their BufferSpace on B1/B2, so a later miss on the same
+// range tells us which list evicted it too early.  The target size of T1
+// (arc_p) is grown on B1 ghost hits and shrunk on B2 ghost hits, which
+// lets a one-pass scan (backfill, scrub) churn through T1 without
+// flushing the frequently used data on T2.
+
+struct ArcBufferCacheShard : public BlueStore::BufferCacheShard {
+  typedef boost::intrusive::list<
+    BlueStore::Buffer,
+    boost::intrusive::member_hook<
+      BlueStore::Buffer,
+      boost::intrusive::list_member_hook<>,
+      &BlueStore::Buffer::lru_item> > list_t;
+  list_t recent;          ///< "T1" buffers referenced once
+  list_t frequent;        ///< "T2" buffers referenced more than once
+  list_t recent_ghost;    ///< "B1" empty buffers evicted from T1
+  list_t frequent_ghost;  ///< "B2" empty buffers evicted from T2
+
+  // BufferSpace::_discard hands back the highest value of the buffers
+  // it trimmed; order these so that a ghost wins over its resident list.
+  enum {
+    BUFFER_NEW = 0,
+    BUFFER_RECENT,          ///< in recent
+    BUFFER_RECENT_GHOST,    ///< in recent_ghost
+    BUFFER_FREQUENT,        ///< in frequent
+    BUFFER_FREQUENT_GHOST,  ///< in frequent_ghost
+    BUFFER_TYPE_MAX
+  };
+
+  uint64_t list_bytes[BUFFER_TYPE_MAX] = {0}; ///< bytes per type
+  uint64_t arc_p = 0;  ///< adaptive target for bytes in recent
+
+public:
+  explicit ArcBufferCacheShard(CephContext *cct) : BufferCacheShard(cct) {}
+
+  list_t& _get_list(uint16_t type) {
+    switch (type) {
+    case BUFFER_RECENT:
+      return recent;
+    case BUFFER_RECENT_GHOST:
+      return recent_ghost;
+    case BUFFER_FREQUENT:
+      return frequent;
+    case BUFFER_FREQUENT_GHOST:
+      return frequent_ghost;
+    default:
+      ceph_abort_msg("bad cache_private");
+    }
+  }
+
+  static bool _is_ghost(uint16_t type) {
+    return type == BUFFER_RECENT_GHOST || type == BUFFER_FREQUENT_GHOST;
+  }
+
+  void _account(BlueStore::Buffer *b) {
+    list_bytes[b->cache_private] += b->length;
+    if (!b->is_empty()) {
+      buffer_bytes += b->length;
+      *(b->cache_age_bin) += b->length;
+    }
+    num = recent.size() + frequent.size();
+  }
+
+  void _unaccount(BlueStore::Buffer *b) {
+    ceph_assert(list_bytes[b->cache_private] >= b->length);
+    list_bytes[b->cache_private] -= b->length;
+    if (!b->is_empty()) {
+      ceph_assert(buffer_bytes >= b->length);
+      buffer_bytes -= b->length;
+      assert(*(b->cache_age_bin) >= b->length);
+      *(b->cache_age_bin) -= b->length;
+    }
+  }
+
+  void _ghost_hit(BlueStore::Buffer *b) {
+    // ARC adapts by the ratio of the two ghost lists; the ghost that was
+    // hit has already been trimmed from its list by BufferSpace::_discard.
+    uint64_t max_bytes = max;
+    uint64_t b1 = list_bytes[BUFFER_RECENT_GHOST];
+    uint64_t b2 = list_bytes[BUFFER_FREQUENT_GHOST];
+    if (b->cache_private == BUFFER_RECENT_GHOST) {
+      uint64_t delta = b->length * std::max<uint64_t>(
+        1, b2 / std::max<uint64_t>(b1, b->length));
+      arc_p = std::min(max_bytes, arc_p + delta);
+      if (logger) {
+        logger->inc(l_bluestore_buffer_ghost_recent_hit_bytes, b->length);
+      }
+    } else {
+      uint64_t delta = b->length * std::max<uint64_t>(
+        1, b1 / std::max<uint64_t>(b2, b->length));
+      arc_p = arc_p > delta ? arc_p - delta : 0;
+      if (logger) {
+        logger->inc(l_bluestore_buffer_ghost_frequent_hit_bytes, b->length);
+      }
+    }
+    dout(20) << __func__ << " " << *b << " arc_p now " << arc_p << dendl;
+  }
+
+  void _add(BlueStore::Buffer *b, int level, BlueStore::Buffer *near) override
+  {
+    dout(20) << __func__ << " level " << level << " near " << near
+             << " on " << *b
+             << " which has cache_private " << b->cache_private << dendl;
+    if (near) {
+      b->cache_private = near->cache_private;
+      ceph_assert(!_is_ghost(b->cache_private) || b->is_empty());
+      auto& l = _get_list(b->cache_private);
+      l.insert(l.iterator_to(*near), *b);
+    } else if (b->cache_private == BUFFER_NEW) {
+      b->cache_private = BUFFER_RECENT;
+      if (level > 0) {
+        recent.push_front(*b);
+      } else {
+        // take caller hint to start at the back of the recent queue
+        recent.push_back(*b);
+      }
+    } else {
+      // we got a hint from discard: the range was cached (or remembered)
+      // before, so this is at least its second reference
+      ceph_assert(b->cache_private < BUFFER_TYPE_MAX);
+      if (_is_ghost(b->cache_private)) {
+        _ghost_hit(b);
+      }
+      dout(20) << __func__ << " move to front of frequent " << *b << dendl;
+      b->cache_private = BUFFER_FREQUENT;
+      frequent.push_front(*b);
+    }
+    b->cache_age_bin = age_bins.front();
+    _account(b);
+  }
+
+  void _rm(BlueStore::Buffer *b) override
+  {
+    dout(20) << __func__ << " " << *b << dendl;
+    _unaccount(b);
+    auto& l = _get_list(b->cache_private);
+    l.erase(l.iterator_to(*b));
+    num = recent.size() + frequent.size();
+  }
+
+  void _move(BlueStore::BufferCacheShard *srcc, BlueStore::Buffer *b) override
+  {
+    ArcBufferCacheShard *src = static_cast<ArcBufferCacheShard*>(srcc);
+    src->_rm(b);
+
+    // preserve which list we're on (even if we can't preserve the order!)
+    ceph_assert(_is_ghost(b->cache_private) == b->is_empty());
+    _get_list(b->cache_private).push_back(*b);
+    _account(b);
+  }
+
+  void _adjust_size(BlueStore::Buffer *b, int64_t delta) override
+  {
+    dout(20) << __func__ << " delta " << delta << " on " << *b << dendl;
+    ceph_assert((int64_t)list_bytes[b->cache_private] + delta >= 0);
+    list_bytes[b->cache_private] += delta;
+    if (!b->is_empty()) {
+      ceph_assert((int64_t)buffer_bytes + delta >= 0);
+      buffer_bytes += delta;
+      assert(*(b->cache_age_bin) + delta >= 0);
+      *(b->cache_age_bin) += delta;
+    }
+  }
+
+  void _touch(BlueStore::Buffer *b) override {
+    switch (b->cache_private) {
+    case BUFFER_RECENT:
+      // second reference: promote to frequent
+      recent.erase(recent.iterator_to(*b));
+      list_bytes[BUFFER_RECENT] -= b->length;
+      b->cache_private = BUFFER_FREQUENT;
+      list_bytes[BUFFER_FREQUENT] += b->length;
+      frequent.push_front(*b);
+      break;
+    case BUFFER_FREQUENT:
+      frequent.erase(frequent.iterator_to(*b));
+      frequent.push_front(*b);
+      break;
+    default:
+      ceph_abort_msg("touch of ghost buffer");
+    }
+    *(b->cache_age_bin) -= b->length;
+    b->cache_age_bin = age_bins.front();
+    *(b->cache_age_bin) += b->length;
+    num = recent.size() + frequent.size();
+    _audit("_touch_buffer end");
+  }
+
+  void _evict_to_ghost(BlueStore::Buffer *b, list_t& from, list_t& to,
+                       uint16_t ghost) {
+    ceph_assert(b->is_clean());
+    dout(20) << __func__ << " " << *b << dendl;
+    _unaccount(b);
+    b->state = BlueStore::Buffer::STATE_EMPTY;
+    b->data.clear();
+    from.erase(from.iterator_to(*b));
+    to.push_front(*b);
+    b->cache_private = ghost;
+    list_bytes[ghost] += b->length;
+  }
+
+  void _trim_to(uint64_t max) override
+  {
+    uint64_t evicted = 0;
+    while (buffer_bytes > max) {
+      if (!recent.empty() &&
+          (list_bytes[BUFFER_RECENT] > arc_p || frequent.empty())) {
+        evicted += recent.rbegin()->length;
+        _evict_to_ghost(&*recent.rbegin(), recent, recent_ghost,
+                        BUFFER_RECENT_GHOST);
+      } else if (!frequent.empty()) {
+        evicted += frequent.rbegin()->length;
+        _evict_to_ghost(&*frequent.rbegin(), frequent, frequent_ghost,
+                        BUFFER_FREQUENT_GHOST);
+      } else {
+        break;
+      }
+    }
+    if (evicted > 0) {
+      dout(20) << __func__ << " evicted " << byte_u_t(evicted)
+               << " arc_p " << arc_p << dendl;
+    }
+
+    // bound the ghost lists the way ARC does: T1 + B1 <= c and
+    // T1 + T2 + B1 + B2 <= 2c
+    while (!recent_ghost.empty() &&
+           list_bytes[BUFFER_RECENT] + list_bytes[BUFFER_RECENT_GHOST] > max) {
+      BlueStore::Buffer *b = &*recent_ghost.rbegin();
+      dout(20) << __func__ << " recent_ghost rm " << *b << dendl;
+      b->space->_rm_buffer(this, b);
+    }
+    while (list_bytes[BUFFER_RECENT_GHOST] +
+           list_bytes[BUFFER_FREQUENT_GHOST] > max) {
+      list_t& l = frequent_ghost.empty() ? recent_ghost : frequent_ghost;
+      BlueStore::Buffer *b = &*l.rbegin();
+      dout(20) << __func__ << " ghost rm " << *b << dendl;
+      b->space->_rm_buffer(this, b);
+    }
+    num = recent.size() + frequent.size();
+  }
+
+  void add_stats(uint64_t *extents,
+                 uint64_t *blobs,
+                 uint64_t *buffers,
+                 uint64_t *bytes) override {
+    std::lock_guard l(lock);
+    *extents += num_extents;
+    *blobs += num_blobs;
+    *buffers += num;
+    *bytes += buffer_bytes;
+  }
+
+#ifdef DEBUG_CACHE
+  void _audit(const char *when) override
+  {
+    dout(10) << __func__ << " " << when << " start" << dendl;
+    uint64_t s = 0;
+    for (uint16_t t = BUFFER_RECENT; t < BUFFER_TYPE_MAX; ++t) {
+      uint64_t lb = 0;
+      for (auto& i : _get_list(t)) {
+        ceph_assert(i.cache_private == t);
+        ceph_assert(_is_ghost(t) == i.is_empty());
+        lb += i.length;
+      }
+      if (lb != list_bytes[t]) {
+        derr << __func__ << " list " << t << " bytes " << list_bytes[t]
+             << " != actual " << lb << dendl;
+        ceph_assert(lb == list_bytes[t]);
+      }
+      if (!_is_ghost(t)) {
+        s += lb;
+      }
+    }
+    if (s != buffer_bytes) {
+      derr << __func__ << " buffer_bytes " << buffer_bytes << " actual " << s
+           << dendl;
+      ceph_assert(s == buffer_bytes);
+    }
+    dout(20) << __func__ << " " << when << " buffer_bytes " << buffer_bytes
+             << " ok" << dendl;
+  }
+#endif
+};
+
 // BuferCacheShard
 
 BlueStore::BufferCacheShard *BlueStore::BufferCacheShard::create(
@@ -1653,6 +1954,8 @@ BlueStore::BufferCacheShard *BlueStore::BufferCacheShard::create(
     c = new LruBufferCacheShard(cct);
   else if (type == "2q")
     c = new TwoQBufferCacheShard(cct);
+  else if (type == "arc")
+    c = new ArcBufferCacheShard(cct);
   else
     ceph_abort_msg("unrecognized cache type");
   c->logger = logger;
@@ -1706,7 +2009,7 @@ int BlueStore::BufferSpace::_discard(BufferCacheShard* cache, uint32_t offset, u
 	  cache->_adjust_size(b, front - (int64_t)b->length);
 	}
 	b->truncate(front);
-	b->maybe_rebuild();
+	b->maybe_rebuild(cache->cct->_conf->bluestore_zero_copy_read);
 	cache->_audit("discard end 1");
 	break;
       } else {
@@ -1715,7 +2018,7 @@ int BlueStore::BufferSpace::_discard(BufferCacheShard* cache, uint32_t offset, u
 	  cache->_adjust_size(b, front - (int64_t)b->length);
 	}
 	b->truncate(front);
-	b->maybe_rebuild();
+	b->maybe_rebuild(cache->cct->_conf->bluestore_zero_copy_read);
 	++i;
 	continue;
       }
@@ -1769,6 +2072,13 @@ void BlueStore::BufferSpace::read(
       else
         val = b->is_writing() || b->is_clean();
       if (val) {
+        if ((b->flags & Buffer::FLAG_REBUILD) && !b->is_writing()) {
+          // the read that shared it may be done by now
+          b->maybe_rebuild(true);
+          if (!(b->flags & Buffer::FLAG_REBUILD)) {
+            b->data.reassign_to_mempool(mempool::mempool_bluestore_cache_data);
+          }
+        }
         if (b->offset < offset) {
 	  uint32_t skip = offset - b->offset;
 	  uint32_t l = min(length, b->length - skip);
@@ -1776,7 +2086,7 @@ void BlueStore::BufferSpace::read(
 	  res_intervals.insert(offset, l);
 	  offset += l;
 	  length -= l;
-	  if (!b->is_writing()) {
+	  if (!b->is_writing() && !(flags & USE_ONCE)) {
 	    cache->_touch(b);
           }
 	  continue;
@@ -1789,7 +2099,7 @@ void BlueStore::BufferSpace::read(
 	  offset += gap;
 	  length -= gap;
         }
-        if (!b->is_writing()) {
+        if (!b->is_writing() && !(flags & USE_ONCE)) {
 	  cache->_touch(b);
         }
         if (b->length > length) {
@@ -2014,6 +2324,12 @@ bool BlueStore::OnodeSpace::empty()
   return onode_map.empty();
 }
 
+bool BlueStore::OnodeSpace::contains(const ghobject_t& oid)
+{
+  std::lock_guard l(cache->lock);
+  return onode_map.count(oid);
+}
+
 void BlueStore::OnodeSpace::rename(
   OnodeRef& oldo,
   const ghobject_t& old_oid,
@@ -4194,7 +4510,15 @@ void BlueStore::ExtentMap::fault_range(
   dout(30) << __func__ << " 0x" << std::hex << offset << "~" << length
 	   << std::dec << dendl;
   if (shards.size() == 0) {
-    // no sharding yet; everyting is loaded
+    // no sharding; the inline map is decoded on first access only, so
+    // attr/omap-only users of a cached onode never pay for the extents
+    if (inline_pending) {
+      unsigned n = decode_some(inline_bl);
+      inline_pending = false;
+      dout(20) << __func__ << " decoded inline map, " << n << " extents ("
+	       << inline_bl.length() << " bytes)" << dendl;
+      onode->c->store->logger->inc(l_bluestore_onode_inline_decodes);
+    }
     return;
   }
   auto start = seek_shard(offset);
@@ -4246,6 +4570,8 @@ void BlueStore::ExtentMap::dirty_range(
 	   << std::dec << dendl;
   if (shards.empty()) {
     dout(20) << __func__ << " mark inline shard dirty" << dendl;
+    // callers fault the range first, but never drop undecoded extents
+    fault_range(nullptr, offset, length);
     inline_bl.clear();
     return;
   }
@@ -4728,7 +5054,8 @@ void BlueStore::Onode::put()
 void BlueStore::Onode::decode_raw(
   BlueStore::Onode* on,
   const bufferlist& v,
-  BlueStore::ExtentMap::ExtentDecoder& edecoder)
+  BlueStore::ExtentMap::ExtentDecoder& edecoder,
+  bool lazy_inline)
 {
   on->exists = true;
   auto p = v.front().begin_deep();
@@ -4738,7 +5065,12 @@ void BlueStore::Onode::decode_raw(
   edecoder.decode_spanning_blobs(p, on->c);
   if (on->onode.extent_map_shards.empty()) {
     denc(on->extent_map.inline_bl, p);
-    edecoder.decode_some(on->extent_map.inline_bl, on->c);
+    if (lazy_inline) {
+      // left to ExtentMap::fault_range()
+      on->extent_map.inline_pending = true;
+    } else {
+      edecoder.decode_some(on->extent_map.inline_bl, on->c);
+    }
   }
 }
 
@@ -4754,7 +5086,7 @@ BlueStore::Onode* BlueStore::Onode::create_decode(
 
   if (v.length()) {
     ExtentMap::ExtentDecoderFull edecoder(on->extent_map);
-    decode_raw(on, v, edecoder);
+    decode_raw(on, v, edecoder, true);
 
     for (auto& i : on->onode.attrs) {
       i.second.reassign_to_mempool(mempool::mempool_bluestore_cache_meta);
@@ -4968,6 +5300,10 @@ BlueStore::Collection::Collection(BlueStore *store_, OnodeCacheShard *oc, Buffer
     onode_space(oc),
     commit_queue(nullptr)
 {
+  spg_t pgid;
+  if (cid.is_pg(&pgid)) {
+    io_queue_hint = pgid.ps();
+  }
 }
 
 bool BlueStore::Collection::flush_commit(Context *c)
@@ -5073,7 +5409,8 @@ uint64_t BlueStore::Collection::make_blob_unshared(SharedBlob *sb)
 BlueStore::OnodeRef BlueStore::Collection::get_onode(
   const ghobject_t& oid,
   bool create,
-  bool is_createop)
+  bool is_createop,
+  bool use_once)
 {
   ceph_assert(create ? ceph_mutex_is_wlocked(lock) : ceph_mutex_is_locked(lock));
 
@@ -5087,8 +5424,16 @@ BlueStore::OnodeRef BlueStore::Collection::get_onode(
   }
 
   OnodeRef o = onode_space.lookup(oid);
-  if (o)
+  if (o) {
+    if (!use_once && o->use_once) {
+      // a regular reference makes it part of the working set again
+      o->use_once = false;
+    }
+    if (o->prefetched.exchange(false)) {
+      store->logger->inc(l_bluestore_onode_prefetch_hits);
+    }
     return o;
+  }
 
   string key;
   get_object_key(store->cct, oid, &key);
@@ -5096,6 +5441,10 @@ BlueStore::OnodeRef BlueStore::Collection::get_onode(
   ldout(store->cct, 20) << __func__ << " oid " << oid << " key "
 			<< pretty_binary_string(key) << dendl;
 
+  // the write path holds the lock exclusively, don't make it wait for the
+  // prefetch
+  bool prefetch = !create && _should_prefetch_onodes(key);
+
   bufferlist v;
   int r = -ENOENT;
   Onode *on;
@@ -5113,8 +5462,131 @@ BlueStore::OnodeRef BlueStore::Collection::get_onode(
 
   // new object, load onode if available
   on = Onode::create_decode(this, oid, key, v, true);
+  if (use_once && v.length()) {
+    on->use_once = true;
+    store->logger->inc(l_bluestore_onode_use_once);
+  }
   o.reset(on);
-  return onode_space.add_onode(oid, o);
+  o = onode_space.add_onode(oid, o);
+  if (prefetch) {
+    _prefetch_onodes(key);
+  }
+  return o;
+}
+
+bool BlueStore::Collection::_should_prefetch_onodes(const string& key)
+{
+  spg_t pgid;
+  if (!cid.is_pg(&pgid)) {
+    return false;
+  }
+  if (store->onode_prefetch_count == 0) {
+    return false;
+  }
+  uint64_t trigger = store->onode_prefetch_trigger;
+
+  std::lock_guard l(prefetch_lock);
+  bool prefetch = false;
+  if (key == prefetch_next_key) {
+    // a scan walked off the end of the previous prefetch, keep going
+    prefetch = true;
+  } else if (!prefetch_last_key.empty() && key > prefetch_last_key) {
+    prefetch = ++prefetch_run >= trigger;
+  } else {
+    prefetch_run = 0;
+  }
+  prefetch_last_key = key;
+  if (prefetch) {
+    prefetch_run = 0;
+    prefetch_next_key.clear();
+  }
+  return prefetch;
+}
+
+void BlueStore::Collection::_prefetch_onodes(const string& after)
+{
+  spg_t pgid;
+  ceph_assert(cid.is_pg(&pgid));
+  uint64_t count = store->onode_prefetch_count;
+
+  // with a txc in flight the db may still hold objects it removed, or miss
+  // ones it created, while the cache already says otherwise. a txc queued
+  // after this check can't touch the collection before we drop the lock,
+  // so with the osr empty the db snapshot below matches the cache.
+  if (!osr->empty()) {
+    ldout(store->cct, 20) << __func__ << " osr busy, skipping" << dendl;
+    return;
+  }
+
+  // onode keys sort in object order and each one is followed by its extent
+  // shard keys, so a single pass picks up the onodes and their first shards.
+  // an onode is only published once its shard has been seen; until then
+  // nobody else can reach it.
+  KeyValueDB::Iterator it = store->db->get_iterator(PREFIX_OBJ);
+  it->upper_bound(after);
+  OnodeRef pending;
+  string shard_key;
+  string next_key;
+  unsigned scanned = 0, loaded = 0, shards = 0;
+  auto publish = [&]() {
+    if (pending) {
+      onode_space.add_onode(pending->oid, pending);
+      pending.reset();
+    }
+  };
+  for (; it->valid(); it->next()) {
+    string key = it->key();
+    if (is_extent_shard_key(key)) {
+      if (pending && key == shard_key) {
+	auto& shard = pending->extent_map.shards.front();
+	bufferlist v = it->value();
+	if (v.length() == shard.shard_info->bytes) {
+	  shard.extents = pending->extent_map.decode_some(v);
+	  shard.loaded = true;
+	  ++shards;
+	}
+      }
+      continue;
+    }
+    publish();
+    if (scanned >= count) {
+      next_key = key;
+      break;
+    }
+    ghobject_t oid;
+    if (get_key_object(key, &oid) < 0 ||
+	oid.shard_id != pgid.shard ||
+	oid.hobj.pool != (int64_t)pgid.pool() ||
+	!oid.match(cnode.bits, pgid.ps())) {
+      break;
+    }
+    ++scanned;
+    if (onode_space.contains(oid)) {
+      continue;
+    }
+    bufferlist v = it->value();
+    pending.reset(Onode::create_decode(this, oid, key, v, true));
+    pending->use_once = true;
+    pending->prefetched = true;
+    if (!pending->extent_map.shards.empty()) {
+      get_extent_shard_key(pending->key,
+			   pending->extent_map.shards.front().shard_info->offset,
+			   &shard_key);
+    }
+    ++loaded;
+  }
+  publish();
+
+  {
+    std::lock_guard l(prefetch_lock);
+    prefetch_next_key = next_key;
+  }
+  ldout(store->cct, 20) << __func__ << " after " << pretty_binary_string(after)
+			<< " loaded " << loaded << " of " << scanned
+			<< " onodes, " << shards << " shards" << dendl;
+  store->logger->inc(l_bluestore_onode_prefetch_runs);
+  store->logger->inc(l_bluestore_onode_prefetched, loaded);
+  store->logger->inc(l_bluestore_onode_prefetch_shards, shards);
 }
 
 void BlueStore::Collection::split_cache(
@@ -5461,57 +5933,496 @@ void BlueStore::MempoolThread::_update_cache_settings()
                 << dendl;
 }
 
-// =======================================================
-
-// OmapIteratorImpl
+// DefragThread
 
 #undef dout_prefix
-#define dout_prefix *_dout << "bluestore.OmapIteratorImpl(" << this << ") "
+#define dout_prefix *_dout << "bluestore.DefragThread(" << this << ") "
 
-BlueStore::OmapIteratorImpl::OmapIteratorImpl(
-  PerfCounters* _logger, CollectionRef c, OnodeRef& o, KeyValueDB::Iterator it)
-  : logger(_logger), c(c), o(o), it(it)
+void *BlueStore::DefragThread::entry()
 {
-  logger->inc(l_bluestore_omap_iterator_count);
-  std::shared_lock l(c->lock);
-  if (o->onode.has_omap()) {
-    o->get_omap_key(string(), &head);
-    o->get_omap_tail(&tail);
-    it->lower_bound(head);
+  std::unique_lock l{lock};
+  while (!stop) {
+    auto interval =
+      store->cct->_conf.get_val<double>("bluestore_defrag_check_interval");
+    if (!requested && interval > 0) {
+      auto start_ratio =
+	store->cct->_conf.get_val<double>("bluestore_defrag_start_ratio");
+      fragmentation = store->alloc->get_fragmentation();
+      if (fragmentation >= start_ratio) {
+	target =
+	  store->cct->_conf.get_val<double>("bluestore_defrag_target_ratio");
+	requested = true;
+      }
+    }
+    if (requested) {
+      _run(l);
+      requested = false;
+    }
+    if (stop) {
+      break;
+    }
+    if (interval > 0) {
+      cond.wait_for(l, ceph::make_timespan(interval));
+    } else {
+      cond.wait(l);
+    }
   }
-}
-BlueStore::OmapIteratorImpl::~OmapIteratorImpl()
-{
-  logger->dec(l_bluestore_omap_iterator_count);
+  stop = false;
+  return NULL;
 }
 
-string BlueStore::OmapIteratorImpl::_stringify() const
+bool BlueStore::DefragThread::_should_continue(
+  std::unique_lock<ceph::mutex>& l)
 {
-  stringstream s;
-  s << " omap_iterator(cid = " << c->cid
-    <<", oid = " << o->oid << ")";
-  return s.str();
+  if (stop || aborted) {
+    return false;
+  }
+  fragmentation = store->alloc->get_fragmentation();
+  return fragmentation >= target;
 }
 
-int BlueStore::OmapIteratorImpl::seek_to_first()
+void BlueStore::DefragThread::_run(std::unique_lock<ceph::mutex>& l)
 {
-  std::shared_lock l(c->lock);
-  auto start1 = mono_clock::now();
-  if (o->onode.has_omap()) {
-    it->lower_bound(head);
-  } else {
-    it = KeyValueDB::Iterator();
-  }
-  c->store->log_latency(
-    __func__,
-    l_bluestore_omap_seek_to_first_lat,
-    mono_clock::now() - start1,
-    c->store->cct->_conf->bluestore_log_omap_iterator_age);
+  running = true;
+  aborted = false;
+  started = ceph_clock_now();
+  start_fragmentation = fragmentation = store->alloc->get_fragmentation();
+  collections_total = collections_done = 0;
+  objects_scanned = objects_rewritten = bytes_rewritten = 0;
+  dout(1) << __func__ << " start, fragmentation " << start_fragmentation
+	  << " target " << target << dendl;
 
-  return 0;
-}
+  std::vector<CollectionRef> colls;
+  {
+    std::shared_lock cl{store->coll_lock};
+    for (auto& [cid, c] : store->coll_map) {
+      colls.push_back(c);
+    }
+  }
+  collections_total = colls.size();
 
-int BlueStore::OmapIteratorImpl::upper_bound(const string& after)
+  const uint64_t window = std::max<uint64_t>(
+    store->cct->_conf.get_val<Option::size_t>("bluestore_defrag_window_size"),
+    store->min_alloc_size);
+  const auto sleep = ceph::make_timespan(
+    store->cct->_conf.get_val<double>("bluestore_defrag_sleep"));
+  for (auto& c : colls) {
+    if (!_should_continue(l)) {
+      break;
+    }
+    cur_cid = c->cid;
+    CollectionHandle ch = c;
+    ghobject_t next;
+    bool more = true;
+    while (more && _should_continue(l)) {
+      std::vector<ghobject_t> ls;
+      l.unlock();
+      int r = store->collection_list(ch, next, ghobject_t::get_max(), 64,
+				     &ls, &next);
+      l.lock();
+      if (r < 0 || ls.empty()) {
+	break;
+      }
+      more = !next.is_max();
+      for (auto& oid : ls) {
+	if (!_should_continue(l)) {
+	  break;
+	}
+	++objects_scanned;
+	bool touched = false;
+	uint64_t size = window;
+	for (uint64_t offset = 0; offset < size; offset += window) {
+	  uint64_t rewritten = 0;
+	  l.unlock();
+	  r = store->_defrag_region(c, oid, offset, window, &size, &rewritten);
+	  l.lock();
+	  if (r == -ENOSPC) {
+	    dout(1) << __func__ << " not enough free space, stopping" << dendl;
+	    aborted = true;
+	  }
+	  if (r < 0 && r != -EAGAIN) {
+	    break;
+	  }
+	  if (rewritten) {
+	    touched = true;
+	    bytes_rewritten += rewritten;
+	    // throttle, waking up early on stop/abort
+	    if (sleep != ceph::timespan::zero()) {
+	      cond.wait_for(l, sleep);
+	    }
+	    if (stop || aborted) {
+	      break;
+	    }
+	  }
+	}
+	if (touched) {
+	  ++objects_rewritten;
+	  store->logger->inc(l_bluestore_defrag_objects);
+	}
+      }
+    }
+    ++collections_done;
+  }
+  fragmentation = store->alloc->get_fragmentation();
+  dout(1) << __func__ << " done, fragmentation " << start_fragmentation
+	  << " -> " << fragmentation
+	  << ", rewritten " << objects_rewritten << " objects "
+	  << byte_u_t(bytes_rewritten)
+	  << " in " << ceph_clock_now() - started << dendl;
+  running = false;
+  cur_cid = coll_t();
+}
+
+void BlueStore::DefragThread::dump(Formatter *f)
+{
+  std::lock_guard l(lock);
+  f->open_object_section("defrag");
+  f->dump_bool("running", running);
+  f->dump_stream("started") << started;
+  f->dump_float("elapsed",
+    running ? (double)(ceph_clock_now() - started) : 0.0);
+  f->dump_float("target", target);
+  f->dump_float("start_fragmentation", start_fragmentation);
+  f->dump_float("fragmentation", fragmentation);
+  f->dump_unsigned("collections_total", collections_total);
+  f->dump_unsigned("collections_done", collections_done);
+  f->dump_stream("current_collection") << cur_cid;
+  f->dump_unsigned("objects_scanned", objects_scanned);
+  f->dump_unsigned("objects_rewritten", objects_rewritten);
+  f->dump_unsigned("bytes_rewritten", bytes_rewritten);
+  f->close_section();
+}
+
+// TierThread
+
+#undef dout_prefix
+#define dout_prefix *_dout << "bluestore.TierThread(" << this << ") "
+
+void *BlueStore::TierThread::entry()
+{
+  std::unique_lock l{lock};
+  auto next_epoch = mono_clock::now();
+  while (!stop) {
+    auto now = mono_clock::now();
+    if (now >= next_epoch) {
+      // heat decays once per epoch, which is also when we check whether
+      // the fast tier needs room
+      ++store->tier_epoch;
+      next_epoch = now + ceph::make_timespan(
+	store->cct->_conf.get_val<double>("bluestore_tier_interval"));
+      auto ratio =
+	store->cct->_conf.get_val<double>("bluestore_tier_fast_free_ratio");
+      if (_fast_tier_low(ratio)) {
+	_demote(l);
+      }
+    }
+    _promote(l);
+    store->logger->set(l_bluestore_tier_fast_free,
+		       store->tiered_alloc->get_fast_free());
+    if (stop) {
+      break;
+    }
+    if (promote_queue.empty()) {
+      cond.wait_for(l, next_epoch - mono_clock::now());
+    }
+  }
+  stop = false;
+  return NULL;
+}
+
+void BlueStore::TierThread::queue_promote(Collection *c, const ghobject_t& oid)
+{
+  static constexpr size_t max_queued = 1024;
+  std::lock_guard l(lock);
+  if (stop || promote_queue.size() >= max_queued) {
+    return;
+  }
+  promote_queue.emplace_back(c, oid);
+  cond.notify_all();
+}
+
+bool BlueStore::TierThread::_fast_tier_low(double ratio)
+{
+  auto a = store->tiered_alloc;
+  return a->get_fast_free() < ratio * a->get_fast_size();
+}
+
+bool BlueStore::TierThread::_migrate(
+  std::unique_lock<ceph::mutex>& l,
+  CollectionRef& c,
+  const ghobject_t& oid,
+  bool to_fast)
+{
+  const uint64_t window = std::max<uint64_t>(4 << 20, store->min_alloc_size);
+  const auto sleep = ceph::make_timespan(
+    store->cct->_conf.get_val<double>("bluestore_tier_sleep"));
+  uint64_t size = window;
+  uint64_t total = 0;
+  for (uint64_t offset = 0; offset < size; offset += window) {
+    uint64_t moved = 0;
+    l.unlock();
+    int r = store->_tier_migrate_region(c, oid, offset, window, to_fast,
+					&size, &moved);
+    l.lock();
+    if (r == -ENOSPC) {
+      dout(5) << __func__ << " not enough room on the "
+	      << (to_fast ? "fast" : "slow") << " tier" << dendl;
+      return false;
+    }
+    if (r < 0) {
+      // gone, or busy with client writes; skip it
+      break;
+    }
+    if (moved) {
+      total += moved;
+      // throttle, waking up early on stop
+      if (sleep != ceph::timespan::zero()) {
+	cond.wait_for(l, sleep);
+      }
+    }
+    if (stop) {
+      return false;
+    }
+  }
+  if (total) {
+    if (to_fast) {
+      ++objects_promoted;
+      bytes_promoted += total;
+    } else {
+      ++objects_demoted;
+      bytes_demoted += total;
+    }
+  }
+  return true;
+}
+
+void BlueStore::TierThread::_promote(std::unique_lock<ceph::mutex>& l)
+{
+  while (!promote_queue.empty() && !stop) {
+    auto [c, oid] = std::move(promote_queue.front());
+    promote_queue.pop_front();
+    if (!_migrate(l, c, oid, true)) {
+      // no room; the objects get queued again when they heat up next time
+      promote_queue.clear();
+    }
+  }
+}
+
+void BlueStore::TierThread::_demote(std::unique_lock<ceph::mutex>& l)
+{
+  // free the fast tier down to twice the ratio that triggered us, so that
+  // we don't start over right away
+  auto ratio = 2 *
+    store->cct->_conf.get_val<double>("bluestore_tier_fast_free_ratio");
+  demoting = true;
+  dout(5) << __func__ << " start, fast tier free "
+	  << byte_u_t(store->tiered_alloc->get_fast_free()) << dendl;
+
+  std::vector<CollectionRef> colls;
+  {
+    std::shared_lock cl{store->coll_lock};
+    for (auto& [cid, c] : store->coll_map) {
+      colls.push_back(c);
+    }
+  }
+  for (auto& c : colls) {
+    CollectionHandle ch = c;
+    ghobject_t next;
+    bool more = true;
+    while (more && !stop && _fast_tier_low(ratio)) {
+      std::vector<ghobject_t> ls;
+      l.unlock();
+      int r = store->collection_list(ch, next, ghobject_t::get_max(), 64,
+				     &ls, &next);
+      l.lock();
+      if (r < 0 || ls.empty()) {
+	break;
+      }
+      more = !next.is_max();
+      for (auto& oid : ls) {
+	if (!_fast_tier_low(ratio) || !_migrate(l, c, oid, false)) {
+	  goto out;
+	}
+      }
+    }
+  }
+ out:
+  dout(5) << __func__ << " done, fast tier free "
+	  << byte_u_t(store->tiered_alloc->get_fast_free()) << dendl;
+  demoting = false;
+}
+
+void BlueStore::TierThread::dump(Formatter *f)
+{
+  std::lock_guard l(lock);
+  f->open_object_section("tier");
+  auto a = store->tiered_alloc;
+  f->dump_bool("enabled", a != nullptr);
+  f->dump_unsigned("fast_size", a ? a->get_fast_size() : 0);
+  f->dump_unsigned("fast_free", a ? a->get_fast_free() : 0);
+  f->dump_unsigned("epoch", store->tier_epoch);
+  f->dump_bool("demoting", demoting);
+  f->dump_unsigned("promote_queue", promote_queue.size());
+  f->dump_unsigned("objects_promoted", objects_promoted);
+  f->dump_unsigned("bytes_promoted", bytes_promoted);
+  f->dump_unsigned("objects_demoted", objects_demoted);
+  f->dump_unsigned("bytes_demoted", bytes_demoted);
+  f->close_section();
+}
+
+// CompressThreadPool
+
+void BlueStore::CompressThreadPool::init(size_t n)
+{
+  ceph_assert(threads.empty());
+  stop = false;
+  for (size_t i = 0; i < n; ++i) {
+    threads.emplace_back(make_named_thread("bstore_compress",
+      &CompressThreadPool::entry, this));
+  }
+}
+
+void BlueStore::CompressThreadPool::shutdown()
+{
+  {
+    std::lock_guard l(lock);
+    stop = true;
+    cond.notify_all();
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  threads.clear();
+}
+
+void BlueStore::CompressThreadPool::entry()
+{
+  std::unique_lock l(lock);
+  while (!stop) {
+    if (q.empty()) {
+      cond.wait(l);
+      continue;
+    }
+    batch_t* batch = q.front();
+    if (!_run_one(*batch, l, true)) {
+      // all jobs taken; the owner waits for the ones still running
+      if (!q.empty() && q.front() == batch) {
+        q.pop_front();
+      }
+    }
+  }
+}
+
+bool BlueStore::CompressThreadPool::_run_one(
+  batch_t& batch,
+  std::unique_lock<ceph::mutex>& l,
+  bool offloaded)
+{
+  if (batch.next >= batch.jobs.size()) {
+    return false;
+  }
+  auto& job = batch.jobs[batch.next++];
+  l.unlock();
+  auto start = mono_clock::now();
+  store->logger->tinc(l_bluestore_compress_queue_lat, start - batch.queued);
+  if (offloaded) {
+    store->logger->inc(l_bluestore_compress_offloaded_count);
+  }
+  // FIXME: memory alignment here is bad
+  job.r = batch.c->compress_with_dict(*job.in, job.out,
+				      job.compressor_message, batch.dict);
+  job.lat = mono_clock::now() - start;
+  l.lock();
+  if (++batch.done == batch.jobs.size()) {
+    done_cond.notify_all();
+  }
+  return true;
+}
+
+void BlueStore::CompressThreadPool::compress(batch_t& batch, bool offload)
+{
+  std::unique_lock l(lock);
+  batch.queued = mono_clock::now();
+  offload = offload && batch.jobs.size() > 1 && !threads.empty();
+  if (offload) {
+    q.push_back(&batch);
+    cond.notify_all();
+  }
+  while (_run_one(batch, l, false))
+    ;
+  if (offload) {
+    auto p = std::find(q.begin(), q.end(), &batch);
+    if (p != q.end()) {
+      q.erase(p);
+    }
+  }
+  done_cond.wait(l, [&] { return batch.done == batch.jobs.size(); });
+}
+
+// =======================================================
+
+// OmapIteratorImpl
+
+#undef dout_prefix
+#define dout_prefix *_dout << "bluestore.OmapIteratorImpl(" << this << ") "
+
+template <typename Func>
+void BlueStore::OmapIteratorImpl::_count_tombstones(Func&& f)
+{
+  KeyValueDB *db = c->store->db;
+  KeyValueDB::tombstone_count_t tc;
+  db->begin_thread_tombstone_count(&tc);
+  f();
+  tombstones_skipped += db->end_thread_tombstone_count(tc);
+}
+
+BlueStore::OmapIteratorImpl::OmapIteratorImpl(
+  PerfCounters* _logger, CollectionRef c, OnodeRef& o, KeyValueDB::Iterator it)
+  : logger(_logger), c(c), o(o), it(it)
+{
+  logger->inc(l_bluestore_omap_iterator_count);
+  std::shared_lock l(c->lock);
+  if (o->onode.has_omap()) {
+    o->get_omap_key(string(), &head);
+    o->get_omap_tail(&tail);
+    _count_tombstones([&] { it->lower_bound(head); });
+  }
+}
+BlueStore::OmapIteratorImpl::~OmapIteratorImpl()
+{
+  logger->dec(l_bluestore_omap_iterator_count);
+  if (!head.empty()) {
+    c->store->_note_omap_tombstones(o, head, tail, tombstones_skipped);
+  }
+}
+
+string BlueStore::OmapIteratorImpl::_stringify() const
+{
+  stringstream s;
+  s << " omap_iterator(cid = " << c->cid
+    <<", oid = " << o->oid << ")";
+  return s.str();
+}
+
+int BlueStore::OmapIteratorImpl::seek_to_first()
+{
+  std::shared_lock l(c->lock);
+  auto start1 = mono_clock::now();
+  if (o->onode.has_omap()) {
+    _count_tombstones([&] { it->lower_bound(head); });
+  } else {
+    it = KeyValueDB::Iterator();
+  }
+  c->store->log_latency(
+    __func__,
+    l_bluestore_omap_seek_to_first_lat,
+    mono_clock::now() - start1,
+    c->store->cct->_conf->bluestore_log_omap_iterator_age);
+
+  return 0;
+}
+
+int BlueStore::OmapIteratorImpl::upper_bound(const string& after)
 {
   std::shared_lock l(c->lock);
   auto start1 = mono_clock::now();
@@ -5520,7 +6431,7 @@ int BlueStore::OmapIteratorImpl::upper_bound(const string& after)
     o->get_omap_key(after, &key);
     ldout(c->store->cct,20) << __func__ << " after " << after << " key "
 			    << pretty_binary_string(key) << dendl;
-    it->upper_bound(key);
+    _count_tombstones([&] { it->upper_bound(key); });
   } else {
     it = KeyValueDB::Iterator();
   }
@@ -5546,7 +6457,7 @@ int BlueStore::OmapIteratorImpl::lower_bound(const string& to)
     o->get_omap_key(to, &key);
     ldout(c->store->cct,20) << __func__ << " to " << to << " key "
 			    << pretty_binary_string(key) << dendl;
-    it->lower_bound(key);
+    _count_tombstones([&] { it->lower_bound(key); });
   } else {
     it = KeyValueDB::Iterator();
   }
@@ -5582,7 +6493,7 @@ int BlueStore::OmapIteratorImpl::next()
   std::shared_lock l(c->lock);
   auto start1 = mono_clock::now();
   if (o->onode.has_omap()) {
-    it->next();
+    _count_tombstones([&] { it->next(); });
     r = 0;
   }
   c->store->log_latency(
@@ -5642,6 +6553,133 @@ void BlueStore::handle_discard(interval_set<uint64_t>& to_release)
   alloc->release(to_release);
 }
 
+class BlueStore::SocketHook : public AdminSocketHook {
+  BlueStore* store;
+public:
+  static BlueStore::SocketHook* create(BlueStore* store)
+  {
+    BlueStore::SocketHook* hook = nullptr;
+    AdminSocket* admin_socket = store->cct->get_admin_socket();
+    if (admin_socket) {
+      hook = new BlueStore::SocketHook(store);
+      int r = admin_socket->register_command(
+	"bluestore defrag status",
+	hook,
+	"Show progress of the background defragmenter");
+      if (r != 0) {
+	// e.g. another BlueStore instance in this process owns the commands
+	delete hook;
+	hook = nullptr;
+      } else {
+	r = admin_socket->register_command(
+	  "bluestore fsck status",
+	  hook,
+	  "Show progress and ETA of the running (or last) fsck/repair");
+	ceph_assert(r == 0);
+	r = admin_socket->register_command(
+	  "bluestore defrag start "
+	  "name=target,type=CephFloat,range=0.0|1.0,req=false",
+	  hook,
+	  "Rewrite fragmented objects until allocator fragmentation drops "
+	  "below target (default bluestore_defrag_target_ratio)");
+	ceph_assert(r == 0);
+	r = admin_socket->register_command(
+	  "bluestore defrag stop",
+	  hook,
+	  "Stop the running defragmentation pass");
+	ceph_assert(r == 0);
+	r = admin_socket->register_command(
+	  "bluestore tier status",
+	  hook,
+	  "Show fast tier usage and data migrated between the tiers");
+	ceph_assert(r == 0);
+	r = admin_socket->register_command(
+	  "bluestore compression dict train "
+	  "name=pool,type=CephInt "
+	  "name=size,type=CephInt,req=false "
+	  "name=samples,type=CephInt,req=false",
+	  hook,
+	  "Train a compression dictionary for the pool from objects stored "
+	  "on this OSD and compress new blobs of the pool with it");
+	ceph_assert(r == 0);
+	r = admin_socket->register_command(
+	  "bluestore compression dict clear "
+	  "name=pool,type=CephInt",
+	  hook,
+	  "Stop compressing new blobs of the pool with a dictionary");
+	ceph_assert(r == 0);
+	r = admin_socket->register_command(
+	  "bluestore compression stats",
+	  hook,
+	  "Show per pool compression ratio and CPU time");
+	ceph_assert(r == 0);
+      }
+    }
+    return hook;
+  }
+
+  ~SocketHook() {
+    AdminSocket* admin_socket = store->cct->get_admin_socket();
+    admin_socket->unregister_commands(this);
+  }
+private:
+  SocketHook(BlueStore* store) :
+    store(store) {}
+  int call(std::string_view command, const cmdmap_t& cmdmap,
+	   const bufferlist&,
+	   Formatter *f,
+	   std::ostream& errss,
+	   bufferlist& out) override {
+    if (command == "bluestore fsck status") {
+      store->fsck_progress.dump(f);
+    } else if (command == "bluestore defrag status") {
+      store->defrag_thread.dump(f);
+    } else if (command == "bluestore tier status") {
+      store->tier_thread.dump(f);
+    } else if (!store->mounted) {
+      errss << "store is not mounted" << std::endl;
+      return -EBUSY;
+    } else if (command == "bluestore defrag start") {
+      double target =
+	store->cct->_conf.get_val<double>("bluestore_defrag_target_ratio");
+      cmd_getval(cmdmap, "target", target);
+      store->defrag_thread.start(target);
+      store->defrag_thread.dump(f);
+    } else if (command == "bluestore defrag stop") {
+      store->defrag_thread.abort();
+      store->defrag_thread.dump(f);
+    } else if (command == "bluestore compression dict train") {
+      int64_t pool = -1;
+      cmd_getval(cmdmap, "pool", pool);
+      int64_t size = store->cct->_conf.get_val<Option::size_t>(
+	"bluestore_compression_dict_max_size");
+      cmd_getval(cmdmap, "size", size);
+      int64_t samples = store->cct->_conf.get_val<uint64_t>(
+	"bluestore_compression_dict_samples");
+      cmd_getval(cmdmap, "samples", samples);
+      if (size <= 0 || samples <= 0) {
+	errss << "size and samples must be positive" << std::endl;
+	return -EINVAL;
+      }
+      return store->_train_compression_dict(pool, size, samples, f, errss);
+    } else if (command == "bluestore compression dict clear") {
+      int64_t pool = -1;
+      cmd_getval(cmdmap, "pool", pool);
+      int r = store->_clear_compression_dict(pool);
+      if (r < 0) {
+	errss << "pool " << pool << " has no dictionary" << std::endl;
+      }
+      return r;
+    } else if (command == "bluestore compression stats") {
+      store->_dump_compression_stats(f);
+    } else {
+      errss << "Invalid command" << std::endl;
+      return -ENOSYS;
+    }
+    return 0;
+  }
+};
+
 BlueStore::BlueStore(CephContext *cct, const string& path)
   : BlueStore(cct, path, 0) {}
 
@@ -5655,16 +6693,23 @@ BlueStore::BlueStore(CephContext *cct,
     kv_finalize_thread(this),
     min_alloc_size(_min_alloc_size),
     min_alloc_size_order(std::countr_zero(_min_alloc_size)),
-    mempool_thread(this)
+    mempool_thread(this),
+    defrag_thread(this),
+    tier_thread(this),
+    alloc_ckpt_thread(this),
+    compress_pool(this)
 {
   _init_logger();
   cct->_conf.add_observer(this);
   set_cache_shards(1);
+  _set_onode_prefetch();
+  _set_tier_promote_heat();
   bluestore_bdev_label_require_all = cct->_conf.get_val<bool>("bluestore_bdev_label_require_all");
 }
 
 BlueStore::~BlueStore()
 {
+  _asok_unregister();
   cct->_conf.remove_observer(this);
   _shutdown_logger();
   ceph_assert(!mounted);
@@ -5682,6 +6727,21 @@ BlueStore::~BlueStore()
   buffer_cache_shards.clear();
 }
 
+bool BlueStore::_asok_register()
+{
+  if (asok_hook) {
+    return false;
+  }
+  asok_hook = SocketHook::create(this);
+  return true;
+}
+
+void BlueStore::_asok_unregister()
+{
+  delete asok_hook;
+  asok_hook = nullptr;
+}
+
 const char **BlueStore::get_tracked_conf_keys() const
 {
   static const char* KEYS[] = {
@@ -5726,6 +6786,9 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_warn_on_no_per_pool_omap",
     "bluestore_warn_on_no_per_pg_omap",
     "bluestore_max_defer_interval",
+    "bluestore_onode_prefetch_count",
+    "bluestore_onode_prefetch_trigger",
+    "bluestore_tier_promote_heat",
     NULL
   };
   return KEYS;
@@ -5790,6 +6853,13 @@ void BlueStore::handle_conf_change(const ConfigProxy& conf,
       _set_max_defer_interval();
     }
   }
+  if (changed.count("bluestore_onode_prefetch_count") ||
+      changed.count("bluestore_onode_prefetch_trigger")) {
+    _set_onode_prefetch();
+  }
+  if (changed.count("bluestore_tier_promote_heat")) {
+    _set_tier_promote_heat();
+  }
   if (changed.count("osd_memory_target") ||
       changed.count("osd_memory_base") ||
       changed.count("osd_memory_cache_min") ||
@@ -6194,6 +7264,22 @@ void BlueStore::_init_logger()
   b.add_time_avg(l_bluestore_read_lat, "read_lat",
 		 "Average read latency",
 		 "r_l", PerfCountersBuilder::PRIO_CRITICAL);
+  b.add_u64_counter(l_bluestore_read_bytes_shared, "read_bytes_shared",
+		    "Read bytes returned by reference to device or cache buffers",
+		    NULL,
+		    PerfCountersBuilder::PRIO_USEFUL,
+		    unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_read_bytes_copied, "read_bytes_copied",
+		    "Read bytes that had to be produced by a copy (decompression)",
+		    NULL,
+		    PerfCountersBuilder::PRIO_USEFUL,
+		    unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_read_use_once_bytes, "read_use_once_bytes",
+		    "Read bytes served for use-once (scrub, recovery) requests "
+		    "without populating or promoting buffer cache",
+		    NULL,
+		    PerfCountersBuilder::PRIO_USEFUL,
+		    unit_t(UNIT_BYTES));
   //****************************************
 
   // kv_thread latencies
@@ -6270,6 +7356,23 @@ void BlueStore::_init_logger()
 		    NULL,
 		    PerfCountersBuilder::PRIO_DEBUGONLY,
 		    unit_t(UNIT_BYTES));
+  b.add_u64_avg(l_bluestore_deferred_elevator_batches,
+		"deferred_elevator_batches",
+		"Sequencer batches merged into each deferred write sweep");
+  b.add_u64_counter(l_bluestore_deferred_elevator_ios,
+		    "deferred_elevator_ios",
+		    "Deferred ios merged into deferred write sweeps");
+  b.add_u64_counter(l_bluestore_deferred_elevator_writes,
+		    "deferred_elevator_writes",
+		    "Device writes issued by deferred write sweeps",
+		    NULL,
+		    PerfCountersBuilder::PRIO_DEBUGONLY);
+  b.add_u64_avg(l_bluestore_deferred_elevator_seek_bytes,
+		"deferred_elevator_seek_bytes",
+		"Head movement between the writes of a deferred write sweep",
+		NULL,
+		PerfCountersBuilder::PRIO_DEBUGONLY,
+		unit_t(UNIT_BYTES));
 
   b.add_u64_counter(l_bluestore_write_big_skipped_blobs,
       "write_big_skipped_blobs",
@@ -6306,6 +7409,10 @@ void BlueStore::_init_logger()
 	    "Sum for beneficial compress ops");
   b.add_u64_counter(l_bluestore_compress_rejected_count, "compress_rejected_count",
 	    "Sum for compress ops rejected due to low net gain of space");
+  b.add_time_avg(l_bluestore_compress_queue_lat, "compress_queue_lat",
+	    "Average time a blob waited before its compression started");
+  b.add_u64_counter(l_bluestore_compress_offloaded_count, "compress_offloaded_count",
+	    "Sum for blobs compressed by the compression thread pool");
   //****************************************
 
   // onode cache stats
@@ -6325,6 +7432,26 @@ void BlueStore::_init_logger()
   b.add_u64_counter(l_bluestore_onode_shard_misses,
 		    "onode_shard_misses",
 		    "Count of onode shard cache lookups misses");
+  b.add_u64_counter(l_bluestore_onode_inline_decodes,
+		    "onode_inline_decodes",
+		    "Count of unsharded extent maps decoded on first access");
+  b.add_u64_counter(l_bluestore_onode_use_once,
+		    "onode_use_once",
+		    "Count of onodes loaded by use-once reads and kept at "
+		    "the cold end of cache");
+  b.add_u64_counter(l_bluestore_onode_prefetch_runs,
+		    "onode_prefetch_runs",
+		    "Count of onode prefetches started by sequential lookups");
+  b.add_u64_counter(l_bluestore_onode_prefetched,
+		    "onode_prefetched",
+		    "Count of onodes loaded into cache ahead of use");
+  b.add_u64_counter(l_bluestore_onode_prefetch_shards,
+		    "onode_prefetch_shards",
+		    "Count of extent map shards loaded along with prefetched "
+		    "onodes");
+  b.add_u64_counter(l_bluestore_onode_prefetch_hits,
+		    "onode_prefetch_hits",
+		    "Count of prefetched onodes later found in cache");
   b.add_u64(l_bluestore_extents, "onode_extents",
 	    "Number of extents in cache");
   b.add_u64(l_bluestore_blobs, "onode_blobs",
@@ -6350,6 +7477,20 @@ void BlueStore::_init_logger()
 	    NULL,
 	    PerfCountersBuilder::PRIO_DEBUGONLY,
 	    unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_buffer_ghost_recent_hit_bytes,
+	    "buffer_ghost_recent_hit_bytes",
+	    "Sum for bytes of read missed in the cache but recently evicted "
+	    "from the recency list (arc only)",
+	    NULL,
+	    PerfCountersBuilder::PRIO_DEBUGONLY,
+	    unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_buffer_ghost_frequent_hit_bytes,
+	    "buffer_ghost_frequent_hit_bytes",
+	    "Sum for bytes of read missed in the cache but recently evicted "
+	    "from the frequency list (arc only)",
+	    NULL,
+	    PerfCountersBuilder::PRIO_DEBUGONLY,
+	    unit_t(UNIT_BYTES));
   //****************************************
 
   // internal stats
@@ -6363,6 +7504,20 @@ void BlueStore::_init_logger()
   b.add_u64_counter(l_bluestore_gc_merged, "gc_merged",
 		    "Sum for extents that have been merged due to garbage "
 		    "collection");
+  b.add_u64_counter(l_bluestore_defrag_objects, "defrag_objects",
+		    "Objects rewritten by the background defragmenter");
+  b.add_u64_counter(l_bluestore_defrag_bytes, "defrag_bytes",
+		    "Bytes rewritten by the background defragmenter",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_tier_promoted_bytes, "tier_promoted_bytes",
+		    "Bytes of hot objects moved to the fast tier",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_tier_demoted_bytes, "tier_demoted_bytes",
+		    "Bytes of cold objects moved off the fast tier",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64(l_bluestore_tier_fast_free, "tier_fast_free",
+	    "Free space on the fast tier of the main device",
+	    NULL, 0, unit_t(UNIT_BYTES));
   //****************************************
   // misc
   //****************************************
@@ -6372,6 +7527,12 @@ void BlueStore::_init_logger()
     "amount of omap keys removed via rmkeys");
   b.add_u64_counter(l_bluestore_omap_rmkey_ranges_count, "omap_rmkey_range_count",
     "amount of omap key ranges removed via rmkeys");
+  b.add_u64_counter(l_bluestore_omap_rmkeys_ranged_count, "omap_rmkeys_ranged_count",
+    "amount of omap keys removed via rmkeys that were coalesced into range deletes");
+  b.add_u64_avg(l_bluestore_omap_iterate_tombstones, "omap_iterate_tombstones",
+    "Deleted omap entries skipped per omap iteration");
+  b.add_u64_counter(l_bluestore_omap_compact_hints, "omap_compact_hints",
+    "Object omap ranges queued for compaction due to tombstones");
   //****************************************
   // other client ops latencies
   //****************************************
@@ -6453,6 +7614,14 @@ void BlueStore::_init_logger()
     "Average bluestore allocator latency",
     "bsal",
     PerfCountersBuilder::PRIO_USEFUL);
+  b.add_u64_counter(l_bluestore_alloc_journal_records, "alloc_journal_records",
+    "Allocation journal records written");
+  b.add_u64_counter(l_bluestore_alloc_journal_replayed, "alloc_journal_replayed",
+    "Allocation journal records replayed on mount");
+  b.add_u64_counter(l_bluestore_alloc_checkpoints, "alloc_checkpoints",
+    "Allocation map checkpoints written");
+  b.add_time_avg(l_bluestore_alloc_checkpoint_lat, "alloc_checkpoint_lat",
+    "Average time to write an allocation map checkpoint");
 
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
@@ -7122,11 +8291,37 @@ int BlueStore::_create_alloc()
 
   std::string allocator_type = cct->_conf->bluestore_allocator;
 
-  alloc = Allocator::create(
-    cct, allocator_type,
-    bdev->get_size(),
-    alloc_size,
-    "block");
+  uint64_t fast_size = p2align<uint64_t>(
+    cct->_conf.get_val<Option::size_t>("bluestore_fast_tier_size"),
+    alloc_size);
+  if (fast_size >= bdev->get_size()) {
+    derr << __func__ << " bluestore_fast_tier_size 0x" << std::hex
+	 << fast_size << " does not leave a slow tier on a 0x"
+	 << bdev->get_size() << std::dec << " device, ignoring" << dendl;
+    fast_size = 0;
+  }
+  if (fast_size) {
+    Allocator *fast = Allocator::create(
+      cct, allocator_type, fast_size, alloc_size, "block.fast");
+    Allocator *slow = Allocator::create(
+      cct, allocator_type, bdev->get_size() - fast_size, alloc_size,
+      "block.slow");
+    if (fast && slow) {
+      tiered_alloc = new TieredAllocator(cct, fast, slow, fast_size, "block");
+      alloc = tiered_alloc;
+      dout(1) << __func__ << " fast tier 0x0~0x" << std::hex << fast_size
+	      << std::dec << dendl;
+    } else {
+      delete fast;
+      delete slow;
+    }
+  } else {
+    alloc = Allocator::create(
+      cct, allocator_type,
+      bdev->get_size(),
+      alloc_size,
+      "block");
+  }
   if (!alloc) {
     lderr(cct) << __func__ << " failed to create " << allocator_type << " allocator"
 	       << dendl;
@@ -7175,6 +8370,10 @@ int BlueStore::_init_alloc(std::map<uint64_t, uint64_t> *zone_adjustments)
     }
     if (restore_allocator(alloc, &num, &bytes) == 0) {
       dout(5) << __func__ << "::NCB::restore_allocator() completed successfully alloc=" << alloc << dendl;
+    } else if (cct->_conf.get_val<bool>("bluestore_allocation_journal") &&
+	       restore_allocator_from_journal(alloc, &num, &bytes) == 0) {
+      // an unplanned shutdown, but the allocation journal covers it
+      dout(1) << __func__ << "::NCB::restored allocation from checkpoint + journal" << dendl;
     } else {
       // This must mean that we had an unplanned shutdown and didn't manage to destage the allocator
       dout(0) << __func__ << "::NCB::restore_allocator() failed! Run Full Recovery from ONodes (might take a while) ..." << dendl;
@@ -7186,6 +8385,15 @@ int BlueStore::_init_alloc(std::map<uint64_t, uint64_t> *zone_adjustments)
 	return -ENOTRECOVERABLE;
       }
     }
+    if (cct->_conf.get_val<bool>("bluestore_allocation_journal")) {
+      // bluefs has not claimed its extents yet, so this is what the
+      // allocation file would hold; it becomes the first checkpoint once
+      // the db is writable
+      alloc_journal_base.emplace();
+      alloc->foreach([&](uint64_t offset, uint64_t length) {
+	alloc_journal_base->insert(offset, length);
+      });
+    }
   }
   dout(1) << __func__
           << " loaded " << byte_u_t(bytes) << " in " << num << " extents"
@@ -7230,6 +8438,9 @@ void BlueStore::_close_alloc()
 
   shared_alloc.reset();
   alloc = nullptr;
+  tiered_alloc = nullptr;
+  alloc_journal = false;
+  alloc_journal_base.reset();
 }
 
 int BlueStore::_open_fsid(bool create)
@@ -7709,6 +8920,14 @@ int BlueStore::_open_db_and_around(bool read_only, bool to_repair)
     dout(10) << __func__ << "::NCB::need_to_destage_allocation_file was set" << dendl;
   }
 
+  if (fm->is_null_manager() && !read_only && !to_repair) {
+    // fsck repair and the tool paths change the allocator outside of txcs,
+    // the journal can't follow. only _mount() starts a new one, once it is
+    // done with such changes; until then an unclean restart has to walk
+    // the onodes
+    invalidate_allocation_checkpoint();
+  }
+
   return 0;
 
 out_alloc:
@@ -8085,6 +9304,7 @@ int BlueStore::_open_collections()
     dout(20) << __func__ << "::NCB::collections are already opened, nothing to do" << dendl;
     return 0;
   }
+  _load_compression_dicts();
 
   dout(10) << __func__ << dendl;
   collections_had_errors = false;
@@ -8990,6 +10210,12 @@ int BlueStore::_mount()
   }
 
   _kv_only = false;
+  _asok_register();
+  auto unregister_asok = make_scope_guard([&] {
+    if (!mounted) {
+      _asok_unregister();
+    }
+  });
   if (cct->_conf->bluestore_fsck_on_mount) {
     int rc = fsck(cct->_conf->bluestore_fsck_on_mount_deep);
     if (rc < 0)
@@ -9060,6 +10286,8 @@ int BlueStore::_mount()
 
     dout(1) << __func__ << " quick-fix on mount" << dendl;
     _fsck_on_open(FSCK_SHALLOW, true);
+    // the repair may have changed the allocator behind our back
+    alloc_journal_base.reset();
 
     //set again as hopefully it has been fixed
     if (was_per_pool_omap != OMAP_PER_PG) {
@@ -9067,6 +10295,24 @@ int BlueStore::_mount()
     }
   }
 
+  if (alloc_journal_base) {
+    if (start_allocation_journal() < 0) {
+      derr << __func__ << " failed to start the allocation journal" << dendl;
+    }
+    alloc_journal_base.reset();
+  }
+
+  // background writers start once the quick-fix above is done with
+  // the store
+  defrag_thread.init();
+  if (tiered_alloc) {
+    tier_thread.init();
+  }
+  if (alloc_journal) {
+    alloc_ckpt_thread.init();
+  }
+  compress_pool.init(cct->_conf.get_val<uint64_t>("bluestore_compression_threads"));
+
   mounted = true;
   return 0;
 }
@@ -9075,7 +10321,20 @@ int BlueStore::umount()
 {
   dout(5) << __func__ << dendl;
   ceph_assert(_kv_only || mounted);
+  if (!_kv_only) {
+    _asok_unregister();
+    defrag_thread.shutdown();
+    if (tier_thread.is_started()) {
+      tier_thread.shutdown();
+    }
+    if (alloc_ckpt_thread.is_started()) {
+      alloc_ckpt_thread.shutdown();
+    }
+  }
   _osr_drain_all();
+  if (!_kv_only) {
+    compress_pool.shutdown();
+  }
 
   mounted = false;
 
@@ -9484,6 +10743,8 @@ BlueStore::OnodeRef BlueStore::fsck_check_objects_shallow(
   OnodeRef o;
   o.reset(Onode::create_decode(c, oid, key, value));
   ++num_objects;
+  ++fsck_progress.objects;
+  fsck_progress.bytes += o->onode.size;
 
   num_spanning_blobs += o->extent_map.spanning_blob_map.size();
 
@@ -10081,13 +11342,417 @@ void BlueStore::_fsck_check_object_omap(FSCKDepth depth,
   }
 }
 
-void BlueStore::_fsck_check_objects(
-  FSCKDepth depth,
-  BlueStore::FSCK_ObjectCtx& ctx)
+int64_t BlueStore::_fsck_read_object(Collection *c, OnodeRef& o)
 {
-  auto& errors = ctx.errors;
-  auto sb_info_lock = ctx.sb_info_lock;
-  auto& sb_info = ctx.sb_info;
+  // _do_read verifies blob checksums on the way
+  bufferlist bl;
+  uint64_t max_read_block = cct->_conf->bluestore_fsck_read_bytes_cap;
+  uint64_t offset = 0;
+  do {
+    uint64_t l = std::min(uint64_t(o->onode.size - offset), max_read_block);
+    int r = _do_read(c, o, offset, l, bl,
+      CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+    if (r < 0) {
+      derr << "fsck error: " << o->oid << std::hex
+        << " error during read: "
+        << " " << offset << "~" << l
+        << " " << cpp_strerror(r) << std::dec
+        << dendl;
+      return 1;
+    }
+    fsck_progress.read_bytes += l;
+    offset += l;
+    bl.clear();
+  } while (offset < o->onode.size);
+  return 0;
+}
+
+int64_t BlueStore::_fsck_read_objects(
+  std::vector<std::pair<CollectionRef, OnodeRef>>& batch)
+{
+  // Read back the data of several objects with as few, as large device
+  // reads as possible: the blob regions of all of them are sorted by
+  // device offset and merged across small gaps. The result is then
+  // checked object by object the way _do_read does it.
+  const uint64_t max_read = cct->_conf->bluestore_fsck_read_bytes_cap;
+  struct object_read_t {
+    ready_regions_t ready_regions;
+    blobs2read_t blobs2read;
+    vector<bufferlist> compressed_blob_bls;
+  };
+  struct piece_t {
+    uint64_t offset;
+    uint64_t length;
+    bufferlist *bl;   ///< appended to in the order pieces were added
+    size_t read = 0;  ///< device read it is part of
+  };
+  vector<object_read_t> reads(batch.size());
+  vector<piece_t> pieces;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    auto& [c, o] = batch[i];
+    if (o->onode.size > max_read) {
+      continue;
+    }
+    std::shared_lock l{c->lock};
+    o->extent_map.fault_range(db, 0, o->onode.size);
+    auto& rd = reads[i];
+    _read_cache(o, 0, o->onode.size, BufferSpace::BYPASS_CLEAN_CACHE,
+		rd.ready_regions, rd.blobs2read);
+    rd.compressed_blob_bls.reserve(rd.blobs2read.size());
+    for (auto& [bptr, r2r] : rd.blobs2read) {
+      const bluestore_blob_t& blob = bptr->get_blob();
+      auto add = [&](uint64_t b_off, uint64_t b_len, bufferlist *bl) {
+	int r = blob.map(b_off, b_len, [&](uint64_t offset, uint64_t length) {
+	  pieces.push_back(piece_t{offset, length, bl});
+	  return 0;
+	});
+	ceph_assert(r == 0);
+      };
+      if (blob.is_compressed()) {
+	rd.compressed_blob_bls.emplace_back();
+	add(0, blob.get_ondisk_length(), &rd.compressed_blob_bls.back());
+      } else {
+	for (auto& req : r2r) {
+	  add(req.r_off, req.r_len, &req.bl);
+	}
+      }
+    }
+  }
+
+  vector<size_t> order(pieces.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return pieces[a].offset < pieces[b].offset;
+  });
+  // reading a gap of up to an allocation unit beats another request
+  vector<std::pair<uint64_t, uint64_t>> extents;
+  for (auto i : order) {
+    auto& p = pieces[i];
+    if (!extents.empty()) {
+      auto& [off, len] = extents.back();
+      if (p.offset <= off + len + min_alloc_size &&
+	  p.offset + p.length - off <= max_read) {
+	len = std::max(len, p.offset + p.length - off);
+	p.read = extents.size() - 1;
+	continue;
+      }
+    }
+    p.read = extents.size();
+    extents.emplace_back(p.offset, p.length);
+  }
+  dout(20) << __func__ << " " << batch.size() << " objects, "
+	   << pieces.size() << " regions in " << extents.size() << " reads"
+	   << dendl;
+
+  vector<bufferlist> bls(extents.size());
+  IOContext ioc(cct, NULL, !cct->_conf->bluestore_fail_eio);
+  int r = 0;
+  for (size_t i = 0; i < extents.size() && r == 0; ++i) {
+    r = bdev->aio_read(extents[i].first, extents[i].second, &bls[i], &ioc);
+  }
+  if (r == 0 && ioc.has_pending_aios()) {
+    bdev->aio_submit(&ioc);
+    ioc.aio_wait();
+    r = ioc.get_return_value();
+  }
+  if (r < 0) {
+    dout(10) << __func__ << " batch read failed: " << cpp_strerror(r)
+	     << ", reading objects one by one" << dendl;
+  } else {
+    for (auto& p : pieces) {
+      bufferlist t;
+      t.substr_of(bls[p.read], p.offset - extents[p.read].first, p.length);
+      p.bl->claim_append(t);
+    }
+  }
+
+  int64_t errors = 0;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    auto& [c, o] = batch[i];
+    if (r == 0 && o->onode.size <= max_read) {
+      auto& rd = reads[i];
+      bool csum_error = false;
+      bufferlist bl;
+      int rr;
+      {
+	std::shared_lock l{c->lock};
+	rr = _generate_read_result_bl(o, 0, o->onode.size, rd.ready_regions,
+				      rd.compressed_blob_bls, rd.blobs2read,
+				      false, &csum_error, bl);
+      }
+      if (rr >= 0) {
+	fsck_progress.read_bytes += o->onode.size;
+	continue;
+      }
+    }
+    // read it again on its own, which retries and reports what is wrong
+    std::shared_lock l{c->lock};
+    errors += _fsck_read_object(c.get(), o);
+  }
+  return errors;
+}
+
+/*
+ * Bounded pool reading back object data for deep fsck, so that device
+ * reads and checksum verification of many objects overlap with the
+ * (inherently sequential) object keyspace walk. Each thread takes queued
+ * objects in batches of up to bluestore_fsck_read_bytes_cap and reads
+ * them in device order.
+ */
+class BlueStore::FSCKDeepReader {
+  BlueStore* store;
+  ceph::mutex lock = ceph::make_mutex("BlueStore::FSCKDeepReader::lock");
+  ceph::condition_variable cond;
+  ceph::condition_variable space_cond;
+  std::deque<std::pair<CollectionRef, OnodeRef>> q;
+  size_t max_queued;
+  bool stopping = false;
+  std::vector<std::thread> threads;
+  std::atomic<int64_t> errors = {0};
+
+  void entry() {
+    const uint64_t batch_bytes = store->cct->_conf->bluestore_fsck_read_bytes_cap;
+    std::unique_lock l{lock};
+    while (true) {
+      if (q.empty()) {
+        if (stopping) {
+          break;
+        }
+        cond.wait(l);
+        continue;
+      }
+      // take as many objects as fit into one read
+      std::vector<std::pair<CollectionRef, OnodeRef>> batch;
+      uint64_t bytes = 0;
+      while (!q.empty() &&
+             (batch.empty() ||
+              bytes + q.front().second->onode.size <= batch_bytes)) {
+        bytes += q.front().second->onode.size;
+        batch.push_back(std::move(q.front()));
+        q.pop_front();
+      }
+      space_cond.notify_all();
+      l.unlock();
+      errors += store->_fsck_read_objects(batch);
+      l.lock();
+    }
+  }
+
+public:
+  FSCKDeepReader(BlueStore* _store, size_t n)
+    : store(_store), max_queued(n * 64) {
+    for (size_t i = 0; i < n; ++i) {
+      threads.emplace_back(make_named_thread("bstore_fsck_rd",
+        &FSCKDeepReader::entry, this));
+    }
+  }
+  ~FSCKDeepReader() {
+    finish();
+  }
+
+  void queue(CollectionRef& c, OnodeRef& o) {
+    std::unique_lock l{lock};
+    space_cond.wait(l, [this] { return q.size() < max_queued; });
+    q.emplace_back(c, o);
+    cond.notify_one();
+  }
+
+  // wait for all queued objects, returns the number of errors found
+  int64_t finish() {
+    {
+      std::lock_guard l{lock};
+      stopping = true;
+      cond.notify_all();
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    threads.clear();
+    return errors.exchange(0);
+  }
+};
+
+/*
+ * Warms the kv cache for an fsck keyspace walk. The keyspace is cut into
+ * ranges which a few threads iterate, in key order, while the walk itself
+ * stays sequential and finds the keys in cache. The threads stay within
+ * MAX_AHEAD keys of the walk, so they don't evict what it is about to
+ * read.
+ */
+class BlueStore::FSCKKeyPrefetcher {
+  static constexpr uint64_t MAX_AHEAD = 1 << 16;
+  static constexpr uint64_t REPORT_EVERY = 1 << 10;
+
+  KeyValueDB* db;
+  const std::string prefix;
+  /// range i is [bounds[i], bounds[i + 1]), the last one is open ended
+  const std::vector<std::string> bounds;
+
+  ceph::mutex lock = ceph::make_mutex("BlueStore::FSCKKeyPrefetcher::lock");
+  ceph::condition_variable cond;
+  size_t next_range = 0;
+  uint64_t prefetched = 0;
+  uint64_t walked = 0;
+  bool stopping = false;
+  uint64_t walked_unreported = 0;  ///< walker's own
+  std::vector<std::thread> threads;
+
+  // false once stopping
+  bool account(uint64_t n) {
+    std::unique_lock l{lock};
+    prefetched += n;
+    cond.wait(l, [this] {
+      return stopping || prefetched < walked + MAX_AHEAD;
+    });
+    return !stopping;
+  }
+
+  void entry() {
+    auto it = db->get_iterator(prefix);
+    std::unique_lock l{lock};
+    while (!stopping && next_range < bounds.size()) {
+      size_t i = next_range++;
+      l.unlock();
+      uint64_t n = 0;
+      for (it->lower_bound(bounds[i]); it->valid(); it->next()) {
+        if (i + 1 < bounds.size() && it->key() >= bounds[i + 1]) {
+          break;
+        }
+        if (++n == REPORT_EVERY) {
+          if (!account(n)) {
+            return;
+          }
+          n = 0;
+        }
+      }
+      account(n);
+      l.lock();
+    }
+  }
+
+public:
+  FSCKKeyPrefetcher(KeyValueDB* _db, const std::string& _prefix,
+                    std::vector<std::string>&& _bounds, size_t n)
+    : db(_db), prefix(_prefix), bounds(std::move(_bounds)) {
+    for (size_t i = 0; i < n; ++i) {
+      threads.emplace_back(make_named_thread("bstore_fsck_pf",
+        &FSCKKeyPrefetcher::entry, this));
+    }
+  }
+  ~FSCKKeyPrefetcher() {
+    {
+      std::lock_guard l{lock};
+      stopping = true;
+      cond.notify_all();
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+  }
+
+  /// called by the walk for every key it visits
+  void walked_key() {
+    if (++walked_unreported == REPORT_EVERY) {
+      std::lock_guard l{lock};
+      walked += walked_unreported;
+      walked_unreported = 0;
+      cond.notify_all();
+    }
+  }
+};
+
+std::unique_ptr<BlueStore::FSCKKeyPrefetcher>
+BlueStore::_fsck_prefetch_objects()
+{
+  auto n = cct->_conf.get_val<uint64_t>("bluestore_fsck_prefetch_threads");
+  if (n == 0) {
+    return nullptr;
+  }
+  // a range per collection temp section and per 1/16th of its hash range
+  constexpr unsigned SLICES = 16;
+  std::vector<std::string> bounds{string()};
+  for (auto& [cid, c] : coll_map) {
+    ghobject_t temp_start, temp_end, start, end;
+    get_coll_range(cid, c->cnode.bits, &temp_start, &temp_end, &start, &end,
+                   false);
+    string key;
+    if (cid.is_pg()) {
+      get_object_key(cct, temp_start, &key);
+      bounds.push_back(key);
+    }
+    uint64_t first = start.hobj.get_bitwise_key_u32();
+    uint64_t span = cid.is_pg() ?
+      1ull << (32 - c->cnode.bits) : 1ull << 32;
+    for (unsigned i = 0; i < SLICES; ++i) {
+      ghobject_t b = start;
+      b.hobj.set_bitwise_key_u32(first + span * i / SLICES);
+      get_object_key(cct, b, &key);
+      bounds.push_back(key);
+    }
+  }
+  std::sort(bounds.begin(), bounds.end());
+  bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+  return std::make_unique<FSCKKeyPrefetcher>(db, PREFIX_OBJ, std::move(bounds),
+                                             n);
+}
+
+std::unique_ptr<BlueStore::FSCKKeyPrefetcher>
+BlueStore::_fsck_prefetch_shared_blobs()
+{
+  auto n = cct->_conf.get_val<uint64_t>("bluestore_fsck_prefetch_threads");
+  if (n == 0) {
+    return nullptr;
+  }
+  // shared blob ids are handed out in order, cut them into even ranges
+  constexpr unsigned SLICES = 64;
+  std::vector<std::string> bounds{string()};
+  for (unsigned i = 1; i < SLICES && blobid_max >= SLICES; ++i) {
+    string key;
+    get_shared_blob_key(blobid_max / SLICES * i, &key);
+    bounds.push_back(key);
+  }
+  return std::make_unique<FSCKKeyPrefetcher>(db, PREFIX_SHARED_BLOB,
+                                             std::move(bounds), n);
+}
+
+void BlueStore::FSCKProgress::dump(Formatter *f)
+{
+  std::lock_guard l(lock);
+  f->open_object_section("fsck");
+  f->dump_bool("running", running);
+  f->dump_string("mode", mode);
+  f->dump_string("phase", phase);
+  f->dump_stream("started") << started;
+  if (!running) {
+    f->dump_stream("finished") << finished;
+  }
+  double elapsed = (double)((running ? ceph_clock_now() : finished) - started);
+  f->dump_float("elapsed", elapsed);
+  f->dump_unsigned("objects", objects);
+  f->dump_unsigned("bytes", bytes);
+  f->dump_unsigned("read_bytes", read_bytes);
+  f->dump_unsigned("expected_bytes", expected_bytes);
+  // a rough estimate: compression, holes and bluefs usage on the shared
+  // device all skew the walked/used ratio
+  double progress = running ?
+    (expected_bytes ? std::min(0.99, (double)bytes / expected_bytes) : 0) :
+    1.0;
+  f->dump_float("progress", progress);
+  if (running && progress > 0) {
+    f->dump_float("eta", elapsed * (1 - progress) / progress);
+  }
+  f->close_section();
+}
+
+void BlueStore::_fsck_check_objects(
+  FSCKDepth depth,
+  BlueStore::FSCK_ObjectCtx& ctx)
+{
+  auto& errors = ctx.errors;
+  auto sb_info_lock = ctx.sb_info_lock;
+  auto& sb_info = ctx.sb_info;
   auto& sb_ref_counts = ctx.sb_ref_counts;
   auto repairer = ctx.repairer;
 
@@ -10098,6 +11763,13 @@ void BlueStore::_fsck_check_objects(
   auto it = db->get_iterator(PREFIX_OBJ, KeyValueDB::ITERATOR_NOCACHE);
   mempool::bluestore_fsck::list<string> expecting_shards;
   if (it) {
+    std::unique_ptr<FSCKDeepReader> deep_reader;
+    if (depth == FSCK_DEEP) {
+      if (auto n = cct->_conf.get_val<uint64_t>("bluestore_fsck_deep_read_threads");
+          n > 0) {
+        deep_reader = std::make_unique<FSCKDeepReader>(this, n);
+      }
+    }
     const size_t thread_count = cct->_conf->bluestore_fsck_quick_fix_threads;
     typedef ShallowFSCKThreadPool::FSCKWorkQueue<256> WQ;
     std::unique_ptr<WQ> wq(
@@ -10119,6 +11791,8 @@ void BlueStore::_fsck_check_objects(
       thread_pool.start();
     }
 
+    auto prefetcher = _fsck_prefetch_objects();
+
     // fill global if not overriden below
     CollectionRef c;
     int64_t pool_id = -1;
@@ -10126,6 +11800,9 @@ void BlueStore::_fsck_check_objects(
     for (it->lower_bound(string()); it->valid(); it->next()) {
       dout(30) << __func__ << " key "
         << pretty_binary_string(it->key()) << dendl;
+      if (prefetcher) {
+        prefetcher->walked_key();
+      }
       if (is_extent_shard_key(it->key())) {
         if (depth == FSCK_SHALLOW) {
           continue;
@@ -10304,27 +11981,17 @@ void BlueStore::_fsck_check_objects(
           }
         } // if (o->onode.has_omap())
         if (depth == FSCK_DEEP) {
-          bufferlist bl;
-          uint64_t max_read_block = cct->_conf->bluestore_fsck_read_bytes_cap;
-          uint64_t offset = 0;
-          do {
-            uint64_t l = std::min(uint64_t(o->onode.size - offset), max_read_block);
-            int r = _do_read(c.get(), o, offset, l, bl,
-              CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
-            if (r < 0) {
-              ++errors;
-              derr << "fsck error: " << oid << std::hex
-                << " error during read: "
-                << " " << offset << "~" << l
-                << " " << cpp_strerror(r) << std::dec
-                << dendl;
-              break;
-            }
-            offset += l;
-          } while (offset < o->onode.size);
+          if (deep_reader) {
+            deep_reader->queue(c, o);
+          } else {
+            errors += _fsck_read_object(c.get(), o);
+          }
         } // deep
       } //if (depth != FSCK_SHALLOW)
     } // for (it->lower_bound(string()); it->valid(); it->next())
+    if (deep_reader) {
+      errors += deep_reader->finish();
+    }
     if (depth == FSCK_SHALLOW && thread_count > 0) {
       wq->finalize(thread_pool, ctx);
       if (processed_myself) {
@@ -10382,6 +12049,14 @@ int BlueStore::_fsck(BlueStore::FSCKDepth depth, bool repair)
       depth == FSCK_SHALLOW ? " (shallow)" : " (regular)")
     << dendl;
 
+  // mount-time fsck runs with the mount's registration
+  bool own_asok = _asok_register();
+  auto unregister_asok = make_scope_guard([&] {
+    if (own_asok) {
+      _asok_unregister();
+    }
+  });
+
   // hack - sanitize check for bdev label
   bluestore_bdev_label_require_all = false;
   auto restore_option = make_scope_guard([&] {
@@ -10448,6 +12123,15 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
   int64_t warnings = 0;
   unsigned repaired = 0;
 
+  fsck_progress.start(
+    std::string(repair ? "repair" : "check") +
+      (depth == FSCK_DEEP ? " (deep)" :
+        depth == FSCK_SHALLOW ? " (shallow)" : " (regular)"),
+    alloc ? alloc->get_capacity() - alloc->get_free() : 0);
+  auto finish_progress = make_scope_guard([&] {
+    fsck_progress.finish();
+  });
+
   std::vector<uint64_t> bdev_labels_broken;
   std::vector<uint64_t> bdev_labels_in_repair;
   uint64_t_btree_t used_omap_head;
@@ -10626,9 +12310,14 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
   }
 
   dout(1) << __func__ << " checking shared_blobs (phase 1)" << dendl;
+  fsck_progress.set_phase("checking shared_blobs (phase 1)");
   it = db->get_iterator(PREFIX_SHARED_BLOB, KeyValueDB::ITERATOR_NOCACHE);
   if (it) {
+    auto prefetcher = _fsck_prefetch_shared_blobs();
     for (it->lower_bound(string()); it->valid(); it->next()) {
+      if (prefetcher) {
+        prefetcher->walked_key();
+      }
       string key = it->key();
       uint64_t sbid;
       if (get_key_shared_blob(key, &sbid) < 0) {
@@ -10665,6 +12354,7 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
   // walk PREFIX_OBJ
   {
     dout(1) << __func__ << " walking object keyspace" << dendl;
+    fsck_progress.set_phase("walking object keyspace");
     ceph::mutex sb_info_lock =  ceph::make_mutex("BlueStore::fsck::sbinfo_lock");
     BlueStore::FSCK_ObjectCtx ctx(
       errors,
@@ -10724,6 +12414,7 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
     _fsck_repair_shared_blobs(repairer, sb_ref_counts, sb_info);
   }
   dout(1) << __func__ << " checking shared_blobs (phase 2)" << dendl;
+  fsck_progress.set_phase("checking shared_blobs (phase 2)");
   it = db->get_iterator(PREFIX_SHARED_BLOB, KeyValueDB::ITERATOR_NOCACHE);
   if (it) {
     // FIXME minor: perhaps simplify for shallow mode?
@@ -10803,6 +12494,7 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
   if (repair && repairer.preprocess_misreference(db)) {
 
     dout(1) << __func__ << " sorting out misreferenced extents" << dendl;
+    fsck_progress.set_phase("sorting out misreferenced extents");
     auto& misref_extents = repairer.get_misreferences();
     interval_set<uint64_t> to_release;
     it = db->get_iterator(PREFIX_OBJ, KeyValueDB::ITERATOR_NOCACHE);
@@ -11004,10 +12696,12 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
   sb_ref_counts.reset();
 
   dout(1) << __func__ << " checking pool_statfs" << dendl;
+  fsck_progress.set_phase("checking pool_statfs");
   _fsck_check_statfs(expected_store_statfs, expected_pool_statfs,
     errors, warnings, repair ? &repairer : nullptr);
   if (depth != FSCK_SHALLOW) {
     dout(1) << __func__ << " checking for stray omap data " << dendl;
+    fsck_progress.set_phase("checking for stray omap data");
     it = db->get_iterator(PREFIX_OMAP, KeyValueDB::ITERATOR_NOCACHE);
     if (it) {
       uint64_t last_omap_head = 0;
@@ -11098,6 +12792,7 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
       }
     }
     dout(1) << __func__ << " checking deferred events" << dendl;
+    fsck_progress.set_phase("checking deferred events");
     it = db->get_iterator(PREFIX_DEFERRED, KeyValueDB::ITERATOR_NOCACHE);
     if (it) {
       for (it->lower_bound(string()); it->valid(); it->next()) {
@@ -11134,6 +12829,7 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
     // skip freelist vs allocated compare when we have Null fm
     if (!fm->is_null_manager()) {
       dout(1) << __func__ << " checking freelist vs allocated" << dendl;
+      fsck_progress.set_phase("checking freelist vs allocated");
       if (!bdev->supported_bdev_label()) {
         // it should be 0 labels if labels are not supported
         ceph_assert(bdev_label_valid_locations.empty());
@@ -11232,6 +12928,7 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
     }
 
     dout(5) << __func__ << " applying repair results" << dendl;
+    fsck_progress.set_phase("applying repair results");
     repaired = repairer.apply(db);
     dout(5) << __func__ << " repair applied" << dendl;
   }
@@ -11843,8 +13540,8 @@ BlueStore::CollectionRef BlueStore::_get_collection_by_oid(const ghobject_t& oid
 void BlueStore::_queue_reap_collection(CollectionRef& c)
 {
   dout(10) << __func__ << " " << c << " " << c->cid << dendl;
-  // _reap_collections and this in the same thread,
-  // so no need a lock.
+  // with sharded kv commits this may race with other finalizers
+  std::lock_guard l(reap_lock);
   removed_collections.push_back(c);
 }
 
@@ -11853,8 +13550,7 @@ void BlueStore::_reap_collections()
 
   list<CollectionRef> removed_colls;
   {
-    // _queue_reap_collection and this in the same thread.
-    // So no need a lock.
+    std::lock_guard l(reap_lock);
     if (!removed_collections.empty())
       removed_colls.swap(removed_collections);
     else
@@ -11884,6 +13580,7 @@ void BlueStore::_reap_collections()
   if (removed_colls.empty()) {
     dout(10) << __func__ << " all reaped" << dendl;
   } else {
+    std::lock_guard l(reap_lock);
     removed_collections.splice(removed_collections.begin(), removed_colls);
   }
 }
@@ -11967,11 +13664,20 @@ bool BlueStore::exists(CollectionHandle &c_, const ghobject_t& oid)
   return r;
 }
 
+// scrub and recovery access objects once with NOCACHE, keep what they
+// load out of the caches unless they asked for it to be cached anyway
+static bool is_use_once(uint32_t op_flags)
+{
+  return (op_flags & CEPH_OSD_OP_FLAG_FADVISE_NOCACHE) &&
+    !(op_flags & CEPH_OSD_OP_FLAG_FADVISE_WILLNEED);
+}
+
 int BlueStore::stat(
   CollectionHandle &c_,
   const ghobject_t& oid,
   struct stat *st,
-  bool allow_eio)
+  bool allow_eio,
+  uint32_t op_flags)
 {
   Collection *c = static_cast<Collection *>(c_.get());
   if (!c->exists)
@@ -11980,7 +13686,7 @@ int BlueStore::stat(
 
   {
     std::shared_lock l(c->lock);
-    OnodeRef o = c->get_onode(oid, false);
+    OnodeRef o = c->get_onode(oid, false, false, is_use_once(op_flags));
     if (!o || !o->exists)
       return -ENOENT;
     st->st_size = o->onode.size;
@@ -12031,7 +13737,7 @@ int BlueStore::read(
   {
     std::shared_lock l(c->lock);
     auto start1 = mono_clock::now();
-    OnodeRef o = c->get_onode(oid, false);
+    OnodeRef o = c->get_onode(oid, false, false, is_use_once(op_flags));
     log_latency("get_onode@read",
       l_bluestore_read_onode_meta_lat,
       mono_clock::now() - start1,
@@ -12045,6 +13751,9 @@ int BlueStore::read(
     if (offset == length && offset == 0)
       length = o->onode.size;
 
+    if (!(op_flags & CEPH_OSD_OP_FLAG_FADVISE_NOCACHE)) {
+      _tier_note_access(c, o);
+    }
     r = _do_read(c, o, offset, length, bl, op_flags);
     if (r == -EIO) {
       logger->inc(l_bluestore_read_eio);
@@ -12249,6 +13958,34 @@ int BlueStore::_generate_read_result_bl(
   bool* csum_error,
   bufferlist& bl)
 {
+ // cache hits are handed out by reference
+  uint64_t shared_bytes = 0, copied_bytes = 0;
+  for (auto& [off, rbl] : ready_regions) {
+    shared_bytes += rbl.length();
+  }
+
+ // verify all blobs in one batch, before anything is decompressed or cached
+  {
+    csum_batch_t batch;
+    auto p = compressed_blob_bls.begin();
+    for (auto& [bptr, r2r] : blobs2read) {
+      if (bptr->get_blob().is_compressed()) {
+        ceph_assert(p != compressed_blob_bls.end());
+        batch.add(&bptr->get_blob(), 0, *p++,
+                  r2r.front().regs.front().logical_offset);
+      } else {
+        for (auto& req : r2r) {
+          batch.add(&bptr->get_blob(), req.r_off, req.bl,
+                    req.regs.front().logical_offset);
+        }
+      }
+    }
+    if (_verify_csum(o, batch) < 0) {
+      *csum_error = true;
+      return -EIO;
+    }
+  }
+
  // enumerate and decompress desired blobs
   auto p = compressed_blob_bls.begin();
   blobs2read_t::iterator b2r_it = blobs2read.begin();
@@ -12260,13 +13997,8 @@ int BlueStore::_generate_read_result_bl(
     if (bptr->get_blob().is_compressed()) {
       ceph_assert(p != compressed_blob_bls.end());
       bufferlist& compressed_bl = *p++;
-      if (_verify_csum(o, &bptr->get_blob(), 0, compressed_bl,
-                       r2r.front().regs.front().logical_offset) < 0) {
-        *csum_error = true;
-        return -EIO;
-      }
       bufferlist raw_bl;
-      auto r = _decompress(compressed_bl, &raw_bl);
+      auto r = _decompress(compressed_bl, &raw_bl, o->c->cid.pool());
       if (r < 0)
         return r;
       if (buffered) {
@@ -12277,23 +14009,21 @@ int BlueStore::_generate_read_result_bl(
         for (auto& r : req.regs) {
           ready_regions[r.logical_offset].substr_of(
             raw_bl, r.blob_xoffset, r.length);
+          copied_bytes += r.length;
         }
       }
     } else {
       for (auto& req : r2r) {
-        if (_verify_csum(o, &bptr->get_blob(), req.r_off, req.bl,
-                         req.regs.front().logical_offset) < 0) {
-          *csum_error = true;
-          return -EIO;
-        }
         if (buffered) {
           bptr->dirty_bc().did_read(bptr->get_cache(),
                                          req.r_off, req.bl);
         }
 
-        // prune and keep result
+        // prune and keep result; the device buffer is shared with the
+        // cache entry added above, nothing is copied
         for (const auto& r : req.regs) {
           ready_regions[r.logical_offset].substr_of(req.bl, r.front, r.length);
+          shared_bytes += r.length;
         }
       }
     }
@@ -12328,6 +14058,8 @@ int BlueStore::_generate_read_result_bl(
   ceph_assert(bl.length() == length);
   ceph_assert(pos == length);
   ceph_assert(pr == pr_end);
+  logger->inc(l_bluestore_read_bytes_shared, shared_bytes);
+  logger->inc(l_bluestore_read_bytes_copied, copied_bytes);
   return 0;
 }
 
@@ -12365,6 +14097,13 @@ int BlueStore::_do_read(
     dout(20) << __func__ << " defaulting to buffered read" << dendl;
     buffered = true;
   }
+  // use-once reads (scrub, recovery) must neither populate nor reorder
+  // the cache the client working set lives in
+  bool use_once = is_use_once(op_flags);
+  if (use_once) {
+    dout(20) << __func__ << " use-once read" << dendl;
+    read_cache_policy |= BufferSpace::USE_ONCE;
+  }
 
   if (offset + length > o->onode.size) {
     length = o->onode.size - offset;
@@ -12383,7 +14122,7 @@ int BlueStore::_do_read(
   // order to read underlying block device in case there are silent disk errors.
   if (op_flags & CEPH_OSD_OP_FLAG_BYPASS_CLEAN_CACHE) {
     dout(20) << __func__ << " will bypass cache and do direct read" << dendl;
-    read_cache_policy = BufferSpace::BYPASS_CLEAN_CACHE;
+    read_cache_policy |= BufferSpace::BYPASS_CLEAN_CACHE;
   }
 
   // build blob-wise list to of stuff read (that isn't cached)
@@ -12398,6 +14137,7 @@ int BlueStore::_do_read(
                              // The error isn't that much...
   vector<bufferlist> compressed_blob_bls;
   IOContext ioc(cct, NULL, !cct->_conf->bluestore_fail_eio);
+  ioc.queue_hint = c->io_queue_hint;
   r = _prepare_read_ioc(blobs2read, &compressed_blob_bls, &ioc);
   // we always issue aio for reading, so errors other than EIO are not allowed
   if (r < 0)
@@ -12440,6 +14180,9 @@ int BlueStore::_do_read(
     return _do_read(c, o, offset, length, bl, op_flags, retry_count + 1);
   }
   r = bl.length();
+  if (use_once) {
+    logger->inc(l_bluestore_read_use_once_bytes, r);
+  }
   if (retry_count) {
     logger->inc(l_bluestore_reads_with_retries);
     dout(5) << __func__ << " read at 0x" << std::hex << offset << "~" << length
@@ -12451,27 +14194,30 @@ int BlueStore::_do_read(
   return r;
 }
 
-int BlueStore::_verify_csum(OnodeRef& o,
-			    const bluestore_blob_t* blob, uint64_t blob_xoffset,
-			    const bufferlist& bl,
-			    uint64_t logical_offset)
+int BlueStore::_verify_csum(OnodeRef& o, csum_batch_t& batch)
 {
-  int bad;
-  uint64_t bad_csum;
   auto start = mono_clock::now();
-  int r = blob->verify_csum(blob_xoffset, bl, &bad, &bad_csum);
-  if (cct->_conf->bluestore_debug_inject_csum_err_probability > 0 &&
-      (rand() % 10000) < cct->_conf->bluestore_debug_inject_csum_err_probability * 10000.0) {
-    derr << __func__ << " injecting bluestore checksum verifcation error" << dendl;
-    bad = blob_xoffset;
-    r = -1;
-    bad_csum = 0xDEADBEEF;
-  }
+  int r = Checksummer::verify_batch(batch.items.data(), batch.items.size());
   if (r < 0) {
-    if (r == -1) {
+    derr << __func__ << " failed with exit code: " << cpp_strerror(r) << dendl;
+  } else {
+    r = 0;
+    for (size_t i = 0; i < batch.items.size(); ++i) {
+      auto& item = batch.items[i];
+      auto [blob, logical_offset] = batch.origins[i];
+      if (cct->_conf->bluestore_debug_inject_csum_err_probability > 0 &&
+	  (rand() % 10000) < cct->_conf->bluestore_debug_inject_csum_err_probability * 10000.0) {
+	derr << __func__ << " injecting bluestore checksum verifcation error" << dendl;
+	item.bad = item.offset;
+	item.bad_csum = 0xDEADBEEF;
+      }
+      if (item.bad < 0) {
+	continue;
+      }
+      r = -1;
       PExtentVector pex;
       blob->map(
-	bad,
+	item.bad,
 	blob->get_csum_chunk_size(),
 	[&](uint64_t offset, uint64_t length) {
 	  pex.emplace_back(bluestore_pextent_t(offset, length));
@@ -12480,17 +14226,15 @@ int BlueStore::_verify_csum(OnodeRef& o,
       derr << __func__ << " bad "
 	   << Checksummer::get_csum_type_string(blob->csum_type)
 	   << "/0x" << std::hex << blob->get_csum_chunk_size()
-	   << " checksum at blob offset 0x" << bad
-	   << ", got 0x" << bad_csum << ", expected 0x"
-	   << blob->get_csum_item(bad / blob->get_csum_chunk_size()) << std::dec
+	   << " checksum at blob offset 0x" << item.bad
+	   << ", got 0x" << item.bad_csum << ", expected 0x"
+	   << blob->get_csum_item(item.bad / blob->get_csum_chunk_size()) << std::dec
 	   << ", device location " << pex
 	   << ", logical extent 0x" << std::hex
-	   << (logical_offset + bad - blob_xoffset) << "~"
+	   << (logical_offset + item.bad - item.offset) << "~"
 	   << blob->get_csum_chunk_size() << std::dec
 	   << ", object " << o->oid
 	   << dendl;
-    } else {
-      derr << __func__ << " failed with exit code: " << cpp_strerror(r) << dendl;
     }
   }
   log_latency(__func__,
@@ -12503,7 +14247,8 @@ int BlueStore::_verify_csum(OnodeRef& o,
   return r;
 }
 
-int BlueStore::_decompress(bufferlist& source, bufferlist* result)
+int BlueStore::_decompress(bufferlist& source, bufferlist* result,
+			   int64_t pool)
 {
   int r = 0;
   auto start = mono_clock::now();
@@ -12515,6 +14260,14 @@ int BlueStore::_decompress(bufferlist& source, bufferlist* result)
   if (!cp || (int)cp->get_type() != alg) {
     cp = Compressor::create(cct, alg);
   }
+  Compressor::DictionaryRef dict;
+  if (chdr.compressor_message) {
+    auto dicts = std::atomic_load(&compression_dicts);
+    auto p = dicts->dicts.find(std::make_pair(alg, *chdr.compressor_message));
+    if (p != dicts->dicts.end()) {
+      dict = p->second;
+    }
+  }
 
   if (!cp.get()) {
     // if compressor isn't available - error, because cannot return
@@ -12525,19 +14278,295 @@ int BlueStore::_decompress(bufferlist& source, bufferlist* result)
     _set_compression_alert(false, alg_name);
     r = -EIO;
   } else {
-    r = cp->decompress(i, chdr.length, *result, chdr.compressor_message);
+    r = cp->decompress_with_dict(i, chdr.length, *result,
+				 chdr.compressor_message, dict);
     if (r < 0) {
       derr << __func__ << " decompression failed with exit code " << r << dendl;
       r = -EIO;
     }
   }
+  auto lat = mono_clock::now() - start;
+  pool_compression_stats_t s;
+  s.decompressed_blobs = 1;
+  s.decompress_lat = lat;
+  _add_compression_stats(pool, s);
   log_latency(__func__,
     l_bluestore_decompress_lat,
-    mono_clock::now() - start,
+    lat,
     cct->_conf->bluestore_log_op_age);
   return r;
 }
 
+static string compression_dict_key(int alg, int32_t id)
+{
+  return "compression_dict." + stringify(alg) + "." + stringify(id);
+}
+
+static string compression_dict_pool_key(int64_t pool)
+{
+  return "compression_dict_pool." + stringify(pool);
+}
+
+int BlueStore::_load_compression_dicts()
+{
+  std::lock_guard l(compression_dict_lock);
+  auto loaded = std::make_shared<compression_dicts_t>();
+  KeyValueDB::Iterator it = db->get_iterator(PREFIX_SUPER);
+  int errors = 0;
+  for (it->lower_bound("compression_dict");
+       it->valid() && it->key().starts_with("compression_dict");
+       it->next()) {
+    bufferlist bl = it->value();
+    auto p = bl.cbegin();
+    int32_t alg, id;
+    try {
+      decode(alg, p);
+      decode(id, p);
+      if (it->key().starts_with("compression_dict_pool.")) {
+	int64_t pool = std::stoll(it->key().substr(
+	  strlen("compression_dict_pool.")));
+	loaded->pools[pool] = std::make_pair(alg, id);
+	continue;
+      }
+      bufferlist raw;
+      decode(raw, p);
+      CompressorRef c = Compressor::create(cct, alg);
+      auto dict = c ? c->load_dictionary(raw) : Compressor::DictionaryRef();
+      if (!dict || dict->get_id() != id) {
+	derr << __func__ << " unable to load "
+	     << Compressor::get_comp_alg_name(alg)
+	     << " dictionary " << id << dendl;
+	++errors;
+	continue;
+      }
+      loaded->dicts[std::make_pair(alg, id)] = dict;
+    } catch (std::exception& e) {
+      derr << __func__ << " failed to decode " << it->key() << dendl;
+      ++errors;
+    }
+  }
+  dout(10) << __func__ << " loaded " << loaded->dicts.size()
+	   << " dictionaries, " << loaded->pools.size()
+	   << " pools use one" << dendl;
+  std::atomic_store(&compression_dicts,
+		    std::shared_ptr<const compression_dicts_t>(loaded));
+  return errors ? -EIO : 0;
+}
+
+Compressor::DictionaryRef BlueStore::_get_pool_compression_dict(
+  int64_t pool,
+  const CompressorRef& c)
+{
+  auto dicts = std::atomic_load(&compression_dicts);
+  auto p = dicts->pools.find(pool);
+  if (p == dicts->pools.end() ||
+      p->second.first != (int)c->get_type()) {
+    return Compressor::DictionaryRef();
+  }
+  auto q = dicts->dicts.find(p->second);
+  return q != dicts->dicts.end() ? q->second : Compressor::DictionaryRef();
+}
+
+int BlueStore::_train_compression_dict(
+  int64_t pool,
+  size_t max_size,
+  size_t max_samples,
+  Formatter *f,
+  std::ostream& ss)
+{
+  std::vector<CollectionRef> colls;
+  {
+    std::shared_lock l(coll_lock);
+    for (auto& [cid, c] : coll_map) {
+      if (cid.is_pg() && cid.pool() == pool) {
+	colls.push_back(c);
+      }
+    }
+  }
+  if (colls.empty()) {
+    ss << "no PGs of pool " << pool << " on this OSD";
+    return -ENOENT;
+  }
+
+  // the dictionary is for the algorithm the pool compresses with
+  CompressorRef c = select_option(
+    "compression_algorithm",
+    compressor,
+    [&]() {
+      string val;
+      if (colls.front()->pool_opts.get(pool_opts_t::COMPRESSION_ALGORITHM, &val)) {
+	return std::optional<CompressorRef>(Compressor::create(cct, val));
+      }
+      return std::optional<CompressorRef>();
+    }
+  );
+  if (!c) {
+    ss << "pool " << pool << " has no compression algorithm";
+    return -EINVAL;
+  }
+
+  uint64_t sample_size = cct->_conf.get_val<Option::size_t>(
+    "bluestore_compression_dict_sample_size");
+  std::vector<bufferlist> samples;
+  uint64_t sample_bytes = 0;
+  for (auto& coll : colls) {
+    CollectionHandle ch = coll;
+    ghobject_t next;
+    while (samples.size() < max_samples && !next.is_max()) {
+      vector<ghobject_t> ls;
+      int r = collection_list(ch, next, ghobject_t::get_max(),
+			      max_samples - samples.size(), &ls, &next);
+      if (r < 0 || ls.empty()) {
+	break;
+      }
+      for (auto& oid : ls) {
+	bufferlist bl;
+	if (read(ch, oid, 0, sample_size, bl) > 0) {
+	  sample_bytes += bl.length();
+	  samples.push_back(std::move(bl));
+	}
+      }
+    }
+  }
+
+  bufferlist raw;
+  int r = c->train_dictionary(samples, max_size, raw);
+  if (r == -EOPNOTSUPP) {
+    ss << c->get_type_name() << " does not support dictionaries";
+    return r;
+  } else if (r < 0) {
+    ss << "training from " << samples.size() << " samples failed, "
+       << "more or larger objects are needed";
+    return r;
+  }
+  auto dict = c->load_dictionary(raw);
+  if (!dict) {
+    ss << "unable to load the trained dictionary";
+    return -EINVAL;
+  }
+  int alg = c->get_type();
+  int32_t id = dict->get_id();
+
+  std::lock_guard l(compression_dict_lock);
+  KeyValueDB::Transaction t = db->get_transaction();
+  bufferlist bl;
+  encode((int32_t)alg, bl);
+  encode(id, bl);
+  encode(raw, bl);
+  {
+    // the id is derived from the dictionary content, so a stored one
+    // with the same id is normally the very same dictionary; blobs name
+    // their dictionary by id only, so a different one must not replace it
+    bufferlist stored;
+    if (db->get(PREFIX_SUPER, compression_dict_key(alg, id), &stored) >= 0 &&
+	!stored.contents_equal(bl)) {
+      ss << c->get_type_name() << " dictionary id " << id
+	 << " is taken by another dictionary, retrain with a different size"
+	 << " or sample count";
+      return -EEXIST;
+    }
+  }
+  t->set(PREFIX_SUPER, compression_dict_key(alg, id), bl);
+  bl.clear();
+  encode((int32_t)alg, bl);
+  encode(id, bl);
+  t->set(PREFIX_SUPER, compression_dict_pool_key(pool), bl);
+  db->submit_transaction_sync(t);
+  {
+    auto dicts = std::make_shared<compression_dicts_t>(
+      *std::atomic_load(&compression_dicts));
+    dicts->dicts.emplace(std::make_pair(alg, id), dict);
+    dicts->pools[pool] = std::make_pair(alg, id);
+    std::atomic_store(&compression_dicts,
+		      std::shared_ptr<const compression_dicts_t>(dicts));
+  }
+  dout(1) << __func__ << " pool " << pool << " " << c->get_type_name()
+	  << " dictionary " << id << " of " << raw.length() << " bytes from "
+	  << samples.size() << " samples" << dendl;
+
+  f->open_object_section("dictionary");
+  f->dump_int("pool", pool);
+  f->dump_string("algorithm", c->get_type_name());
+  f->dump_int("id", id);
+  f->dump_unsigned("size", raw.length());
+  f->dump_unsigned("samples", samples.size());
+  f->dump_unsigned("sample_bytes", sample_bytes);
+  f->close_section();
+  return 0;
+}
+
+int BlueStore::_clear_compression_dict(int64_t pool)
+{
+  // the dictionary itself stays, existing blobs still need it
+  std::lock_guard l(compression_dict_lock);
+  KeyValueDB::Transaction t = db->get_transaction();
+  t->rmkey(PREFIX_SUPER, compression_dict_pool_key(pool));
+  db->submit_transaction_sync(t);
+  auto dicts = std::make_shared<compression_dicts_t>(
+    *std::atomic_load(&compression_dicts));
+  if (!dicts->pools.erase(pool)) {
+    return -ENOENT;
+  }
+  std::atomic_store(&compression_dicts,
+		    std::shared_ptr<const compression_dicts_t>(dicts));
+  return 0;
+}
+
+void BlueStore::_add_compression_stats(
+  int64_t pool,
+  const pool_compression_stats_t& s)
+{
+  static std::atomic<unsigned> next_slot = {0};
+  static thread_local unsigned slot = next_slot++;
+  auto& shard = compression_stats[slot % COMPRESSION_STATS_SHARDS];
+  std::lock_guard l(shard.lock);
+  shard.pools[pool].add(s);
+}
+
+void BlueStore::pool_compression_stats_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("compressed_blobs", compressed_blobs);
+  f->dump_unsigned("dict_blobs", dict_blobs);
+  f->dump_unsigned("rejected_blobs", rejected_blobs);
+  f->dump_unsigned("original_bytes", original_bytes);
+  f->dump_unsigned("compressed_bytes", compressed_bytes);
+  f->dump_float("ratio", original_bytes ?
+    (double)compressed_bytes / original_bytes : 0.0);
+  f->dump_float("compress_seconds",
+    std::chrono::duration<double>(compress_lat).count());
+  f->dump_unsigned("decompressed_blobs", decompressed_blobs);
+  f->dump_float("decompress_seconds",
+    std::chrono::duration<double>(decompress_lat).count());
+}
+
+void BlueStore::_dump_compression_stats(Formatter *f)
+{
+  std::map<int64_t, pool_compression_stats_t> pools;
+  for (auto& shard : compression_stats) {
+    std::lock_guard l(shard.lock);
+    for (auto& [pool, s] : shard.pools) {
+      pools[pool].add(s);
+    }
+  }
+  auto dicts = std::atomic_load(&compression_dicts);
+  f->open_object_section("compression_stats");
+  f->open_array_section("pools");
+  for (auto& [pool, s] : pools) {
+    f->open_object_section("pool");
+    f->dump_int("pool", pool);
+    auto p = dicts->pools.find(pool);
+    if (p != dicts->pools.end()) {
+      f->dump_string("dict_algorithm",
+		     Compressor::get_comp_alg_name(p->second.first));
+      f->dump_int("dict_id", p->second.second);
+    }
+    s.dump(f);
+    f->close_section();
+  }
+  f->close_section();
+  f->close_section();
+}
+
 // this stores fiemap into interval_set, other variations
 // use it internally
 int BlueStore::_fiemap(
@@ -12553,7 +14582,10 @@ int BlueStore::_fiemap(
   {
     std::shared_lock l(c->lock);
 
-    OnodeRef o = c->get_onode(oid, false);
+    // a mapping query alone doesn't make an object part of the working
+    // set: leave a use-once onode (e.g. one being recovered) cold, and
+    // treat one loaded just for this the same way
+    OnodeRef o = c->get_onode(oid, false, false, true);
     if (!o || !o->exists) {
       return -ENOENT;
     }
@@ -12660,7 +14692,7 @@ int BlueStore::readv(
   {
     std::shared_lock l(c->lock);
     auto start1 = mono_clock::now();
-    OnodeRef o = c->get_onode(oid, false);
+    OnodeRef o = c->get_onode(oid, false, false, is_use_once(op_flags));
     log_latency("get_onode@read",
       l_bluestore_read_onode_meta_lat,
       mono_clock::now() - start1,
@@ -12675,6 +14707,9 @@ int BlueStore::readv(
       goto out;
     }
 
+    if (!(op_flags & CEPH_OSD_OP_FLAG_FADVISE_NOCACHE)) {
+      _tier_note_access(c, o);
+    }
     r = _do_readv(c, o, m, bl, op_flags);
     if (r == -EIO) {
       logger->inc(l_bluestore_read_eio);
@@ -12730,6 +14765,11 @@ int BlueStore::_do_readv(
     dout(20) << __func__ << " defaulting to buffered read" << dendl;
     buffered = true;
   }
+  bool use_once = is_use_once(op_flags);
+  if (use_once) {
+    dout(20) << __func__ << " use-once read" << dendl;
+    read_cache_policy |= BufferSpace::USE_ONCE;
+  }
   // this method must be idempotent since we may call it several times
   // before we finally read the expected result.
   bl.clear();
@@ -12747,6 +14787,7 @@ int BlueStore::_do_readv(
   _dump_onode<30>(cct, *o);
 
   IOContext ioc(cct, NULL, !cct->_conf->bluestore_fail_eio);
+  ioc.queue_hint = c->io_queue_hint;
   vector<std::tuple<ready_regions_t, vector<bufferlist>, blobs2read_t>> raw_results;
   raw_results.reserve(m.num_intervals());
   int i = 0;
@@ -12803,6 +14844,9 @@ int BlueStore::_do_readv(
     }
     bl.claim_append(t);
   }
+  if (use_once) {
+    logger->inc(l_bluestore_read_use_once_bytes, bl.length());
+  }
   if (retry_count) {
     logger->inc(l_bluestore_reads_with_retries);
     dout(5) << __func__ << " read fiemap " << m
@@ -12890,7 +14934,8 @@ int BlueStore::getattr(
 int BlueStore::getattrs(
   CollectionHandle &c_,
   const ghobject_t& oid,
-  map<string,bufferptr,less<>>& aset)
+  map<string,bufferptr,less<>>& aset,
+  uint32_t op_flags)
 {
   Collection *c = static_cast<Collection *>(c_.get());
   dout(15) << __func__ << " " << c->cid << " " << oid << dendl;
@@ -12901,7 +14946,7 @@ int BlueStore::getattrs(
   {
     std::shared_lock l(c->lock);
 
-    OnodeRef o = c->get_onode(oid, false);
+    OnodeRef o = c->get_onode(oid, false, false, is_use_once(op_flags));
     if (!o || !o->exists) {
       r = -ENOENT;
       goto out;
@@ -13165,6 +15210,8 @@ int BlueStore::_onode_omap_get(
     string head, tail;
     o->get_omap_header(&head);
     o->get_omap_tail(&tail);
+    KeyValueDB::tombstone_count_t tc;
+    db->begin_thread_tombstone_count(&tc);
     KeyValueDB::Iterator it = db->get_iterator(prefix, 0, KeyValueDB::IteratorBounds{head, tail});
     it->lower_bound(head);
     while (it->valid()) {
@@ -13183,6 +15230,8 @@ int BlueStore::_onode_omap_get(
       }
       it->next();
     }
+    _note_omap_tombstones(o, head, tail,
+      db->end_thread_tombstone_count(tc));
   }
 out:
   return r;
@@ -13192,7 +15241,8 @@ int BlueStore::omap_get_header(
   CollectionHandle &c_,                ///< [in] Collection containing oid
   const ghobject_t &oid,   ///< [in] Object containing omap
   bufferlist *header,      ///< [out] omap header
-  bool allow_eio ///< [in] don't assert on eio
+  bool allow_eio, ///< [in] don't assert on eio
+  uint32_t op_flags
   )
 {
   Collection *c = static_cast<Collection *>(c_.get());
@@ -13201,7 +15251,7 @@ int BlueStore::omap_get_header(
     return -ENOENT;
   std::shared_lock l(c->lock);
   int r = 0;
-  OnodeRef o = c->get_onode(oid, false);
+  OnodeRef o = c->get_onode(oid, false, false, is_use_once(op_flags));
   if (!o || !o->exists) {
     r = -ENOENT;
     goto out;
@@ -13250,6 +15300,8 @@ int BlueStore::omap_get_keys(
     string head, tail;
     o->get_omap_key(string(), &head);
     o->get_omap_tail(&tail);
+    KeyValueDB::tombstone_count_t tc;
+    db->begin_thread_tombstone_count(&tc);
     KeyValueDB::Iterator it = db->get_iterator(prefix, 0, KeyValueDB::IteratorBounds{head, tail});
     it->lower_bound(head);
     while (it->valid()) {
@@ -13264,6 +15316,8 @@ int BlueStore::omap_get_keys(
       keys->insert(user_key);
       it->next();
     }
+    _note_omap_tombstones(o, head, tail,
+      db->end_thread_tombstone_count(tc));
   }
  out:
   c->store->log_latency(
@@ -13423,7 +15477,8 @@ int BlueStore::omap_check_keys(
 
 ObjectMap::ObjectMapIterator BlueStore::get_omap_iterator(
   CollectionHandle &c_,              ///< [in] collection
-  const ghobject_t &oid  ///< [in] object
+  const ghobject_t &oid, ///< [in] object
+  uint32_t op_flags
   )
 {
   Collection *c = static_cast<Collection *>(c_.get());
@@ -13432,7 +15487,7 @@ ObjectMap::ObjectMapIterator BlueStore::get_omap_iterator(
     return ObjectMap::ObjectMapIterator();
   }
   std::shared_lock l(c->lock);
-  OnodeRef o = c->get_onode(oid, false);
+  OnodeRef o = c->get_onode(oid, false, false, is_use_once(op_flags));
   if (!o || !o->exists) {
     dout(10) << __func__ << " " << oid << "doesn't exist" <<dendl;
     return ObjectMap::ObjectMapIterator();
@@ -13834,6 +15889,10 @@ void BlueStore::_txc_state_proc(TransContext *txc)
 	  _txc_apply_kv(txc, true);
 	}
       }
+      if (auto shard = _get_kv_sync_shard(txc->osr.get()); shard) {
+	_kv_shard_queue(shard, txc);
+	return;
+      }
       {
 	std::lock_guard l(kv_lock);
 	kv_queue.push_back(txc);
@@ -13848,6 +15907,10 @@ void BlueStore::_txc_state_proc(TransContext *txc)
 	if (txc->had_ios)
 	  kv_ios++;
 	kv_throttle_costs += txc->cost;
+	if (kv_shard0_logger) {
+	  kv_shard0_logger->set(l_bluestore_kv_shard_queue_depth,
+				kv_queue.size());
+	}
       }
       return;
     case TransContext::STATE_KV_SUBMITTED:
@@ -14041,8 +16104,32 @@ void BlueStore::_txc_apply_kv(TransContext *txc, bool sync_submit_transaction)
     }
 #endif
 
+    uint64_t journal_seq = 0;
+    if (alloc_journal &&
+	(!txc->allocated.empty() || !txc->released.empty())) {
+      // the record commits along with the txc. concurrent submitters may
+      // commit out of seq order, a crash can then leave a gap in the
+      // journal; their records never touch the same extents though, as
+      // released space is only reused once its txc has committed
+      bufferlist bl;
+      encode(txc->allocated, bl);
+      encode(txc->released, bl);
+      string key;
+      {
+	std::lock_guard l(alloc_journal_lock);
+	journal_seq = ++alloc_journal_seq;
+	alloc_journal_pending.insert(journal_seq);
+	_key_encode_u64(journal_seq, &key);
+	txc->t->set(PREFIX_ALLOC_JOURNAL, key, bl);
+      }
+      logger->inc(l_bluestore_alloc_journal_records);
+    }
     int r = cct->_conf->bluestore_debug_omit_kv_commit ? 0 : db->submit_transaction(txc->t);
     ceph_assert(r == 0);
+    if (journal_seq) {
+      std::lock_guard l(alloc_journal_lock);
+      alloc_journal_pending.erase(journal_seq);
+    }
     txc->set_state(TransContext::STATE_KV_SUBMITTED);
     if (txc->osr->kv_submitted_waiters) {
       std::lock_guard l(txc->osr->qlock);
@@ -14330,6 +16417,14 @@ void BlueStore::_osr_drain_all()
     std::lock_guard l(kv_finalize_lock);
     kv_finalize_cond.notify_one();
   }
+  for (auto& shard : kv_sync_shards) {
+    {
+      std::lock_guard l(shard->lock);
+      shard->cond.notify_one();
+    }
+    std::lock_guard l(shard->finalize_lock);
+    shard->finalize_cond.notify_one();
+  }
   for (auto osr : s) {
     dout(20) << __func__ << " drain " << osr << dendl;
     osr->drain();
@@ -14362,8 +16457,25 @@ void BlueStore::_kv_start()
   dout(10) << __func__ << dendl;
 
   finisher.start();
+  unsigned num_shards = cct->_conf.get_val<uint64_t>("bluestore_kv_sync_shards");
+  ceph_assert(kv_sync_shards.empty());
+  if (num_shards > 1) {
+    dout(1) << __func__ << " using " << num_shards << " kv sync shards"
+	    << dendl;
+    kv_shard0_logger = _create_kv_shard_logger(0);
+    for (unsigned i = 1; i < num_shards; ++i) {
+      kv_sync_shards.emplace_back(std::make_unique<KVSyncShard>(this, i));
+    }
+  }
   kv_sync_thread.create("bstore_kv_sync");
   kv_finalize_thread.create("bstore_kv_final");
+  for (auto& shard : kv_sync_shards) {
+    shard->logger = _create_kv_shard_logger(shard->id);
+    shard->sync_thread.create(
+      fmt::format("bstore_kvs{}", shard->id).c_str());
+    shard->finalize_thread.create(
+      fmt::format("bstore_kvf{}", shard->id).c_str());
+  }
 }
 
 void BlueStore::_kv_stop()
@@ -14385,8 +16497,40 @@ void BlueStore::_kv_stop()
     kv_finalize_stop = true;
     kv_finalize_cond.notify_all();
   }
+  for (auto& shard : kv_sync_shards) {
+    std::unique_lock l{shard->lock};
+    while (!shard->started) {
+      shard->cond.wait(l);
+    }
+    shard->stop = true;
+    shard->cond.notify_all();
+  }
   kv_sync_thread.join();
+  for (auto& shard : kv_sync_shards) {
+    shard->sync_thread.join();
+  }
   kv_finalize_thread.join();
+  // stop the other finalizers only now: shard 0 may still have handed
+  // them deferred batches
+  for (auto& shard : kv_sync_shards) {
+    {
+      std::unique_lock l{shard->finalize_lock};
+      while (!shard->finalize_started) {
+	shard->finalize_cond.wait(l);
+      }
+      shard->finalize_stop = true;
+      shard->finalize_cond.notify_all();
+    }
+    shard->finalize_thread.join();
+    cct->get_perfcounters_collection()->remove(shard->logger);
+    delete shard->logger;
+  }
+  kv_sync_shards.clear();
+  if (kv_shard0_logger) {
+    cct->get_perfcounters_collection()->remove(kv_shard0_logger);
+    delete kv_shard0_logger;
+    kv_shard0_logger = nullptr;
+  }
   ceph_assert(removed_collections.empty());
   {
     std::lock_guard l(kv_lock);
@@ -14430,9 +16574,11 @@ void BlueStore::_kv_sync_thread()
       kv_submitted = 0;
     }
     ceph_assert(kv_committing.empty());
+    // with sharded commits shard 0 may not see another commit for a
+    // while, so it cleans up finished deferred batches right away
     if (kv_queue.empty() &&
 	((deferred_done_queue.empty() && deferred_stable_queue.empty()) ||
-	 !deferred_aggressive)) {
+	 (!deferred_aggressive && kv_sync_shards.empty()))) {
       if (kv_stop)
 	break;
       dout(20) << __func__ << " sleep" << dendl;
@@ -14514,25 +16660,15 @@ void BlueStore::_kv_sync_thread()
       // increase {nid,blobid}_max?  note that this covers both the
       // case where we are approaching the max and the case we passed
       // it.  in either case, we increase the max in the earlier txn
-      // we submit.
+      // we submit.  with sharded commits the lock is held until the
+      // new max is committed so that concurrent shards can't regress it.
       uint64_t new_nid_max = 0, new_blobid_max = 0;
-      if (nid_last + cct->_conf->bluestore_nid_prealloc/2 > nid_max) {
-	KeyValueDB::Transaction t =
-	  kv_submitting.empty() ? synct : kv_submitting.front()->t;
-	new_nid_max = nid_last + cct->_conf->bluestore_nid_prealloc;
-	bufferlist bl;
-	encode(new_nid_max, bl);
-	t->set(PREFIX_SUPER, "nid_max", bl);
-	dout(10) << __func__ << " new_nid_max " << new_nid_max << dendl;
-      }
-      if (blobid_last + cct->_conf->bluestore_blobid_prealloc/2 > blobid_max) {
-	KeyValueDB::Transaction t =
-	  kv_submitting.empty() ? synct : kv_submitting.front()->t;
-	new_blobid_max = blobid_last + cct->_conf->bluestore_blobid_prealloc;
-	bufferlist bl;
-	encode(new_blobid_max, bl);
-	t->set(PREFIX_SUPER, "blobid_max", bl);
-	dout(10) << __func__ << " new_blobid_max " << new_blobid_max << dendl;
+      std::unique_lock id_max_l{kv_id_max_lock};
+      _kv_prepare_id_max(
+	kv_submitting.empty() ? synct : kv_submitting.front()->t,
+	&new_nid_max, &new_blobid_max);
+      if (!new_nid_max && !new_blobid_max) {
+	id_max_l.unlock();
       }
 
       for (auto txc : kv_committing) {
@@ -14638,6 +16774,9 @@ void BlueStore::_kv_sync_thread()
 	blobid_max = new_blobid_max;
 	dout(10) << __func__ << " blobid_max now " << blobid_max << dendl;
       }
+      if (id_max_l.owns_lock()) {
+	id_max_l.unlock();
+      }
 
       {
 	auto finish = mono_clock::now();
@@ -14661,6 +16800,14 @@ void BlueStore::_kv_sync_thread()
 	  l_bluestore_kv_sync_lat,
 	  dur,
 	  cct->_conf->bluestore_log_op_age);
+	if (kv_shard0_logger) {
+	  kv_shard0_logger->inc(l_bluestore_kv_shard_batch_size,
+				committing_size);
+	  kv_shard0_logger->inc(l_bluestore_kv_shard_committed,
+				committing_size);
+	  kv_shard0_logger->tinc(l_bluestore_kv_shard_flush_lat, dur_flush);
+	  kv_shard0_logger->tinc(l_bluestore_kv_shard_sync_lat, dur);
+	}
       }
 
       l.lock();
@@ -14669,80 +16816,344 @@ void BlueStore::_kv_sync_thread()
       deferred_stable_queue.swap(deferred_done);
     }
   }
-  dout(10) << __func__ << " finish" << dendl;
-  kv_sync_started = false;
+  dout(10) << __func__ << " finish" << dendl;
+  kv_sync_started = false;
+}
+
+void BlueStore::_kv_finalize_thread()
+{
+  deque<TransContext*> kv_committed;
+  deque<DeferredBatch*> deferred_stable;
+  dout(10) << __func__ << " start" << dendl;
+  std::unique_lock l(kv_finalize_lock);
+  ceph_assert(!kv_finalize_started);
+  kv_finalize_started = true;
+  kv_finalize_cond.notify_all();
+  while (true) {
+    ceph_assert(kv_committed.empty());
+    ceph_assert(deferred_stable.empty());
+    if (kv_committing_to_finalize.empty() &&
+	deferred_stable_to_finalize.empty()) {
+      if (kv_finalize_stop)
+	break;
+      dout(20) << __func__ << " sleep" << dendl;
+      kv_finalize_in_progress = false;
+      kv_finalize_cond.wait(l);
+      dout(20) << __func__ << " wake" << dendl;
+    } else {
+      kv_committed.swap(kv_committing_to_finalize);
+      deferred_stable.swap(deferred_stable_to_finalize);
+      l.unlock();
+      dout(20) << __func__ << " kv_committed " << kv_committed << dendl;
+      dout(20) << __func__ << " deferred_stable " << deferred_stable << dendl;
+
+      auto start = mono_clock::now();
+
+      while (!kv_committed.empty()) {
+	TransContext *txc = kv_committed.front();
+	ceph_assert(txc->get_state() == TransContext::STATE_KV_SUBMITTED);
+	_txc_state_proc(txc);
+	kv_committed.pop_front();
+      }
+
+      for (auto b : deferred_stable) {
+	// deferred cleanup of a sharded sequencer is finished by its own
+	// pipeline, so that all of its txcs are finalized by a single thread
+	if (auto shard = _get_kv_sync_shard(b->osr); shard) {
+	  _kv_shard_queue_deferred_stable(shard, b);
+	  continue;
+	}
+	auto p = b->txcs.begin();
+	while (p != b->txcs.end()) {
+	  TransContext *txc = &*p;
+	  p = b->txcs.erase(p); // unlink here because
+	  _txc_state_proc(txc); // this may destroy txc
+	}
+	delete b;
+      }
+      deferred_stable.clear();
+
+      if (!deferred_aggressive) {
+	if (deferred_queue_size >= deferred_batch_ops.load() ||
+	    throttle.should_submit_deferred()) {
+	  deferred_try_submit();
+	}
+      }
+
+      // this is as good a place as any ...
+      _reap_collections();
+
+      logger->set(l_bluestore_fragmentation,
+	  (uint64_t)(alloc->get_fragmentation() * 1000));
+
+      auto dur = mono_clock::now() - start;
+      log_latency("kv_final",
+	l_bluestore_kv_final_lat,
+	dur,
+	cct->_conf->bluestore_log_op_age);
+      if (kv_shard0_logger) {
+	kv_shard0_logger->tinc(l_bluestore_kv_shard_final_lat, dur);
+      }
+
+      l.lock();
+    }
+  }
+  dout(10) << __func__ << " finish" << dendl;
+  kv_finalize_started = false;
+}
+
+void BlueStore::_kv_prepare_id_max(KeyValueDB::Transaction t,
+				   uint64_t *new_nid_max,
+				   uint64_t *new_blobid_max)
+{
+  ceph_assert(ceph_mutex_is_locked(kv_id_max_lock));
+  if (nid_last + cct->_conf->bluestore_nid_prealloc/2 > nid_max) {
+    *new_nid_max = nid_last + cct->_conf->bluestore_nid_prealloc;
+    bufferlist bl;
+    encode(*new_nid_max, bl);
+    t->set(PREFIX_SUPER, "nid_max", bl);
+    dout(10) << __func__ << " new_nid_max " << *new_nid_max << dendl;
+  }
+  if (blobid_last + cct->_conf->bluestore_blobid_prealloc/2 > blobid_max) {
+    *new_blobid_max = blobid_last + cct->_conf->bluestore_blobid_prealloc;
+    bufferlist bl;
+    encode(*new_blobid_max, bl);
+    t->set(PREFIX_SUPER, "blobid_max", bl);
+    dout(10) << __func__ << " new_blobid_max " << *new_blobid_max << dendl;
+  }
+}
+
+PerfCounters *BlueStore::_create_kv_shard_logger(unsigned id)
+{
+  PerfCountersBuilder b(cct, fmt::format("bluestore-kv-shard-{}", id),
+			l_bluestore_kv_shard_first, l_bluestore_kv_shard_last);
+  b.add_u64(l_bluestore_kv_shard_queue_depth, "queue_depth",
+	    "Number of txcs waiting for this kv sync shard");
+  b.add_u64_avg(l_bluestore_kv_shard_batch_size, "batch_size",
+		"Average number of txcs committed per sync");
+  b.add_u64_counter(l_bluestore_kv_shard_committed, "committed",
+		    "Number of txcs committed by this shard");
+  b.add_time_avg(l_bluestore_kv_shard_flush_lat, "flush_lat",
+		 "Average block device flush latency of this shard");
+  b.add_time_avg(l_bluestore_kv_shard_sync_lat, "sync_lat",
+		 "Average flush + kv commit latency of this shard");
+  b.add_time_avg(l_bluestore_kv_shard_final_lat, "final_lat",
+		 "Average finalize latency of this shard");
+  PerfCounters *l = b.create_perf_counters();
+  cct->get_perfcounters_collection()->add(l);
+  return l;
+}
+
+void BlueStore::_kv_shard_queue(KVSyncShard *shard, TransContext *txc)
+{
+  std::lock_guard l(shard->lock);
+  shard->queue.push_back(txc);
+  if (!shard->in_progress) {
+    shard->in_progress = true;
+    shard->cond.notify_one();
+  }
+  if (txc->get_state() != TransContext::STATE_KV_SUBMITTED) {
+    shard->queue_unsubmitted.push_back(txc);
+    ++txc->osr->kv_committing_serially;
+  }
+  if (txc->had_ios)
+    shard->ios++;
+  shard->throttle_costs += txc->cost;
+  shard->logger->set(l_bluestore_kv_shard_queue_depth, shard->queue.size());
+}
+
+void BlueStore::_kv_shard_queue_deferred_stable(KVSyncShard *shard,
+						DeferredBatch *b)
+{
+  std::lock_guard l(shard->finalize_lock);
+  shard->deferred_stable_to_finalize.push_back(b);
+  if (!shard->finalize_in_progress) {
+    shard->finalize_in_progress = true;
+    shard->finalize_cond.notify_one();
+  }
+}
+
+void BlueStore::_kv_shard_sync_thread(KVSyncShard *shard)
+{
+  dout(10) << __func__ << " shard " << shard->id << " start" << dendl;
+  std::unique_lock l{shard->lock};
+  ceph_assert(!shard->started);
+  shard->started = true;
+  shard->cond.notify_all();
+
+  while (true) {
+    ceph_assert(shard->committing.empty());
+    if (shard->queue.empty()) {
+      if (shard->stop)
+	break;
+      dout(20) << __func__ << " shard " << shard->id << " sleep" << dendl;
+      shard->in_progress = false;
+      shard->cond.wait(l);
+      dout(20) << __func__ << " shard " << shard->id << " wake" << dendl;
+      continue;
+    }
+
+    deque<TransContext*> submitting;
+    dout(20) << __func__ << " shard " << shard->id
+	     << " committing " << shard->queue.size()
+	     << " submitting " << shard->queue_unsubmitted.size() << dendl;
+    shard->committing.swap(shard->queue);
+    submitting.swap(shard->queue_unsubmitted);
+    uint64_t aios = shard->ios;
+    uint64_t costs = shard->throttle_costs;
+    shard->ios = 0;
+    shard->throttle_costs = 0;
+    shard->logger->set(l_bluestore_kv_shard_queue_depth, 0);
+    l.unlock();
+
+    auto start = mono_clock::now();
+    // deferred ios are owned by shard 0, so we only need a barrier
+    // for our own data ios.
+    if (aios) {
+      dout(20) << __func__ << " shard " << shard->id
+	       << " num_aios=" << aios << ", flushing" << dendl;
+      bdev->flush();
+    }
+    auto after_flush = mono_clock::now();
+
+    KeyValueDB::Transaction synct = db->get_transaction();
+    uint64_t new_nid_max = 0, new_blobid_max = 0;
+    std::unique_lock id_max_l{kv_id_max_lock};
+    _kv_prepare_id_max(
+      submitting.empty() ? synct : submitting.front()->t,
+      &new_nid_max, &new_blobid_max);
+    if (!new_nid_max && !new_blobid_max) {
+      id_max_l.unlock();
+    }
+
+    for (auto txc : shard->committing) {
+      throttle.log_state_latency(*txc, logger, l_bluestore_state_kv_queued_lat);
+      if (txc->get_state() == TransContext::STATE_KV_QUEUED) {
+	_txc_apply_kv(txc, false);
+	--txc->osr->kv_committing_serially;
+      } else {
+	ceph_assert(txc->get_state() == TransContext::STATE_KV_SUBMITTED);
+      }
+      if (txc->had_ios) {
+	--txc->osr->txc_with_unstable_io;
+      }
+    }
+    throttle.release_kv_throttle(costs);
+
+    int r = cct->_conf->bluestore_debug_omit_kv_commit ? 0 : db->submit_transaction_sync(synct);
+    ceph_assert(r == 0);
+
+    int committing_size = shard->committing.size();
+    {
+      std::lock_guard m{shard->finalize_lock};
+      shard->committing_to_finalize.insert(
+	shard->committing_to_finalize.end(),
+	shard->committing.begin(),
+	shard->committing.end());
+      shard->committing.clear();
+      if (!shard->finalize_in_progress) {
+	shard->finalize_in_progress = true;
+	shard->finalize_cond.notify_one();
+      }
+    }
+
+    if (new_nid_max) {
+      nid_max = new_nid_max;
+      dout(10) << __func__ << " nid_max now " << nid_max << dendl;
+    }
+    if (new_blobid_max) {
+      blobid_max = new_blobid_max;
+      dout(10) << __func__ << " blobid_max now " << blobid_max << dendl;
+    }
+    if (id_max_l.owns_lock()) {
+      id_max_l.unlock();
+    }
+
+    auto finish = mono_clock::now();
+    ceph::timespan dur_flush = after_flush - start;
+    ceph::timespan dur = finish - start;
+    dout(20) << __func__ << " shard " << shard->id
+	     << " committed " << committing_size
+	     << " in " << dur << " (" << dur_flush << " flush)" << dendl;
+    shard->logger->inc(l_bluestore_kv_shard_batch_size, committing_size);
+    shard->logger->inc(l_bluestore_kv_shard_committed, committing_size);
+    shard->logger->tinc(l_bluestore_kv_shard_flush_lat, dur_flush);
+    shard->logger->tinc(l_bluestore_kv_shard_sync_lat, dur);
+    log_latency("kv_sync",
+      l_bluestore_kv_sync_lat,
+      dur,
+      cct->_conf->bluestore_log_op_age);
+
+    l.lock();
+  }
+  dout(10) << __func__ << " shard " << shard->id << " finish" << dendl;
+  shard->started = false;
 }
 
-void BlueStore::_kv_finalize_thread()
+void BlueStore::_kv_shard_finalize_thread(KVSyncShard *shard)
 {
   deque<TransContext*> kv_committed;
   deque<DeferredBatch*> deferred_stable;
-  dout(10) << __func__ << " start" << dendl;
-  std::unique_lock l(kv_finalize_lock);
-  ceph_assert(!kv_finalize_started);
-  kv_finalize_started = true;
-  kv_finalize_cond.notify_all();
+  dout(10) << __func__ << " shard " << shard->id << " start" << dendl;
+  std::unique_lock l(shard->finalize_lock);
+  ceph_assert(!shard->finalize_started);
+  shard->finalize_started = true;
+  shard->finalize_cond.notify_all();
   while (true) {
     ceph_assert(kv_committed.empty());
     ceph_assert(deferred_stable.empty());
-    if (kv_committing_to_finalize.empty() &&
-	deferred_stable_to_finalize.empty()) {
-      if (kv_finalize_stop)
+    if (shard->committing_to_finalize.empty() &&
+	shard->deferred_stable_to_finalize.empty()) {
+      if (shard->finalize_stop)
 	break;
-      dout(20) << __func__ << " sleep" << dendl;
-      kv_finalize_in_progress = false;
-      kv_finalize_cond.wait(l);
-      dout(20) << __func__ << " wake" << dendl;
-    } else {
-      kv_committed.swap(kv_committing_to_finalize);
-      deferred_stable.swap(deferred_stable_to_finalize);
-      l.unlock();
-      dout(20) << __func__ << " kv_committed " << kv_committed << dendl;
-      dout(20) << __func__ << " deferred_stable " << deferred_stable << dendl;
+      shard->finalize_in_progress = false;
+      shard->finalize_cond.wait(l);
+      continue;
+    }
+    kv_committed.swap(shard->committing_to_finalize);
+    deferred_stable.swap(shard->deferred_stable_to_finalize);
+    l.unlock();
 
-      auto start = mono_clock::now();
+    auto start = mono_clock::now();
 
-      while (!kv_committed.empty()) {
-	TransContext *txc = kv_committed.front();
-	ceph_assert(txc->get_state() == TransContext::STATE_KV_SUBMITTED);
-	_txc_state_proc(txc);
-	kv_committed.pop_front();
-      }
+    while (!kv_committed.empty()) {
+      TransContext *txc = kv_committed.front();
+      ceph_assert(txc->get_state() == TransContext::STATE_KV_SUBMITTED);
+      _txc_state_proc(txc);
+      kv_committed.pop_front();
+    }
 
-      for (auto b : deferred_stable) {
-	auto p = b->txcs.begin();
-	while (p != b->txcs.end()) {
-	  TransContext *txc = &*p;
-	  p = b->txcs.erase(p); // unlink here because
-	  _txc_state_proc(txc); // this may destroy txc
-	}
-	delete b;
+    for (auto b : deferred_stable) {
+      auto p = b->txcs.begin();
+      while (p != b->txcs.end()) {
+	TransContext *txc = &*p;
+	p = b->txcs.erase(p); // unlink here because
+	_txc_state_proc(txc); // this may destroy txc
       }
-      deferred_stable.clear();
+      delete b;
+    }
+    deferred_stable.clear();
 
-      if (!deferred_aggressive) {
-	if (deferred_queue_size >= deferred_batch_ops.load() ||
-	    throttle.should_submit_deferred()) {
-	  deferred_try_submit();
-	}
+    if (!deferred_aggressive) {
+      if (deferred_queue_size >= deferred_batch_ops.load() ||
+	  throttle.should_submit_deferred()) {
+	deferred_try_submit();
       }
+    }
 
-      // this is as good a place as any ...
-      _reap_collections();
-
-      logger->set(l_bluestore_fragmentation,
-	  (uint64_t)(alloc->get_fragmentation() * 1000));
+    _reap_collections();
 
-      log_latency("kv_final",
-	l_bluestore_kv_final_lat,
-	mono_clock::now() - start,
-	cct->_conf->bluestore_log_op_age);
+    auto dur = mono_clock::now() - start;
+    shard->logger->tinc(l_bluestore_kv_shard_final_lat, dur);
+    log_latency("kv_final",
+      l_bluestore_kv_final_lat,
+      dur,
+      cct->_conf->bluestore_log_op_age);
 
-      l.lock();
-    }
+    l.lock();
   }
-  dout(10) << __func__ << " finish" << dendl;
-  kv_finalize_started = false;
+  dout(10) << __func__ << " shard " << shard->id << " finish" << dendl;
+  shard->finalize_started = false;
 }
 
 
@@ -14808,6 +17219,7 @@ void BlueStore::deferred_try_submit()
   dout(20) << __func__ << " " << deferred_queue.size() << " osrs, "
 	   << deferred_queue_size << " txcs" << dendl;
   vector<OpSequencerRef> osrs;
+  uint64_t head;
 
   {
     std::lock_guard l(deferred_lock);
@@ -14815,12 +17227,35 @@ void BlueStore::deferred_try_submit()
     for (auto& osr : deferred_queue) {
       osrs.push_back(&osr);
     }
+    head = deferred_elevator_head;
   }
 
+  bool elevator = cct->_conf.get_val<bool>("bluestore_deferred_elevator");
+  vector<DeferredBatch*> batches;
+  interval_set<uint64_t> claimed;
   for (auto& osr : osrs) {
     osr->deferred_lock.lock();
     if (osr->deferred_pending) {
-      if (!osr->deferred_running) {
+      if (!osr->deferred_running && elevator) {
+	// batches of different sequencers are written in any order, so one
+	// that overlaps an already claimed batch waits for the next round
+	auto& iomap = osr->deferred_pending->iomap;
+	bool overlaps = std::any_of(
+	  iomap.begin(), iomap.end(),
+	  [&](auto& i) {
+	    return claimed.intersects(i.first, i.second.bl.length());
+	  });
+	if (overlaps) {
+	  osr->deferred_lock.unlock();
+	  dout(20) << __func__ << "  osr " << osr << " overlaps claimed ios"
+		   << dendl;
+	  continue;
+	}
+	for (auto& i : iomap) {
+	  claimed.union_insert(i.first, i.second.bl.length());
+	}
+	batches.push_back(_deferred_claim_unlock(osr.get()));
+      } else if (!osr->deferred_running) {
 	_deferred_submit_unlock(osr.get());
       } else {
 	osr->deferred_lock.unlock();
@@ -14832,14 +17267,18 @@ void BlueStore::deferred_try_submit()
       dout(20) << __func__ << "  osr " << osr << " has no pending" << dendl;
     }
   }
+  if (!batches.empty()) {
+    head = _deferred_submit_elevator(std::move(batches), head);
+  }
 
   {
     std::lock_guard l(deferred_lock);
     deferred_last_submitted = ceph_clock_now();
+    deferred_elevator_head = head;
   }
 }
 
-void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
+BlueStore::DeferredBatch *BlueStore::_deferred_claim_unlock(OpSequencer *osr)
 {
   dout(10) << __func__ << " osr " << osr
 	   << " " << osr->deferred_pending->iomap.size() << " ios pending "
@@ -14859,6 +17298,68 @@ void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
   for (auto& txc : b->txcs) {
     throttle.log_state_latency(txc, logger, l_bluestore_state_deferred_queued_lat);
   }
+  return b;
+}
+
+uint64_t BlueStore::_deferred_submit_elevator(
+  std::vector<DeferredBatch*>&& batches,
+  uint64_t head)
+{
+  // no two batches overlap, so their ios fit in one offset order and
+  // adjacent ios of different sequencers become a single write
+  std::map<uint64_t, bufferlist*> ios;
+  for (auto b : batches) {
+    for (auto& i : b->iomap) {
+      ios.emplace(i.first, &i.second.bl);
+    }
+  }
+  std::vector<std::pair<uint64_t, bufferlist>> runs;
+  for (auto& [offset, bl] : ios) {
+    if (runs.empty() ||
+	runs.back().first + runs.back().second.length() != offset) {
+      runs.emplace_back(offset, bufferlist());
+    }
+    runs.back().second.claim_append(*bl);
+  }
+
+  // one ascending sweep from where the previous one stopped, then wrap
+  auto first = std::lower_bound(
+    runs.begin(), runs.end(), head,
+    [](auto& run, uint64_t offset) { return run.first < offset; });
+  std::rotate(runs.begin(), first, runs.end());
+
+  dout(10) << __func__ << " " << batches.size() << " batches, " << ios.size()
+	   << " ios, " << runs.size() << " writes, head 0x" << std::hex << head
+	   << std::dec << dendl;
+  logger->inc(l_bluestore_deferred_elevator_batches, batches.size());
+  logger->inc(l_bluestore_deferred_elevator_ios, ios.size());
+  logger->inc(l_bluestore_deferred_elevator_writes, runs.size());
+
+  auto m = new DeferredElevatorBatch(cct, std::move(batches));
+  uint64_t seek = 0;
+  for (auto& [start, bl] : runs) {
+    seek += start > head ? start - head : head - start;
+    head = start + bl.length();
+    dout(20) << __func__ << " write 0x" << std::hex
+	     << start << "~" << bl.length()
+	     << " crc " << bl.crc32c(-1) << std::dec << dendl;
+    if (!g_conf()->bluestore_debug_omit_block_device_write) {
+      logger->inc(l_bluestore_submitted_deferred_writes);
+      logger->inc(l_bluestore_submitted_deferred_write_bytes, bl.length());
+      int r = bdev->aio_write(start, bl, &m->ioc, false);
+      ceph_assert(r == 0);
+    }
+  }
+  logger->inc(l_bluestore_deferred_elevator_seek_bytes, seek);
+
+  // m may be gone as soon as its ios are submitted
+  bdev->aio_submit(&m->ioc);
+  return head;
+}
+
+void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
+{
+  auto b = _deferred_claim_unlock(osr);
   uint64_t start = 0, pos = 0;
   bufferlist bl;
   auto i = b->iomap.begin();
@@ -14952,8 +17453,11 @@ void BlueStore::_deferred_aio_finish(OpSequencer *osr)
     deferred_done_queue.emplace_back(b);
 
     // in the normal case, do not bother waking up the kv thread; it will
-    // catch us on the next commit anyway.
-    if (deferred_aggressive && !kv_sync_in_progress) {
+    // catch us on the next commit anyway.  not so with sharded commits:
+    // this batch may belong to a sequencer committing on another shard
+    // while shard 0 stays idle.
+    if ((deferred_aggressive || !kv_sync_shards.empty()) &&
+	!kv_sync_in_progress) {
 	kv_sync_in_progress = true;
 	kv_cond.notify_one();
     }
@@ -15204,6 +17708,318 @@ int BlueStore::queue_transactions(
   return 0;
 }
 
+int BlueStore::_rewrite_ranges(
+  CollectionRef& c,
+  OnodeRef& o,
+  const interval_set<uint64_t>& m,
+  const bufferlist& bl,
+  int64_t alloc_hint,
+  std::unique_lock<ceph::shared_mutex>& l,
+  interval_set<uint64_t> *allocated)
+{
+  // Queue our txc first, then look for a client txc ahead of it that is
+  // still in PREPARE: it may be waiting for c->lock and would apply its
+  // ops after ours but commit before us.  One queued after ours can't
+  // overtake us.
+  OpSequencer *osr = c->osr.get();
+  C_SaferCond on_commit;
+  list<Context*> on_commits{&on_commit};
+  TransContext *txc = _txc_create(c.get(), osr, &on_commits);
+  spg_t pgid;
+  if (c->cid.is_pg(&pgid)) {
+    txc->osd_pool_id = pgid.pool();
+  }
+  txc->alloc_hint = alloc_hint;
+  int r = 0;
+  if (osr->has_preparing_txc_before(txc)) {
+    // the txc can't be unqueued once others may follow it; let it
+    // pass through empty
+    r = -EAGAIN;
+  } else {
+    auto p = bl.cbegin();
+    for (auto [o_off, o_len] : m) {
+      bufferlist t;
+      p.copy(o_len, t);
+      txc->bytes += o_len;
+      int wr = _write(txc, c, o, o_off, o_len, t,
+		      CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+      if (wr < 0) {
+	derr << __func__ << " " << c->cid << " " << o->oid
+	     << " write error " << cpp_strerror(wr) << dendl;
+	ceph_abort_msg("unexpected error");
+      }
+    }
+  }
+  if (allocated) {
+    *allocated = txc->allocated;
+  }
+  _txc_calc_cost(txc);
+  _txc_write_nodes(txc, txc->t);
+  if (txc->deferred_txn) {
+    txc->deferred_txn->seq = ++deferred_seq;
+    bufferlist dbl;
+    encode(*txc->deferred_txn, dbl);
+    string key;
+    get_deferred_key(txc->deferred_txn->seq, &key);
+    txc->t->set(PREFIX_DEFERRED, key, dbl);
+  }
+  _txc_finalize_kv(txc, txc->t);
+  l.unlock();
+
+  auto tstart = mono_clock::now();
+  if (!throttle.try_start_transaction(*db, *txc, tstart)) {
+    ++deferred_aggressive;
+    deferred_try_submit();
+    {
+      std::lock_guard kl(kv_lock);
+      if (!kv_sync_in_progress) {
+	kv_sync_in_progress = true;
+	kv_cond.notify_one();
+      }
+    }
+    throttle.finish_start_transaction(*db, *txc, tstart);
+    --deferred_aggressive;
+  }
+  logger->inc(l_bluestore_txc);
+  _txc_state_proc(txc);
+  on_commit.wait();
+  return r;
+}
+
+int BlueStore::_defrag_region(
+  CollectionRef& c,
+  const ghobject_t& oid,
+  uint64_t offset,
+  uint64_t length,
+  uint64_t *object_size,
+  uint64_t *rewritten)
+{
+  OnodeRef o;
+  interval_set<uint64_t> m;
+  int64_t hint = 0;
+  uint64_t queued = 0;
+  bufferlist bl;
+  {
+    // look and read under the read lock like any client read, so client
+    // writes to the collection only wait for the rewrite itself
+    std::shared_lock l{c->lock};
+    if (!c->exists) {
+      return -ENOENT;
+    }
+    o = c->get_onode(oid, false, false, true);
+    if (!o || !o->exists) {
+      return -ENOENT;
+    }
+    *object_size = o->onode.size;
+    if (offset >= o->onode.size) {
+      return 0;
+    }
+    length = std::min<uint64_t>(length, o->onode.size - offset);
+
+    // count physically contiguous runs backing the region; shared and
+    // compressed blobs are left alone
+    o->extent_map.fault_range(db, offset, length);
+    uint64_t end = offset + length;
+    uint64_t runs = 0;
+    uint64_t prev_end = 0;
+    for (auto ep = o->extent_map.seek_lextent(offset);
+	 ep != o->extent_map.extent_map.end() && ep->logical_offset < end;
+	 ++ep) {
+      auto& b = ep->blob->get_blob();
+      if (b.is_compressed() || b.is_shared()) {
+	return 0;
+      }
+      uint64_t lo = std::max<uint64_t>(ep->logical_offset, offset);
+      uint64_t le = std::min<uint64_t>(ep->logical_end(), end);
+      m.insert(lo, le - lo);
+      b.map(ep->blob_offset + (lo - ep->logical_offset), le - lo,
+	[&](uint64_t poff, uint64_t plen) {
+	  if (runs == 0) {
+	    // stay on the tier the region starts on
+	    hint = poff;
+	  }
+	  if (runs == 0 || poff != prev_end) {
+	    ++runs;
+	  }
+	  prev_end = poff + plen;
+	  return 0;
+	});
+    }
+    uint64_t min_run = cct->_conf.get_val<Option::size_t>(
+      "bluestore_defrag_min_run_size");
+    if (runs <= 1 || m.size() / runs >= min_run) {
+      return 0;
+    }
+    // keep clear of the full ratio, we need the new extents before
+    // the old ones are released
+    if (alloc->get_free() < m.size() * 2 + bdev->get_size() / 100) {
+      return -ENOSPC;
+    }
+    dout(10) << __func__ << " " << c->cid << " " << oid
+	     << " 0x" << std::hex << offset << "~" << length << std::dec
+	     << " " << runs << " runs over " << m << dendl;
+    // a txc still in PREPARE may change the region after our read
+    if (!c->osr->get_settled(&queued)) {
+      return -EAGAIN;
+    }
+    int r = _do_readv(c.get(), o, m, bl, CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+    if (r < 0) {
+      derr << __func__ << " " << c->cid << " " << oid
+	   << " read error " << cpp_strerror(r) << dendl;
+      return r;
+    }
+  }
+
+  // Everything up to the kv transaction encoding happens under the
+  // collection lock, see _rewrite_ranges() for the ordering against
+  // client txcs.  Anything queued since the read may have changed the
+  // region; leave it for the next pass.
+  std::unique_lock l{c->lock};
+  uint64_t now_queued;
+  if (!c->exists || !c->osr->get_settled(&now_queued) ||
+      now_queued != queued ||
+      c->get_onode(oid, false, false, true) != o) {
+    return -EAGAIN;
+  }
+  int r = _rewrite_ranges(c, o, m, bl, hint, l);
+  if (r < 0) {
+    return r;
+  }
+  *rewritten = m.size();
+  logger->inc(l_bluestore_defrag_bytes, m.size());
+  return 0;
+}
+
+void BlueStore::_tier_note_access(Collection *c, OnodeRef& o)
+{
+  if (!tiered_alloc) {
+    return;
+  }
+  uint32_t heat = o->note_access(tier_epoch);
+  if (heat == tier_promote_heat) {
+    tier_thread.queue_promote(c, o->oid);
+  }
+}
+
+int BlueStore::_tier_migrate_region(
+  CollectionRef& c,
+  const ghobject_t& oid,
+  uint64_t offset,
+  uint64_t length,
+  bool to_fast,
+  uint64_t *object_size,
+  uint64_t *moved)
+{
+  ceph_assert(tiered_alloc);
+  const uint64_t fast_size = tiered_alloc->get_fast_size();
+  OnodeRef o;
+  // the parts of the region that live on the other tier; shared and
+  // compressed blobs are left alone
+  interval_set<uint64_t> m;
+  auto scan = [&]() {
+    m.clear();
+    if (!c->exists) {
+      return -ENOENT;
+    }
+    o = c->get_onode(oid, false, false, true);
+    if (!o || !o->exists) {
+      return -ENOENT;
+    }
+    *object_size = o->onode.size;
+    if (offset >= o->onode.size) {
+      return 0;
+    }
+    if (!to_fast &&
+	o->get_heat(tier_epoch) >= tier_promote_heat) {
+      // still hot; a zero size ends the caller's walk over the object
+      *object_size = 0;
+      return 0;
+    }
+    uint64_t len = std::min<uint64_t>(length, o->onode.size - offset);
+    o->extent_map.fault_range(db, offset, len);
+    uint64_t end = offset + len;
+    for (auto ep = o->extent_map.seek_lextent(offset);
+	 ep != o->extent_map.extent_map.end() && ep->logical_offset < end;
+	 ++ep) {
+      auto& b = ep->blob->get_blob();
+      if (b.is_compressed() || b.is_shared()) {
+	continue;
+      }
+      uint64_t lo = std::max<uint64_t>(ep->logical_offset, offset);
+      uint64_t le = std::min<uint64_t>(ep->logical_end(), end);
+      uint64_t pos = lo;
+      b.map(ep->blob_offset + (lo - ep->logical_offset), le - lo,
+	[&](uint64_t poff, uint64_t plen) {
+	  if (tiered_alloc->is_fast(poff) != to_fast) {
+	    m.union_insert(pos, plen);
+	  }
+	  pos += plen;
+	  return 0;
+	});
+    }
+    return 0;
+  };
+
+  uint64_t queued = 0;
+  bufferlist bl;
+  {
+    // most windows have nothing to move, find out and read the rest
+    // without stalling client writes, see _defrag_region()
+    std::shared_lock l{c->lock};
+    int r = scan();
+    if (r < 0 || m.empty()) {
+      return r;
+    }
+    // the new extents are needed before the old ones are released
+    uint64_t fast_free = tiered_alloc->get_fast_free();
+    uint64_t room = to_fast ? fast_free : alloc->get_free() - fast_free;
+    uint64_t reserve = to_fast ? fast_size / 100 :
+      (bdev->get_size() - fast_size) / 100;
+    if (room < m.size() + reserve) {
+      return -ENOSPC;
+    }
+    dout(10) << __func__ << " " << c->cid << " " << oid
+	     << " 0x" << std::hex << offset << "~" << length << std::dec
+	     << " to " << (to_fast ? "fast" : "slow") << " tier: " << m
+	     << dendl;
+    if (!c->osr->get_settled(&queued)) {
+      return -EAGAIN;
+    }
+    r = _do_readv(c.get(), o, m, bl, CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+    if (r < 0) {
+      derr << __func__ << " " << c->cid << " " << oid
+	   << " read error " << cpp_strerror(r) << dendl;
+      return r;
+    }
+  }
+  std::unique_lock l{c->lock};
+  uint64_t now_queued;
+  if (!c->exists || !c->osr->get_settled(&now_queued) ||
+      now_queued != queued ||
+      c->get_onode(oid, false, false, true) != o) {
+    return -EAGAIN;
+  }
+
+  interval_set<uint64_t> allocated;
+  int r = _rewrite_ranges(c, o, m, bl, to_fast ? 0 : fast_size, l,
+			  &allocated);
+  if (r < 0) {
+    return r;
+  }
+  // small overwrites may be deferred in place and a short tier falls
+  // back to the other one, so count what actually landed on the target
+  uint64_t n = 0;
+  for (auto [p_off, p_len] : allocated) {
+    uint64_t on_fast = p_off < fast_size ?
+      std::min<uint64_t>(p_len, fast_size - p_off) : 0;
+    n += to_fast ? on_fast : p_len - on_fast;
+  }
+  *moved = n;
+  logger->inc(to_fast ? l_bluestore_tier_promoted_bytes :
+	      l_bluestore_tier_demoted_bytes, n);
+  return 0;
+}
+
 void BlueStore::_txc_aio_submit(TransContext *txc)
 {
   dout(10) << __func__ << " txc " << txc << dendl;
@@ -15373,6 +18189,9 @@ void BlueStore::_txc_add_transaction(TransContext *txc, Transaction *t)
 	uint32_t fadvise_flags = i.get_fadvise_flags();
         bufferlist bl;
         i.decode_bl(bl);
+	if (!(fadvise_flags & CEPH_OSD_OP_FLAG_FADVISE_NOCACHE)) {
+	  _tier_note_access(c.get(), o);
+	}
 	r = _write(txc, c, o, off, len, bl, fadvise_flags);
       }
       break;
@@ -16476,18 +19295,44 @@ int BlueStore::_do_alloc_write(
   // and the condition is : (data_size < deferred).
 
   auto max_bsize = std::max(wctx->target_blob_size, min_alloc_size);
-  for (auto& wi : wctx->writes) {
-    if (c && wi.blob_length > min_alloc_size) {
-      auto start = mono_clock::now();
 
-      // compress
-      ceph_assert(wi.b_off == 0);
-      ceph_assert(wi.blob_length == wi.bl.length());
+  // compress all candidate blobs up front, in parallel for large writes
+  CompressThreadPool::batch_t batch;
+  if (c) {
+    uint64_t to_compress = 0;
+    for (auto& wi : wctx->writes) {
+      if (wi.blob_length > min_alloc_size) {
+        ceph_assert(wi.b_off == 0);
+        ceph_assert(wi.blob_length == wi.bl.length());
+        batch.jobs.emplace_back().in = &wi.bl;
+        to_compress += wi.blob_length;
+      }
+    }
+    int64_t async_min = select_option(
+      "compression_async_min_size",
+      (int64_t)cct->_conf.get_val<Option::size_t>(
+        "bluestore_compression_async_min_size"),
+      [&]() {
+        int64_t val;
+        if (coll->pool_opts.get(pool_opts_t::COMPRESSION_ASYNC_MIN_SIZE, &val)) {
+          return std::optional<int64_t>(val);
+        }
+        return std::optional<int64_t>();
+      }
+    );
+    batch.c = c;
+    batch.dict = _get_pool_compression_dict(coll->cid.pool(), c);
+    compress_pool.compress(batch, (int64_t)to_compress >= async_min);
+  }
+  auto job = batch.jobs.begin();
+  pool_compression_stats_t cstats;
 
-      // FIXME: memory alignment here is bad
-      bufferlist t;
-      std::optional<int32_t> compressor_message;
-      int r = c->compress(wi.bl, t, compressor_message);
+  for (auto& wi : wctx->writes) {
+    if (c && wi.blob_length > min_alloc_size) {
+      ceph_assert(job != batch.jobs.end());
+      bufferlist& t = job->out;
+      std::optional<int32_t>& compressor_message = job->compressor_message;
+      int r = job->r;
       uint64_t want_len_raw = wi.blob_length * crr;
       uint64_t want_len = p2roundup(want_len_raw, min_alloc_size);
       bool rejected = false;
@@ -16520,6 +19365,10 @@ int BlueStore::_do_alloc_write(
 	  txc->statfs_delta.compressed_original() += wi.blob_length;
 	  txc->statfs_delta.compressed_allocated() += result_len;
 	  logger->inc(l_bluestore_compress_success_count);
+	  ++cstats.compressed_blobs;
+	  cstats.dict_blobs += batch.dict ? 1 : 0;
+	  cstats.original_bytes += wi.blob_length;
+	  cstats.compressed_bytes += compressed_len;
 	  need += result_len;
 	  data_size += result_len;
 	} else {
@@ -16551,22 +19400,30 @@ int BlueStore::_do_alloc_write(
 	need += wi.blob_length;
 	data_size += wi.bl.length();
       }
+      if (!wi.compressed) {
+	++cstats.rejected_blobs;
+      }
+      cstats.compress_lat += job->lat;
       log_latency("compress@_do_alloc_write",
 	l_bluestore_compress_lat,
-        mono_clock::now() - start,
+        job->lat,
 	cct->_conf->bluestore_log_op_age );
+      ++job;
     } else {
       need += wi.blob_length;
       data_size += wi.bl.length();
     }
   }
+  if (c) {
+    _add_compression_stats(coll->cid.pool(), cstats);
+  }
   PExtentVector prealloc;
   prealloc.reserve(2 * wctx->writes.size());
   int64_t prealloc_left = 0;
   auto start = mono_clock::now();
   prealloc_left = alloc->allocate(
     need, min_alloc_size, need,
-    0, &prealloc);
+    txc->alloc_hint, &prealloc);
   log_latency("allocator@_do_alloc_write",
     l_bluestore_allocator_lat,
     mono_clock::now() - start,
@@ -17614,14 +20471,39 @@ int BlueStore::_omap_rmkeys(TransContext *txc,
     size_t base_key_len = final_key.size();
     decode(num, p);
     logger->inc(l_bluestore_omap_rmkeys_count, num);
-    while (num--) {
-      string key;
-      decode(key, p);
-      final_key.resize(base_key_len); // keep prefix
-      final_key += key;
-      dout(20) << __func__ << "  rm " << pretty_binary_string(final_key)
-	       << " <- " << key << dendl;
-      txc->t->rmkey(prefix, final_key);
+    uint64_t min_run = cct->_conf.get_val<uint64_t>(
+      "bluestore_omap_rmkeys_range_min");
+    if (min_run) {
+      // shorter runs are better off with point deletes on this kv store
+      min_run = std::max(min_run, cct->_conf.get_val<uint64_t>(
+	"rocksdb_delete_range_threshold"));
+    }
+    // runs are found against the committed omap, so there must be no
+    // omap updates to this object in flight, not even earlier in this
+    // txc: setkeys/setheader on an object without omap yet, clone and
+    // the like write the onode rather than just note the object
+    if (min_run && num >= min_run &&
+	o->flushing_count.load() == 0 &&
+	txc->modified_objects.count(o) == 0 &&
+	txc->onodes.count(o) == 0) {
+      set<string> keys;
+      while (num--) {
+	string key;
+	decode(key, p);
+	keys.insert(std::move(key));
+      }
+      _omap_rmkeys_ranged(txc, o, keys, min_run);
+    } else {
+      o->omap_tombstones += num;
+      while (num--) {
+	string key;
+	decode(key, p);
+	final_key.resize(base_key_len); // keep prefix
+	final_key += key;
+	dout(20) << __func__ << "  rm " << pretty_binary_string(final_key)
+		 << " <- " << key << dendl;
+	txc->t->rmkey(prefix, final_key);
+      }
     }
   }
   txc->note_modified_object(o);
@@ -17631,6 +20513,82 @@ int BlueStore::_omap_rmkeys(TransContext *txc,
   return r;
 }
 
+void BlueStore::_omap_rmkeys_ranged(TransContext *txc,
+				    OnodeRef& o,
+				    const set<string>& keys,
+				    size_t min_run)
+{
+  const string& prefix = o->get_omap_prefix();
+  string base, tail;
+  o->get_omap_key(string(), &base);
+  o->get_omap_tail(&tail);
+
+  // a run is a sequence of removed keys with no surviving key between
+  // them; keys that do not exist need no tombstone and do not break a run
+  vector<string> run;
+  uint64_t tombstones = 0;
+  auto flush_run = [&]() {
+    if (run.size() >= min_run) {
+      dout(20) << __func__ << "  rm range " << pretty_binary_string(run.front())
+	       << " to " << pretty_binary_string(run.back())
+	       << " (" << run.size() << " keys)" << dendl;
+      // the end is exclusive, the immediate successor of the last key
+      txc->t->rm_range_keys_direct(prefix, run.front(), run.back() + '\0');
+      logger->inc(l_bluestore_omap_rmkey_ranges_count);
+      logger->inc(l_bluestore_omap_rmkeys_ranged_count, run.size());
+      ++tombstones;
+    } else {
+      for (auto& k : run) {
+	dout(20) << __func__ << "  rm " << pretty_binary_string(k) << dendl;
+	txc->t->rmkey(prefix, k);
+      }
+      tombstones += run.size();
+    }
+    run.clear();
+  };
+
+  string final_key = base + *keys.begin();
+  KeyValueDB::Iterator it = db->get_iterator(
+    prefix, 0, KeyValueDB::IteratorBounds{final_key, tail});
+  it->lower_bound(final_key);
+  for (auto& key : keys) {
+    final_key.resize(base.size()); // keep prefix
+    final_key += key;
+    if (it->valid() && it->key() < final_key) {
+      // a key that stays
+      flush_run();
+      it->lower_bound(final_key);
+    }
+    if (it->valid() && it->key() == final_key) {
+      run.push_back(final_key);
+      it->next();
+    } else {
+      dout(20) << __func__ << "  skip missing " << pretty_binary_string(final_key)
+	       << dendl;
+    }
+  }
+  flush_run();
+  o->omap_tombstones += tombstones;
+}
+
+void BlueStore::_note_omap_tombstones(const OnodeRef& o,
+				      const string& head, const string& tail,
+				      uint64_t skipped)
+{
+  logger->inc(l_bluestore_omap_iterate_tombstones, skipped);
+  uint64_t threshold = cct->_conf.get_val<uint64_t>(
+    "bluestore_omap_compact_tombstones");
+  if (!threshold ||
+      (skipped < threshold && o->omap_tombstones.load() < threshold)) {
+    return;
+  }
+  dout(10) << __func__ << " " << o->oid << " skipped " << skipped
+	   << " tombstones, " << o->omap_tombstones << " written" << dendl;
+  o->omap_tombstones = 0;
+  logger->inc(l_bluestore_omap_compact_hints);
+  db->compact_range_async(o->get_omap_prefix(), head, tail);
+}
+
 int BlueStore::_omap_rmkey_range(TransContext *txc,
 				 CollectionRef& c,
 				 OnodeRef& o,
@@ -18477,6 +21435,11 @@ void BlueStore::_shutdown_cache()
   for (auto i : onode_cache_shards) {
     ceph_assert(i->empty());
   }
+  {
+    std::lock_guard l(compression_dict_lock);
+    std::atomic_store(&compression_dicts,
+		      std::make_shared<const compression_dicts_t>());
+  }
 }
 
 // For external caller.
@@ -19118,6 +22081,11 @@ bool RocksDBBlueFSVolumeSelector::compare(BlueFSVolumeSelector* other) {
 
 static const std::string allocator_dir    = "ALLOCATOR_NCB_DIR";
 static const std::string allocator_file   = "ALLOCATOR_NCB_FILE";
+// the allocation journal checkpoint, written to the .tmp file and renamed into place
+static const std::string allocator_ckpt_file     = "ALLOCATOR_NCB_CKPT";
+static const std::string allocator_ckpt_tmp_file = "ALLOCATOR_NCB_CKPT.tmp";
+// PREFIX_SUPER key holding the seq and serial of the checkpoint
+static const std::string alloc_journal_ckpt_key  = "alloc_journal_ckpt";
 static uint32_t    s_format_version = 0x01; // support future changes to allocator-map file
 static uint32_t    s_serial         = 0x01;
 
@@ -19424,6 +22392,73 @@ static uint32_t flush_extent_buffer_with_crc(BlueFS::FileWriter *p_handle, const
 }
 
 const unsigned MAX_EXTENTS_IN_BUFFER = 4 * 1024; // 4K extents = 64KB of data
+// write an allocator image (header, crc'd chunks of free extents, trailer) to p_handle
+//-----------------------------------------------------------------------------------
+int BlueStore::write_allocator_image(BlueFS::FileWriter *p_handle,
+				     uint32_t serial,
+				     const extent_foreach_t& foreach_extent,
+				     uint64_t *p_extent_count,
+				     uint64_t *p_allocation_size)
+{
+  int                     ret       = 0;
+  utime_t                 timestamp = ceph_clock_now();
+  uint32_t                crc       = -1;
+  {
+    allocator_image_header  header(timestamp, s_format_version, serial);
+    bufferlist              header_bl;
+    encode(header, header_bl);
+    crc = header_bl.crc32c(crc);
+    encode(crc, header_bl);
+    p_handle->append(header_bl);
+  }
+
+  crc = -1;					 // reset crc
+  extent_t        buffer[MAX_EXTENTS_IN_BUFFER]; // 64KB
+  extent_t       *p_curr          = buffer;
+  const extent_t *p_end           = buffer + MAX_EXTENTS_IN_BUFFER;
+  uint64_t        extent_count    = 0;
+  uint64_t        allocation_size = 0;
+  auto iterated_allocation = [&](uint64_t extent_offset, uint64_t extent_length) {
+    if (extent_length == 0) {
+      derr <<  __func__ << "" << extent_count << "::[" << extent_offset << "," << extent_length << "]" << dendl;
+      ret = -1;
+      return;
+    }
+    p_curr->offset = HTOCEPH_64(extent_offset);
+    p_curr->length = HTOCEPH_64(extent_length);
+    extent_count++;
+    allocation_size += extent_length;
+    p_curr++;
+
+    if (p_curr == p_end) {
+      crc = flush_extent_buffer_with_crc(p_handle, (const char*)buffer, (const char*)p_curr, crc);
+      p_curr = buffer; // recycle the buffer
+    }
+  };
+  foreach_extent(iterated_allocation);
+  if (ret != 0) {
+    return ret;
+  }
+
+  // if we got any leftovers -> add crc and append to file
+  if (p_curr > buffer) {
+    crc = flush_extent_buffer_with_crc(p_handle, (const char*)buffer, (const char*)p_curr, crc);
+  }
+
+  {
+    allocator_image_trailer trailer(timestamp, s_format_version, serial, extent_count, allocation_size);
+    bufferlist trailer_bl;
+    encode(trailer, trailer_bl);
+    uint32_t crc = -1;
+    crc = trailer_bl.crc32c(crc);
+    encode(crc, trailer_bl);
+    p_handle->append(trailer_bl);
+  }
+  *p_extent_count    = extent_count;
+  *p_allocation_size = allocation_size;
+  return 0;
+}
+
 // write the allocator to a flat bluefs file - 4K extents at a time
 //-----------------------------------------------------------------------------------
 int BlueStore::store_allocator(Allocator* src_allocator)
@@ -19469,41 +22504,12 @@ int BlueStore::store_allocator(Allocator* src_allocator)
   }
 
   // store all extents (except for the bluefs extents we removed) in a single flat file
-  utime_t                 timestamp = ceph_clock_now();
-  uint32_t                crc       = -1;
-  {
-    allocator_image_header  header(timestamp, s_format_version, s_serial);
-    bufferlist              header_bl;
-    encode(header, header_bl);
-    crc = header_bl.crc32c(crc);
-    encode(crc, header_bl);
-    p_handle->append(header_bl);
-  }
-
-  crc = -1;					 // reset crc
-  extent_t        buffer[MAX_EXTENTS_IN_BUFFER]; // 64KB
-  extent_t       *p_curr          = buffer;
-  const extent_t *p_end           = buffer + MAX_EXTENTS_IN_BUFFER;
-  uint64_t        extent_count    = 0;
-  uint64_t        allocation_size = 0;
-  auto iterated_allocation = [&](uint64_t extent_offset, uint64_t extent_length) {
-    if (extent_length == 0) {
-      derr <<  __func__ << "" << extent_count << "::[" << extent_offset << "," << extent_length << "]" << dendl;
-      ret = -1;
-      return;
-    }
-    p_curr->offset = HTOCEPH_64(extent_offset);
-    p_curr->length = HTOCEPH_64(extent_length);
-    extent_count++;
-    allocation_size += extent_length;
-    p_curr++;
-
-    if (p_curr == p_end) {
-      crc = flush_extent_buffer_with_crc(p_handle, (const char*)buffer, (const char*)p_curr, crc);
-      p_curr = buffer; // recycle the buffer
-    }
-  };
-  allocator->foreach(iterated_allocation);
+  uint64_t extent_count    = 0;
+  uint64_t allocation_size = 0;
+  ret = write_allocator_image(
+    p_handle, s_serial,
+    [&](auto&& notify) { allocator->foreach(notify); },
+    &extent_count, &allocation_size);
   // if got null extent -> fail the operation
   if (ret != 0) {
     derr << "Illegal extent, fail store operation" << dendl;
@@ -19513,21 +22519,6 @@ int BlueStore::store_allocator(Allocator* src_allocator)
     return -1;
   }
 
-  // if we got any leftovers -> add crc and append to file
-  if (p_curr > buffer) {
-    crc = flush_extent_buffer_with_crc(p_handle, (const char*)buffer, (const char*)p_curr, crc);
-  }
-
-  {
-    allocator_image_trailer trailer(timestamp, s_format_version, s_serial, extent_count, allocation_size);
-    bufferlist trailer_bl;
-    encode(trailer, trailer_bl);
-    uint32_t crc = -1;
-    crc = trailer_bl.crc32c(crc);
-    encode(crc, trailer_bl);
-    p_handle->append(trailer_bl);
-  }
-
   bluefs->fsync(p_handle);
   bluefs->truncate(p_handle, p_handle->pos);
   bluefs->fsync(p_handle);
@@ -19596,9 +22587,28 @@ int BlueStore::__restore_allocator(Allocator* allocator, uint64_t *num, uint64_t
       return -1;
     }
   }
+  uint32_t serial = 0;
+  int ret = read_allocator_image(
+    allocator_file,
+    [&](uint64_t offset, uint64_t length) {
+      allocator->init_add_free(offset, length);
+    },
+    num, bytes, &serial);
+  if (ret == 0) {
+    // increment version for next store
+    s_serial = serial + 1;
+  }
+  return ret;
+}
+
+//-----------------------------------------------------------------------------------
+int BlueStore::read_allocator_image(const std::string& file,
+				    const std::function<void(uint64_t, uint64_t)>& add_free,
+				    uint64_t *num, uint64_t *bytes, uint32_t *p_serial)
+{
   utime_t start_time = ceph_clock_now();
   BlueFS::FileReader *p_temp_handle = nullptr;
-  int ret = bluefs->open_for_read(allocator_dir, allocator_file, &p_temp_handle, false);
+  int ret = bluefs->open_for_read(allocator_dir, file, &p_temp_handle, false);
   if (ret != 0) {
     dout(1) << "Failed open_for_read with error-code " << ret << dendl;
     return -1;
@@ -19644,9 +22654,7 @@ int BlueStore::__restore_allocator(Allocator* allocator, uint64_t *num, uint64_t
       derr << "header = \n" << header << dendl;
       return -1;
     }
-
-    // increment version for next store
-    s_serial = header.serial + 1;
+    *p_serial = header.serial;
   }
 
   // then read the payload (extents list) using a recycled buffer
@@ -19674,7 +22682,7 @@ int BlueStore::__restore_allocator(Allocator* allocator, uint64_t *num, uint64_t
       read_alloc_size += length;
 
       if (length > 0) {
-	allocator->init_add_free(offset, length);
+	add_free(offset, length);
 	extent_count ++;
       } else {
 	derr << "extent with zero length at idx=" << extent_count << dendl;
@@ -19760,6 +22768,306 @@ int BlueStore::restore_allocator(Allocator* dest_allocator, uint64_t *num, uint6
   return ret;
 }
 
+//-----------------------------------------------------------------------------------
+// The allocation journal: every txc that allocates or releases space also
+// writes a PREFIX_ALLOC_JOURNAL record {allocated, released} keyed by a seq
+// that follows submission order.  The checkpoint file is an allocator image
+// (same format as the allocation file) of the free space after record
+// <seq>, where <seq> is kept in PREFIX_SUPER.  Replaying a record sets its
+// extents to the state it recorded, so replaying records the checkpoint
+// already covers is harmless; this is what makes it safe to move the
+// PREFIX_SUPER key only after the new checkpoint file is in place.
+int BlueStore::read_allocation_checkpoint_key(uint64_t *seq, uint32_t *serial)
+{
+  bufferlist bl;
+  int ret = db->get(PREFIX_SUPER, alloc_journal_ckpt_key, &bl);
+  if (ret < 0) {
+    return ret;
+  }
+  try {
+    auto p = bl.cbegin();
+    decode(*seq, p);
+    decode(*serial, p);
+  } catch (ceph::buffer::error& e) {
+    derr << "failed to decode " << alloc_journal_ckpt_key << ": " << e.what() << dendl;
+    return -EIO;
+  }
+  return 0;
+}
+
+//-----------------------------------------------------------------------------------
+int BlueStore::replay_allocation_journal(interval_set<uint64_t> *free,
+					 uint64_t after_seq,
+					 uint64_t upto_seq,
+					 uint64_t *p_last_seq,
+					 uint64_t *p_records)
+{
+  uint64_t bdev_size = bdev->get_size();
+  uint64_t last_seq  = after_seq;
+  uint64_t records   = 0;
+  auto it = db->get_iterator(PREFIX_ALLOC_JOURNAL, KeyValueDB::ITERATOR_NOCACHE);
+  string key;
+  _key_encode_u64(after_seq, &key);
+  for (it->upper_bound(key); it->valid(); it->next()) {
+    uint64_t seq = 0;
+    _key_decode_u64(it->key().c_str(), &seq);
+    if (seq > upto_seq) {
+      break;
+    }
+    // records of txcs that were submitted concurrently and didn't make it
+    // leave gaps
+    if (seq != last_seq + 1) {
+      dout(10) << "journal gap: expected seq " << last_seq + 1 << ", found " << seq << dendl;
+    }
+    interval_set<uint64_t> allocated, released;
+    try {
+      bufferlist bl = it->value();
+      auto p = bl.cbegin();
+      decode(allocated, p);
+      decode(released, p);
+    } catch (ceph::buffer::error& e) {
+      derr << "failed to decode journal record " << seq << ": " << e.what() << dendl;
+      return -EIO;
+    }
+    if ((!allocated.empty() && allocated.range_end() > bdev_size) ||
+	(!released.empty() && released.range_end() > bdev_size)) {
+      derr << "journal record " << seq << " is beyond the device end" << dendl;
+      return -EIO;
+    }
+    // a txc may release what it has just allocated, never the other way around
+    interval_set<uint64_t> now_used;
+    now_used.intersection_of(*free, allocated);
+    free->subtract(now_used);
+    free->union_of(released);
+    last_seq = seq;
+    records++;
+  }
+  *p_last_seq = last_seq;
+  *p_records  = records;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------------
+int BlueStore::restore_allocator_from_journal(Allocator* dest_allocator, uint64_t *num, uint64_t *bytes)
+{
+  utime_t  start = ceph_clock_now();
+  uint64_t ckpt_seq = 0;
+  uint32_t ckpt_serial = 0;
+  int ret = read_allocation_checkpoint_key(&ckpt_seq, &ckpt_serial);
+  if (ret < 0) {
+    dout(1) << "no allocation checkpoint (" << cpp_strerror(ret) << ")" << dendl;
+    return ret;
+  }
+
+  interval_set<uint64_t> free;
+  uint32_t serial = 0;
+  ret = read_allocator_image(
+    allocator_ckpt_file,
+    [&](uint64_t offset, uint64_t length) {
+      free.insert(offset, length);
+    },
+    num, bytes, &serial);
+  if (ret != 0) {
+    derr << "failed to read the allocation checkpoint" << dendl;
+    return -EIO;
+  }
+  // the file is one checkpoint ahead if we crashed before moving the key
+  if (serial != ckpt_serial && serial != ckpt_serial + 1) {
+    derr << "stale allocation checkpoint: serial=" << serial
+	 << ", expected " << ckpt_serial << dendl;
+    return -EIO;
+  }
+
+  uint64_t last_seq = 0, records = 0;
+  ret = replay_allocation_journal(&free, ckpt_seq, UINT64_MAX, &last_seq, &records);
+  if (ret != 0) {
+    return ret;
+  }
+
+  *num   = 0;
+  *bytes = 0;
+  for (auto [offset, length] : free) {
+    dest_allocator->init_add_free(offset, length);
+    (*num)++;
+    *bytes += length;
+  }
+  logger->inc(l_bluestore_alloc_journal_replayed, records);
+  utime_t duration = ceph_clock_now() - start;
+  dout(1) << "checkpoint seq=" << ckpt_seq << " + " << records
+	  << " journal records restored in " << duration << " seconds" << dendl;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------------
+int BlueStore::store_allocation_checkpoint(const interval_set<uint64_t>& free, uint64_t seq)
+{
+  utime_t start = ceph_clock_now();
+  int ret = 0;
+  if (!bluefs->dir_exists(allocator_dir)) {
+    ret = bluefs->mkdir(allocator_dir);
+    if (ret != 0) {
+      derr << "Failed mkdir with error-code " << ret << dendl;
+      return ret;
+    }
+  }
+  BlueFS::FileWriter *p_handle = nullptr;
+  ret = bluefs->open_for_write(allocator_dir, allocator_ckpt_tmp_file, &p_handle, false);
+  if (ret != 0) {
+    derr << "Failed open_for_write with error-code " << ret << dendl;
+    return ret;
+  }
+  uint32_t serial = alloc_journal_ckpt_serial + 1;
+  uint64_t extent_count = 0, allocation_size = 0;
+  ret = write_allocator_image(
+    p_handle, serial,
+    [&](auto&& notify) {
+      for (auto [offset, length] : free) {
+	notify(offset, length);
+      }
+    },
+    &extent_count, &allocation_size);
+  if (ret == 0) {
+    bluefs->fsync(p_handle);
+  }
+  bluefs->close_writer(p_handle);
+  if (ret == 0) {
+    ret = bluefs->rename(allocator_dir, allocator_ckpt_tmp_file,
+			 allocator_dir, allocator_ckpt_file);
+  }
+  if (ret != 0) {
+    derr << "failed to write the allocation checkpoint: " << cpp_strerror(ret) << dendl;
+    bluefs->unlink(allocator_dir, allocator_ckpt_tmp_file);
+    bluefs->sync_metadata(false);
+    return ret;
+  }
+  bluefs->sync_metadata(false);
+
+  KeyValueDB::Transaction t = db->get_transaction();
+  bufferlist bl;
+  encode(seq, bl);
+  encode(serial, bl);
+  t->set(PREFIX_SUPER, alloc_journal_ckpt_key, bl);
+  string end;
+  _key_encode_u64(seq + 1, &end);
+  t->rm_range_keys(PREFIX_ALLOC_JOURNAL, string(), end);
+  ret = db->submit_transaction_sync(t);
+  if (ret != 0) {
+    derr << "failed to commit the allocation checkpoint: " << cpp_strerror(ret) << dendl;
+    return ret;
+  }
+  alloc_journal_ckpt_seq    = seq;
+  alloc_journal_ckpt_serial = serial;
+
+  utime_t duration = ceph_clock_now() - start;
+  logger->inc(l_bluestore_alloc_checkpoints);
+  logger->tinc(l_bluestore_alloc_checkpoint_lat, duration);
+  dout(5) << "seq=" << seq << ", serial=" << serial
+	  << ", extent_count=" << extent_count
+	  << ", free=" << allocation_size
+	  << " written in " << duration << " seconds" << dendl;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------------
+// make sure a journal that stopped short of the current state is never replayed
+void BlueStore::invalidate_allocation_checkpoint()
+{
+  KeyValueDB::Transaction t = db->get_transaction();
+  t->rmkey(PREFIX_SUPER, alloc_journal_ckpt_key);
+  int ret = db->submit_transaction_sync(t);
+  ceph_assert(ret == 0);
+}
+
+//-----------------------------------------------------------------------------------
+int BlueStore::start_allocation_journal()
+{
+  ceph_assert(alloc_journal_base);
+  uint64_t seq = 0;
+  uint32_t serial = 0;
+  int ret = read_allocation_checkpoint_key(&seq, &serial);
+  if (ret < 0 && ret != -ENOENT) {
+    return ret;
+  }
+  alloc_journal_ckpt_serial = serial;
+  // whatever is in the journal already is part of what we loaded; new
+  // records must continue after it, even if it has been trimmed
+  auto it = db->get_iterator(PREFIX_ALLOC_JOURNAL, KeyValueDB::ITERATOR_NOCACHE);
+  if (it->seek_to_last() == 0 && it->valid()) {
+    uint64_t last = 0;
+    _key_decode_u64(it->key().c_str(), &last);
+    seq = std::max(seq, last);
+  }
+  ret = store_allocation_checkpoint(*alloc_journal_base, seq);
+  if (ret < 0) {
+    return ret;
+  }
+  alloc_journal_seq = seq;
+  alloc_journal = true;
+  dout(5) << "allocation journal starts after seq=" << seq << dendl;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------------
+// fold the journal into the last checkpoint and write that out instead
+int BlueStore::checkpoint_allocation_journal()
+{
+  // records below one that is still being submitted may not be visible
+  // yet, they must stay in the journal
+  uint64_t upto_seq;
+  {
+    std::lock_guard l(alloc_journal_lock);
+    upto_seq = alloc_journal_pending.empty() ?
+      alloc_journal_seq : *alloc_journal_pending.begin() - 1;
+  }
+  if (upto_seq <= alloc_journal_ckpt_seq) {
+    return 0;
+  }
+  interval_set<uint64_t> free;
+  uint64_t num = 0, bytes = 0;
+  uint32_t serial = 0;
+  int ret = read_allocator_image(
+    allocator_ckpt_file,
+    [&](uint64_t offset, uint64_t length) {
+      free.insert(offset, length);
+    },
+    &num, &bytes, &serial);
+  if (ret != 0) {
+    derr << "failed to read the allocation checkpoint" << dendl;
+    return -EIO;
+  }
+  uint64_t last_seq = 0, records = 0;
+  ret = replay_allocation_journal(&free, alloc_journal_ckpt_seq, upto_seq,
+				  &last_seq, &records);
+  if (ret != 0) {
+    return ret;
+  }
+  dout(10) << "folding " << records << " records into the checkpoint" << dendl;
+  return store_allocation_checkpoint(free, upto_seq);
+}
+
+void *BlueStore::AllocCheckpointThread::entry()
+{
+  std::unique_lock l{lock};
+  auto last = mono_clock::now();
+  while (!stop) {
+    double interval = store->cct->_conf.get_val<double>(
+      "bluestore_allocation_checkpoint_interval");
+    if (interval > 0 &&
+	mono_clock::now() - last >= ceph::make_timespan(interval)) {
+      l.unlock();
+      store->checkpoint_allocation_journal();
+      l.lock();
+      last = mono_clock::now();
+      continue;
+    }
+    // wake up every second or so to pick up interval changes
+    cond.wait_for(l, ceph::make_timespan(
+      interval > 0 ? std::min(interval, 1.0) : 1.0));
+  }
+  stop = false;
+  return NULL;
+}
+
 //-----------------------------------------------------------------------------------
 void BlueStore::set_allocation_in_simple_bmap(SimpleBitmap* sbmap, uint64_t offset, uint64_t length)
 {
@@ -20509,6 +23817,13 @@ int BlueStore::commit_to_real_manager()
   freelist_type = "bitmap";
   int ret = commit_freelist_type();
   if (ret == 0) {
+    // the allocation journal is meaningless with a real freelist
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->rmkeys_by_prefix(PREFIX_ALLOC_JOURNAL);
+    t->rmkey(PREFIX_SUPER, alloc_journal_ckpt_key);
+    db->submit_transaction_sync(t);
+    bluefs->unlink(allocator_dir, allocator_ckpt_file);
+
     //remove the allocation_file
     invalidate_allocation_file_on_bluefs();
     ret = bluefs->unlink(allocator_dir, allocator_file);
@@ -62,6 +62,7 @@
 #endif
 
 class Allocator;
+class TieredAllocator;
 class FreelistManager;
 class BlueStoreRepairer;
 class SimpleBitmap;
@@ -115,6 +116,9 @@ enum {
   l_bluestore_read_eio,
   l_bluestore_reads_with_retries,
   l_bluestore_read_lat,
+  l_bluestore_read_bytes_shared,
+  l_bluestore_read_bytes_copied,
+  l_bluestore_read_use_once_bytes,
   //****************************************
 
   // kv_thread latencies
@@ -145,6 +149,10 @@ enum {
   l_bluestore_issued_deferred_write_bytes,
   l_bluestore_submitted_deferred_writes,
   l_bluestore_submitted_deferred_write_bytes,
+  l_bluestore_deferred_elevator_batches,
+  l_bluestore_deferred_elevator_ios,
+  l_bluestore_deferred_elevator_writes,
+  l_bluestore_deferred_elevator_seek_bytes,
 
   l_bluestore_write_big_skipped_blobs,
   l_bluestore_write_big_skipped_bytes,
@@ -161,6 +169,8 @@ enum {
   l_bluestore_decompress_lat,
   l_bluestore_compress_success_count,
   l_bluestore_compress_rejected_count,
+  l_bluestore_compress_queue_lat,
+  l_bluestore_compress_offloaded_count,
   //****************************************
 
   // onode cache stats
@@ -171,6 +181,12 @@ enum {
   l_bluestore_onode_misses,
   l_bluestore_onode_shard_hits,
   l_bluestore_onode_shard_misses,
+  l_bluestore_onode_inline_decodes,
+  l_bluestore_onode_use_once,
+  l_bluestore_onode_prefetch_runs,
+  l_bluestore_onode_prefetched,
+  l_bluestore_onode_prefetch_shards,
+  l_bluestore_onode_prefetch_hits,
   l_bluestore_extents,
   l_bluestore_blobs,
   //****************************************
@@ -181,6 +197,8 @@ enum {
   l_bluestore_buffer_bytes,
   l_bluestore_buffer_hit_bytes,
   l_bluestore_buffer_miss_bytes,
+  l_bluestore_buffer_ghost_recent_hit_bytes,
+  l_bluestore_buffer_ghost_frequent_hit_bytes,
   //****************************************
 
   // internal stats
@@ -189,6 +207,11 @@ enum {
   l_bluestore_blob_split,
   l_bluestore_extent_compress,
   l_bluestore_gc_merged,
+  l_bluestore_defrag_objects,
+  l_bluestore_defrag_bytes,
+  l_bluestore_tier_promoted_bytes,
+  l_bluestore_tier_demoted_bytes,
+  l_bluestore_tier_fast_free,
   //****************************************
 
   // misc
@@ -196,6 +219,9 @@ enum {
   l_bluestore_omap_iterator_count,
   l_bluestore_omap_rmkeys_count,
   l_bluestore_omap_rmkey_ranges_count,
+  l_bluestore_omap_rmkeys_ranged_count,
+  l_bluestore_omap_iterate_tombstones,
+  l_bluestore_omap_compact_hints,
   //****************************************
 
   // other client ops latencies
@@ -216,6 +242,10 @@ enum {
   //****************************************
   l_bluestore_allocate_hist,
   l_bluestore_allocator_lat,
+  l_bluestore_alloc_journal_records,
+  l_bluestore_alloc_journal_replayed,
+  l_bluestore_alloc_checkpoints,
+  l_bluestore_alloc_checkpoint_lat,
   //****************************************
 
   // slow op counter
@@ -228,6 +258,17 @@ enum {
   l_bluestore_last
 };
 
+enum {
+  l_bluestore_kv_shard_first = 732590,
+  l_bluestore_kv_shard_queue_depth,
+  l_bluestore_kv_shard_batch_size,
+  l_bluestore_kv_shard_committed,
+  l_bluestore_kv_shard_flush_lat,
+  l_bluestore_kv_shard_sync_lat,
+  l_bluestore_kv_shard_final_lat,
+  l_bluestore_kv_shard_last
+};
+
 #define META_POOL_ID ((uint64_t)-1ull)
 using bptr_c_it_t = buffer::ptr::const_iterator;
 
@@ -252,6 +293,16 @@ public:
     max_defer_interval =
 	cct->_conf.get_val<double>("bluestore_max_defer_interval");
   }
+  void _set_onode_prefetch() {
+    onode_prefetch_count =
+      cct->_conf.get_val<uint64_t>("bluestore_onode_prefetch_count");
+    onode_prefetch_trigger =
+      cct->_conf.get_val<uint64_t>("bluestore_onode_prefetch_trigger");
+  }
+  void _set_tier_promote_heat() {
+    tier_promote_heat =
+      cct->_conf.get_val<uint64_t>("bluestore_tier_promote_heat");
+  }
 
   struct TransContext;
 
@@ -286,11 +337,12 @@ public:
     }
     enum {
       FLAG_NOCACHE = 1,  ///< trim when done WRITING (do not become CLEAN)
-      // NOTE: fix operator<< when you define a second flag
+      FLAG_REBUILD = 2,  ///< rebuild skipped while data was shared
     };
     static const char *get_flag_name(int s) {
       switch (s) {
       case FLAG_NOCACHE: return "nocache";
+      case FLAG_REBUILD: return "rebuild";
       default: return "???";
       }
     }
@@ -352,12 +404,37 @@ public:
       }
       length = newlen;
     }
-    void maybe_rebuild() {
+    /// true if any data buffer is referenced outside of the cache too,
+    /// e.g. by a read reply that is still in flight
+    bool is_data_shared() const {
+      for (const auto& p : data.buffers()) {
+	if (p.raw_nref() > 1) {
+	  return true;
+	}
+      }
+      return false;
+    }
+    uint64_t wasted() const {
+      uint64_t w = 0;
+      for (const auto& p : data.buffers()) {
+	w += p.wasted();
+      }
+      return w;
+    }
+    void maybe_rebuild(bool keep_shared = false) {
       if (data.length() &&
 	  (data.get_num_buffers() > 1 ||
 	   data.front().wasted() > data.length() / MAX_BUFFER_SLOP_RATIO_DEN)) {
+	// while shared, rebuilding adds a copy and releases nothing until
+	// the other user lets go; only do it if the copy is smaller than
+	// what it releases, otherwise retry when the buffer is next touched
+	if (keep_shared && is_data_shared() && wasted() <= data.length()) {
+	  flags |= FLAG_REBUILD;
+	  return;
+	}
 	data.rebuild();
       }
+      flags &= ~FLAG_REBUILD;
     }
 
     void dump(ceph::Formatter *f) const {
@@ -375,6 +452,7 @@ public:
   struct BufferSpace {
     enum {
       BYPASS_CLEAN_CACHE = 0x1,  // bypass clean cache
+      USE_ONCE = 0x2,            // serve clean hits without touching them
     };
 
     typedef boost::intrusive::list<
@@ -964,6 +1042,7 @@ public:
     mempool::bluestore_cache_meta::vector<Shard> shards;    ///< shards
 
     ceph::buffer::list inline_bl;    ///< cached encoded map, if unsharded; empty=>dirty
+    bool inline_pending = false;     ///< inline_bl not decoded into extent_map yet
 
     uint32_t needs_reshard_begin = 0;
     uint32_t needs_reshard_end = 0;
@@ -1018,6 +1097,7 @@ public:
       extent_map.clear_and_dispose(DeleteDisposer());
       shards.clear();
       inline_bl.clear();
+      inline_pending = false;
       clear_needs_reshard();
     }
 
@@ -1324,12 +1404,35 @@ public:
     bool cached;              ///< Onode is logically in the cache
                               /// (it can be pinned and hence physically out
                               /// of it at the moment though)
+    /// loaded by a use-once read (scrub, recovery) and not referenced by
+    /// anything else since; kept at the cold end of the onode LRU
+    std::atomic<bool> use_once = {false};
+    /// loaded ahead of use by an onode prefetch and not looked up since
+    std::atomic<bool> prefetched = {false};
+    /// access temperature for tiered data placement; halves every tier
+    /// epoch (bluestore_tier_interval) and is lost when the onode is trimmed
+    std::atomic<uint32_t> heat = {0};
+    std::atomic<uint32_t> heat_epoch = {0};
+
+    uint32_t get_heat(uint32_t epoch) const {
+      uint32_t age = epoch - heat_epoch;
+      return age >= 32 ? 0 : heat >> age;
+    }
+    /// count an access, returns the new heat
+    uint32_t note_access(uint32_t epoch) {
+      uint32_t h = get_heat(epoch) + 1;
+      heat = h;
+      heat_epoch = epoch;
+      return h;
+    }
     ExtentMap extent_map;
 
     // track txc's that have not been committed to kv store (and whose
     // effects cannot be read via the kvdb read methods)
     std::atomic<int> flushing_count = {0};
     std::atomic<int> waiting_count = {0};
+    /// omap tombstones written since the omap range was last compacted
+    std::atomic<uint32_t> omap_tombstones = {0};
     /// protect flush_txns
     ceph::mutex flush_lock = ceph::make_mutex("BlueStore::Onode::flush_lock");
     ceph::condition_variable flush_cond;   ///< wait here for uncommitted txns
@@ -1379,7 +1482,8 @@ public:
     static void decode_raw(
       BlueStore::Onode* on,
       const bufferlist& v,
-      ExtentMap::ExtentDecoder& dencoder);
+      ExtentMap::ExtentDecoder& dencoder,
+      bool lazy_inline = false);
 
     static Onode* create_decode(
       CollectionRef c,
@@ -1609,6 +1713,7 @@ private:
 		const mempool::bluestore_cache_meta::string& new_okey);
     void clear();
     bool empty();
+    bool contains(const ghobject_t& oid);
 
     template <int LogLevelV>
     void dump(CephContext *cct);
@@ -1639,11 +1744,23 @@ private:
     //pool options
     pool_opts_t pool_opts;
     ContextQueue *commit_queue;
+    int64_t io_queue_hint = -1;  ///< IOContext::queue_hint for our I/O
 
     OnodeCacheShard* get_onode_cache() const {
       return onode_space.cache;
     }
-    OnodeRef get_onode(const ghobject_t& oid, bool create, bool is_createop=false);
+    OnodeRef get_onode(const ghobject_t& oid, bool create, bool is_createop=false,
+                       bool use_once=false);
+
+    /// sequential lookup detection for onode prefetch
+    ceph::mutex prefetch_lock =
+      ceph::make_mutex("BlueStore::Collection::prefetch_lock");
+    std::string prefetch_last_key;  ///< key of the last onode cache miss
+    std::string prefetch_next_key;  ///< first key past the last prefetch
+    unsigned prefetch_run = 0;      ///< consecutive in-order misses
+
+    bool _should_prefetch_onodes(const std::string& key);
+    void _prefetch_onodes(const std::string& after);
 
     // the terminology is confusing here, sorry!
     //
@@ -1698,8 +1815,11 @@ private:
     OnodeRef o;
     KeyValueDB::Iterator it;
     std::string head, tail;
+    uint64_t tombstones_skipped = 0;
 
     std::string _stringify() const;
+    template <typename Func>
+    void _count_tombstones(Func&& f);
   public:
     OmapIteratorImpl(PerfCounters* l, CollectionRef c, OnodeRef& o, KeyValueDB::Iterator it);
     virtual ~OmapIteratorImpl();
@@ -1902,6 +2022,7 @@ private:
     interval_set<uint64_t> allocated, released;
     volatile_statfs statfs_delta;	   ///< overall store statistics delta
     uint64_t osd_pool_id = META_POOL_ID;    ///< osd pool id we're operating on
+    int64_t alloc_hint = 0;  ///< where new data extents should preferably go
 
     IOContext ioc;
     bool had_ios = false;  ///< true if we submitted IOs before our kv txn
@@ -1928,6 +2049,9 @@ private:
 	ioc(cct, this),
 	start(ceph::mono_clock::now()) {
       last_stamp = start;
+      if (c) {
+	ioc.queue_hint = c->io_queue_hint;
+      }
       if (on_commits) {
 	oncommits.swap(*on_commits);
       }
@@ -2111,6 +2235,23 @@ private:
     }
   };
 
+  /// deferred batches of several sequencers submitted as one sorted stream
+  struct DeferredElevatorBatch final : public AioContext {
+    std::vector<DeferredBatch*> batches;
+    IOContext ioc;
+
+    DeferredElevatorBatch(CephContext *cct,
+			  std::vector<DeferredBatch*>&& batches)
+      : batches(std::move(batches)), ioc(cct, this) {}
+
+    void aio_finish(BlueStore *store) override {
+      for (auto b : batches) {
+	store->_deferred_aio_finish(b->osr);
+      }
+      delete this;
+    }
+  };
+
   class OpSequencer : public RefCountedObject {
   public:
     ceph::mutex qlock = ceph::make_mutex("BlueStore::OpSequencer::qlock");
@@ -2134,6 +2275,7 @@ private:
     coll_t cid;
 
     uint64_t last_seq = 0;
+    uint64_t num_queued = 0;  ///< unlike last_seq, never rewound
 
     std::atomic_int txc_with_unstable_io = {0};  ///< num txcs with unstable io
 
@@ -2152,6 +2294,7 @@ private:
     void queue_new(TransContext *txc) {
       std::lock_guard l(qlock);
       txc->seq = ++last_seq;
+      ++num_queued;
       q.push_back(*txc);
     }
     void undo_queue(TransContext* txc) {
@@ -2223,6 +2366,38 @@ private:
       }
       }
 
+    bool empty() {
+      std::lock_guard l(qlock);
+      return q.empty();
+    }
+
+    bool has_preparing_txc_before(TransContext *txc) {
+      // a txc still in PREPARE may not have applied or encoded its ops yet
+      std::lock_guard l(qlock);
+      for (auto& i : q) {
+	if (&i == txc) {
+	  break;
+	}
+	if (i.get_state() == TransContext::STATE_PREPARE) {
+	  return true;
+	}
+      }
+      return false;
+    }
+
+    /// if every queued txc has applied its ops, count them so that a
+    /// later call can tell whether anything was queued in between
+    bool get_settled(uint64_t *queued) {
+      std::lock_guard l(qlock);
+      for (auto& i : q) {
+	if (i.get_state() == TransContext::STATE_PREPARE) {
+	  return false;
+	}
+      }
+      *queued = num_queued;
+      return true;
+    }
+
     bool flush_commit(Context *c) {
       std::lock_guard l(qlock);
       if (q.empty()) {
@@ -2270,6 +2445,61 @@ private:
     }
   };
 
+  /// additional commit pipeline used when bluestore_kv_sync_shards > 1
+  ///
+  /// Shard 0 is always the legacy kv_sync_thread/kv_finalize_thread pair,
+  /// which also owns deferred io cleanup.  OpSequencers are mapped to a
+  /// shard by sequencer id, so all txcs of a sequencer go through the
+  /// same pipeline and per-sequencer ordering is preserved.
+  struct KVSyncShard {
+    struct SyncThread : public Thread {
+      KVSyncShard *shard;
+      explicit SyncThread(KVSyncShard *s) : shard(s) {}
+      void *entry() override {
+	shard->store->_kv_shard_sync_thread(shard);
+	return NULL;
+      }
+    };
+    struct FinalizeThread : public Thread {
+      KVSyncShard *shard;
+      explicit FinalizeThread(KVSyncShard *s) : shard(s) {}
+      void *entry() override {
+	shard->store->_kv_shard_finalize_thread(shard);
+	return NULL;
+      }
+    };
+
+    BlueStore *store;
+    const unsigned id;
+
+    SyncThread sync_thread;
+    ceph::mutex lock = ceph::make_mutex("BlueStore::KVSyncShard::lock");
+    ceph::condition_variable cond;
+    bool started = false;
+    bool stop = false;
+    bool in_progress = false;
+    std::deque<TransContext*> queue;             ///< ready, already submitted
+    std::deque<TransContext*> queue_unsubmitted; ///< ready, need submit
+    std::deque<TransContext*> committing;        ///< currently syncing
+    uint64_t ios = 0;
+    uint64_t throttle_costs = 0;
+
+    FinalizeThread finalize_thread;
+    ceph::mutex finalize_lock =
+      ceph::make_mutex("BlueStore::KVSyncShard::finalize_lock");
+    ceph::condition_variable finalize_cond;
+    bool finalize_started = false;
+    bool finalize_stop = false;
+    bool finalize_in_progress = false;
+    std::deque<TransContext*> committing_to_finalize;
+    std::deque<DeferredBatch*> deferred_stable_to_finalize;
+
+    PerfCounters *logger = nullptr;
+
+    KVSyncShard(BlueStore *s, unsigned i)
+      : store(s), id(i), sync_thread(this), finalize_thread(this) {}
+  };
+
   struct BigDeferredWriteContext {
     uint64_t off = 0;     // original logical offset
     uint32_t b_off = 0;   // blob relative offset
@@ -2305,6 +2535,9 @@ private:
   FreelistManager *fm = nullptr;
 
   Allocator *alloc = nullptr;   ///< allocator consumed by BlueStore
+  TieredAllocator *tiered_alloc = nullptr; ///< alloc, if the device has a fast tier
+  std::atomic<uint32_t> tier_epoch = {0};  ///< advanced every bluestore_tier_interval
+  std::atomic<uint64_t> tier_promote_heat = {0};  ///< bluestore_tier_promote_heat
   bluefs_shared_alloc_context_t shared_alloc; ///< consumed by BlueFS (may be == alloc)
 
   uuid_d fsid;
@@ -2316,6 +2549,18 @@ private:
   bool db_was_opened_read_only = true;
   bool need_to_destage_allocation_file = false;
 
+  // allocation journal of a null-fm store, see bluestore_allocation_journal
+  bool alloc_journal = false;  ///< txcs record their allocation changes
+  ceph::mutex alloc_journal_lock =
+    ceph::make_mutex("BlueStore::alloc_journal_lock");
+  uint64_t alloc_journal_seq = 0;       ///< last record, protected by alloc_journal_lock
+  std::set<uint64_t> alloc_journal_pending;  ///< records being submitted, ditto
+  uint64_t alloc_journal_ckpt_seq = 0;  ///< last record folded into the checkpoint
+  uint32_t alloc_journal_ckpt_serial = 0;
+  /// free space found on mount, written out as the first checkpoint once
+  /// _mount() starts the journal
+  std::optional<interval_set<uint64_t>> alloc_journal_base;
+
   ///< rwlock to protect coll_map/new_coll_map
   ceph::shared_mutex coll_lock = ceph::make_shared_mutex("BlueStore::coll_lock");
   mempool::bluestore_cache_other::unordered_map<coll_t, CollectionRef> coll_map;
@@ -2344,6 +2589,7 @@ private:
   std::atomic_int deferred_aggressive = {0}; ///< aggressive wakeup of kv thread
   Finisher  finisher;
   utime_t  deferred_last_submitted = utime_t();
+  uint64_t deferred_elevator_head = 0; ///< device offset the last sweep ended at
 
   KVSyncThread kv_sync_thread;
   ceph::mutex kv_lock = ceph::make_mutex("BlueStore::kv_lock");
@@ -2366,8 +2612,16 @@ private:
   std::deque<DeferredBatch*> deferred_stable_to_finalize; ///< pending finalization
   bool kv_finalize_in_progress = false;
 
+  /// shards 1..N-1 of the commit path; empty unless bluestore_kv_sync_shards > 1
+  std::vector<std::unique_ptr<KVSyncShard>> kv_sync_shards;
+  PerfCounters *kv_shard0_logger = nullptr; ///< per-shard stats for shard 0
+  /// serializes {nid,blobid}_max updates between commit shards
+  ceph::mutex kv_id_max_lock = ceph::make_mutex("BlueStore::kv_id_max_lock");
+
   PerfCounters *logger = nullptr;
 
+  /// protects removed_collections, which may be fed by several finalizers
+  ceph::mutex reap_lock = ceph::make_mutex("BlueStore::reap_lock");
   std::list<CollectionRef> removed_collections;
 
   ceph::shared_mutex debug_read_error_lock =
@@ -2413,6 +2667,53 @@ private:
     {Compressor::COMP_NONE}; ///< compression mode
   CompressorRef compressor;
   std::atomic<uint64_t> comp_min_blob_size = {0};
+
+  // trained compression dictionaries and per pool compression stats
+  struct pool_compression_stats_t {
+    uint64_t dict_blobs = 0;         ///< blobs compressed with a dictionary
+    uint64_t compressed_blobs = 0;   ///< blobs stored compressed
+    uint64_t rejected_blobs = 0;     ///< blobs stored uncompressed
+    uint64_t original_bytes = 0;     ///< input of accepted compressions
+    uint64_t compressed_bytes = 0;   ///< output of accepted compressions
+    ceph::timespan compress_lat = ceph::timespan::zero();
+    uint64_t decompressed_blobs = 0;
+    ceph::timespan decompress_lat = ceph::timespan::zero();
+
+    void add(const pool_compression_stats_t& o) {
+      dict_blobs += o.dict_blobs;
+      compressed_blobs += o.compressed_blobs;
+      rejected_blobs += o.rejected_blobs;
+      original_bytes += o.original_bytes;
+      compressed_bytes += o.compressed_bytes;
+      compress_lat += o.compress_lat;
+      decompressed_blobs += o.decompressed_blobs;
+      decompress_lat += o.decompress_lat;
+    }
+    void dump(ceph::Formatter *f) const;
+  };
+  struct compression_dicts_t {
+    /// every stored dictionary by (algorithm, id), blobs may refer to
+    /// any of them
+    std::map<std::pair<int, int32_t>, Compressor::DictionaryRef> dicts;
+    /// dictionary new blobs of a pool are compressed with
+    std::map<int64_t, std::pair<int, int32_t>> pools;
+  };
+  /// serializes updates of compression_dicts
+  ceph::mutex compression_dict_lock =
+    ceph::make_mutex("BlueStore::compression_dict_lock");
+  /// replaced as a whole, readers take a snapshot with std::atomic_load
+  std::shared_ptr<const compression_dicts_t> compression_dicts =
+    std::make_shared<const compression_dicts_t>();
+  /// pool stats are sharded by thread so concurrent writes and reads
+  /// don't all serialize on one lock
+  struct compression_stats_shard_t {
+    ceph::mutex lock =
+      ceph::make_mutex("BlueStore::compression_stats_shard_t::lock");
+    std::map<int64_t, pool_compression_stats_t> pools;
+  };
+  static constexpr unsigned COMPRESSION_STATS_SHARDS = 16;
+  std::array<compression_stats_shard_t, COMPRESSION_STATS_SHARDS>
+    compression_stats;
   std::atomic<uint64_t> comp_max_blob_size = {0};
 
   std::atomic<uint64_t> max_blob_size = {0};  ///< maximum blob size
@@ -2439,6 +2740,8 @@ private:
   uint64_t osd_memory_cache_min = 0; ///< Min memory to assign when autotuning cache
   double osd_memory_cache_resize_interval = 0; ///< Time to wait between cache resizing 
   double max_defer_interval = 0; ///< Time to wait between last deferred submit
+  std::atomic<uint64_t> onode_prefetch_count = {0}; ///< onodes to load ahead, 0 disables
+  std::atomic<uint64_t> onode_prefetch_trigger = {0}; ///< in-order misses that start a prefetch
   std::atomic<uint32_t> config_changed = {0}; ///< Counter to determine if there is a configuration change.
 
   // caching of bdev_label
@@ -2688,6 +2991,220 @@ private:
     void _resize_shards(bool interval_stats);
   } mempool_thread;
 
+  // background defragmenter: rewrites physically fragmented object
+  // regions while the allocator fragmentation stays above target
+  struct DefragThread : public Thread {
+    BlueStore *store;
+    ceph::condition_variable cond;
+    ceph::mutex lock = ceph::make_mutex("BlueStore::DefragThread::lock");
+    bool stop = false;
+    bool requested = false;  ///< started via admin socket
+    bool aborted = false;    ///< stopped via admin socket
+
+    // progress, protected by lock
+    bool running = false;
+    utime_t started;
+    double target = 0;
+    double start_fragmentation = 0;
+    double fragmentation = 0;
+    uint64_t collections_total = 0;
+    uint64_t collections_done = 0;
+    uint64_t objects_scanned = 0;
+    uint64_t objects_rewritten = 0;
+    uint64_t bytes_rewritten = 0;
+    coll_t cur_cid;
+
+    explicit DefragThread(BlueStore *s) : store(s) {}
+
+    void *entry() override;
+    void init() {
+      ceph_assert(stop == false);
+      create("bstore_defrag");
+    }
+    void shutdown() {
+      lock.lock();
+      stop = true;
+      cond.notify_all();
+      lock.unlock();
+      join();
+    }
+    void start(double _target) {
+      std::lock_guard l(lock);
+      requested = true;
+      aborted = false;
+      target = _target;
+      cond.notify_all();
+    }
+    void abort() {
+      std::lock_guard l(lock);
+      requested = false;
+      aborted = running;
+      cond.notify_all();
+    }
+    void dump(ceph::Formatter *f);
+
+  private:
+    // returns false if the pass has to stop
+    bool _should_continue(std::unique_lock<ceph::mutex>& l);
+    void _run(std::unique_lock<ceph::mutex>& l);
+  } defrag_thread;
+
+  // moves object data between the tiers of the main device: objects that
+  // get hot go to the fast tier, cold ones leave it when it fills up
+  struct TierThread : public Thread {
+    BlueStore *store;
+    ceph::condition_variable cond;
+    ceph::mutex lock = ceph::make_mutex("BlueStore::TierThread::lock");
+    bool stop = false;
+    std::deque<std::pair<CollectionRef, ghobject_t>> promote_queue;
+
+    // progress, protected by lock
+    bool demoting = false;
+    uint64_t objects_promoted = 0;
+    uint64_t bytes_promoted = 0;
+    uint64_t objects_demoted = 0;
+    uint64_t bytes_demoted = 0;
+
+    explicit TierThread(BlueStore *s) : store(s) {}
+
+    void *entry() override;
+    void init() {
+      ceph_assert(stop == false);
+      create("bstore_tier");
+    }
+    void shutdown() {
+      lock.lock();
+      stop = true;
+      cond.notify_all();
+      lock.unlock();
+      join();
+      promote_queue.clear();
+    }
+    void queue_promote(Collection *c, const ghobject_t& oid);
+    void dump(ceph::Formatter *f);
+
+  private:
+    /// move [0, object size) of oid to (or off) the fast tier, window by
+    /// window; returns false if the pass has to stop
+    bool _migrate(std::unique_lock<ceph::mutex>& l, CollectionRef& c,
+		  const ghobject_t& oid, bool to_fast);
+    void _promote(std::unique_lock<ceph::mutex>& l);
+    void _demote(std::unique_lock<ceph::mutex>& l);
+    bool _fast_tier_low(double ratio);
+  } tier_thread;
+
+  // folds the allocation journal into a new checkpoint every
+  // bluestore_allocation_checkpoint_interval seconds
+  struct AllocCheckpointThread : public Thread {
+    BlueStore *store;
+    ceph::condition_variable cond;
+    ceph::mutex lock = ceph::make_mutex("BlueStore::AllocCheckpointThread::lock");
+    bool stop = false;
+
+    explicit AllocCheckpointThread(BlueStore *s) : store(s) {}
+
+    void *entry() override;
+    void init() {
+      ceph_assert(stop == false);
+      create("bstore_alloc_ckpt");
+    }
+    void shutdown() {
+      lock.lock();
+      stop = true;
+      cond.notify_all();
+      lock.unlock();
+      join();
+    }
+  } alloc_ckpt_thread;
+
+  // compresses the blobs of one write in parallel; the writer takes
+  // jobs from its own batch too, so a busy pool never stalls it
+  struct CompressThreadPool {
+    struct job_t {
+      const ceph::buffer::list *in = nullptr;
+      ceph::buffer::list out;
+      std::optional<int32_t> compressor_message;
+      int r = 0;
+      ceph::timespan lat;  ///< time spent compressing
+    };
+    struct batch_t {
+      CompressorRef c;
+      Compressor::DictionaryRef dict;
+      std::vector<job_t> jobs;
+      // protected by pool lock
+      size_t next = 0;
+      size_t done = 0;
+      mono_clock::time_point queued;
+    };
+
+    BlueStore *store;
+    ceph::mutex lock = ceph::make_mutex("BlueStore::CompressThreadPool::lock");
+    ceph::condition_variable cond;       ///< work queued
+    ceph::condition_variable done_cond;  ///< batch completed
+    std::deque<batch_t*> q;
+    std::vector<std::thread> threads;
+    bool stop = false;
+
+    explicit CompressThreadPool(BlueStore *s) : store(s) {}
+
+    void init(size_t n);
+    void shutdown();
+    /// compress all jobs of the batch, offloading to the pool if allowed
+    void compress(batch_t& batch, bool offload);
+
+  private:
+    void entry();
+    // run one job of the batch, returns false if none is left
+    bool _run_one(batch_t& batch, std::unique_lock<ceph::mutex>& l,
+		  bool offloaded);
+  } compress_pool;
+
+  // fsck/repair progress, reported by 'bluestore fsck status'
+  struct FSCKProgress {
+    ceph::mutex lock = ceph::make_mutex("BlueStore::FSCKProgress::lock");
+    bool running = false;
+    std::string mode;
+    std::string phase;
+    utime_t started;
+    utime_t finished;
+    uint64_t expected_bytes = 0;  ///< device space in use at start
+    std::atomic<uint64_t> objects = {0};
+    std::atomic<uint64_t> bytes = {0};       ///< logical bytes walked
+    std::atomic<uint64_t> read_bytes = {0};  ///< deep: bytes read back
+
+    void start(const std::string& _mode, uint64_t _expected_bytes) {
+      std::lock_guard l(lock);
+      running = true;
+      mode = _mode;
+      phase = "starting";
+      started = ceph_clock_now();
+      expected_bytes = _expected_bytes;
+      objects = 0;
+      bytes = 0;
+      read_bytes = 0;
+    }
+    void set_phase(const char *_phase) {
+      std::lock_guard l(lock);
+      phase = _phase;
+    }
+    void finish() {
+      std::lock_guard l(lock);
+      running = false;
+      phase = "done";
+      finished = ceph_clock_now();
+    }
+    void dump(ceph::Formatter *f);
+  } fsck_progress;
+
+  class SocketHook;
+  /// registered while mounted or running fsck, so that in a process with
+  /// several stores the active one owns the commands
+  SocketHook* asok_hook = nullptr;
+  bool _asok_register();  ///< false if we had registered already
+  void _asok_unregister();
+  class FSCKDeepReader;
+  class FSCKKeyPrefetcher;
+
 #ifdef WITH_BLKIN
   ZTracer::Endpoint trace_endpoint {"0.0.0.0", 0, "BlueStore"};
 #endif
@@ -2837,6 +3354,28 @@ private:
   void _txc_finish(TransContext *txc);
   void _txc_release_alloc(TransContext *txc);
 
+  int _rewrite_ranges(CollectionRef& c,
+		      OnodeRef& o,
+		      const interval_set<uint64_t>& m,
+		      const ceph::buffer::list& bl,
+		      int64_t alloc_hint,
+		      std::unique_lock<ceph::shared_mutex>& l,
+		      interval_set<uint64_t> *allocated = nullptr);
+  int _defrag_region(CollectionRef& c,
+		     const ghobject_t& oid,
+		     uint64_t offset,
+		     uint64_t length,
+		     uint64_t *object_size,
+		     uint64_t *rewritten);
+  void _tier_note_access(Collection *c, OnodeRef& o);
+  int _tier_migrate_region(CollectionRef& c,
+			   const ghobject_t& oid,
+			   uint64_t offset,
+			   uint64_t length,
+			   bool to_fast,
+			   uint64_t *object_size,
+			   uint64_t *moved);
+
   void _osr_attach(Collection *c);
   void _osr_register_zombie(OpSequencer *osr);
   void _osr_drain(OpSequencer *osr);
@@ -2848,12 +3387,32 @@ private:
   void _kv_sync_thread();
   void _kv_finalize_thread();
 
+  KVSyncShard *_get_kv_sync_shard(const OpSequencer *osr) {
+    if (kv_sync_shards.empty()) {
+      return nullptr;
+    }
+    unsigned i = osr->get_sequencer_id() % (kv_sync_shards.size() + 1);
+    return i ? kv_sync_shards[i - 1].get() : nullptr;
+  }
+  PerfCounters *_create_kv_shard_logger(unsigned id);
+  void _kv_shard_queue(KVSyncShard *shard, TransContext *txc);
+  void _kv_shard_queue_deferred_stable(KVSyncShard *shard, DeferredBatch *b);
+  void _kv_shard_sync_thread(KVSyncShard *shard);
+  void _kv_shard_finalize_thread(KVSyncShard *shard);
+  /// bump persisted {nid,blobid}_max in t if needed; caller holds kv_id_max_lock
+  void _kv_prepare_id_max(KeyValueDB::Transaction t,
+			  uint64_t *new_nid_max,
+			  uint64_t *new_blobid_max);
+
   bluestore_deferred_op_t *_get_deferred_op(TransContext *txc, uint64_t len);
   void _deferred_queue(TransContext *txc);
 public:
   void deferred_try_submit();
 private:
   void _deferred_submit_unlock(OpSequencer *osr);
+  DeferredBatch *_deferred_claim_unlock(OpSequencer *osr);
+  uint64_t _deferred_submit_elevator(std::vector<DeferredBatch*>&& batches,
+				     uint64_t head);
   void _deferred_aio_finish(OpSequencer *osr);
   int _deferred_replay();
   bool _eliminate_outdated_deferred(bluestore_deferred_transaction_t* deferred_txn,
@@ -3102,7 +3661,8 @@ public:
     CollectionHandle &c,
     const ghobject_t& oid,
     struct stat *st,
-    bool allow_eio = false) override;
+    bool allow_eio = false,
+    uint32_t op_flags = 0) override;
   int read(
     CollectionHandle &c,
     const ghobject_t& oid,
@@ -3224,7 +3784,8 @@ public:
 	      ceph::buffer::ptr& value) override;
 
   int getattrs(CollectionHandle &c, const ghobject_t& oid,
-	       std::map<std::string,ceph::buffer::ptr, std::less<>>& aset) override;
+	       std::map<std::string,ceph::buffer::ptr, std::less<>>& aset,
+	       uint32_t op_flags = 0) override;
 
   int list_collections(std::vector<coll_t>& ls) override;
 
@@ -3274,7 +3835,8 @@ public:
     CollectionHandle &c,                ///< [in] Collection containing oid
     const ghobject_t &oid,   ///< [in] Object containing omap
     ceph::buffer::list *header,      ///< [out] omap header
-    bool allow_eio = false ///< [in] don't assert on eio
+    bool allow_eio = false, ///< [in] don't assert on eio
+    uint32_t op_flags = 0   ///< [in] CEPH_OSD_OP_FLAG_*
     ) override;
 
   /// Get keys defined on oid
@@ -3311,7 +3873,8 @@ public:
 
   ObjectMap::ObjectMapIterator get_omap_iterator(
     CollectionHandle &c,   ///< [in] collection
-    const ghobject_t &oid  ///< [in] object
+    const ghobject_t &oid, ///< [in] object
+    uint32_t op_flags = 0  ///< [in] CEPH_OSD_OP_FLAG_*
     ) override;
 
   void set_fsid(uuid_d u) override {
@@ -3518,13 +4081,35 @@ private:
 
   // --------------------------------------------------------
   // read processing internal methods
+  // blob ranges checked together by one _verify_csum() call
+  struct csum_batch_t {
+    std::vector<Checksummer::verify_item_t> items;
+    /// blob and logical offset of each item, for error reporting
+    std::vector<std::pair<const bluestore_blob_t*, uint64_t>> origins;
+
+    void add(const bluestore_blob_t* blob, uint64_t blob_xoffset,
+	     const ceph::buffer::list& bl, uint64_t logical_offset) {
+      items.push_back(blob->get_csum_verify_item(blob_xoffset, bl));
+      origins.emplace_back(blob, logical_offset);
+    }
+  };
   int _verify_csum(
     OnodeRef& o,
-    const bluestore_blob_t* blob,
-    uint64_t blob_xoffset,
-    const ceph::buffer::list& bl,
-    uint64_t logical_offset);
-  int _decompress(ceph::buffer::list& source, ceph::buffer::list* result);
+    csum_batch_t& batch);
+  int _decompress(ceph::buffer::list& source, ceph::buffer::list* result,
+		  int64_t pool);
+
+  // compression dictionaries
+  int _load_compression_dicts();
+  Compressor::DictionaryRef _get_pool_compression_dict(int64_t pool,
+						       const CompressorRef& c);
+  int _train_compression_dict(int64_t pool, size_t max_size,
+			      size_t max_samples, ceph::Formatter *f,
+			      std::ostream& ss);
+  int _clear_compression_dict(int64_t pool);
+  void _add_compression_stats(int64_t pool,
+			      const pool_compression_stats_t& s);
+  void _dump_compression_stats(ceph::Formatter *f);
 
 
   // --------------------------------------------------------
@@ -3742,6 +4327,13 @@ private:
 			CollectionRef& c,
 			OnodeRef& o,
 			const std::string& first, const std::string& last);
+  void _omap_rmkeys_ranged(TransContext *txc,
+			   OnodeRef& o,
+			   const std::set<std::string>& keys,
+			   size_t min_run);
+  void _note_omap_tombstones(const OnodeRef& o,
+			     const std::string& head, const std::string& tail,
+			     uint64_t skipped);
   int _set_alloc_hint(
     TransContext *txc,
     CollectionRef& c,
@@ -3962,8 +4554,25 @@ private:
   int  copy_allocator(Allocator* src_alloc, Allocator *dest_alloc, uint64_t* p_num_entries);
   int  store_allocator(Allocator* allocator);
   int  invalidate_allocation_file_on_bluefs();
+  using extent_foreach_t =
+    std::function<void(std::function<void(uint64_t, uint64_t)>)>;
+  int  write_allocator_image(BlueFS::FileWriter *p_handle, uint32_t serial,
+			     const extent_foreach_t& foreach_extent,
+			     uint64_t *p_extent_count, uint64_t *p_allocation_size);
+  int  read_allocator_image(const std::string& file,
+			    const std::function<void(uint64_t, uint64_t)>& add_free,
+			    uint64_t *num, uint64_t *bytes, uint32_t *p_serial);
   int  __restore_allocator(Allocator* allocator, uint64_t *num, uint64_t *bytes);
   int  restore_allocator(Allocator* allocator, uint64_t *num, uint64_t *bytes);
+  int  read_allocation_checkpoint_key(uint64_t *seq, uint32_t *serial);
+  int  replay_allocation_journal(interval_set<uint64_t> *free, uint64_t after_seq,
+				 uint64_t upto_seq,
+				 uint64_t *p_last_seq, uint64_t *p_records);
+  int  restore_allocator_from_journal(Allocator* allocator, uint64_t *num, uint64_t *bytes);
+  int  store_allocation_checkpoint(const interval_set<uint64_t>& free, uint64_t seq);
+  void invalidate_allocation_checkpoint();
+  int  start_allocation_journal();
+  int  checkpoint_allocation_journal();
   int  read_allocation_from_drive_on_startup();
   int  reconstruct_allocations(SimpleBitmap *smbmp, read_alloc_stats_t &stats);
   int  read_allocation_from_onodes(SimpleBitmap *smbmp, read_alloc_stats_t& stats);
@@ -3982,6 +4591,11 @@ private:
     OnodeRef& o,
     const BlueStore::FSCK_ObjectCtx& ctx);
 
+  int64_t _fsck_read_object(Collection *c, OnodeRef& o);
+  int64_t _fsck_read_objects(
+    std::vector<std::pair<CollectionRef, OnodeRef>>& batch);
+  std::unique_ptr<FSCKKeyPrefetcher> _fsck_prefetch_objects();
+  std::unique_ptr<FSCKKeyPrefetcher> _fsck_prefetch_shared_blobs();
   void _fsck_check_objects(FSCKDepth depth,
     FSCK_ObjectCtx& ctx);
 };
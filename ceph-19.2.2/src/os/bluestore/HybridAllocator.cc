@@ -61,6 +61,10 @@ int64_t HybridAllocator::allocate(
       0;
   };
 
+  if (chunk_cache && _try_allocate_cached(want, max_alloc_size, extents)) {
+    return want;
+  }
+
   std::lock_guard l(lock);
   // try bitmap first to avoid unneeded contiguous extents split if
   // desired amount is less than shortes range in AVL
@@ -69,28 +73,48 @@ int64_t HybridAllocator::allocate(
     std::swap(priA, secA);
   }
 
-  {
-    auto orig_size = extents->size();
-    res = priA(want, unit, max_alloc_size, hint, extents);
-    if (res < 0) {
-      // allocator shouldn't return new extents on error
-      ceph_assert(orig_size == extents->size());
-      res = 0;
+  auto do_allocate = [&]() {
+    int64_t res;
+    {
+      auto orig_size = extents->size();
+      res = priA(want, unit, max_alloc_size, hint, extents);
+      if (res < 0) {
+        // allocator shouldn't return new extents on error
+        ceph_assert(orig_size == extents->size());
+        res = 0;
+      }
     }
-  }
-  if ((uint64_t)res < want) {
-    auto orig_size = extents->size();
-    auto res2 = secA(want - res, unit, max_alloc_size, hint, extents);
-    if (res2 > 0) {
-      res += res2;
-    } else {
-      ceph_assert(orig_size == extents->size());
+    if ((uint64_t)res < want) {
+      auto orig_size = extents->size();
+      auto res2 = secA(want - res, unit, max_alloc_size, hint, extents);
+      if (res2 > 0) {
+        res += res2;
+      } else {
+        ceph_assert(orig_size == extents->size());
+      }
     }
+    return res;
+  };
+  auto n = extents->size();
+  res = do_allocate();
+  if (_retry_with_chunk_cache(want, max_alloc_size, res, extents, n)) {
+    res = do_allocate();
   }
   return res ? res : -ENOSPC;
 }
 
 void HybridAllocator::release(const interval_set<uint64_t>& release_set) {
+  if (chunk_cache) {
+    std::vector<std::pair<uint64_t, uint64_t>> rest;
+    if (_try_release_cached(release_set, rest)) {
+      return;
+    }
+    std::lock_guard l(lock);
+    for (auto& [offset, length] : rest) {
+      _add_to_tree(offset, length);
+    }
+    return;
+  }
   std::lock_guard l(lock);
   // this will attempt to put free ranges into AvlAllocator first and
   // fallback to bitmap one via _try_insert_range call
@@ -100,7 +124,8 @@ void HybridAllocator::release(const interval_set<uint64_t>& release_set) {
 uint64_t HybridAllocator::get_free()
 {
   std::lock_guard l(lock);
-  return (bmap_alloc ? bmap_alloc->get_free() : 0) + _get_free();
+  return (bmap_alloc ? bmap_alloc->get_free() : 0) + _get_free() +
+    _get_cached();
 }
 
 double HybridAllocator::get_fragmentation()
@@ -120,6 +145,7 @@ double HybridAllocator::get_fragmentation()
 void HybridAllocator::dump()
 {
   std::lock_guard l(lock);
+  _flush_chunk_cache();
   AvlAllocator::_dump();
   if (bmap_alloc) {
     bmap_alloc->dump();
@@ -134,6 +160,7 @@ void HybridAllocator::foreach(
   std::function<void(uint64_t offset, uint64_t length)> notify)
 {
   std::lock_guard l(lock);
+  _flush_chunk_cache();
   AvlAllocator::_foreach(notify);
   if (bmap_alloc) {
     bmap_alloc->foreach(notify);
@@ -149,6 +176,7 @@ void HybridAllocator::init_rm_free(uint64_t offset, uint64_t length)
                  << " offset 0x" << offset
                  << " length 0x" << length
                  << std::dec << dendl;
+  _flush_chunk_cache();
   _try_remove_from_tree(offset, length,
     [&](uint64_t o, uint64_t l, bool found) {
       if (!found) {
@@ -0,0 +1,142 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "TieredAllocator.h"
+#include "common/debug.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef dout_prefix
+#define dout_prefix *_dout << "tieredalloc 0x" << this << " "
+
+TieredAllocator::TieredAllocator(CephContext* cct,
+				 Allocator* _fast,
+				 Allocator* _slow,
+				 uint64_t _fast_size,
+				 std::string_view name)
+  : Allocator(name, _fast_size + _slow->get_capacity(),
+	      _slow->get_block_size()),
+    cct(cct),
+    fast_size(_fast_size),
+    fast(_fast),
+    slow(_slow)
+{
+  // each allocator is sized to its own tier, so the slow one doesn't
+  // carry (e.g. bitmap) state for the fast range; its offsets are
+  // shifted by fast_size
+  ceph_assert((uint64_t)fast->get_capacity() == fast_size);
+  ceph_assert(fast_size > 0 && fast_size < (uint64_t)device_size);
+  ceph_assert(fast_size % block_size == 0);
+}
+
+TieredAllocator::~TieredAllocator()
+{
+}
+
+int64_t TieredAllocator::allocate(
+  uint64_t want_size,
+  uint64_t alloc_unit,
+  uint64_t max_alloc_size,
+  int64_t hint,
+  PExtentVector *extents)
+{
+  Allocator *first = fast.get(), *second = slow.get();
+  if (hint >= 0 && (uint64_t)hint >= fast_size) {
+    std::swap(first, second);
+  }
+  auto tier_allocate = [&](Allocator *a, uint64_t want) -> int64_t {
+    int64_t h = 0;
+    if (a == fast.get()) {
+      h = hint >= 0 && (uint64_t)hint < fast_size ? hint : 0;
+    } else {
+      h = hint >= 0 && (uint64_t)hint >= fast_size ? hint - fast_size : 0;
+    }
+    size_t first_new = extents->size();
+    int64_t r = a->allocate(want, alloc_unit, max_alloc_size, h, extents);
+    if (a == slow.get()) {
+      for (size_t i = first_new; i < extents->size(); ++i) {
+	(*extents)[i].offset += fast_size;
+      }
+    }
+    return r;
+  };
+  int64_t got = tier_allocate(first, want_size);
+  if (got < 0) {
+    got = 0;
+  }
+  if ((uint64_t)got < want_size) {
+    ldout(cct, 10) << __func__ << " " << first->get_name() << " short by 0x"
+		   << std::hex << want_size - got << std::dec
+		   << ", falling back to " << second->get_name() << dendl;
+    int64_t more = tier_allocate(second, want_size - got);
+    if (more > 0) {
+      got += more;
+    }
+  }
+  return got ? got : -ENOSPC;
+}
+
+void TieredAllocator::release(const interval_set<uint64_t>& release_set)
+{
+  interval_set<uint64_t> f, s;
+  for (auto [offset, length] : release_set) {
+    _split(offset, length, [&](Allocator *a, uint64_t o, uint64_t l) {
+      (a == fast.get() ? f : s).insert(o, l);
+    });
+  }
+  if (!f.empty()) {
+    fast->release(f);
+  }
+  if (!s.empty()) {
+    slow->release(s);
+  }
+}
+
+uint64_t TieredAllocator::get_free()
+{
+  return fast->get_free() + slow->get_free();
+}
+
+double TieredAllocator::get_fragmentation()
+{
+  uint64_t slow_size = device_size - fast_size;
+  return (fast->get_fragmentation() * fast_size +
+	  slow->get_fragmentation() * slow_size) / device_size;
+}
+
+void TieredAllocator::dump()
+{
+  ldout(cct, 0) << __func__ << " fast tier 0x0~0x" << std::hex << fast_size
+		<< std::dec << dendl;
+  fast->dump();
+  slow->dump();
+}
+
+void TieredAllocator::foreach(
+  std::function<void(uint64_t offset, uint64_t length)> notify)
+{
+  fast->foreach(notify);
+  slow->foreach([&](uint64_t offset, uint64_t length) {
+    notify(offset + fast_size, length);
+  });
+}
+
+void TieredAllocator::init_add_free(uint64_t offset, uint64_t length)
+{
+  _split(offset, length, [](Allocator *a, uint64_t o, uint64_t l) {
+    a->init_add_free(o, l);
+  });
+}
+
+void TieredAllocator::init_rm_free(uint64_t offset, uint64_t length)
+{
+  _split(offset, length, [](Allocator *a, uint64_t o, uint64_t l) {
+    a->init_rm_free(o, l);
+  });
+}
+
+void TieredAllocator::shutdown()
+{
+  fast->shutdown();
+  slow->shutdown();
+}
@@ -0,0 +1,85 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OS_BLUESTORE_TIEREDALLOCATOR_H
+#define CEPH_OS_BLUESTORE_TIEREDALLOCATOR_H
+
+#include <memory>
+
+#include "Allocator.h"
+
+/*
+ * Splits the device address space at fast_size into a fast tier (the
+ * leading part, e.g. the NVMe half of a linear concatenation of an NVMe
+ * and an HDD volume) and a slow tier, each managed by an allocator of its
+ * own.  The allocation hint picks the tier: hints below fast_size are
+ * served from the fast tier first, all others from the slow tier first;
+ * either falls back to the other tier when it runs short.
+ */
+class TieredAllocator : public Allocator {
+  CephContext* cct;
+  const uint64_t fast_size;
+  std::unique_ptr<Allocator> fast;
+  std::unique_ptr<Allocator> slow;
+
+  /// split [offset, offset + length) at the tier boundary, passing each
+  /// part on in the offsets of its tier's allocator
+  template <typename F>
+  void _split(uint64_t offset, uint64_t length, F&& f) {
+    if (offset < fast_size) {
+      uint64_t l = std::min(length, fast_size - offset);
+      f(fast.get(), offset, l);
+      offset += l;
+      length -= l;
+    }
+    if (length) {
+      f(slow.get(), offset - fast_size, length);
+    }
+  }
+
+public:
+  /// takes ownership of fast and slow; fast covers [0, fast_size) and
+  /// slow the rest of the device, addressed from 0
+  TieredAllocator(CephContext* cct,
+		  Allocator* fast,
+		  Allocator* slow,
+		  uint64_t fast_size,
+		  std::string_view name);
+  ~TieredAllocator() override;
+
+  /// the type of the per tier allocators
+  const char* get_type() const override {
+    return slow->get_type();
+  }
+
+  int64_t allocate(
+    uint64_t want_size, uint64_t alloc_unit, uint64_t max_alloc_size,
+    int64_t hint, PExtentVector *extents) override;
+
+  using Allocator::release;
+  void release(const interval_set<uint64_t>& release_set) override;
+
+  uint64_t get_free() override;
+  double get_fragmentation() override;
+
+  void dump() override;
+  void foreach(
+    std::function<void(uint64_t offset, uint64_t length)> notify) override;
+
+  void init_add_free(uint64_t offset, uint64_t length) override;
+  void init_rm_free(uint64_t offset, uint64_t length) override;
+
+  void shutdown() override;
+
+  uint64_t get_fast_size() const {
+    return fast_size;
+  }
+  uint64_t get_fast_free() {
+    return fast->get_free();
+  }
+  bool is_fast(uint64_t offset) const {
+    return offset < fast_size;
+  }
+};
+
+#endif
@@ -65,6 +65,11 @@ struct bluefs_fnode_t {
   uint8_t __unused__ = 0; // was prefer_bdev
   mempool::bluefs::vector<bluefs_extent_t> extents;
 
+  // non-zero if the file data is a chain of bluefs_wal_envelope_t, each
+  // crc seeded with this value.  Such files recover their size from the
+  // data on replay, so growing them doesn't require a log update.
+  uint32_t envelope_seed = 0;
+
   // precalculated logical offsets for extents vector entries
   // allows fast lookup for extent index by the offset value via upper_bound()
   mempool::bluefs::vector<uint64_t> extents_index;
@@ -77,6 +82,7 @@ struct bluefs_fnode_t {
     ino(_ino), size(_size), mtime(_mtime), allocated(0), allocated_commited(0) {}
   bluefs_fnode_t(const bluefs_fnode_t& other) :
     ino(other.ino), size(other.size), mtime(other.mtime),
+    envelope_seed(other.envelope_seed),
     allocated(other.allocated),
     allocated_commited(other.allocated_commited) {
     clone_extents(other);
@@ -111,12 +117,15 @@ struct bluefs_fnode_t {
   template<typename T, typename P>
   friend std::enable_if_t<std::is_same_v<bluefs_fnode_t, std::remove_const_t<T>>>
   _denc_friend(T& v, P& p) {
-    DENC_START(1, 1, p);
+    DENC_START(2, 1, p);
     denc_varint(v.ino, p);
     denc_varint(v.size, p);
     denc(v.mtime, p);
     denc(v.__unused__, p);
     denc(v.extents, p);
+    if (struct_v >= 2) {
+      denc(v.envelope_seed, p);
+    }
     DENC_FINISH(p);
   }
   void reset_delta() {
@@ -160,6 +169,7 @@ struct bluefs_fnode_t {
     std::swap(ino, other.ino);
     std::swap(size, other.size);
     std::swap(mtime, other.mtime);
+    std::swap(envelope_seed, other.envelope_seed);
     swap_extents(other);
   }
   void swap_extents(bluefs_fnode_t& other) {
@@ -187,6 +197,22 @@ WRITE_CLASS_DENC(bluefs_fnode_t)
 
 std::ostream& operator<<(std::ostream& out, const bluefs_fnode_t& file);
 
+/// header in front of every chunk flushed to an envelope file
+struct bluefs_wal_envelope_t {
+  static constexpr unsigned HEADER_SIZE = 16;
+
+  uint64_t ino = 0;     ///< owning file
+  uint32_t length = 0;  ///< payload bytes following the header
+  uint32_t crc = 0;     ///< payload crc32c, seeded with fnode.envelope_seed
+
+  DENC(bluefs_wal_envelope_t, v, p) {
+    denc(v.ino, p);
+    denc(v.length, p);
+    denc(v.crc, p);
+  }
+};
+WRITE_CLASS_DENC(bluefs_wal_envelope_t)
+
 struct bluefs_layout_t {
   unsigned shared_bdev = 0;         ///< which bluefs bdev we are sharing
   bool dedicated_db = false;        ///< whether block.db is present
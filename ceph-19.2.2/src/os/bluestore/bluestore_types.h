@@ -907,6 +907,20 @@ public:
   int verify_csum(uint64_t b_off, const ceph::buffer::list& bl, int* b_bad_off,
 		  uint64_t *bad_csum) const;
 
+  /// describe the verification of bl at b_off for Checksummer::verify_batch
+  Checksummer::verify_item_t get_csum_verify_item(
+    uint64_t b_off, const ceph::buffer::list& bl) const {
+    Checksummer::verify_item_t item;
+    item.csum_type = csum_type;
+    if (has_csum()) {
+      item.csum_block_size = get_csum_chunk_size();
+    }
+    item.offset = b_off;
+    item.bl = &bl;
+    item.csum_data = &csum_data;
+    return item;
+  }
+
   bool can_prune_tail() const {
     return
       extents.size() > 1 &&  // if it's all invalid it's not pruning.
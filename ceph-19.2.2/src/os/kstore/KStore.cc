@@ -1150,7 +1150,8 @@ int KStore::stat(
   CollectionHandle& ch,
   const ghobject_t& oid,
   struct stat *st,
-  bool allow_eio)
+  bool allow_eio,
+  uint32_t op_flags)
 {
   dout(10) << __func__ << " " << ch->cid << " " << oid << dendl;
   Collection *c = static_cast<Collection*>(ch.get());
@@ -1363,7 +1364,8 @@ int KStore::getattr(
 int KStore::getattrs(
   CollectionHandle& ch,
   const ghobject_t& oid,
-  map<string,bufferptr,less<>>& aset)
+  map<string,bufferptr,less<>>& aset,
+  uint32_t op_flags)
 {
   dout(15) << __func__ << " " << ch->cid << " " << oid << dendl;
   Collection *c = static_cast<Collection*>(ch.get());
@@ -1703,7 +1705,8 @@ int KStore::omap_get_header(
   CollectionHandle& ch,                ///< [in] Collection containing oid
   const ghobject_t &oid,   ///< [in] Object containing omap
   bufferlist *header,      ///< [out] omap header
-  bool allow_eio ///< [in] don't assert on eio
+  bool allow_eio, ///< [in] don't assert on eio
+  uint32_t op_flags
   )
 {
   dout(15) << __func__ << " " << ch->cid << " oid " << oid << dendl;
@@ -1848,7 +1851,8 @@ int KStore::omap_check_keys(
 
 ObjectMap::ObjectMapIterator KStore::get_omap_iterator(
   CollectionHandle& ch,              ///< [in] collection
-  const ghobject_t &oid  ///< [in] object
+  const ghobject_t &oid, ///< [in] object
+  uint32_t op_flags
   )
 {
 
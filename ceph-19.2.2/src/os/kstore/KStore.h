@@ -465,7 +465,8 @@ public:
     CollectionHandle& c,
     const ghobject_t& oid,
     struct stat *st,
-    bool allow_eio = false) override; // struct stat?
+    bool allow_eio = false,
+    uint32_t op_flags = 0) override; // struct stat?
   int set_collection_opts(
     CollectionHandle& c,
     const pool_opts_t& opts) override;
@@ -493,7 +494,8 @@ public:
   using ObjectStore::getattrs;
   int getattrs(CollectionHandle& c,
 	       const ghobject_t& oid,
-	       std::map<std::string,ceph::buffer::ptr,std::less<>>& aset) override;
+	       std::map<std::string,ceph::buffer::ptr,std::less<>>& aset,
+	       uint32_t op_flags = 0) override;
 
   int list_collections(std::vector<coll_t>& ls) override;
   bool collection_exists(const coll_t& c) override;
@@ -518,7 +520,8 @@ public:
     CollectionHandle& c,                ///< [in] Collection containing oid
     const ghobject_t &oid,   ///< [in] Object containing omap
     ceph::buffer::list *header,      ///< [out] omap header
-    bool allow_eio = false ///< [in] don't assert on eio
+    bool allow_eio = false, ///< [in] don't assert on eio
+    uint32_t op_flags = 0   ///< [in] CEPH_OSD_OP_FLAG_*
     ) override;
 
   using ObjectStore::omap_get_keys;
@@ -550,7 +553,8 @@ public:
   using ObjectStore::get_omap_iterator;
   ObjectMap::ObjectMapIterator get_omap_iterator(
     CollectionHandle& c,              ///< [in] collection
-    const ghobject_t &oid  ///< [in] object
+    const ghobject_t &oid, ///< [in] object
+    uint32_t op_flags = 0  ///< [in] CEPH_OSD_OP_FLAG_*
     ) override;
 
   void set_fsid(uuid_d u) override {
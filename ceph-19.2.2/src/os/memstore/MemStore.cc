@@ -282,7 +282,8 @@ int MemStore::stat(
   CollectionHandle &c_,
   const ghobject_t& oid,
   struct stat *st,
-  bool allow_eio)
+  bool allow_eio,
+  uint32_t op_flags)
 {
   Collection *c = static_cast<Collection*>(c_.get());
   dout(10) << __func__ << " " << c->cid << " " << oid << dendl;
@@ -384,7 +385,8 @@ int MemStore::getattr(CollectionHandle &c_, const ghobject_t& oid,
 }
 
 int MemStore::getattrs(CollectionHandle &c_, const ghobject_t& oid,
-		       std::map<std::string,ceph::buffer::ptr,std::less<>>& aset)
+		       std::map<std::string,ceph::buffer::ptr,std::less<>>& aset,
+		       uint32_t op_flags)
 {
   Collection *c = static_cast<Collection*>(c_.get());
   dout(10) << __func__ << " " << c->cid << " " << oid << dendl;
@@ -486,7 +488,8 @@ int MemStore::omap_get_header(
   CollectionHandle& ch,                ///< [in] Collection containing oid
   const ghobject_t &oid,   ///< [in] Object containing omap
   ceph::buffer::list *header,      ///< [out] omap header
-  bool allow_eio ///< [in] don't assert on eio
+  bool allow_eio, ///< [in] don't assert on eio
+  uint32_t op_flags
   )
 {
   dout(10) << __func__ << " " << ch->cid << " " << oid << dendl;
@@ -629,7 +632,8 @@ public:
 
 ObjectMap::ObjectMapIterator MemStore::get_omap_iterator(
   CollectionHandle& ch,
-  const ghobject_t& oid)
+  const ghobject_t& oid,
+  uint32_t op_flags)
 {
   dout(10) << __func__ << " " << ch->cid << " " << oid << dendl;
   Collection *c = static_cast<Collection*>(ch.get());
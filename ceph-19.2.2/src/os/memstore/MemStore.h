@@ -291,7 +291,8 @@ public:
 
   bool exists(CollectionHandle &c, const ghobject_t& oid) override;
   int stat(CollectionHandle &c, const ghobject_t& oid,
-	   struct stat *st, bool allow_eio = false) override;
+	   struct stat *st, bool allow_eio = false,
+	   uint32_t op_flags = 0) override;
   int set_collection_opts(
     CollectionHandle& c,
     const pool_opts_t& opts) override;
@@ -310,7 +311,8 @@ public:
   int getattr(CollectionHandle &c, const ghobject_t& oid, const char *name,
 	      ceph::buffer::ptr& value) override;
   int getattrs(CollectionHandle &c, const ghobject_t& oid,
-	       std::map<std::string,ceph::buffer::ptr,std::less<>>& aset) override;
+	       std::map<std::string,ceph::buffer::ptr,std::less<>>& aset,
+	       uint32_t op_flags = 0) override;
 
   int list_collections(std::vector<coll_t>& ls) override;
 
@@ -344,7 +346,8 @@ public:
     CollectionHandle& c,                ///< [in] Collection containing oid
     const ghobject_t &oid,   ///< [in] Object containing omap
     ceph::buffer::list *header,      ///< [out] omap header
-    bool allow_eio = false ///< [in] don't assert on eio
+    bool allow_eio = false, ///< [in] don't assert on eio
+    uint32_t op_flags = 0   ///< [in] CEPH_OSD_OP_FLAG_*
     ) override;
 
   using ObjectStore::omap_get_keys;
@@ -384,7 +387,8 @@ public:
   using ObjectStore::get_omap_iterator;
   ObjectMap::ObjectMapIterator get_omap_iterator(
     CollectionHandle& c,              ///< [in] collection
-    const ghobject_t &oid  ///< [in] object
+    const ghobject_t &oid, ///< [in] object
+    uint32_t op_flags = 0  ///< [in] CEPH_OSD_OP_FLAG_*
     ) override;
 
   void set_fsid(uuid_d u) override;
@@ -196,7 +196,9 @@ struct RecoveryMessages {
     bool attrs)
   {
     list<boost::tuple<uint64_t, uint64_t, uint32_t> > to_read;
-    to_read.push_back(boost::make_tuple(off, len, 0));
+    // recovery reads every shard once; keep it out of the peers' caches
+    to_read.push_back(boost::make_tuple(
+      off, len, (uint32_t)CEPH_OSD_OP_FLAG_FADVISE_NOCACHE));
     ceph_assert(!recovery_reads.count(hoid));
     want_to_read.insert(make_pair(hoid, std::move(_want_to_read)));
     recovery_reads.insert(
@@ -1092,10 +1094,11 @@ void ECBackend::handle_sub_read(
         ECUtil::HashInfoRef hinfo;
         map<string, bufferlist, less<>> attrs;
 	struct stat st;
-	int r = object_stat(i->first, &st);
+	ghobject_t oid(i->first, ghobject_t::NO_GEN, shard);
+	int r = store->stat(ch, oid, &st, false, j->get<2>());
         if (r >= 0) {
 	  dout(10) << __func__ << ": found on disk, size " << st.st_size << dendl;
-	  r = PGBackend::objects_get_attrs(i->first, &attrs);
+	  r = store->getattrs(ch, oid, attrs, j->get<2>());
 	}
 	if (r >= 0) {
 	  hinfo = unstable_hashinfo_registry.get_hash_info(i->first, false, attrs, st.st_size);
@@ -1142,11 +1145,19 @@ error:
 	     << *i << dendl;
     if (reply->errors.count(*i))
       continue;
+    // fetched along with the data, by recovery reads with their use-once
+    // hint
+    uint32_t op_flags = 0;
+    if (auto p = op.to_read.find(*i);
+	p != op.to_read.end() && !p->second.empty()) {
+      op_flags = p->second.front().get<2>() & CEPH_OSD_OP_FLAG_FADVISE_NOCACHE;
+    }
     int r = store->getattrs(
       ch,
       ghobject_t(
 	*i, ghobject_t::NO_GEN, shard),
-      reply->attrs_read[*i]);
+      reply->attrs_read[*i],
+      op_flags);
     if (r < 0) {
       // If we read error, we should not return the attrs too.
       reply->attrs_read.erase(*i);
@@ -1719,6 +1730,7 @@ int ECBackend::be_deep_scrub(
 
   uint32_t fadvise_flags = CEPH_OSD_OP_FLAG_FADVISE_SEQUENTIAL |
                            CEPH_OSD_OP_FLAG_FADVISE_DONTNEED | 
+                           CEPH_OSD_OP_FLAG_FADVISE_NOCACHE |
                            CEPH_OSD_OP_FLAG_BYPASS_CLEAN_CACHE;
 
   utime_t sleeptime;
@@ -618,13 +618,15 @@ int PGBackend::be_scan_list(
   int r = 0;
   ScrubMap::object &o = map.objects[poid];
   if (!pos.metadata_done) {
+    // scrub visits every object once, keep it out of the onode cache
     struct stat st;
     r = store->stat(
       ch,
       ghobject_t(
 	poid, ghobject_t::NO_GEN, get_parent()->whoami_shard().shard),
       &st,
-      true);
+      true,
+      CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
 
     if (r == 0) {
       o.size = st.st_size;
@@ -633,7 +635,8 @@ int PGBackend::be_scan_list(
 	ch,
 	ghobject_t(
 	  poid, ghobject_t::NO_GEN, get_parent()->whoami_shard().shard),
-	o.attrs);
+	o.attrs,
+	CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
     }
 
     if (r == -ENOENT) {
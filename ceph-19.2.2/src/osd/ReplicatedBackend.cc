@@ -640,6 +640,7 @@ int ReplicatedBackend::be_deep_scrub(
   int r;
   uint32_t fadvise_flags = CEPH_OSD_OP_FLAG_FADVISE_SEQUENTIAL |
                            CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
+                           CEPH_OSD_OP_FLAG_FADVISE_NOCACHE |
                            CEPH_OSD_OP_FLAG_BYPASS_CLEAN_CACHE;
 
   utime_t sleeptime;
@@ -697,7 +698,7 @@ int ReplicatedBackend::be_deep_scrub(
       ch,
       ghobject_t(
 	poid, ghobject_t::NO_GEN, get_parent()->whoami_shard().shard),
-      &hdrbl, true);
+      &hdrbl, true, CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
     if (r == -EIO) {
       dout(20) << __func__ << "  " << poid << " got "
 	       << r << " on omap header read, read_error" << dendl;
@@ -715,7 +716,8 @@ int ReplicatedBackend::be_deep_scrub(
   ObjectMap::ObjectMapIterator iter = store->get_omap_iterator(
     ch,
     ghobject_t(
-      poid, ghobject_t::NO_GEN, get_parent()->whoami_shard().shard));
+      poid, ghobject_t::NO_GEN, get_parent()->whoami_shard().shard),
+    CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
   ceph_assert(iter);
   if (pos.omap_pos.length()) {
     iter->lower_bound(pos.omap_pos);
@@ -2035,6 +2037,9 @@ int ReplicatedBackend::build_push_op(const ObjectRecoveryInfo &recovery_info,
     out_progress = &_new_progress;
   ObjectRecoveryProgress &new_progress = *out_progress;
   new_progress = progress;
+  // every access of a push reads the object once, keep it out of the caches
+  const uint32_t fadvise_flags = cache_dont_need ?
+    (CEPH_OSD_OP_FLAG_FADVISE_DONTNEED | CEPH_OSD_OP_FLAG_FADVISE_NOCACHE) : 0;
 
   dout(7) << __func__ << " " << recovery_info.soid
 	  << " v " << recovery_info.version
@@ -2045,12 +2050,14 @@ int ReplicatedBackend::build_push_op(const ObjectRecoveryInfo &recovery_info,
   eversion_t v  = recovery_info.version;
   object_info_t oi;
   if (progress.first) {
-    int r = store->omap_get_header(ch, ghobject_t(recovery_info.soid), &out_op->omap_header);
+    int r = store->omap_get_header(ch, ghobject_t(recovery_info.soid),
+				   &out_op->omap_header, false, fadvise_flags);
     if (r < 0) {
       dout(1) << __func__ << " get omap header failed: " << cpp_strerror(-r) << dendl;
       return r;
     }
-    r = store->getattrs(ch, ghobject_t(recovery_info.soid), out_op->attrset);
+    r = store->getattrs(ch, ghobject_t(recovery_info.soid), out_op->attrset,
+			fadvise_flags);
     if (r < 0) {
       dout(1) << __func__ << " getattrs failed: " << cpp_strerror(-r) << dendl;
       return r;
@@ -2086,7 +2093,8 @@ int ReplicatedBackend::build_push_op(const ObjectRecoveryInfo &recovery_info,
   if (!progress.omap_complete) {
     ObjectMap::ObjectMapIterator iter =
       store->get_omap_iterator(ch,
-			       ghobject_t(recovery_info.soid));
+			       ghobject_t(recovery_info.soid),
+			       fadvise_flags);
     ceph_assert(iter);
     for (iter->lower_bound(progress.omap_recovered_to);
 	 iter->valid();
@@ -2139,8 +2147,7 @@ int ReplicatedBackend::build_push_op(const ObjectRecoveryInfo &recovery_info,
   auto origin_size = out_op->data_included.size();
   bufferlist bit;
   int r = store->readv(ch, ghobject_t(recovery_info.soid),
-		       out_op->data_included, bit,
-                       cache_dont_need ? CEPH_OSD_OP_FLAG_FADVISE_DONTNEED: 0);
+		       out_op->data_included, bit, fadvise_flags);
   if (cct->_conf->osd_debug_random_push_read_error &&
         (rand() % (int)(cct->_conf->osd_debug_random_push_read_error * 100.0)) == 0) {
     dout(0) << __func__ << ": inject EIO " << recovery_info.soid << dendl;
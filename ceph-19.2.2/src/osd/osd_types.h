@@ -1106,6 +1106,7 @@ public:
     DEDUP_CDC_CHUNK_SIZE,
     PG_NUM_MAX, // max pg_num
     READ_RATIO, // read ration for the read balancer work [0-100]
+    COMPRESSION_ASYNC_MIN_SIZE,
   };
 
   enum type_t {
@@ -44,6 +44,27 @@ TEST(Crc32c, Big) {
   free(a);
 }
 
+TEST(Crc32c, Multi) {
+  const unsigned n = 11;
+  const unsigned len = 4099;
+  unsigned char *a = (unsigned char *)malloc(n * len);
+  for (unsigned i = 0; i < n * len; i++)
+    a[i] = (i * 31) & 0xff;
+  for (unsigned l : {0u, 1u, 7u, 8u, 13u, len}) {
+    uint32_t crcs[n];
+    unsigned char const *data[n];
+    for (unsigned i = 0; i < n; i++) {
+      crcs[i] = i == 0 ? 0 : -i;
+      data[i] = a + i * len;
+    }
+    ceph_crc32c_multi(crcs, data, n, l);
+    for (unsigned i = 0; i < n; i++) {
+      ASSERT_EQ(ceph_crc32c(i == 0 ? 0 : -i, data[i], l), crcs[i]);
+    }
+  }
+  free(a);
+}
+
 TEST(Crc32c, Performance) {
   int len = 1000 * 1024 * 1024;
   char *a = (char *)malloc(len);
@@ -453,6 +453,59 @@ TEST(CompressionPlugin, all)
   }
 }
 
+TEST(ZstdCompressor, dictionary)
+{
+  CompressorRef zstd = Compressor::create(g_ceph_context, "zstd");
+  ASSERT_TRUE(zstd);
+  // many small, similar JSON documents
+  auto doc = [](int i) {
+    bufferlist bl;
+    bl.append("{\"bucket\":\"logs-" + std::to_string(i % 7) +
+	      "\",\"key\":\"2024/01/" + std::to_string(i) +
+	      "/access.log\",\"status\":" + std::to_string(200 + i % 3) +
+	      ",\"user_agent\":\"Mozilla/5.0 (X11; Linux x86_64)\","
+	      "\"bytes\":" + std::to_string(i * 37) + "}");
+    return bl;
+  };
+  std::vector<bufferlist> samples;
+  for (int i = 0; i < 1000; ++i) {
+    samples.push_back(doc(i));
+  }
+  bufferlist raw;
+  ASSERT_EQ(0, zstd->train_dictionary(samples, 16384, raw));
+  ASSERT_GT(raw.length(), 0u);
+  auto dict = zstd->load_dictionary(raw);
+  ASSERT_TRUE(dict);
+
+  bufferlist orig = doc(12345);
+  bufferlist plain, with_dict;
+  std::optional<int32_t> plain_message, dict_message;
+  ASSERT_EQ(0, zstd->compress(orig, plain, plain_message));
+  ASSERT_EQ(0, zstd->compress_with_dict(orig, with_dict, dict_message, dict));
+  ASSERT_FALSE(plain_message);
+  ASSERT_EQ(dict->get_id(), *dict_message);
+  cout << "orig " << orig.length() << " compressed " << plain.length()
+       << " with dictionary " << with_dict.length() << std::endl;
+  ASSERT_LT(with_dict.length(), plain.length());
+
+  bufferlist out;
+  auto p = with_dict.cbegin();
+  ASSERT_EQ(0, zstd->decompress_with_dict(p, with_dict.length(), out,
+					  dict_message, dict));
+  ASSERT_TRUE(out.contents_equal(orig));
+  // without the dictionary the data can't be recovered
+  out.clear();
+  p = with_dict.cbegin();
+  ASSERT_GT(0, zstd->decompress_with_dict(p, with_dict.length(), out,
+					  dict_message, nullptr));
+
+  // compressors without dictionary support ignore it
+  CompressorRef snappy = Compressor::create(g_ceph_context, "snappy");
+  ASSERT_TRUE(snappy);
+  ASSERT_EQ(-EOPNOTSUPP, snappy->train_dictionary(samples, 16384, raw));
+  ASSERT_FALSE(snappy->load_dictionary(raw));
+}
+
 #if defined(__x86_64__) || defined(__aarch64__)
 
 TEST(ZlibCompressor, isal_compress_zlib_decompress_random)
@@ -22,6 +22,7 @@
 #include <string>
 #include <set>
 #include <vector>
+#include <sys/socket.h>
 #include <gtest/gtest.h>
 
 #include "acconfig.h"
@@ -29,6 +30,9 @@
 #include "include/Context.h"
 #include "msg/async/Event.h"
 #include "msg/async/Stack.h"
+#ifdef HAVE_LIBURING
+#include "msg/async/io_uring/IoUringStack.h"
+#endif
 
 using namespace std;
 
@@ -1051,6 +1055,106 @@ TEST_P(NetworkWorkerTest, StressTest) {
   ASSERT_EQ(0, factory.message_left);
 }
 
+TEST_P(NetworkWorkerTest, ZeroCopySendTest) {
+  if (strcmp(GetParam(), "posix")) {
+    return;
+  }
+  g_ceph_context->_conf.set_val("ms_async_zerocopy_send", "true");
+  g_ceph_context->_conf.set_val("ms_async_zerocopy_send_min_size", "4096");
+  entity_addr_t bind_addr;
+  ASSERT_TRUE(bind_addr.parse(get_addr().c_str()));
+  exec_events([bind_addr](Worker *worker) mutable {
+    if (worker->id != 0)
+      return;
+    EventCenter *center = &worker->center;
+    SocketOptions options;
+    ServerSocket bind_socket;
+    ConnectedSocket cli_socket, srv_socket;
+    ASSERT_EQ(0, worker->listen(bind_addr, 0, options, &bind_socket));
+    ASSERT_EQ(0, worker->connect(bind_addr, options, &cli_socket));
+    {
+      C_poll cb(center);
+      center->create_file_event(bind_socket.fd(), EVENT_READABLE, &cb);
+      ASSERT_TRUE(cb.poll(500));
+      center->delete_file_event(bind_socket.fd(), EVENT_READABLE);
+    }
+    entity_addr_t cli_addr;
+    ASSERT_EQ(0, bind_socket.accept(&srv_socket, options, &cli_addr, worker));
+    {
+      C_poll cb(center);
+      center->create_file_event(cli_socket.fd(), EVENT_WRITABLE, &cb);
+      int r = cli_socket.is_connected();
+      if (r == 0) {
+        ASSERT_TRUE(cb.poll(500));
+        r = cli_socket.is_connected();
+      }
+      ASSERT_EQ(1, r);
+      center->delete_file_event(cli_socket.fd(), EVENT_WRITABLE);
+    }
+
+    // the socket holds the only reference to the segments it sent
+    // zero-copy, so they have to stay alive until the kernel is done
+    const size_t seg_size = 64 << 10;
+    const size_t len = 16 << 20;
+    bufferlist bl;
+    for (size_t off = 0; off < len; off += seg_size) {
+      bufferptr p = buffer::create_page_aligned(seg_size);
+      for (size_t i = 0; i < seg_size; i++)
+        p.c_str()[i] = (off + i) % 251;
+      bl.append(std::move(p));
+    }
+
+    PerfCounters *logger = worker->get_perf_counter();
+    uint64_t zc_bytes = logger->get(l_msgr_send_zerocopy_bytes);
+    uint64_t zc_copied = logger->get(l_msgr_send_zerocopy_copied);
+    C_poll cb(center);
+    center->create_file_event(srv_socket.fd(), EVENT_READABLE, &cb);
+    center->create_file_event(cli_socket.fd(), EVENT_WRITABLE, &cb);
+    string received;
+    char buf[seg_size];
+    while (received.size() < len) {
+      if (bl.length()) {
+        ASSERT_LE(0, cli_socket.send(bl, false));
+      }
+      ssize_t r = srv_socket.read(buf, sizeof(buf));
+      if (r == -EAGAIN) {
+        cb.poll(500);
+        cb.reset();
+        continue;
+      }
+      ASSERT_LT(0, r);
+      received.append(buf, r);
+    }
+    ASSERT_EQ(0u, bl.length());
+    ASSERT_EQ(len, received.size());
+    for (size_t i = 0; i < len; i++) {
+      ASSERT_EQ((char)(i % 251), received[i]);
+    }
+#ifdef SO_ZEROCOPY
+    int on = 0;
+    socklen_t on_len = sizeof(on);
+    if (::getsockopt(cli_socket.fd(), SOL_SOCKET, SO_ZEROCOPY, &on, &on_len) == 0 &&
+        on) {
+      // at least the first sends go zero-copy, on loopback the kernel
+      // copies anyway and the socket may fall back to regular sends
+      ASSERT_LT(zc_bytes, logger->get(l_msgr_send_zerocopy_bytes));
+    }
+#endif
+    cerr << "zero-copy bytes "
+         << logger->get(l_msgr_send_zerocopy_bytes) - zc_bytes
+         << " copied completions "
+         << logger->get(l_msgr_send_zerocopy_copied) - zc_copied
+         << std::endl;
+
+    center->delete_file_event(srv_socket.fd(), EVENT_READABLE);
+    center->delete_file_event(cli_socket.fd(), EVENT_WRITABLE);
+    cli_socket.close();
+    srv_socket.close();
+    bind_socket.abort_accept();
+  });
+  g_ceph_context->_conf.set_val("ms_async_zerocopy_send", "false");
+}
+
 
 INSTANTIATE_TEST_SUITE_P(
   NetworkStack,
@@ -1058,6 +1162,9 @@ INSTANTIATE_TEST_SUITE_P(
   ::testing::Values(
 #ifdef HAVE_DPDK
     "dpdk",
+#endif
+#ifdef HAVE_IO_URING_STACK
+    "io_uring",
 #endif
     "posix"
   )
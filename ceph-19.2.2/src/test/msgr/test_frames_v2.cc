@@ -14,6 +14,7 @@
 
 #include "msg/async/frames_v2.h"
 
+#include <iostream>
 #include <numeric>
 #include <ostream>
 #include <string>
@@ -22,6 +23,7 @@
 #include "msg/async/compression_meta.h"
 #include "auth/Auth.h"
 #include "common/ceph_argparse.h"
+#include "common/ceph_time.h"
 #include "global/global_init.h"
 #include "global/global_context.h"
 #include "include/Context.h"
@@ -147,6 +149,18 @@ static bufferlist make_bufferlist(size_t len, char c) {
   return bl;
 }
 
+// Copies bl into a bufferlist made of frag_len byte long buffers, the
+// way encoded messages tend to look like.
+static bufferlist make_fragmented(const bufferlist& bl, size_t frag_len) {
+  bufferlist frag_bl;
+  for (auto p = bl.cbegin(); !p.end(); ) {
+    const char* data;
+    size_t len = p.get_ptr_and_advance(frag_len, &data);
+    frag_bl.push_back(buffer::copy(data, len));
+  }
+  return frag_bl;
+}
+
 bool disassemble_frame(FrameAssembler& frame_asm, bufferlist& frame_bl,
                        Tag& tag, segment_bls_t& segment_bls) {
   bufferlist preamble_bl;
@@ -232,8 +246,13 @@ protected:
                       frame_asm.get_frame_onwire_len());
   }
 
-  void test_round_trip() {
-    auto tx_frame = TestFrame::Encode(m_header, m_front, m_middle, m_data);
+  void test_round_trip(size_t frag_len = 0) {
+    auto tx_frame = frag_len ?
+      TestFrame::Encode(make_fragmented(m_header, frag_len),
+                        make_fragmented(m_front, frag_len),
+                        make_fragmented(m_middle, frag_len),
+                        make_fragmented(m_data, frag_len)) :
+      TestFrame::Encode(m_header, m_front, m_middle, m_data);
     auto onwire_bl = tx_frame.get_buffer(m_tx_frame_asm);
     check_frame_assembler(m_tx_frame_asm);
     EXPECT_EQ(m_tx_frame_asm.get_frame_onwire_len(), onwire_bl.length());
@@ -279,6 +298,13 @@ TEST_P(RoundTripTest, Reuse) {
   }
 }
 
+TEST_P(RoundTripTest, Fragmented) {
+  // tiny pieces are gathered before encryption, large ones are not
+  for (size_t frag_len : {1, 7, 16, 100, 1000}) {
+    test_round_trip(frag_len);
+  }
+}
+
 static const round_trip_instance_t round_trip_instances[] = {
   // first segment is empty
   { 0,   0,   0,   0, 1, {{32,  0,  17,   0,   0,  0},
@@ -436,6 +462,26 @@ TEST_P(RoundTripPerfTest, DISABLED_Basic) {
   }
 }
 
+// Throughput of a single core assembling frames out of many small
+// buffers, as encoded messages are, e.g. to compare crc and secure modes.
+TEST_P(RoundTripPerfTest, DISABLED_Fragmented) {
+  const auto& [rti, m] = GetParam();
+  const int iterations = 100000;
+  const auto header = make_fragmented(m_header, 8);
+  const auto front = make_fragmented(m_front, 32);
+  const auto data = make_fragmented(m_data, 4096);
+  uint64_t bytes = 0;
+  auto start = ceph::mono_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    auto tx_frame = TestFrame::Encode(header, front, m_middle, data);
+    bytes += tx_frame.get_buffer(m_tx_frame_asm).length();
+  }
+  auto elapsed = ceph::to_seconds<double>(ceph::mono_clock::now() - start);
+  std::cout << m << " " << rti << ": " << iterations / elapsed
+            << " frames/s " << bytes / elapsed / (1 << 20) << " MiB/s"
+            << std::endl;
+}
+
 static const round_trip_instance_t round_trip_perf_instances[] = {
   {41, 250, 0,       0, 2, {{32, 41, 250, 17,       0,  0},
                             {32, 48, 256, 32,       0,  0},
@@ -32,6 +32,7 @@
 
 #include "common/ceph_argparse.h"
 #include "common/ceph_mutex.h"
+#include "common/perf_counters_collection.h"
 #include "global/global_init.h"
 #include "messages/MCommand.h"
 #include "messages/MPing.h"
@@ -2389,6 +2390,125 @@ TEST_P(MessengerTest, MarkdownTest) {
   delete server_msgr2;
 }
 
+class RebalanceDispatcher : public Dispatcher {
+ public:
+  ceph::mutex lock = ceph::make_mutex("RebalanceDispatcher::lock");
+  ceph::condition_variable cond;
+  uint64_t count = 0;
+  uint64_t last_seq = 0;
+  bool out_of_order = false;
+
+  RebalanceDispatcher() : Dispatcher(g_ceph_context) {}
+  bool ms_can_fast_dispatch_any() const override { return true; }
+  bool ms_can_fast_dispatch(const Message *m) const override {
+    return m->get_type() == CEPH_MSG_PING;
+  }
+  void ms_fast_dispatch(Message *m) override {
+    std::lock_guard l{lock};
+    if (last_seq && m->get_seq() != last_seq + 1) {
+      lderr(g_ceph_context) << __func__ << " got seq " << m->get_seq()
+			    << " after " << last_seq << dendl;
+      out_of_order = true;
+    }
+    last_seq = m->get_seq();
+    ++count;
+    cond.notify_all();
+    m->put();
+  }
+  bool ms_dispatch(Message *m) override {
+    m->put();
+    return true;
+  }
+  bool ms_handle_reset(Connection *con) override { return true; }
+  void ms_handle_remote_reset(Connection *con) override {}
+  bool ms_handle_refused(Connection *con) override { return false; }
+  bool ms_handle_fast_authentication(Connection *con) override {
+    return true;
+  }
+};
+
+static uint64_t get_migrated_connections()
+{
+  uint64_t migrated = 0;
+  g_ceph_context->get_perfcounters_collection()->with_counters(
+    [&](const PerfCountersCollectionImpl::CounterMap &by_path) {
+      for (auto& [path, ref] : by_path) {
+	if (path.starts_with("AsyncMessenger::Worker") &&
+	    path.ends_with(".msgr_migrated_connections")) {
+	  migrated += ref.data->u64;
+	}
+      }
+    });
+  return migrated;
+}
+
+/**
+ * Scenario: a connection busy enough for its worker to be the hottest one
+ * is moved to another worker between messages, and keeps delivering them
+ * in order afterwards.
+ */
+TEST_P(MessengerTest, RebalanceTest) {
+  // the options are read when messengers start and connections are created
+  g_ceph_context->_conf.set_val("ms_async_rebalance_interval", "1");
+  g_ceph_context->_conf.set_val("ms_async_rebalance_min_load", "0");
+  g_ceph_context->_conf.set_val("ms_async_rebalance_threshold", "0");
+  g_ceph_context->_conf.set_val("ms_async_rebalance_hysteresis", "1");
+  RebalanceDispatcher srv_dispatcher;
+  FakeDispatcher cli_dispatcher(false);
+  entity_addr_t bind_addr;
+  bind_addr.parse("v2:127.0.0.1");
+  server_msgr->set_policy(entity_name_t::TYPE_CLIENT,
+			  Messenger::Policy::stateful_server(0));
+  client_msgr->set_policy(entity_name_t::TYPE_OSD,
+			  Messenger::Policy::lossless_client(0));
+  server_msgr->bind(bind_addr);
+  server_msgr->add_dispatcher_head(&srv_dispatcher);
+  server_msgr->start();
+  client_msgr->add_dispatcher_head(&cli_dispatcher);
+  client_msgr->start();
+
+  const uint64_t migrated = get_migrated_connections();
+  ConnectionRef conn = client_msgr->connect_to(server_msgr->get_mytype(),
+					       server_msgr->get_myaddrs());
+  // keep the connection busy in batches, leaving idle moments in between
+  // for it to be moved in
+  uint64_t sent = 0;
+  auto send_batch = [&] {
+    for (int i = 0; i < 1000; ++i) {
+      ASSERT_EQ(conn->send_message(new MPing()), 0);
+    }
+    sent += 1000;
+    std::unique_lock l{srv_dispatcher.lock};
+    ASSERT_TRUE(srv_dispatcher.cond.wait_for(l, std::chrono::seconds(30), [&] {
+      return srv_dispatcher.count == sent;
+    }));
+  };
+  auto deadline = ceph::mono_clock::now() + std::chrono::seconds(60);
+  while (get_migrated_connections() == migrated) {
+    ASSERT_LT(ceph::mono_clock::now(), deadline) << "nothing was moved";
+    ASSERT_NO_FATAL_FAILURE(send_batch());
+  }
+  // the moved connection goes on where it left off
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_NO_FATAL_FAILURE(send_batch());
+  }
+  ASSERT_TRUE(conn->is_connected());
+  {
+    std::lock_guard l{srv_dispatcher.lock};
+    ASSERT_FALSE(srv_dispatcher.out_of_order);
+    ASSERT_EQ(sent, srv_dispatcher.count);
+  }
+
+  server_msgr->shutdown();
+  client_msgr->shutdown();
+  server_msgr->wait();
+  client_msgr->wait();
+  g_ceph_context->_conf.set_val("ms_async_rebalance_interval", "0");
+  g_ceph_context->_conf.set_val("ms_async_rebalance_min_load", "0.5");
+  g_ceph_context->_conf.set_val("ms_async_rebalance_threshold", "0.25");
+  g_ceph_context->_conf.set_val("ms_async_rebalance_hysteresis", "3");
+}
+
 INSTANTIATE_TEST_SUITE_P(
   Messenger,
   MessengerTest,
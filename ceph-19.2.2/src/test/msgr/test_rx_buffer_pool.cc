@@ -0,0 +1,90 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "msg/async/RxBufferPool.h"
+#include "include/buffer.h"
+#include "include/mempool.h"
+#include "include/page.h"
+#include "gtest/gtest.h"
+
+static ceph::bufferptr get(RxBufferPool& pool, uint32_t len, uint32_t align,
+			   bool *hit)
+{
+  auto raw = pool.get(len, align, hit);
+  if (!raw) {
+    return ceph::bufferptr();
+  }
+  ceph::bufferptr bp(std::move(raw));
+  bp.set_length(len);
+  return bp;
+}
+
+static size_t cached_bytes()
+{
+  return mempool::msgr_rx_cache::allocated_bytes();
+}
+
+TEST(RxBufferPool, recycle)
+{
+  auto pool = std::make_shared<RxBufferPool>(1 << 20, 64 << 10);
+  ASSERT_EQ(64u << 10, pool->get_max_buffer_size());
+  const size_t anon = mempool::buffer_anon::allocated_bytes();
+  const size_t cached = cached_bytes();
+
+  bool hit = true;
+  auto bp = get(*pool, 5000, CEPH_PAGE_SIZE, &hit);
+  ASSERT_FALSE(hit);
+  ASSERT_EQ(5000u, bp.length());
+  ASSERT_EQ(8192u, bp.raw_length());
+  ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(bp.c_str()) & ~CEPH_PAGE_MASK);
+  // in use buffers are accounted by their class size
+  ASSERT_EQ(anon + 8192, mempool::buffer_anon::allocated_bytes());
+  const char *data = bp.c_str();
+  bp = ceph::bufferptr();
+  ASSERT_EQ(8192u, pool->get_cached());
+  ASSERT_EQ(anon, mempool::buffer_anon::allocated_bytes());
+  ASSERT_EQ(cached + 8192, cached_bytes());
+
+  // same size class
+  bp = get(*pool, 8000, 8, &hit);
+  ASSERT_TRUE(hit);
+  ASSERT_EQ(data, bp.c_str());
+  ASSERT_EQ(0u, pool->get_cached());
+  ASSERT_EQ(cached, cached_bytes());
+
+  // other size class
+  auto small = get(*pool, 100, 8, &hit);
+  ASSERT_FALSE(hit);
+  ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(small.c_str()) %
+	    RxBufferPool::MIN_BUFFER_SIZE);
+
+  // the buffer keeps the pool alive
+  std::weak_ptr<RxBufferPool> weak = pool;
+  pool.reset();
+  ASSERT_FALSE(weak.expired());
+  bp = ceph::bufferptr();
+  small = ceph::bufferptr();
+  ASSERT_TRUE(weak.expired());
+  ASSERT_EQ(cached, cached_bytes());
+}
+
+TEST(RxBufferPool, limits)
+{
+  auto pool = std::make_shared<RxBufferPool>(16 << 10, 64 << 10);
+  bool hit;
+
+  // too large to be pooled
+  ASSERT_FALSE(pool->get((64 << 10) + 1, 8, &hit));
+
+  // idle buffers beyond max_cached are freed
+  auto a = get(*pool, 16 << 10, 8, &hit);
+  auto b = get(*pool, 16 << 10, 8, &hit);
+  a = ceph::bufferptr();
+  b = ceph::bufferptr();
+  ASSERT_EQ(16u << 10, pool->get_cached());
+
+  // disabled
+  auto off = std::make_shared<RxBufferPool>(0, 64 << 10);
+  ASSERT_FALSE(off->enabled());
+  ASSERT_FALSE(off->get(4096, 8, &hit));
+}
@@ -6,6 +6,7 @@
  */
 #include <bit>
 #include <iostream>
+#include <thread>
 #include <boost/scoped_ptr.hpp>
 #include <gtest/gtest.h>
 #include <boost/random/triangle_distribution.hpp>
@@ -414,6 +415,111 @@ TEST_P(AllocTest, test_alloc_fragmentation_max_chunk_8M)
   }
 }
 
+// Concurrent aging with and without the allocator chunk cache: the cache
+// must neither lose space nor leave the free space fragmented once
+// everything is released.
+TEST_P(AllocTest, test_alloc_chunk_cache_mt)
+{
+  uint64_t capacity = uint64_t(16) * 1024 * 1024 * 1024;
+  uint64_t alloc_unit = 4096;
+  const size_t num_threads = 8;
+  const size_t ops_per_thread = 100000;
+  std::string allocator_name = GetParam();
+
+  for (auto shards : {0, 16}) {
+    cct->_conf.set_val_or_die("bluestore_alloc_cache_shards",
+			      stringify(shards));
+    init_alloc(allocator_name, capacity, alloc_unit);
+    alloc->init_add_free(0, capacity);
+
+    utime_t start = ceph_clock_now();
+    std::vector<std::vector<PExtentVector>> held(num_threads);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t]() {
+	gen_type trng(t);
+	boost::uniform_int<> u(0, 4); // 4K-64K
+	auto& mine = held[t];
+	mine.resize(4096);
+	for (size_t i = 0; i < ops_per_thread; ++i) {
+	  auto& slot = mine[trng() % mine.size()];
+	  if (!slot.empty()) {
+	    alloc->release(slot);
+	    slot.clear();
+	  }
+	  uint64_t want = alloc_unit << u(trng);
+	  auto r = alloc->allocate(want, alloc_unit, 0, 0, &slot);
+	  ASSERT_EQ(r, (int64_t)want);
+	}
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    double frag_score = alloc->get_fragmentation_score();
+    for (auto& mine : held) {
+      for (auto& slot : mine) {
+	if (!slot.empty()) {
+	  alloc->release(slot);
+	}
+      }
+    }
+    double free_frag_score = alloc->get_fragmentation_score();
+    std::cout << "Allocator: " << allocator_name
+	      << " chunk cache shards " << shards
+	      << " time=" << (ceph_clock_now() - start) * 1000 << "ms"
+	      << " frag.score=" << frag_score
+	      << " after free frag.score=" << free_frag_score << std::endl;
+    ASSERT_EQ(alloc->get_free(), capacity);
+    EXPECT_LT(free_frag_score, 0.0001);
+    init_close();
+  }
+  cct->_conf.set_val_or_die("bluestore_alloc_cache_shards", "0");
+}
+
+// Chunks one thread parked in the chunk cache must not push another
+// thread into fragmented space.
+TEST_P(AllocTest, test_alloc_chunk_cache_other_thread)
+{
+  std::string allocator_name = GetParam();
+  if (allocator_name != "avl" && allocator_name != "hybrid") {
+    GTEST_SKIP() << "no chunk cache";
+  }
+  uint64_t alloc_unit = 4096;
+  uint64_t capacity = alloc_unit * 32;
+  cct->_conf.set_val_or_die("bluestore_alloc_cache_shards", "16");
+  init_alloc(allocator_name, capacity, alloc_unit);
+  alloc->init_add_free(0, capacity);
+
+  std::map<uint64_t, PExtentVector> held;
+  for (size_t i = 0; i < capacity / alloc_unit; ++i) {
+    PExtentVector tmp;
+    ASSERT_EQ(alloc->allocate(alloc_unit, alloc_unit, 0, 0, &tmp),
+	      (int64_t)alloc_unit);
+    held[tmp[0].offset] = tmp;
+  }
+  // the first eight fill this thread's cache slots, the other eight
+  // are scattered over the tree
+  std::thread([&]() {
+    for (uint64_t off = 0; off < alloc_unit * 8; off += alloc_unit) {
+      alloc->release(held[off]);
+    }
+    for (uint64_t off = alloc_unit * 16; off < capacity; off += alloc_unit * 2) {
+      alloc->release(held[off]);
+    }
+  }).join();
+
+  PExtentVector extents;
+  std::thread([&]() {
+    ASSERT_EQ(alloc->allocate(alloc_unit * 8, alloc_unit, 0, 0, &extents),
+	      (int64_t)alloc_unit * 8);
+  }).join();
+  EXPECT_EQ(extents.size(), 1u);
+  EXPECT_EQ(alloc->get_free(), alloc_unit * 8);
+  init_close();
+  cct->_conf.set_val_or_die("bluestore_alloc_cache_shards", "0");
+}
+
 TEST_P(AllocTest, test_bonus_empty_fragmented)
 {
   uint64_t capacity = uint64_t(512) * 1024 * 1024 * 1024; //512 G
@@ -460,4 +566,4 @@ TEST_P(AllocTest, test_bonus_empty_fragmented)
 INSTANTIATE_TEST_SUITE_P(
   Allocator,
   AllocTest,
-  ::testing::Values("stupid", "bitmap", "avl", "btree"));
+  ::testing::Values("stupid", "bitmap", "avl", "btree", "hybrid"));
@@ -5,6 +5,7 @@
  * Author: Igor Fedotov, ifedotov@suse.com
  */
 #include <iostream>
+#include <thread>
 #include <boost/scoped_ptr.hpp>
 #include <gtest/gtest.h>
 
@@ -328,6 +329,60 @@ TEST_P(AllocTest, test_alloc_bench_10_300)
   doOverwriteTest(capacity, prefill, overwrite);
 }
 
+// Several threads doing small allocate/release pairs, i.e. what
+// concurrent kv_sync/finalize threads and BlueFS do to a shared device.
+// Runs with the allocator chunk cache disabled and enabled.
+TEST_P(AllocTest, test_alloc_bench_mt)
+{
+  uint64_t capacity = uint64_t(64) * 1024 * 1024 * 1024;
+  uint64_t alloc_unit = 4096;
+  const size_t num_threads = 8;
+  const size_t ops_per_thread = 200000;
+  const size_t held_per_thread = 1024;
+
+  for (auto shards : {0, 16}) {
+    g_ceph_context->_conf.set_val_or_die(
+      "bluestore_alloc_cache_shards", stringify(shards));
+    init_alloc(capacity, alloc_unit);
+    alloc->init_add_free(0, capacity);
+
+    utime_t start = ceph_clock_now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t]() {
+	gen_type rng(t);
+	boost::uniform_int<> u(0, 4); // 4K-64K
+	std::vector<PExtentVector> held(held_per_thread);
+	PExtentVector tmp;
+	for (size_t i = 0; i < ops_per_thread; ++i) {
+	  auto& slot = held[i % held_per_thread];
+	  if (!slot.empty()) {
+	    alloc->release(slot);
+	    slot.clear();
+	  }
+	  uint64_t want = alloc_unit << u(rng);
+	  auto r = alloc->allocate(want, alloc_unit, 0, 0, &slot);
+	  ASSERT_EQ(r, (int64_t)want);
+	}
+	for (auto& slot : held) {
+	  if (!slot.empty()) {
+	    alloc->release(slot);
+	  }
+	}
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    std::cout << GetParam() << " chunk cache shards " << shards
+	      << ": " << num_threads * ops_per_thread << " ops executed in "
+	      << ceph_clock_now() - start << std::endl;
+    ASSERT_EQ(alloc->get_free(), capacity);
+    init_close();
+  }
+  g_ceph_context->_conf.set_val_or_die("bluestore_alloc_cache_shards", "0");
+}
+
 TEST_P(AllocTest, mempoolAccounting)
 {
   uint64_t bytes = mempool::bluestore_alloc::allocated_bytes();
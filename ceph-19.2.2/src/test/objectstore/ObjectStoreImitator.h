@@ -284,7 +284,7 @@ public:
     return 0;
   }
   int stat(CollectionHandle &c, const ghobject_t &oid, struct stat *st,
-           bool allow_eio = false) override {
+           bool allow_eio = false, uint32_t op_flags = 0) override {
     return 0;
   }
   int fiemap(CollectionHandle &c, const ghobject_t &oid, uint64_t offset,
@@ -301,7 +301,8 @@ public:
   }
   int getattrs(
       CollectionHandle &c, const ghobject_t &oid,
-      std::map<std::string, ceph::buffer::ptr, std::less<>> &aset) override {
+      std::map<std::string, ceph::buffer::ptr, std::less<>> &aset,
+      uint32_t op_flags = 0) override {
     return 0;
   }
   int omap_get(CollectionHandle &c,        ///< [in] Collection containing oid
@@ -315,7 +316,8 @@ public:
   int omap_get_header(CollectionHandle &c,   ///< [in] Collection containing oid
                       const ghobject_t &oid, ///< [in] Object containing omap
                       ceph::buffer::list *header, ///< [out] omap header
-                      bool allow_eio = false      ///< [in] don't assert on eio
+                      bool allow_eio = false,     ///< [in] don't assert on eio
+                      uint32_t op_flags = 0       ///< [in] CEPH_OSD_OP_FLAG_*
                       ) override {
     return 0;
   }
@@ -343,7 +345,8 @@ public:
   }
   ObjectMap::ObjectMapIterator
   get_omap_iterator(CollectionHandle &c,  ///< [in] collection
-                    const ghobject_t &oid ///< [in] object
+                    const ghobject_t &oid, ///< [in] object
+                    uint32_t op_flags = 0  ///< [in] CEPH_OSD_OP_FLAG_*
                     ) override {
     return {};
   }
@@ -36,6 +36,7 @@
 #include "common/buffer_instrumentation.h"
 #include "common/ceph_argparse.h"
 #include "common/admin_socket.h"
+#include "common/ceph_json.h"
 #include "global/global_init.h"
 #include "common/ceph_mutex.h"
 #include "common/Cond.h"
@@ -7304,6 +7305,1227 @@ void doMany4KWritesTest(ObjectStore* store,
   test_obj.shutdown();
 }
 
+TEST_P(StoreTestSpecificAUSize, ShardedKVSyncTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf(), "bluestore_kv_sync_shards", "4");
+  SetVal(g_conf(), "bluestore_prefer_deferred_size", "16384");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(0x1000);
+
+  const unsigned num_colls = 8;
+  const unsigned num_objs = 32;
+  std::vector<coll_t> cids;
+  std::vector<ObjectStore::CollectionHandle> chs;
+  for (unsigned i = 0; i < num_colls; ++i) {
+    coll_t cid(spg_t(pg_t(i, 777), shard_id_t::NO_SHARD));
+    auto ch = store->create_new_collection(cid);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    cids.push_back(cid);
+    chs.push_back(ch);
+  }
+  // interleave small (deferred) writes across all collections so that
+  // every commit shard has work at the same time; each object gets a
+  // sequence of overwrites whose final content must win.
+  for (unsigned pass = 0; pass < 4; ++pass) {
+    for (unsigned n = 0; n < num_objs; ++n) {
+      for (unsigned i = 0; i < num_colls; ++i) {
+        ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(n),
+                                            CEPH_NOSNAP)));
+        bufferlist data;
+        data.append(std::string(8192, 'a' + pass));
+        ObjectStore::Transaction t;
+        t.write(cids[i], hoid, 0, data.length(), data);
+        store->queue_transaction(chs[i], std::move(t));
+      }
+    }
+  }
+  for (auto& ch : chs) {
+    ch->flush();
+  }
+#if defined(WITH_BLUESTORE)
+  // deferred writes of a sequencer committing on a shard other than 0
+  // have their deferred keys cleaned up while shard 0 stays idle
+  {
+    unsigned i = 0;
+    for (; i < num_colls; ++i) {
+      auto c = static_cast<BlueStore::Collection*>(chs[i].get());
+      if (c->osr->get_sequencer_id() % 4) {
+	break;
+      }
+    }
+    ASSERT_LT(i, num_colls);
+    const PerfCounters* logger = store->get_perf_counters();
+    auto count = [logger](int idx) {
+      return logger->get_tavg_ns(idx).second;
+    };
+    auto submitted = count(l_bluestore_state_deferred_queued_lat);
+    ghobject_t hoid(hobject_t(sobject_t("Deferred", CEPH_NOSNAP)));
+    bufferlist data;
+    data.append(std::string(8192, 'x'));
+    {
+      ObjectStore::Transaction t;
+      t.write(cids[i], hoid, 0, data.length(), data);
+      int r = queue_transaction(store, chs[i], std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+    // bluestore_max_defer_interval gets the batch submitted eventually,
+    // wait for everything submitted to be written and cleaned up
+    auto all_clean = [&] {
+      auto n = count(l_bluestore_state_deferred_queued_lat);
+      return n > submitted &&
+	count(l_bluestore_state_deferred_aio_wait_lat) == n &&
+	count(l_bluestore_state_deferred_cleanup_lat) == n;
+    };
+    for (unsigned n = 0; n < 200 && !all_clean(); ++n) {
+      usleep(100000);
+    }
+    ASSERT_TRUE(all_clean());
+    ObjectStore::Transaction t;
+    t.remove(cids[i], hoid);
+    int r = queue_transaction(store, chs[i], std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+#endif
+  chs.clear();
+  int r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  for (unsigned i = 0; i < num_colls; ++i) {
+    auto ch = store->open_collection(cids[i]);
+    ObjectStore::Transaction t;
+    for (unsigned n = 0; n < num_objs; ++n) {
+      ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(n),
+                                          CEPH_NOSNAP)));
+      bufferlist in;
+      r = store->read(ch, hoid, 0, 8192, in);
+      ASSERT_EQ(8192, r);
+      ASSERT_EQ(std::string(8192, 'd'), in.to_str());
+      t.remove(cids[i], hoid);
+    }
+    t.remove_collection(cids[i]);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+#if defined(WITH_BLUESTORE)
+TEST_P(StoreTestSpecificAUSize, UseOnceReadTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf(), "bluestore_default_buffered_read", "true");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(0x10000);
+
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    bufferlist bl;
+    bl.append(std::string(0x20000, 'a'));
+    t.write(cid, hoid, 0, bl.length(), bl);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // start with cold caches
+  ch.reset();
+  int r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  ch = store->open_collection(cid);
+
+  const PerfCounters* logger = store->get_perf_counters();
+  auto use_once_bytes = logger->get(l_bluestore_read_use_once_bytes);
+  auto use_once_onodes = logger->get(l_bluestore_onode_use_once);
+  {
+    // scrub-like read: served, but nothing is left behind in buffer cache
+    bufferlist bl;
+    r = store->read(ch, hoid, 0, 0x20000, bl,
+                    CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+    ASSERT_EQ(0x20000, r);
+    ASSERT_EQ(std::string(0x20000, 'a'), bl.to_str());
+    ASSERT_EQ(use_once_bytes + 0x20000,
+              logger->get(l_bluestore_read_use_once_bytes));
+    ASSERT_EQ(use_once_onodes + 1, logger->get(l_bluestore_onode_use_once));
+    store->refresh_perf_counters();
+    ASSERT_EQ(0u, logger->get(l_bluestore_buffer_bytes));
+  }
+  {
+    // a regular read still populates the cache
+    bufferlist bl;
+    r = store->read(ch, hoid, 0, 0x20000, bl);
+    ASSERT_EQ(0x20000, r);
+    store->refresh_perf_counters();
+    ASSERT_EQ(0x20000u, logger->get(l_bluestore_buffer_bytes));
+  }
+  {
+    // and an already cached onode is not reloaded as use-once
+    bufferlist bl;
+    r = store->read(ch, hoid, 0, 0x20000, bl,
+                    CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+    ASSERT_EQ(0x20000, r);
+    ASSERT_EQ(use_once_onodes + 1, logger->get(l_bluestore_onode_use_once));
+  }
+
+  // scrub and recovery look the object up before they read it
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  ch = store->open_collection(cid);
+  {
+    struct stat st;
+    r = store->stat(ch, hoid, &st, true, CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+    ASSERT_EQ(0, r);
+    ASSERT_EQ(0x20000, st.st_size);
+    ASSERT_EQ(use_once_onodes + 2, logger->get(l_bluestore_onode_use_once));
+    std::map<std::string, bufferptr, std::less<>> aset;
+    r = store->getattrs(ch, hoid, aset, CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+    ASSERT_EQ(0, r);
+    bufferlist bl;
+    r = store->read(ch, hoid, 0, 0x20000, bl,
+                    CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+    ASSERT_EQ(0x20000, r);
+    ASSERT_EQ(use_once_onodes + 2, logger->get(l_bluestore_onode_use_once));
+    store->refresh_perf_counters();
+    ASSERT_EQ(0u, logger->get(l_bluestore_buffer_bytes));
+  }
+  {
+    // asking for the data to be kept wins over the use-once hint
+    bufferlist bl;
+    r = store->read(ch, hoid, 0, 0x20000, bl,
+                    CEPH_OSD_OP_FLAG_FADVISE_NOCACHE |
+                    CEPH_OSD_OP_FLAG_FADVISE_WILLNEED);
+    ASSERT_EQ(0x20000, r);
+    store->refresh_perf_counters();
+    ASSERT_EQ(0x20000u, logger->get(l_bluestore_buffer_bytes));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, DefragTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf(), "bluestore_defrag_sleep", "0");
+  SetVal(g_conf(), "bluestore_defrag_min_run_size", "65536");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(0x1000);
+
+  const uint64_t block = 0x1000;
+  const uint64_t obj_size = 0x40000;
+  coll_t cid;
+  ghobject_t hoid1(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  ghobject_t hoid2(hobject_t(sobject_t("Object 2", CEPH_NOSNAP)));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // interleave allocations of two objects block by block
+  bufferlist expected1, expected2;
+  for (uint64_t offset = 0; offset < obj_size; offset += block) {
+    for (auto hoid : {&hoid1, &hoid2}) {
+      bufferlist bl;
+      bl.append(std::string(block, 'a' + (offset / block) % 26));
+      (hoid == &hoid1 ? expected1 : expected2).append(bl);
+      ObjectStore::Transaction t;
+      t.write(cid, *hoid, offset, bl.length(), bl);
+      int r = queue_transaction(store, ch, std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+  }
+
+  const PerfCounters* logger = store->get_perf_counters();
+  auto defrag_objects = logger->get(l_bluestore_defrag_objects);
+  {
+    AdminSocket* admin_socket = g_ceph_context->get_admin_socket();
+    ASSERT_TRUE(admin_socket);
+    bufferlist in, out;
+    ostringstream err;
+    // target 0 makes the pass walk all collections
+    int r = admin_socket->execute_command(
+      { "{\"prefix\": \"bluestore defrag start\", \"target\": 0.0}" },
+      in, err, &out);
+    ASSERT_EQ(0, r);
+  }
+  for (int i = 0; i < 100 &&
+	 logger->get(l_bluestore_defrag_objects) < defrag_objects + 2; ++i) {
+    usleep(100000);
+  }
+  ASSERT_EQ(defrag_objects + 2, logger->get(l_bluestore_defrag_objects));
+  ASSERT_LE(2 * obj_size, logger->get(l_bluestore_defrag_bytes));
+  {
+    AdminSocket* admin_socket = g_ceph_context->get_admin_socket();
+    bufferlist in, out;
+    ostringstream err;
+    int r = admin_socket->execute_command(
+      { "{\"prefix\": \"bluestore defrag stop\"}" },
+      in, err, &out);
+    ASSERT_EQ(0, r);
+  }
+  for (auto [hoid, expected] : {std::make_pair(&hoid1, &expected1),
+				std::make_pair(&hoid2, &expected2)}) {
+    bufferlist bl;
+    int r = store->read(ch, *hoid, 0, obj_size, bl);
+    ASSERT_EQ((int)obj_size, r);
+    ASSERT_TRUE(bl_eq(*expected, bl));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid1);
+    t.remove(cid, hoid2);
+    t.remove_collection(cid);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, OnodeLazyInlineExtentMapTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  StartDeferred(0x10000);
+
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  auto ch = store->create_new_collection(cid);
+  bufferlist data, attr;
+  data.append(std::string(0x3000, 'd'));
+  attr.append("value");
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.write(cid, hoid, 0, data.length(), data);
+    t.setattr(cid, hoid, "attr", attr);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // start over with a cold onode cache
+  ch.reset();
+  ASSERT_EQ(0, store->umount());
+  ASSERT_EQ(0, store->mount());
+  ch = store->open_collection(cid);
+
+  const PerfCounters* logger = store->get_perf_counters();
+  auto decodes = logger->get(l_bluestore_onode_inline_decodes);
+  {
+    bufferptr bp;
+    ASSERT_EQ(0, store->getattr(ch, hoid, "attr", bp));
+    ASSERT_EQ(0, memcmp(bp.c_str(), "value", bp.length()));
+    struct stat st;
+    ASSERT_EQ(0, store->stat(ch, hoid, &st));
+    ASSERT_EQ((off_t)data.length(), st.st_size);
+  }
+  // metadata-only access leaves the extent map encoded
+  ASSERT_EQ(decodes, logger->get(l_bluestore_onode_inline_decodes));
+  {
+    ObjectStore::Transaction t;
+    t.setattr(cid, hoid, "attr2", attr);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(decodes, logger->get(l_bluestore_onode_inline_decodes));
+  {
+    bufferlist bl;
+    ASSERT_EQ((int)data.length(), store->read(ch, hoid, 0, data.length(), bl));
+    ASSERT_TRUE(bl_eq(data, bl));
+  }
+  ASSERT_EQ(decodes + 1, logger->get(l_bluestore_onode_inline_decodes));
+  {
+    // the reused encoding must still describe the data after a remount
+    ch.reset();
+    ASSERT_EQ(0, store->umount());
+    ASSERT_EQ(0, store->mount());
+    ch = store->open_collection(cid);
+    bufferlist bl;
+    ASSERT_EQ((int)data.length(), store->read(ch, hoid, 0, data.length(), bl));
+    ASSERT_TRUE(bl_eq(data, bl));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, CompressThreadPoolTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf(), "bluestore_compression_algorithm", "snappy");
+  SetVal(g_conf(), "bluestore_compression_mode", "force");
+  SetVal(g_conf(), "bluestore_compression_threads", "4");
+  SetVal(g_conf(), "bluestore_compression_async_min_size", "262144");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(0x1000);
+
+  coll_t cid;
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  std::string data(0x100000, 0);
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = (i / 256) ^ (i % 7);
+
+  const PerfCounters* logger = store->get_perf_counters();
+  auto write = [&](const char* name, size_t len) {
+    ghobject_t hoid(hobject_t(sobject_t(name, CEPH_NOSNAP)));
+    bufferlist bl;
+    bl.append(data.substr(0, len));
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 0, bl.length(), bl);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  };
+  auto check = [&](const char* name, size_t len) {
+    ghobject_t hoid(hobject_t(sobject_t(name, CEPH_NOSNAP)));
+    bufferlist bl;
+    ASSERT_EQ((int)len, store->read(ch, hoid, 0, len, bl));
+    bufferlist expected;
+    expected.append(data.substr(0, len));
+    ASSERT_TRUE(bl_eq(expected, bl));
+  };
+
+  // below the threshold everything is compressed inline
+  auto offloaded = logger->get(l_bluestore_compress_offloaded_count);
+  auto success = logger->get(l_bluestore_compress_success_count);
+  write("small", 0x20000);
+  ASSERT_EQ(offloaded, logger->get(l_bluestore_compress_offloaded_count));
+  ASSERT_LT(success, logger->get(l_bluestore_compress_success_count));
+
+  // a large write has its blobs spread over the pool; the submitting
+  // thread works on the batch too and may get through it first, so
+  // allow a few attempts for a pool thread to pick up a job
+  success = logger->get(l_bluestore_compress_success_count);
+  write("large", data.size());
+  ASSERT_LT(success + 1, logger->get(l_bluestore_compress_success_count));
+  for (int i = 0;
+       i < 100 && logger->get(l_bluestore_compress_offloaded_count) == offloaded;
+       ++i) {
+    write("large", data.size());
+  }
+  ASSERT_LT(offloaded, logger->get(l_bluestore_compress_offloaded_count));
+  cerr << "offloaded "
+       << logger->get(l_bluestore_compress_offloaded_count) - offloaded
+       << " of "
+       << logger->get(l_bluestore_compress_success_count) - success
+       << " blobs" << std::endl;
+
+  // and smaller writes still don't go near it
+  offloaded = logger->get(l_bluestore_compress_offloaded_count);
+  for (int i = 0; i < 10; ++i) {
+    write("small", 0x20000);
+  }
+  ASSERT_EQ(offloaded, logger->get(l_bluestore_compress_offloaded_count));
+
+  check("small", 0x20000);
+  check("large", data.size());
+  ch.reset();
+  ASSERT_EQ(0, store->umount());
+  ASSERT_EQ(0, store->fsck(false));
+  ASSERT_EQ(0, store->mount());
+  ch = store->open_collection(cid);
+  check("small", 0x20000);
+  check("large", data.size());
+}
+
+TEST_P(StoreTestSpecificAUSize, CompressionDictTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf(), "bluestore_compression_algorithm", "zstd");
+  SetVal(g_conf(), "bluestore_compression_mode", "force");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(0x1000);
+
+  const int64_t poolid = 77;
+  coll_t cid(spg_t(pg_t(0, poolid), shard_id_t::NO_SHARD));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // small json-like documents share most of their structure
+  auto make_doc = [](unsigned i) {
+    std::string s;
+    while (s.size() < 0x2000) {
+      s += "{\"id\": " + stringify(i) + ", \"user\": \"user" +
+	stringify(i * 7919 % 1000) + "\", \"status\": \"" +
+	(i % 3 ? "active" : "inactive") + "\", \"tags\": [\"t" +
+	stringify(i % 11) + "\", \"t" + stringify(s.size() % 13) + "\"]}\n";
+      i = i * 1103515245 + 12345;
+    }
+    s.resize(0x2000);
+    return s;
+  };
+  auto write = [&](const std::string& name, unsigned i) {
+    ghobject_t hoid(hobject_t(sobject_t(name, CEPH_NOSNAP)),
+		    ghobject_t::NO_GEN, shard_id_t::NO_SHARD);
+    hoid.hobj.pool = poolid;
+    bufferlist bl;
+    bl.append(make_doc(i));
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 0, bl.length(), bl);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  };
+  auto check = [&](const std::string& name, unsigned i) {
+    ghobject_t hoid(hobject_t(sobject_t(name, CEPH_NOSNAP)),
+		    ghobject_t::NO_GEN, shard_id_t::NO_SHARD);
+    hoid.hobj.pool = poolid;
+    bufferlist bl;
+    ASSERT_EQ(0x2000, store->read(ch, hoid, 0, 0x2000, bl));
+    bufferlist expected;
+    expected.append(make_doc(i));
+    ASSERT_TRUE(bl_eq(expected, bl));
+  };
+  auto command = [&](const std::string& cmd, bufferlist* out) {
+    AdminSocket* admin_socket = g_ceph_context->get_admin_socket();
+    ceph_assert(admin_socket);
+    bufferlist in;
+    ostringstream err;
+    return admin_socket->execute_command({ cmd }, in, err, out);
+  };
+  auto dict_blobs = [&]() {
+    bufferlist out;
+    ceph_assert(command("{\"prefix\": \"bluestore compression stats\"}",
+			&out) == 0);
+    JSONParser p;
+    ceph_assert(p.parse(out.c_str(), out.length()));
+    uint64_t n = 0;
+    JSONObj* pools = p.find_obj("pools");
+    ceph_assert(pools);
+    for (auto it = pools->find_first(); !it.end(); ++it) {
+      int64_t pool = -1;
+      JSONDecoder::decode_json("pool", pool, *it);
+      if (pool == poolid) {
+	JSONDecoder::decode_json("dict_blobs", n, *it);
+      }
+    }
+    return n;
+  };
+
+  for (unsigned i = 0; i < 300; i++) {
+    write("train_" + stringify(i), i);
+  }
+  ASSERT_EQ(0u, dict_blobs());
+  {
+    bufferlist out;
+    ASSERT_EQ(-ENOENT, command(
+      "{\"prefix\": \"bluestore compression dict train\", \"pool\": 78}",
+      &out));
+    ASSERT_EQ(0, command(
+      "{\"prefix\": \"bluestore compression dict train\", \"pool\": 77, "
+      "\"size\": 16384}", &out));
+
+    // the id comes from the content: the same samples give the same
+    // dictionary again, a different stored one with that id is refused
+    JSONParser p;
+    ASSERT_TRUE(p.parse(out.c_str(), out.length()));
+    int32_t id = 0;
+    JSONDecoder::decode_json("id", id, &p);
+    BlueStore* bstore = dynamic_cast<BlueStore*>(store.get());
+    ASSERT_TRUE(bstore);
+    auto* kv = bstore->get_kv();
+    // to be inline with BlueStore.cc
+    const string PREFIX_SUPER = "S";
+    const string key = "compression_dict." +
+      stringify((int)Compressor::COMP_ALG_ZSTD) + "." + stringify(id);
+    bufferlist orig;
+    ASSERT_EQ(0, kv->get(PREFIX_SUPER, key, &orig));
+    out.clear();
+    ASSERT_EQ(0, command(
+      "{\"prefix\": \"bluestore compression dict train\", \"pool\": 77, "
+      "\"size\": 16384}", &out));
+
+    auto txn = kv->get_transaction();
+    bufferlist other = orig;
+    other.append("x");
+    txn->set(PREFIX_SUPER, key, other);
+    kv->submit_transaction_sync(txn);
+    out.clear();
+    ASSERT_EQ(-EEXIST, command(
+      "{\"prefix\": \"bluestore compression dict train\", \"pool\": 77, "
+      "\"size\": 16384}", &out));
+    bufferlist stored;
+    ASSERT_EQ(0, kv->get(PREFIX_SUPER, key, &stored));
+    ASSERT_TRUE(bl_eq(other, stored));
+    txn = kv->get_transaction();
+    txn->set(PREFIX_SUPER, key, orig);
+    kv->submit_transaction_sync(txn);
+  }
+  for (unsigned i = 0; i < 50; i++) {
+    write("dict_" + stringify(i), 1000 + i);
+  }
+  ASSERT_LT(0u, dict_blobs());
+
+  // blobs written without a dictionary stay readable
+  check("train_0", 0);
+  check("dict_0", 1000);
+  ch.reset();
+  ASSERT_EQ(0, store->umount());
+  ASSERT_EQ(0, store->fsck(false));
+  ASSERT_EQ(0, store->mount());
+  ch = store->open_collection(cid);
+  for (unsigned i = 0; i < 300; i += 37) {
+    check("train_" + stringify(i), i);
+  }
+  for (unsigned i = 0; i < 50; i++) {
+    check("dict_" + stringify(i), 1000 + i);
+  }
+
+  // clearing only stops new writes from using the dictionary
+  {
+    bufferlist out;
+    ASSERT_EQ(0, command(
+      "{\"prefix\": \"bluestore compression dict clear\", \"pool\": 77}",
+      &out));
+  }
+  auto n = dict_blobs();
+  write("plain_0", 2000);
+  ASSERT_EQ(n, dict_blobs());
+  check("dict_1", 1001);
+  check("plain_0", 2000);
+}
+
+TEST_P(StoreTestSpecificAUSize, OmapRmkeysRangeTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf(), "bluestore_omap_rmkeys_range_min", "8");
+  SetVal(g_conf(), "rocksdb_delete_range_threshold", "0");
+  SetVal(g_conf(), "bluestore_omap_compact_tombstones", "0");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(0x10000);
+
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("omap_obj", CEPH_NOSNAP)));
+  auto ch = store->create_new_collection(cid);
+  auto key = [](unsigned i) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "key%03u", i);
+    return string(buf);
+  };
+  set<string> expected;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.touch(cid, hoid);
+    map<string, bufferlist> kvs;
+    for (unsigned i = 0; i < 100; i++) {
+      kvs[key(i)].append("value" + stringify(i));
+      expected.insert(key(i));
+    }
+    t.omap_setkeys(cid, hoid, kvs);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  auto rmkeys = [&](const set<string>& keys) {
+    // runs are only searched for once earlier updates have committed
+    ch->flush();
+    ObjectStore::Transaction t;
+    t.omap_rmkeys(cid, hoid, keys);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    for (auto& k : keys) {
+      expected.erase(k);
+    }
+  };
+  auto check = [&]() {
+    set<string> keys;
+    ASSERT_EQ(0, store->omap_get_keys(ch, hoid, &keys));
+    ASSERT_EQ(expected, keys);
+  };
+
+  const PerfCounters* logger = store->get_perf_counters();
+  auto ranges = logger->get(l_bluestore_omap_rmkey_ranges_count);
+  auto ranged = logger->get(l_bluestore_omap_rmkeys_ranged_count);
+
+  // key030 stays and splits the removed keys into two runs, key0505 does
+  // not exist and doesn't
+  {
+    set<string> keys;
+    for (unsigned i = 10; i < 60; i++) {
+      if (i != 30) {
+	keys.insert(key(i));
+      }
+    }
+    keys.insert("key0505");
+    rmkeys(keys);
+  }
+  ASSERT_EQ(ranges + 2, logger->get(l_bluestore_omap_rmkey_ranges_count));
+  ASSERT_EQ(ranged + 49, logger->get(l_bluestore_omap_rmkeys_ranged_count));
+  check();
+
+  // runs shorter than the minimum get point deletes
+  rmkeys({ key(0), key(1), key(2), key(4), key(5), key(6), key(8), key(9) });
+  ASSERT_EQ(ranges + 2, logger->get(l_bluestore_omap_rmkey_ranges_count));
+  check();
+
+  // keys set earlier in the same transaction are not visible to the run
+  // search, so it isn't done
+  {
+    ObjectStore::Transaction t;
+    map<string, bufferlist> kvs;
+    kvs["key0705"].append("new");
+    t.omap_setkeys(cid, hoid, kvs);
+    set<string> keys;
+    for (unsigned i = 60; i < 90; i++) {
+      keys.insert(key(i));
+      expected.erase(key(i));
+    }
+    t.omap_rmkeys(cid, hoid, keys);
+    expected.insert("key0705");
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(ranges + 2, logger->get(l_bluestore_omap_rmkey_ranges_count));
+  check();
+
+  // an object read after accumulating tombstones gets its omap compacted
+  SetVal(g_conf(), "bluestore_omap_rmkeys_range_min", "0");
+  SetVal(g_conf(), "bluestore_omap_compact_tombstones", "8");
+  g_conf().apply_changes(nullptr);
+  auto hints = logger->get(l_bluestore_omap_compact_hints);
+  {
+    set<string> keys;
+    for (unsigned i = 90; i < 100; i++) {
+      keys.insert(key(i));
+    }
+    rmkeys(keys);
+  }
+  ASSERT_EQ(hints, logger->get(l_bluestore_omap_compact_hints));
+  {
+    auto it = store->get_omap_iterator(ch, hoid);
+    ASSERT_TRUE(it);
+    set<string> keys;
+    for (it->seek_to_first(); it->valid(); it->next()) {
+      keys.insert(it->key());
+    }
+    ASSERT_EQ(expected, keys);
+  }
+  ASSERT_LT(hints, logger->get(l_bluestore_omap_compact_hints));
+
+  ch.reset();
+  ASSERT_EQ(0, store->umount());
+  ASSERT_EQ(0, store->fsck(false));
+  ASSERT_EQ(0, store->mount());
+  ch = store->open_collection(cid);
+  check();
+}
+
+TEST_P(StoreTestSpecificAUSize, OmapRmkeysRangeSameTxcTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf(), "bluestore_omap_rmkeys_range_min", "8");
+  SetVal(g_conf(), "rocksdb_delete_range_threshold", "0");
+  SetVal(g_conf(), "bluestore_omap_compact_tombstones", "0");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(0x10000);
+
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("omap_obj", CEPH_NOSNAP)));
+  ghobject_t fresh(hobject_t(sobject_t("omap_fresh", CEPH_NOSNAP)));
+  ghobject_t cloned(hobject_t(sobject_t("omap_clone", CEPH_NOSNAP)));
+  auto ch = store->create_new_collection(cid);
+  auto key = [](unsigned i) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "key%03u", i);
+    return string(buf);
+  };
+  map<string, bufferlist> kvs;
+  set<string> all, rm, rest;
+  for (unsigned i = 0; i < 100; i++) {
+    kvs[key(i)].append("value" + stringify(i));
+    all.insert(key(i));
+    (i >= 10 && i < 60 ? rm : rest).insert(key(i));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.touch(cid, hoid);
+    t.omap_setkeys(cid, hoid, kvs);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  auto check = [&](const ghobject_t& oid, const set<string>& expected) {
+    set<string> keys;
+    ASSERT_EQ(0, store->omap_get_keys(ch, oid, &keys));
+    ASSERT_EQ(expected, keys);
+  };
+
+  // none of the keys are committed yet, the run search would find
+  // nothing to remove
+  const PerfCounters* logger = store->get_perf_counters();
+  auto ranges = logger->get(l_bluestore_omap_rmkey_ranges_count);
+  ch->flush();
+  {
+    ObjectStore::Transaction t;
+    t.touch(cid, fresh);
+    t.omap_setkeys(cid, fresh, kvs);
+    t.omap_rmkeys(cid, fresh, rm);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  check(fresh, rest);
+  {
+    ObjectStore::Transaction t;
+    t.clone(cid, hoid, cloned);
+    t.omap_rmkeys(cid, cloned, rm);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  check(cloned, rest);
+  check(hoid, all);
+  ASSERT_EQ(ranges, logger->get(l_bluestore_omap_rmkey_ranges_count));
+
+  ch.reset();
+  ASSERT_EQ(0, store->umount());
+  ASSERT_EQ(0, store->fsck(false));
+  ASSERT_EQ(0, store->mount());
+  ch = store->open_collection(cid);
+  check(fresh, rest);
+  check(cloned, rest);
+  check(hoid, all);
+}
+
+TEST_P(StoreTestSpecificAUSize, OnodePrefetchTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf(), "bluestore_onode_prefetch_count", "16");
+  SetVal(g_conf(), "bluestore_onode_prefetch_trigger", "4");
+  // small shards so that every object has a sharded extent map
+  SetVal(g_conf(), "bluestore_extent_map_shard_max_size", "300");
+  SetVal(g_conf(), "bluestore_extent_map_shard_target_size", "150");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(0x1000);
+
+  const int64_t poolid = 78;
+  const unsigned n = 64;
+  coll_t cid(spg_t(pg_t(0, poolid), shard_id_t::NO_SHARD));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  for (unsigned i = 0; i < n; i++) {
+    ghobject_t hoid(hobject_t(sobject_t("prefetch_" + stringify(i), CEPH_NOSNAP)),
+		    ghobject_t::NO_GEN, shard_id_t::NO_SHARD);
+    hoid.hobj.pool = poolid;
+    ObjectStore::Transaction t;
+    for (unsigned j = 0; j < 16; j++) {
+      bufferlist bl;
+      bl.append(std::string(0x1000, 'a' + j));
+      t.write(cid, hoid, j * 0x2000, bl.length(), bl);
+    }
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  vector<ghobject_t> ls;
+  ASSERT_EQ(0, collection_list(store, ch, ghobject_t(), ghobject_t::get_max(),
+			       INT_MAX, &ls, nullptr, true));
+  ASSERT_EQ(n, ls.size());
+
+  auto remount = [&]() {
+    ch.reset();
+    ASSERT_EQ(0, store->umount());
+    ASSERT_EQ(0, store->mount());
+    ch = store->open_collection(cid);
+  };
+  auto walk = [&](auto begin, auto end) {
+    for (auto p = begin; p != end; ++p) {
+      struct stat st;
+      ASSERT_EQ(0, store->stat(ch, *p, &st));
+      bufferlist bl;
+      ASSERT_EQ(0x1000, store->read(ch, *p, 0, 0x1000, bl));
+      ASSERT_EQ('a', bl[0]);
+    }
+  };
+  const PerfCounters* logger = store->get_perf_counters();
+
+  // lookups against key order never start a prefetch
+  remount();
+  auto runs = logger->get(l_bluestore_onode_prefetch_runs);
+  walk(ls.rbegin(), ls.rend());
+  ASSERT_EQ(runs, logger->get(l_bluestore_onode_prefetch_runs));
+
+  // a walk in key order misses a few times, then keeps running into the
+  // onodes and first shards prefetched ahead of it
+  remount();
+  runs = logger->get(l_bluestore_onode_prefetch_runs);
+  auto prefetched = logger->get(l_bluestore_onode_prefetched);
+  auto shards = logger->get(l_bluestore_onode_prefetch_shards);
+  auto hits = logger->get(l_bluestore_onode_prefetch_hits);
+  auto misses = logger->get(l_bluestore_onode_misses);
+  auto shard_misses = logger->get(l_bluestore_onode_shard_misses);
+  walk(ls.begin(), ls.end());
+  ASSERT_LT(runs + 1, logger->get(l_bluestore_onode_prefetch_runs));
+  ASSERT_LT(prefetched, logger->get(l_bluestore_onode_prefetched));
+  ASSERT_LT(shards, logger->get(l_bluestore_onode_prefetch_shards));
+  ASSERT_LE(hits + n * 3 / 4, logger->get(l_bluestore_onode_prefetch_hits));
+  ASSERT_GT(misses + n / 4, logger->get(l_bluestore_onode_misses));
+  ASSERT_GT(shard_misses + n / 4, logger->get(l_bluestore_onode_shard_misses));
+
+  // the prefetched state is consumed by the first lookup
+  hits = logger->get(l_bluestore_onode_prefetch_hits);
+  walk(ls.begin(), ls.end());
+  ASSERT_EQ(hits, logger->get(l_bluestore_onode_prefetch_hits));
+
+  // a prefetch racing with removals must not bring removed objects back
+  remount();
+  for (unsigned i = n / 2; i < n; i += 2) {
+    ObjectStore::Transaction t;
+    t.remove(cid, ls[i]);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  for (unsigned i = 0; i < n; i++) {
+    struct stat st;
+    bool removed = i >= n / 2 && (i - n / 2) % 2 == 0;
+    ASSERT_EQ(removed ? -ENOENT : 0, store->stat(ch, ls[i], &st));
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, DeferredElevatorTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  const unsigned ncolls = 4, nwrites = 4;
+  SetVal(g_conf(), "bluestore_prefer_deferred_size", "65536");
+  SetVal(g_conf(), "bluestore_deferred_batch_ops",
+	 stringify(ncolls * nwrites).c_str());
+  SetVal(g_conf(), "bluestore_deferred_elevator", "true");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(0x1000);
+
+  // every collection has its own sequencer, and so its own deferred batch
+  vector<coll_t> cids;
+  vector<ObjectStore::CollectionHandle> chs;
+  for (unsigned c = 0; c < ncolls; c++) {
+    cids.emplace_back(spg_t(pg_t(c, 79), shard_id_t::NO_SHARD));
+    chs.push_back(store->create_new_collection(cids.back()));
+    ObjectStore::Transaction t;
+    t.create_collection(cids.back(), 0);
+    int r = queue_transaction(store, chs.back(), std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  auto oid = [](unsigned c, unsigned i) {
+    ghobject_t hoid(hobject_t(sobject_t("deferred_" + stringify(i), CEPH_NOSNAP),
+			      "", c, 79, ""));
+    return hoid;
+  };
+  auto write = [&](char fill) {
+    for (unsigned i = 0; i < nwrites; i++) {
+      for (unsigned c = 0; c < ncolls; c++) {
+	bufferlist bl;
+	bl.append(std::string(0x4000, fill + c));
+	ObjectStore::Transaction t;
+	t.write(cids[c], oid(c, i), 0, bl.length(), bl);
+	int r = queue_transaction(store, chs[c], std::move(t));
+	ASSERT_EQ(r, 0);
+      }
+    }
+  };
+  auto check = [&](char fill) {
+    for (unsigned c = 0; c < ncolls; c++) {
+      for (unsigned i = 0; i < nwrites; i++) {
+	bufferlist bl, expected;
+	expected.append(std::string(0x4000, fill + c));
+	ASSERT_EQ(0x4000, store->read(chs[c], oid(c, i), 0, 0x4000, bl));
+	ASSERT_TRUE(bl_eq(expected, bl));
+      }
+    }
+  };
+  auto remount = [&]() {
+    chs.clear();
+    ASSERT_EQ(0, store->umount());
+    ASSERT_EQ(0, store->fsck(false));
+    ASSERT_EQ(0, store->mount());
+    for (auto& cid : cids) {
+      chs.push_back(store->open_collection(cid));
+    }
+  };
+  const PerfCounters* logger = store->get_perf_counters();
+  auto wait_for_ios = [&](uint64_t ios) {
+    // submitted once the queue fills up, or when the oldest write has
+    // waited for bluestore_max_defer_interval
+    for (unsigned n = 0; n < 100; n++) {
+      if (logger->get(l_bluestore_deferred_elevator_ios) >= ios) {
+	break;
+      }
+      usleep(100000);
+    }
+    ASSERT_LE(ios, logger->get(l_bluestore_deferred_elevator_ios));
+  };
+
+  // the initial writes allocate, the overwrites go deferred
+  write('a');
+  remount();
+  auto ios = logger->get(l_bluestore_deferred_elevator_ios);
+  auto writes = logger->get(l_bluestore_deferred_elevator_writes);
+  auto batches = logger->get(l_bluestore_deferred_elevator_batches);
+  write('A');
+  wait_for_ios(ios + ncolls * nwrites);
+  ASSERT_LT(batches + 1, logger->get(l_bluestore_deferred_elevator_batches));
+  ASSERT_LE(logger->get(l_bluestore_deferred_elevator_writes) - writes,
+	    logger->get(l_bluestore_deferred_elevator_ios) - ios);
+  check('A');
+  remount();
+  check('A');
+
+  // with the elevator off every batch is submitted on its own
+  SetVal(g_conf(), "bluestore_deferred_elevator", "false");
+  g_conf().apply_changes(nullptr);
+  ios = logger->get(l_bluestore_deferred_elevator_ios);
+  write('k');
+  remount();
+  ASSERT_EQ(ios, logger->get(l_bluestore_deferred_elevator_ios));
+  check('k');
+}
+
+TEST_P(StoreTestSpecificAUSize, TieredPlacementTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  const uint64_t fast_size = 256 << 20;
+  const uint64_t obj_size = 4 << 20;
+  const unsigned nobjs = 32;
+  SetVal(g_conf(), "bluestore_fast_tier_size", stringify(fast_size).c_str());
+  SetVal(g_conf(), "bluestore_tier_interval", "1");
+  SetVal(g_conf(), "bluestore_tier_promote_heat", "4");
+  SetVal(g_conf(), "bluestore_tier_fast_free_ratio", "0");
+  SetVal(g_conf(), "bluestore_tier_sleep", "0");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(0x10000);
+
+  auto fast_free = []() {
+    AdminSocket* admin_socket = g_ceph_context->get_admin_socket();
+    bufferlist in, out;
+    ostringstream err;
+    int r = admin_socket->execute_command(
+      { "{\"prefix\": \"bluestore tier status\"}" },
+      in, err, &out);
+    ceph_assert(r == 0);
+    JSONParser p;
+    ceph_assert(p.parse(out.c_str(), out.length()));
+    JSONObj* o = p.find_obj("tier");
+    ceph_assert(o);
+    bool enabled = false;
+    uint64_t free = 0;
+    JSONDecoder::decode_json("enabled", enabled, o);
+    JSONDecoder::decode_json("fast_free", free, o);
+    ceph_assert(enabled);
+    return free;
+  };
+
+  coll_t cid;
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  auto oid = [](unsigned i) {
+    return ghobject_t(hobject_t(sobject_t("tiered_" + stringify(i),
+					  CEPH_NOSNAP)));
+  };
+  auto data = [&](unsigned i) {
+    bufferlist bl;
+    bl.append(std::string(obj_size, 'a' + i % 26));
+    return bl;
+  };
+  auto check = [&]() {
+    for (unsigned i = 0; i < nobjs; i++) {
+      bufferlist bl;
+      ASSERT_EQ((int)obj_size, store->read(ch, oid(i), 0, obj_size, bl,
+					   CEPH_OSD_OP_FLAG_FADVISE_NOCACHE));
+      bufferlist expected = data(i);
+      ASSERT_TRUE(bl_eq(expected, bl));
+    }
+  };
+
+  // new data goes to the fast tier
+  auto free = fast_free();
+  for (unsigned i = 0; i < nobjs; i++) {
+    ObjectStore::Transaction t;
+    bufferlist bl = data(i);
+    t.write(cid, oid(i), 0, bl.length(), bl);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_GE(free, fast_free() + nobjs * obj_size * 3 / 4);
+
+  // cold objects leave it once it runs short of space
+  const PerfCounters* logger = store->get_perf_counters();
+  auto demoted = logger->get(l_bluestore_tier_demoted_bytes);
+  free = fast_free();
+  SetVal(g_conf(), "bluestore_tier_fast_free_ratio", "0.5");
+  g_conf().apply_changes(nullptr);
+  for (unsigned n = 0; n < 200 &&
+	 logger->get(l_bluestore_tier_demoted_bytes) <
+	 demoted + nobjs * obj_size / 2; n++) {
+    usleep(100000);
+  }
+  SetVal(g_conf(), "bluestore_tier_fast_free_ratio", "0");
+  g_conf().apply_changes(nullptr);
+  ASSERT_LE(demoted + nobjs * obj_size / 2,
+	    logger->get(l_bluestore_tier_demoted_bytes));
+  ASSERT_LT(free, fast_free());
+  check();
+
+  // and come back when they get hot
+  auto promoted = logger->get(l_bluestore_tier_promoted_bytes);
+  for (unsigned n = 0; n < 200 &&
+	 logger->get(l_bluestore_tier_promoted_bytes) < promoted + obj_size;
+       n++) {
+    bufferlist bl;
+    ASSERT_EQ((int)obj_size, store->read(ch, oid(0), 0, obj_size, bl));
+    usleep(10000);
+  }
+  ASSERT_LE(promoted + obj_size, logger->get(l_bluestore_tier_promoted_bytes));
+  check();
+
+  ch.reset();
+  ASSERT_EQ(0, store->umount());
+  ASSERT_EQ(0, store->fsck(false));
+  ASSERT_EQ(0, store->mount());
+  ch = store->open_collection(cid);
+  check();
+}
+
+TEST_P(StoreTestSpecificAUSize, AllocationJournalTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  const uint64_t obj_size = 0x40000;
+  const unsigned nobjs = 64;
+  SetVal(g_conf(), "bluestore_allocation_journal", "true");
+  SetVal(g_conf(), "bluestore_allocation_checkpoint_interval", "0");
+  SetVal(g_conf(), "bluestore_debug_inject_allocation_from_file_failure", "0");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(0x10000);
+  BlueStore* bstore = dynamic_cast<BlueStore*>(store.get());
+  ceph_assert(bstore);
+  if (!bstore->has_null_manager()) {
+    return;
+  }
+
+  // free space of the main device, whoever uses it: bluefs usage varies
+  // from mount to mount
+  auto data_free = [&]() {
+    store_statfs_t st;
+    EXPECT_EQ(0, store->statfs(&st));
+    return st.available + st.internal_metadata + st.omap_allocated;
+  };
+  const PerfCounters* logger = store->get_perf_counters();
+  // remount the way an unclean shutdown would, without the allocation file
+  auto remount = [&](bool journal) {
+    SetVal(g_conf(), "bluestore_debug_inject_allocation_from_file_failure", "1");
+    SetVal(g_conf(), "bluestore_allocation_journal", journal ? "true" : "false");
+    g_conf().apply_changes(nullptr);
+    EXPECT_EQ(0, store->umount());
+    EXPECT_EQ(0, store->mount());
+    SetVal(g_conf(), "bluestore_debug_inject_allocation_from_file_failure", "0");
+    SetVal(g_conf(), "bluestore_allocation_journal", "true");
+    g_conf().apply_changes(nullptr);
+  };
+
+  coll_t cid(spg_t(pg_t(0, 80), shard_id_t::NO_SHARD));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  auto oid = [](unsigned i) {
+    return ghobject_t(hobject_t(sobject_t("journal_" + stringify(i),
+					  CEPH_NOSNAP)));
+  };
+  // writes allocate, overwrites and removes release
+  auto churn = [&](unsigned round) {
+    for (unsigned i = 0; i < nobjs; i++) {
+      ObjectStore::Transaction t;
+      bufferlist bl;
+      bl.append(std::string(obj_size, 'a' + (i + round) % 26));
+      if (i % 4 == round % 4) {
+	t.remove(cid, oid(i));
+      } else {
+	t.write(cid, oid(i), 0, bl.length(), bl);
+      }
+      int r = queue_transaction(store, ch, std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+  };
+
+  auto records = logger->get(l_bluestore_alloc_journal_records);
+  churn(0);
+  churn(1);
+  ASSERT_LE(records + nobjs, logger->get(l_bluestore_alloc_journal_records));
+  auto free = data_free();
+
+  // everything since mount comes back from the journal
+  auto replayed = logger->get(l_bluestore_alloc_journal_replayed);
+  ch.reset();
+  remount(true);
+  ch = store->open_collection(cid);
+  ASSERT_LE(replayed + nobjs, logger->get(l_bluestore_alloc_journal_replayed));
+  ASSERT_EQ(free, data_free());
+
+  // checkpoints fold the journal
+  churn(2);
+  auto checkpoints = logger->get(l_bluestore_alloc_checkpoints);
+  SetVal(g_conf(), "bluestore_allocation_checkpoint_interval", "1");
+  g_conf().apply_changes(nullptr);
+  for (unsigned n = 0; n < 100 &&
+	 logger->get(l_bluestore_alloc_checkpoints) == checkpoints; n++) {
+    usleep(100000);
+  }
+  SetVal(g_conf(), "bluestore_allocation_checkpoint_interval", "0");
+  g_conf().apply_changes(nullptr);
+  ASSERT_LT(checkpoints, logger->get(l_bluestore_alloc_checkpoints));
+  churn(3);
+  free = data_free();
+  replayed = logger->get(l_bluestore_alloc_journal_replayed);
+  ch.reset();
+  remount(true);
+  ch = store->open_collection(cid);
+  ASSERT_LE(replayed + nobjs / 2, logger->get(l_bluestore_alloc_journal_replayed));
+  ASSERT_GE(replayed + nobjs * 2, logger->get(l_bluestore_alloc_journal_replayed));
+  ASSERT_EQ(free, data_free());
+
+  // and agree with what the onodes say
+  replayed = logger->get(l_bluestore_alloc_journal_replayed);
+  ch.reset();
+  remount(false);
+  ASSERT_EQ(replayed, logger->get(l_bluestore_alloc_journal_replayed));
+  ASSERT_EQ(free, data_free());
+  ASSERT_EQ(0, store->umount());
+  ASSERT_EQ(0, store->fsck(false));
+  ASSERT_EQ(0, store->mount());
+}
+#endif
+
 TEST_P(StoreTestSpecificAUSize, Many4KWritesTest) {
   if (string(GetParam()) != "bluestore")
     return;
@@ -9778,6 +11000,71 @@ TEST_P(StoreTestSpecificAUSize, BluestoreRepairTest) {
   cerr << "Completing" << std::endl;
 }
 
+TEST_P(StoreTestSpecificAUSize, BluestoreDeepFsckParallelTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf(), "bluestore_fsck_on_mount", "false");
+  SetVal(g_conf(), "bluestore_fsck_on_umount", "false");
+  StartDeferred(0x10000);
+
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+
+  const uint64_t pool = 555;
+  const unsigned num_objects = 64;
+  coll_t cid(spg_t(pg_t(0, pool), shard_id_t::NO_SHARD));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  for (unsigned i = 0; i < num_objects; ++i) {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(0x10000 * (1 + i % 4), 'a' + i % 26));
+    t.write(cid, make_object(stringify(i).c_str(), pool),
+	    0, bl.length(), bl);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  bstore->umount();
+  for (auto threads : {"0", "4"}) {
+    SetVal(g_conf(), "bluestore_fsck_deep_read_threads", threads);
+    g_conf().apply_changes(nullptr);
+    ASSERT_EQ(bstore->fsck(true), 0);
+  }
+  // the command is registered while mounted and reports the last fsck
+  ASSERT_EQ(bstore->mount(), 0);
+  {
+    AdminSocket* admin_socket = g_ceph_context->get_admin_socket();
+    ASSERT_TRUE(admin_socket);
+    bufferlist in, out;
+    ostringstream err;
+    int r = admin_socket->execute_command(
+      { "{\"prefix\": \"bluestore fsck status\"}" },
+      in, err, &out);
+    ASSERT_EQ(0, r);
+    JSONParser p;
+    ASSERT_TRUE(p.parse(out.c_str(), out.length()));
+    JSONObj* o = p.find_obj("fsck");
+    ASSERT_TRUE(o);
+    bool running = true;
+    std::string mode;
+    uint64_t objects = 0, bytes = 0, read_bytes = 0;
+    JSONDecoder::decode_json("running", running, o);
+    JSONDecoder::decode_json("mode", mode, o);
+    JSONDecoder::decode_json("objects", objects, o);
+    JSONDecoder::decode_json("bytes", bytes, o);
+    JSONDecoder::decode_json("read_bytes", read_bytes, o);
+    ASSERT_FALSE(running);
+    ASSERT_EQ("check (deep)", mode);
+    ASSERT_EQ(num_objects, objects);
+    ASSERT_LE(bytes, read_bytes);
+  }
+}
+
 TEST_P(StoreTestSpecificAUSize, BluestoreBrokenZombieRepairTest) {
   if (string(GetParam()) != "bluestore")
     return;
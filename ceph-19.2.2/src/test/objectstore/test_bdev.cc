@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <iostream>
+#include <thread>
 #include <gtest/gtest.h>
 #include "global/global_init.h"
 #include "global/global_context.h"
@@ -11,8 +12,10 @@
 #include "common/ceph_argparse.h"
 #include "include/stringify.h"
 #include "common/errno.h"
+#include "common/ceph_time.h"
 
 #include "blk/BlockDevice.h"
+#include "blk/kernel/io_uring.h"
 
 using namespace std;
 
@@ -91,6 +94,148 @@ TEST(KernelDevice, Ticket45337) {
   b->close();
 }
 
+// Random aio reads at a fixed queue depth; returns IOPS, or 0 if the
+// device can't be opened (e.g. no O_DIRECT on the temp dir).
+static double bench_aio_read(const string& path, uint64_t data_size,
+			     unsigned io_size, unsigned qd, unsigned ios)
+{
+  std::unique_ptr<BlockDevice> b(
+    BlockDevice::create(g_ceph_context, path, NULL, NULL,
+      [](void* handle, void* aio) {}, NULL));
+  if (b->open(path) < 0) {
+    std::cerr << "open " << path << " failed" << std::endl;
+    return 0;
+  }
+  {
+    bufferlist bl;
+    for (uint64_t off = 0; off < data_size; off += io_size) {
+      bl.append(string(io_size, 'a' + (off / io_size) % 26));
+    }
+    int r = b->write(0, bl, false);
+    ceph_assert(r == 0);
+  }
+
+  const uint64_t blocks = data_size / io_size;
+  unsigned done = 0;
+  auto start = ceph::mono_clock::now();
+  while (done < ios) {
+    IOContext ioc(g_ceph_context, NULL);
+    std::vector<bufferlist> bls(std::min(qd, ios - done));
+    std::vector<uint64_t> blks(bls.size());
+    for (size_t i = 0; i < bls.size(); ++i) {
+      blks[i] = rand() % blocks;
+      int r = b->aio_read(blks[i] * io_size, io_size, &bls[i], &ioc);
+      ceph_assert(r == 0);
+    }
+    b->aio_submit(&ioc);
+    ioc.aio_wait();
+    ceph_assert(ioc.get_return_value() >= 0);
+    for (size_t i = 0; i < bls.size(); ++i) {
+      ceph_assert(bls[i].length() == io_size);
+      ceph_assert(bls[i][0] == 'a' + blks[i] % 26);
+    }
+    done += bls.size();
+  }
+  double secs = ceph::to_seconds<double>(ceph::mono_clock::now() - start);
+  b->close();
+  return ios / secs;
+}
+
+TEST(KernelDevice, DISABLED_AioReadBench) {
+  // compare libaio with io_uring, with and without registered buffers
+  const uint64_t data_size = 64ull << 20;
+  TempBdev bdev{ 128ull << 20 };
+  const unsigned io_size = 4096, qd = 32, ios = 10000;
+
+  struct {
+    const char *name;
+    bool ioring;
+    const char *fixed_buffers;
+  } modes[] = {
+    { "libaio", false, "0" },
+    { "io_uring", true, "0" },
+    { "io_uring+fixed", true, "256" },
+  };
+  for (auto& m : modes) {
+    if (m.ioring && !ioring_queue_t::supported()) {
+      std::cout << m.name << ": not supported, skipping" << std::endl;
+      continue;
+    }
+    g_ceph_context->_conf.set_val_or_die("bdev_ioring",
+					  m.ioring ? "true" : "false");
+    g_ceph_context->_conf.set_val_or_die("bdev_ioring_fixed_buffers",
+					  m.fixed_buffers);
+    g_ceph_context->_conf.apply_changes(nullptr);
+    double iops = bench_aio_read(bdev.path, data_size, io_size, qd, ios);
+    std::cout << m.name << ": " << io_size << " byte random reads, qd " << qd
+	      << ": " << (uint64_t)iops << " iops" << std::endl;
+  }
+  g_ceph_context->_conf.set_val_or_die("bdev_ioring", "false");
+  g_ceph_context->_conf.set_val_or_die("bdev_ioring_fixed_buffers", "0");
+  g_ceph_context->_conf.apply_changes(nullptr);
+}
+
+TEST(KernelDevice, MultipleAioQueues) {
+  // several threads, hinted and unhinted, write and read back their own
+  // regions through 4 queues; reopen a few times to restart the reapers
+  const unsigned num_queues = 4, num_threads = 8, ios = 64;
+  const unsigned io_size = 4096;
+  TempBdev bdev{ 64ull << 20 };
+  g_ceph_context->_conf.set_val_or_die("bdev_aio_queues",
+					stringify(num_queues));
+  g_ceph_context->_conf.apply_changes(nullptr);
+
+  for (unsigned round = 0; round < 3; ++round) {
+    std::unique_ptr<BlockDevice> b(
+      BlockDevice::create(g_ceph_context, bdev.path, NULL, NULL,
+	[](void* handle, void* aio) {}, NULL));
+    int r = b->open(bdev.path);
+    if (r < 0) {
+      std::cerr << "open " << bdev.path << " failed" << std::endl;
+      break;
+    }
+    std::atomic<unsigned> errors = {0};
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t] {
+	const uint64_t base = (uint64_t)t * ios * io_size;
+	const char fill = 'a' + (round * num_threads + t) % 26;
+	for (unsigned i = 0; i < ios; ++i) {
+	  IOContext ioc(g_ceph_context, NULL);
+	  // odd threads leave the hint unset
+	  ioc.queue_hint = t % 2 ? -1 : (int64_t)(t + i);
+	  bufferlist bl;
+	  bl.append(string(io_size, fill + i % 2));
+	  uint64_t off = base + i * io_size;
+	  if (b->aio_write(off, bl, &ioc, false) < 0) {
+	    ++errors;
+	    continue;
+	  }
+	  b->aio_submit(&ioc);
+	  ioc.aio_wait();
+	  bufferlist rbl;
+	  if (b->aio_read(off, io_size, &rbl, &ioc) < 0) {
+	    ++errors;
+	    continue;
+	  }
+	  b->aio_submit(&ioc);
+	  ioc.aio_wait();
+	  if (ioc.get_return_value() < 0 || !rbl.contents_equal(bl)) {
+	    ++errors;
+	  }
+	}
+      });
+    }
+    for (auto& th : threads) {
+      th.join();
+    }
+    ASSERT_EQ(0u, errors.load());
+    b->close();
+  }
+  g_ceph_context->_conf.set_val_or_die("bdev_aio_queues", "1");
+  g_ceph_context->_conf.apply_changes(nullptr);
+}
+
 int main(int argc, char **argv) {
   auto args = argv_to_vec(argc, argv);
   map<string,string> defaults = {
@@ -101,6 +246,8 @@ int main(int argc, char **argv) {
 			 CODE_ENVIRONMENT_UTILITY,
 			 CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
   common_init_finish(g_ceph_context);
+  // make sure we can adjust any config settings
+  g_ceph_context->_conf._clear_safe_to_start_threads();
   g_ceph_context->_conf.set_val(
     "enable_experimental_unrecoverable_data_corrupting_features",
     "*");
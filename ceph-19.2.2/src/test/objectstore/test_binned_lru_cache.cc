@@ -0,0 +1,254 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "common/ceph_context.h"
+#include "global/global_context.h"
+#include "kv/rocksdb_cache/BinnedLRUCache.h"
+
+using namespace std;
+using rocksdb_cache::BinnedLRUCache;
+
+static std::atomic<uint64_t> deleted = {0};
+
+static void delete_value(const rocksdb::Slice& key, void* value)
+{
+  delete static_cast<uint64_t*>(value);
+  ++deleted;
+}
+
+static string key_of(uint64_t i)
+{
+  return "key" + std::to_string(i);
+}
+
+static std::shared_ptr<BinnedLRUCache> make_cache(size_t capacity,
+						  int shard_bits = 0)
+{
+  return std::static_pointer_cast<BinnedLRUCache>(
+    rocksdb_cache::NewBinnedLRUCache(g_ceph_context, capacity, shard_bits));
+}
+
+static void insert(BinnedLRUCache* cache, uint64_t i, size_t charge = 1,
+		   rocksdb::Cache::Handle** handle = nullptr)
+{
+  ASSERT_TRUE(cache->Insert(key_of(i), new uint64_t(i), charge, delete_value,
+			    handle, rocksdb::Cache::Priority::LOW).ok());
+}
+
+static bool hit(BinnedLRUCache* cache, uint64_t i)
+{
+  auto h = cache->Lookup(key_of(i), nullptr);
+  if (!h) {
+    return false;
+  }
+  EXPECT_EQ(i, *static_cast<uint64_t*>(cache->Value(h)));
+  cache->Release(h);
+  return true;
+}
+
+TEST(BinnedLRUCache, refs_and_usage)
+{
+  auto cache = make_cache(100);
+  uint64_t d = deleted;
+  insert(cache.get(), 1, 10);
+  ASSERT_EQ(10u, cache->GetUsage());
+  ASSERT_EQ(0u, cache->GetPinnedUsage());
+
+  auto h = cache->Lookup(key_of(1), nullptr);
+  ASSERT_TRUE(h);
+  ASSERT_EQ(10u, cache->GetPinnedUsage());
+  auto h2 = cache->Lookup(key_of(1), nullptr);
+  ASSERT_TRUE(cache->Ref(h2));
+  ASSERT_EQ(10u, cache->GetPinnedUsage());
+  ASSERT_FALSE(cache->Release(h2));
+  ASSERT_FALSE(cache->Release(h2));
+  ASSERT_EQ(10u, cache->GetPinnedUsage());
+
+  // erased while referenced: gone from the table, alive until released
+  cache->Erase(key_of(1));
+  ASSERT_FALSE(cache->Lookup(key_of(1), nullptr));
+  ASSERT_EQ(10u, cache->GetUsage());
+  ASSERT_EQ(d, deleted);
+  ASSERT_TRUE(cache->Release(h));
+  ASSERT_EQ(0u, cache->GetUsage());
+  ASSERT_EQ(0u, cache->GetPinnedUsage());
+  ASSERT_EQ(d + 1, deleted);
+
+  // replaced while referenced
+  insert(cache.get(), 2, 10);
+  h = cache->Lookup(key_of(2), nullptr);
+  insert(cache.get(), 2, 20);
+  ASSERT_EQ(30u, cache->GetUsage());
+  ASSERT_TRUE(cache->Release(h));
+  ASSERT_EQ(20u, cache->GetUsage());
+  ASSERT_EQ(0u, cache->GetPinnedUsage());
+  ASSERT_EQ(1u, cache->TEST_GetLRUSize());
+
+  // force_erase drops the last cache reference too
+  h = cache->Lookup(key_of(2), nullptr);
+  ASSERT_TRUE(cache->Release(h, true));
+  ASSERT_EQ(0u, cache->GetUsage());
+  ASSERT_EQ(0u, cache->TEST_GetLRUSize());
+}
+
+TEST(BinnedLRUCache, strict_lru)
+{
+  auto cache = make_cache(10);
+  for (uint64_t i = 0; i < 10; i++) {
+    insert(cache.get(), i);
+  }
+  // 0 was hit and 1 is referenced, 2 is the first one to go
+  ASSERT_TRUE(hit(cache.get(), 0));
+  auto h = cache->Lookup(key_of(1), nullptr);
+  ASSERT_EQ(9u, cache->TEST_GetLRUSize());
+  insert(cache.get(), 10);
+  ASSERT_TRUE(hit(cache.get(), 0));
+  ASSERT_FALSE(hit(cache.get(), 2));
+  ASSERT_TRUE(hit(cache.get(), 3));
+  ASSERT_EQ(10u, cache->GetUsage());
+
+  // referenced entries are off the LRU and never evicted
+  for (uint64_t i = 11; i < 40; i++) {
+    insert(cache.get(), i);
+  }
+  ASSERT_EQ(10u, cache->GetUsage());
+  ASSERT_EQ(1u, cache->GetPinnedUsage());
+  cache->Release(h);
+  ASSERT_TRUE(hit(cache.get(), 1));
+  ASSERT_EQ(0u, cache->GetPinnedUsage());
+
+  // with everything referenced inserts are turned away
+  vector<rocksdb::Cache::Handle*> handles;
+  for (uint64_t i = 0; i < 40; i++) {
+    if (auto p = cache->Lookup(key_of(i), nullptr); p) {
+      handles.push_back(p);
+    }
+  }
+  ASSERT_EQ(10u, cache->GetPinnedUsage());
+  ASSERT_EQ(0u, cache->TEST_GetLRUSize());
+  insert(cache.get(), 100);
+  ASSERT_FALSE(hit(cache.get(), 100));
+  for (auto p : handles) {
+    cache->Release(p);
+  }
+  ASSERT_EQ(0u, cache->GetPinnedUsage());
+}
+
+TEST(BinnedLRUCache, age_bins)
+{
+  auto cache = make_cache(10);
+  cache->set_bin_count(4);
+  for (uint64_t i = 0; i < 5; i++) {
+    insert(cache.get(), i);
+  }
+  cache->shift_bins();
+  for (uint64_t i = 5; i < 10; i++) {
+    insert(cache.get(), i);
+  }
+  ASSERT_EQ(5u, cache->sum_bins(0, 1));
+  ASSERT_EQ(10u, cache->sum_bins(0, 2));
+
+  // a hit moves the entry into the youngest bin
+  cache->shift_bins();
+  ASSERT_TRUE(hit(cache.get(), 0));
+  ASSERT_EQ(1u, cache->sum_bins(0, 1));
+  insert(cache.get(), 10);
+  ASSERT_FALSE(hit(cache.get(), 1));
+  ASSERT_EQ(2u, cache->sum_bins(0, 1));
+  ASSERT_EQ(5u, cache->sum_bins(1, 2));
+  ASSERT_EQ(3u, cache->sum_bins(2, 3));
+}
+
+TEST(BinnedLRUCache, concurrent)
+{
+  const uint64_t nkeys = 2000;
+  uint64_t d = deleted;
+  uint64_t inserted = 0;
+  {
+    auto cache = make_cache(nkeys / 2, 2);
+    std::atomic<bool> stop = {false};
+    std::atomic<uint64_t> hits = {0};
+    vector<std::thread> readers;
+    for (int t = 0; t < 8; t++) {
+      readers.emplace_back([&, t] {
+	std::mt19937_64 rng(t);
+	while (!stop) {
+	  uint64_t i = rng() % nkeys;
+	  auto h = cache->Lookup(key_of(i), nullptr);
+	  if (h) {
+	    ASSERT_EQ(i, *static_cast<uint64_t*>(cache->Value(h)));
+	    ++hits;
+	    if (rng() % 16 == 0) {
+	      cache->Erase(key_of(i));
+	    }
+	    cache->Release(h);
+	  }
+	}
+      });
+    }
+    std::mt19937_64 rng(100);
+    for (int n = 0; n < 100000; n++) {
+      insert(cache.get(), rng() % nkeys);
+      ++inserted;
+    }
+    stop = true;
+    for (auto& t : readers) {
+      t.join();
+    }
+    ASSERT_LT(0u, hits);
+    ASSERT_EQ(0u, cache->GetPinnedUsage());
+    ASSERT_LE(cache->GetUsage(), nkeys / 2);
+  }
+  // everything inserted was freed exactly once
+  ASSERT_EQ(d + inserted, deleted);
+}
+
+TEST(BinnedLRUCache, DISABLED_lookup_bench)
+{
+  const uint64_t nkeys = 100000;
+  // leave room for uneven sharding, every lookup should hit
+  auto cache = make_cache(nkeys * 4096 * 2, 4);
+  for (uint64_t i = 0; i < nkeys; i++) {
+    insert(cache.get(), i, 4096);
+  }
+  for (unsigned threads : {1, 4, 16, 32}) {
+    const uint64_t lookups = 200000;
+    std::atomic<uint64_t> hits = {0};
+    vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; t++) {
+      workers.emplace_back([&, t] {
+	std::mt19937_64 rng(t);
+	// a zipf-ish mix: most lookups go to a small hot set
+	uint64_t n = 0;
+	for (uint64_t j = 0; j < lookups; j++) {
+	  uint64_t i = rng() % (rng() % 8 ? nkeys / 100 : nkeys);
+	  auto h = cache->Lookup(key_of(i), nullptr);
+	  if (h) {
+	    ++n;
+	    cache->Release(h);
+	  }
+	}
+	hits += n;
+      });
+    }
+    for (auto& t : workers) {
+      t.join();
+    }
+    std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    ASSERT_EQ(lookups * threads, hits);
+    std::cout << threads << " threads: "
+	      << (uint64_t)(lookups * threads / elapsed.count())
+	      << " lookups/s" << std::endl;
+  }
+}
@@ -423,6 +423,149 @@ TEST(bluestore_blob_t, csum_bench)
   }
 }
 
+TEST(bluestore_blob_t, verify_csum_batch)
+{
+  bufferlist bl;
+  bufferptr bp(0x10000);
+  for (unsigned i = 0; i < bp.length(); ++i)
+    bp.c_str()[i] = (i * 7) & 0xff;
+  bl.append(bp);
+
+  for (unsigned csum_type = Checksummer::CSUM_NONE + 1;
+       csum_type < Checksummer::CSUM_MAX;
+       ++csum_type) {
+    cout << "csum_type " << Checksummer::get_csum_type_string(csum_type)
+	 << std::endl;
+    bluestore_blob_t a, b;
+    a.init_csum(csum_type, 12, bl.length());
+    a.calc_csum(0, bl);
+    b.init_csum(Checksummer::CSUM_CRC32C, 13, bl.length());
+    b.calc_csum(0, bl);
+
+    // fragmented copy, with blocks straddling buffer boundaries
+    bufferlist frag;
+    for (unsigned off = 0; off < bl.length(); off += 0x1100) {
+      bufferlist t;
+      t.substr_of(bl, off, std::min(0x1100u, bl.length() - off));
+      t.rebuild();
+      frag.claim_append(t);
+    }
+    bufferlist tail;
+    tail.substr_of(bl, 0x8000, 0x8000);
+
+    std::vector<Checksummer::verify_item_t> items = {
+      a.get_csum_verify_item(0, bl),
+      b.get_csum_verify_item(0, frag),
+      a.get_csum_verify_item(0x8000, tail),
+    };
+    ASSERT_EQ(0, Checksummer::verify_batch(items.data(), items.size()));
+    for (auto& i : items) {
+      ASSERT_EQ(-1, i.bad);
+    }
+
+    // corrupt the second and eleventh 4k blocks of a, and only the sixth
+    // 8k block of b
+    bufferlist bad;
+    bad.append(bl.c_str(), bl.length());
+    bad.c_str()[0x1003] ^= 1;
+    bad.c_str()[0xa001] ^= 1;
+    bufferlist bad_b;
+    bad_b.append(bl.c_str(), bl.length());
+    bad_b.c_str()[0xa001] ^= 1;
+    bufferlist bad_tail;
+    bad_tail.substr_of(bad, 0x8000, 0x8000);
+    items = {
+      a.get_csum_verify_item(0, bad),
+      b.get_csum_verify_item(0, bad_b),
+      a.get_csum_verify_item(0x8000, bad_tail),
+    };
+    ASSERT_EQ(3, Checksummer::verify_batch(items.data(), items.size()));
+    ASSERT_EQ(0x1000, items[0].bad);
+    ASSERT_EQ(0xa000, items[1].bad);
+    ASSERT_EQ(0xa000, items[2].bad);
+
+    // must agree with the single blob version
+    int bad_off;
+    uint64_t bad_csum;
+    ASSERT_EQ(-1, a.verify_csum(0, bad, &bad_off, &bad_csum));
+    ASSERT_EQ(bad_off, items[0].bad);
+    ASSERT_EQ(bad_csum, items[0].bad_csum);
+  }
+}
+
+TEST(bluestore_blob_t, csum_verify_batch_bench)
+{
+  // 64 blobs of 64k with 4k csum blocks, i.e. a 4M read
+  const unsigned blob_size = 0x10000;
+  const unsigned nblobs = 64;
+  bufferptr bp(blob_size * nblobs);
+  for (char *a = bp.c_str(); a < bp.c_str() + bp.length(); ++a)
+    *a = (unsigned long)a & 0xff;
+  std::vector<bufferlist> bls(nblobs);
+  for (unsigned i = 0; i < nblobs; ++i) {
+    bls[i].append(bufferptr(bp, i * blob_size, blob_size));
+  }
+  int count = 64;
+  for (unsigned csum_type = Checksummer::CSUM_NONE + 1;
+       csum_type < Checksummer::CSUM_MAX;
+       ++csum_type) {
+    std::vector<bluestore_blob_t> blobs(nblobs);
+    for (unsigned i = 0; i < nblobs; ++i) {
+      blobs[i].init_csum(csum_type, 12, blob_size);
+      blobs[i].calc_csum(0, bls[i]);
+    }
+    auto rate = [&](ceph::mono_clock::time_point start) {
+      auto dur = std::chrono::duration_cast<ceph::timespan>(
+	ceph::mono_clock::now() - start);
+      return (double)count * bp.length() / 1000000.0 /
+	(double)dur.count() * 1000000000.0;
+    };
+
+    // one verify_csum() per 4k block
+    auto start = ceph::mono_clock::now();
+    for (int c = 0; c < count; ++c) {
+      for (unsigned i = 0; i < nblobs; ++i) {
+	for (unsigned off = 0; off < blob_size; off += 0x1000) {
+	  bufferlist t;
+	  t.substr_of(bls[i], off, 0x1000);
+	  int bad_off;
+	  uint64_t bad_csum;
+	  ASSERT_EQ(0, blobs[i].verify_csum(off, t, &bad_off, &bad_csum));
+	}
+      }
+    }
+    double per_block = rate(start);
+
+    // one verify_csum() per blob
+    start = ceph::mono_clock::now();
+    for (int c = 0; c < count; ++c) {
+      for (unsigned i = 0; i < nblobs; ++i) {
+	int bad_off;
+	uint64_t bad_csum;
+	ASSERT_EQ(0, blobs[i].verify_csum(0, bls[i], &bad_off, &bad_csum));
+      }
+    }
+    double per_blob = rate(start);
+
+    // everything in one batch
+    start = ceph::mono_clock::now();
+    std::vector<Checksummer::verify_item_t> items;
+    for (int c = 0; c < count; ++c) {
+      items.clear();
+      for (unsigned i = 0; i < nblobs; ++i) {
+	items.push_back(blobs[i].get_csum_verify_item(0, bls[i]));
+      }
+      ASSERT_EQ(0, Checksummer::verify_batch(items.data(), items.size()));
+    }
+    double batched = rate(start);
+
+    cout << "csum_type " << Checksummer::get_csum_type_string(csum_type)
+	 << ": per block " << per_block << " MB/sec"
+	 << ", per blob " << per_blob << " MB/sec"
+	 << ", batched " << batched << " MB/sec" << std::endl;
+  }
+}
+
 TEST(Blob, put_ref)
 {
   {
@@ -2193,6 +2336,110 @@ TEST(BlueStoreRepairer, StoreSpaceTracker)
   ASSERT_TRUE(bmap2.is_used(hoid, 0x3223b19ffff));
 }
 
+TEST(Buffer, maybe_rebuild_keep_shared)
+{
+  bufferlist bl;
+  bl.append(ceph::buffer::create_page_aligned(0x10000));
+  bl.append(ceph::buffer::create_page_aligned(0x10000));
+  {
+    BlueStore::Buffer b(nullptr, BlueStore::Buffer::STATE_CLEAN, 0, 0, bl);
+    // the two segments are still referenced by bl (think: a read reply)
+    ASSERT_TRUE(b.is_data_shared());
+    b.truncate(0x18000);
+    b.maybe_rebuild(true);
+    ASSERT_EQ(2u, b.data.get_num_buffers());
+    ASSERT_TRUE(b.flags & BlueStore::Buffer::FLAG_REBUILD);
+    b.maybe_rebuild(false);
+    ASSERT_EQ(1u, b.data.get_num_buffers());
+    ASSERT_FALSE(b.is_data_shared());
+    ASSERT_FALSE(b.flags & BlueStore::Buffer::FLAG_REBUILD);
+  }
+  {
+    bufferlist other;
+    other.append(ceph::buffer::create_page_aligned(0x10000));
+    other.append(ceph::buffer::create_page_aligned(0x10000));
+    BlueStore::Buffer b(nullptr, BlueStore::Buffer::STATE_CLEAN, 0, 0, other);
+    b.truncate(0x18000);
+    b.maybe_rebuild(true);
+    ASSERT_TRUE(b.flags & BlueStore::Buffer::FLAG_REBUILD);
+    // once the other user lets go, the skipped rebuild is caught up on
+    other.clear();
+    b.maybe_rebuild(true);
+    ASSERT_EQ(1u, b.data.get_num_buffers());
+    ASSERT_FALSE(b.flags & BlueStore::Buffer::FLAG_REBUILD);
+  }
+  {
+    // a small piece of a large shared raw is copied out right away
+    bufferlist big;
+    big.append(ceph::buffer::create_page_aligned(0x10000));
+    BlueStore::Buffer b(nullptr, BlueStore::Buffer::STATE_CLEAN, 0, 0, big);
+    ASSERT_TRUE(b.is_data_shared());
+    b.truncate(0x1000);
+    b.maybe_rebuild(true);
+    ASSERT_FALSE(b.is_data_shared());
+    ASSERT_EQ(0x1000u, b.data.front().raw_length());
+  }
+  {
+    BlueStore::Buffer b(nullptr, BlueStore::Buffer::STATE_CLEAN, 0, 0, bl);
+    bl.clear();
+    // nobody else holds the data, so rebuilding is worthwhile
+    ASSERT_FALSE(b.is_data_shared());
+    b.truncate(0x18000);
+    b.maybe_rebuild(true);
+    ASSERT_EQ(1u, b.data.get_num_buffers());
+  }
+}
+
+TEST(ArcBufferCacheShard, scan_resistance)
+{
+  BlueStore::BufferCacheShard *bc = BlueStore::BufferCacheShard::create(
+    g_ceph_context, "arc", NULL);
+  const uint32_t len = 0x1000;
+  bc->set_max(4 * len);
+  BlueStore::BufferSpace bs;
+  auto did_read = [&](uint32_t i) {
+    bufferlist bl;
+    bl.append_zero(len);
+    bs.did_read(bc, i * len, bl);
+  };
+  auto is_cached = [&](uint32_t i) {
+    auto p = bs.buffer_map.find(i * len);
+    return p != bs.buffer_map.end() && p->second.is_clean();
+  };
+
+  // 0 is read twice and becomes frequent
+  did_read(0);
+  did_read(0);
+  did_read(1);
+  did_read(2);
+  did_read(3);
+  ASSERT_EQ(4 * len, bc->_get_bytes());
+  // 4 pushes 1 out of the cache, but it is remembered as a ghost
+  did_read(4);
+  ASSERT_FALSE(is_cached(1));
+  ASSERT_TRUE(bs.buffer_map.count(1 * len));
+  // re-reading 1 is a ghost hit and promotes it to the frequent list
+  did_read(1);
+  ASSERT_TRUE(is_cached(1));
+
+  // a long scan only churns through the recency list
+  for (uint32_t i = 100; i < 120; ++i) {
+    did_read(i);
+  }
+  ASSERT_TRUE(is_cached(0));
+  ASSERT_TRUE(is_cached(1));
+  ASSERT_FALSE(is_cached(100));
+  ASSERT_TRUE(is_cached(119));
+  ASSERT_EQ(4 * len, bc->_get_bytes());
+
+  {
+    std::lock_guard l(bc->lock);
+    bs._clear(bc);
+  }
+  ASSERT_EQ(0u, bc->_get_bytes());
+  delete bc;
+}
+
 TEST(bluestore_blob_t, unused)
 {
   {
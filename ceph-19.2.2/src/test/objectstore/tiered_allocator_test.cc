@@ -0,0 +1,119 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <iostream>
+#include <gtest/gtest.h>
+
+#include "global/global_context.h"
+#include "os/bluestore/TieredAllocator.h"
+
+const uint64_t _1m = 1024 * 1024;
+
+static TieredAllocator *make_allocator(const std::string& type,
+				       uint64_t capacity,
+				       uint64_t fast_size)
+{
+  const uint64_t block_size = 0x1000;
+  return new TieredAllocator(
+    g_ceph_context,
+    Allocator::create(g_ceph_context, type, fast_size, block_size,
+		      "test_tiered_allocator.fast"),
+    Allocator::create(g_ceph_context, type, capacity - fast_size, block_size,
+		      "test_tiered_allocator.slow"),
+    fast_size,
+    "test_tiered_allocator");
+}
+
+class TieredAllocatorTest : public ::testing::TestWithParam<const char*> {
+};
+
+TEST_P(TieredAllocatorTest, placement)
+{
+  const uint64_t capacity = 64 * _1m;
+  const uint64_t fast_size = 16 * _1m;
+  std::unique_ptr<TieredAllocator> a(
+    make_allocator(GetParam(), capacity, fast_size));
+  a->init_add_free(0, capacity);
+  ASSERT_EQ(capacity, a->get_free());
+  ASSERT_EQ(fast_size, a->get_fast_free());
+
+  // the hint picks the tier
+  PExtentVector fast, slow;
+  ASSERT_EQ(4 * _1m, a->allocate(4 * _1m, 0x1000, 4 * _1m, 0, &fast));
+  for (auto& e : fast) {
+    ASSERT_LE(e.end(), fast_size);
+  }
+  ASSERT_EQ(12 * _1m, a->get_fast_free());
+  ASSERT_EQ(4 * _1m, a->allocate(4 * _1m, 0x1000, 4 * _1m, fast_size, &slow));
+  for (auto& e : slow) {
+    ASSERT_GE(e.offset, fast_size);
+  }
+  ASSERT_EQ(12 * _1m, a->get_fast_free());
+  ASSERT_EQ(capacity - 8 * _1m, a->get_free());
+  ASSERT_EQ(capacity, a->get_capacity());
+
+  // a full fast tier spills over into the slow one
+  PExtentVector spill;
+  ASSERT_EQ(16 * _1m, a->allocate(16 * _1m, 0x1000, 16 * _1m, 0, &spill));
+  ASSERT_EQ(0u, a->get_fast_free());
+  uint64_t spilled = 0;
+  for (auto& e : spill) {
+    if (e.offset >= fast_size) {
+      spilled += e.length;
+    }
+  }
+  ASSERT_EQ(4 * _1m, spilled);
+
+  // the slow tier hands out device offsets, up to the end of the device
+  PExtentVector rest;
+  ASSERT_EQ(40 * _1m, a->allocate(40 * _1m, 0x1000, 40 * _1m, fast_size,
+				  &rest));
+  ASSERT_EQ(0u, a->get_free());
+  for (auto& e : rest) {
+    ASSERT_GE(e.offset, fast_size);
+    ASSERT_LE(e.end(), capacity);
+  }
+  a->release(rest);
+
+  // releases go back to the tier they came from
+  a->release(spill);
+  a->release(fast);
+  ASSERT_EQ(fast_size, a->get_fast_free());
+  a->release(slow);
+  ASSERT_EQ(capacity, a->get_free());
+  a->shutdown();
+}
+
+TEST_P(TieredAllocatorTest, init_across_boundary)
+{
+  const uint64_t capacity = 64 * _1m;
+  const uint64_t fast_size = 16 * _1m;
+  std::unique_ptr<TieredAllocator> a(
+    make_allocator(GetParam(), capacity, fast_size));
+  a->init_add_free(0, capacity);
+  a->init_rm_free(fast_size - _1m, 2 * _1m);
+  ASSERT_EQ(fast_size - _1m, a->get_fast_free());
+  ASSERT_EQ(capacity - 2 * _1m, a->get_free());
+
+  // free extents are reported in offset order, split at the boundary
+  uint64_t last = 0, total = 0;
+  a->foreach([&](uint64_t offset, uint64_t length) {
+    ASSERT_LE(last, offset);
+    ASSERT_TRUE(offset + length <= fast_size || offset >= fast_size);
+    last = offset + length;
+    total += length;
+  });
+  ASSERT_EQ(capacity - 2 * _1m, total);
+
+  interval_set<uint64_t> r;
+  r.insert(fast_size - _1m, 2 * _1m);
+  a->release(r);
+  ASSERT_EQ(fast_size, a->get_fast_free());
+  ASSERT_EQ(capacity, a->get_free());
+  a->shutdown();
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  TieredAllocator,
+  TieredAllocatorTest,
+  ::testing::Values("stupid", "bitmap", "avl", "btree", "hybrid"));